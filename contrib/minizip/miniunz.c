@@ -276,6 +276,9 @@ static int do_list(unzFile uf) {
         {
               string_method="BZip2 ";
         }
+        else
+        if (file_info.compression_method==99)
+            string_method="AES   ";
         else
             string_method="Unkn. ";
 
@@ -167,12 +167,13 @@ static void do_banner()
 
 static void do_help()
 {
-    printf("Usage : minizip [-o] [-a] [-0 to -9] [-p password] [-j] file.zip [files_to_add]\n\n" \
+    printf("Usage : minizip [-o] [-a] [-0 to -9] [-p password] [-e] [-j] file.zip [files_to_add]\n\n" \
            "  -o  Overwrite existing file.zip\n" \
            "  -a  Append to existing file.zip\n" \
            "  -0  Store only\n" \
            "  -1  Compress faster\n" \
            "  -9  Compress better\n\n" \
+           "  -e  with -p, encrypt with WinZip AES-256\n" \
            "  -j  exclude path. store only the file name.\n\n");
 }
 
@@ -243,6 +244,7 @@ int main(int argc, char *argv[]) {
     int opt_overwrite=0;
     int opt_compress_level=Z_DEFAULT_COMPRESSION;
     int opt_exclude_path=0;
+    int opt_aes=0;
     int zipfilenamearg = 0;
     char filename_try[MAXFILENAME+16];
     int zipok;
@@ -277,6 +279,8 @@ int main(int argc, char *argv[]) {
                         opt_compress_level = c-'0';
                     if ((c=='j') || (c=='J'))
                         opt_exclude_path = 1;
+                    if ((c=='e') || (c=='E'))
+                        opt_aes = 3;
 
                     if (((c=='p') || (c=='P')) && (i+1<argc))
                     {
@@ -408,7 +412,8 @@ int main(int argc, char *argv[]) {
                                  (opt_compress_level != 0) ? Z_DEFLATED : 0,
                                  opt_compress_level);
 */
-                if ((password != NULL) && (err==ZIP_OK))
+                /* AES does not need the CRC before the data */
+                if ((password != NULL) && (!opt_aes) && (err==ZIP_OK))
                     err = getFileCrc(filenameinzip,buf,size_buf,&crcFile);
 
                 zip64 = isLargeFile(filenameinzip);
@@ -440,13 +445,14 @@ int main(int argc, char *argv[]) {
                  }
 
                  /**/
-                err = zipOpenNewFileInZip3_64(zf,savefilenameinzip,&zi,
+                err = zipOpenNewFileInZip5(zf,savefilenameinzip,&zi,
                                  NULL,0,NULL,0,NULL /* comment*/,
                                  (opt_compress_level != 0) ? Z_DEFLATED : 0,
                                  opt_compress_level,0,
                                  /* -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY, */
                                  -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY,
-                                 password,crcFile, zip64);
+                                 password,crcFile, 0, 0, zip64,
+                                 (password != NULL) ? opt_aes : 0);
 
                 if (err != ZIP_OK)
                     printf("error in opening %s in zipfile\n",filenameinzip);
@@ -8,8 +8,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <zlib/zlib.h>
 #include "unzip.h"
+#include "zip.h"
+#include "wzaes.h"
 
 #define READ_8(adr)  ((unsigned char)*(adr))
 #define READ_16(adr) ( READ_8(adr) | (READ_8(adr+1) << 8) )
@@ -283,3 +286,321 @@ extern int ZEXPORT unzRepair(const char* file, const char* fileOut, const char*
   }
   return err;
 }
+
+/* Bytes read and written at a time by zipCopyFileInZipRaw() -- large, so that
+   the data goes directly between the files and the buffer */
+#define COPY_BUFSIZE (1024 * 1024)
+
+extern int ZEXPORT zipCopyFileInZipRaw(zipFile dest, unzFile src) {
+  unz_file_info64 info;
+  zip_fileinfo zi;
+  char *name = NULL, *extra = NULL, *comment = NULL, *local = NULL;
+  char *buffer = NULL;
+  int size_extra, size_local = 0, method, level, zip64, n;
+  int err, opened = 0;
+
+  err = unzGetCurrentFileInfo64(src, &info, NULL, 0, NULL, 0, NULL, 0);
+  if (err != UNZ_OK)
+    return err;
+
+  /* the password check byte of an encrypted entry with a data descriptor is
+     made from the time, and zip.c does not write data descriptors -- AES
+     entries do not depend on either */
+  if ((info.flag & 9) == 9 && info.compression_method != WZAES_METHOD)
+    return ZIP_PARAMERROR;
+
+  name = (char*)malloc(info.size_filename + 1);
+  extra = (char*)malloc(info.size_file_extra + 1);
+  comment = (char*)malloc(info.size_file_comment + 1);
+  buffer = (char*)malloc(COPY_BUFSIZE);
+  if (name == NULL || extra == NULL || comment == NULL || buffer == NULL)
+    err = ZIP_INTERNALERROR;
+  if (err == UNZ_OK)
+    err = unzGetCurrentFileInfo64(src, &info, name, info.size_filename + 1,
+                                  extra, info.size_file_extra,
+                                  comment, info.size_file_comment + 1);
+  if (err == UNZ_OK) {
+    err = unzOpenCurrentFile2(src, &method, &level, 1);
+    opened = err == UNZ_OK;
+  }
+  if (err == UNZ_OK) {
+    size_local = unzGetLocalExtrafield(src, NULL, 0);
+    if (size_local >= 0)
+      local = (char*)malloc((unsigned)size_local + 1);
+    if (size_local < 0)
+      err = size_local;
+    else if (local == NULL)
+      err = ZIP_INTERNALERROR;
+    else if (unzGetLocalExtrafield(src, local, (unsigned)size_local) !=
+             size_local)
+      err = UNZ_ERRNO;
+  }
+
+  if (err == UNZ_OK) {
+    /* zip.c adds the ZIP64 extra fields that the copy needs */
+    size_extra = (int)info.size_file_extra;
+    if (size_extra >= 4)
+      zipRemoveExtraInfoBlock(extra, &size_extra, 0x0001);
+    if (size_local >= 4)
+      zipRemoveExtraInfoBlock(local, &size_local, 0x0001);
+
+    memset(&zi, 0, sizeof(zi));
+    zi.dosDate = info.dosDate;
+    zi.internal_fa = info.internal_fa;
+    zi.external_fa = info.external_fa;
+    zip64 = info.compressed_size >= 0xffffffff ||
+            info.uncompressed_size >= 0xffffffff;
+
+    /* the level only sets flag bits 1 and 2 as they were, and the sizes are
+       written in the local header in place of a data descriptor */
+    err = zipOpenNewFileInZip4_64(dest, name, &zi, local, (uInt)size_local,
+                                  extra, (uInt)size_extra,
+                                  info.size_file_comment ? comment : NULL,
+                                  method, level, 1, -MAX_WBITS, 8,
+                                  Z_DEFAULT_STRATEGY, NULL, 0, info.version,
+                                  info.flag & ~0xeUL, zip64);
+    if (err == ZIP_OK) {
+      while ((n = unzReadCurrentFile(src, buffer, COPY_BUFSIZE)) > 0) {
+        err = zipWriteInFileInZip(dest, buffer, (unsigned)n);
+        if (err != ZIP_OK)
+          break;
+      }
+      if (n < 0 && err == ZIP_OK)
+        err = n;
+      n = zipCloseFileInZipRaw64(dest, info.uncompressed_size, info.crc);
+      if (err == ZIP_OK)
+        err = n;
+    }
+  }
+
+  if (opened) {
+    n = unzCloseCurrentFile(src);
+    if (err == ZIP_OK)
+      err = n;
+  }
+  free(buffer);
+  free(local);
+  free(comment);
+  free(extra);
+  free(name);
+  return err;
+}
+
+extern int ZEXPORT zipRewrite(const char* src, const char* dest,
+                              int (*keep)(void* opaque, const char* name,
+                                          const unz_file_info64* info),
+                              void* opaque) {
+  unzFile in;
+  zipFile out;
+  unz_global_info64 global;
+  unz_file_info64 info;
+  char *name, *comment = NULL;
+  int err, n;
+
+  in = unzOpen64(src);
+  if (in == NULL)
+    return ZIP_ERRNO;
+  out = zipOpen64(dest, APPEND_STATUS_CREATE);
+  if (out == NULL) {
+    unzClose(in);
+    return ZIP_ERRNO;
+  }
+
+  name = (char*)malloc(0x10000);
+  err = unzGetGlobalInfo64(in, &global);
+  if (err == UNZ_OK) {
+    comment = (char*)malloc(global.size_comment + 1);
+    if (name == NULL || comment == NULL)
+      err = ZIP_INTERNALERROR;
+    else if (unzGetGlobalComment(in, comment, global.size_comment + 1) < 0)
+      err = UNZ_ERRNO;
+  }
+
+  if (err == UNZ_OK)
+    err = unzGoToFirstFile(in);
+  while (err == UNZ_OK) {
+    err = unzGetCurrentFileInfo64(in, &info, name, 0x10000,
+                                  NULL, 0, NULL, 0);
+    if (err == UNZ_OK && (keep == NULL || keep(opaque, name, &info)))
+      err = zipCopyFileInZipRaw(out, in);
+    if (err == UNZ_OK)
+      err = unzGoToNextFile(in);
+  }
+  if (err == UNZ_END_OF_LIST_OF_FILE)
+    err = ZIP_OK;
+
+  n = zipClose(out, comment != NULL && *comment ? comment : NULL);
+  if (err == ZIP_OK)
+    err = n;
+  unzClose(in);
+  free(comment);
+  free(name);
+  return err;
+}
+
+static int gzReadByte(const zlib_filefunc64_def* io, voidpf in) {
+  unsigned char c;
+  return io->zread_file(io->opaque, in, &c, 1) == 1 ? c : -1;
+}
+
+static uLong gzGet32(const unsigned char* p) {
+  return (uLong)p[0] | ((uLong)p[1] << 8) | ((uLong)p[2] << 16) |
+         ((uLong)p[3] << 24);
+}
+
+/* Return the length of the deflate data of n bytes at the current position
+   of in, decompressing it with the buffer of COPY_BUFSIZE bytes, and set
+   *crc to the CRC-32 of the result. Return -1 if the data does not end
+   exactly after n bytes, as when a second gzip member follows the first. */
+static ZPOS64_T gzInflatedSize(const zlib_filefunc64_def* io, voidpf in,
+                               ZPOS64_T n, unsigned char* buffer,
+                               uLong* crc) {
+  z_stream strm;
+  unsigned char* out = buffer + COPY_BUFSIZE / 2;
+  ZPOS64_T size = 0;
+  uLong got;
+  int err = Z_OK;
+
+  *crc = crc32(0L, Z_NULL, 0);
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+    return (ZPOS64_T)-1;
+  while (err == Z_OK) {
+    if (strm.avail_in == 0) {
+      if (n == 0)
+        break;
+      got = n < COPY_BUFSIZE / 2 ? (uLong)n : COPY_BUFSIZE / 2;
+      if (io->zread_file(io->opaque, in, buffer, got) != got)
+        break;
+      n -= got;
+      strm.next_in = buffer;
+      strm.avail_in = (uInt)got;
+    }
+    strm.next_out = out;
+    strm.avail_out = COPY_BUFSIZE / 2;
+    err = inflate(&strm, Z_NO_FLUSH);
+    *crc = crc32(*crc, out, COPY_BUFSIZE / 2 - strm.avail_out);
+    size += COPY_BUFSIZE / 2 - strm.avail_out;
+  }
+  inflateEnd(&strm);
+  return err == Z_STREAM_END && n == 0 && strm.avail_in == 0 ?
+         size : (ZPOS64_T)-1;
+}
+
+extern int ZEXPORT zipAddGzip(zipFile dest, const char* name,
+                              const char* gzfile) {
+  zlib_filefunc64_def io;
+  voidpf in;
+  zip_fileinfo zi;
+  unsigned char head[10], trail[8];
+  unsigned char* buffer = NULL;
+  ZPOS64_T start, size, body, usize;
+  uLong crc, check, got;
+  time_t mtime;
+  struct tm* t;
+  int err = ZIP_OK, n, c, level;
+
+  fill_fopen64_filefunc(&io);
+  in = io.zopen64_file(io.opaque, gzfile, ZLIB_FILEFUNC_MODE_READ |
+                                          ZLIB_FILEFUNC_MODE_EXISTING);
+  if (in == NULL)
+    return ZIP_ERRNO;
+
+  /* skip the header, keeping the time and the level */
+  if (io.zread_file(io.opaque, in, head, 10) != 10 ||
+      head[0] != 31 || head[1] != 139 || head[2] != Z_DEFLATED ||
+      (head[3] & 0xe0))
+    err = ZIP_BADZIPFILE;
+  if (err == ZIP_OK && (head[3] & 4)) {
+    n = gzReadByte(&io, in);
+    c = gzReadByte(&io, in);
+    if (n < 0 || c < 0 ||
+        io.zseek64_file(io.opaque, in, (ZPOS64_T)(n + (c << 8)),
+                        ZLIB_FILEFUNC_SEEK_CUR))
+      err = ZIP_BADZIPFILE;
+  }
+  for (n = 8; err == ZIP_OK && n <= 16; n <<= 1)
+    if (head[3] & n) {
+      while ((c = gzReadByte(&io, in)) > 0)
+        ;
+      if (c < 0)
+        err = ZIP_BADZIPFILE;
+    }
+  if (err == ZIP_OK && (head[3] & 2) &&
+      io.zseek64_file(io.opaque, in, 2, ZLIB_FILEFUNC_SEEK_CUR))
+    err = ZIP_BADZIPFILE;
+
+  /* the deflate data runs to the trailer, at the end */
+  if (err == ZIP_OK) {
+    start = io.ztell64_file(io.opaque, in);
+    if (io.zseek64_file(io.opaque, in, 0, ZLIB_FILEFUNC_SEEK_END))
+      err = ZIP_ERRNO;
+    else {
+      size = io.ztell64_file(io.opaque, in);
+      if (start == (ZPOS64_T)-1 || size == (ZPOS64_T)-1)
+        err = ZIP_ERRNO;
+      else if (size < start + 8 ||
+               io.zseek64_file(io.opaque, in, size - 8,
+                               ZLIB_FILEFUNC_SEEK_SET) ||
+               io.zread_file(io.opaque, in, trail, 8) != 8)
+        err = ZIP_BADZIPFILE;
+    }
+  }
+  if (err == ZIP_OK) {
+    body = size - start - 8;
+    crc = gzGet32(trail);
+    buffer = (unsigned char*)malloc(COPY_BUFSIZE);
+    if (buffer == NULL)
+      err = ZIP_INTERNALERROR;
+    else if (io.zseek64_file(io.opaque, in, start, ZLIB_FILEFUNC_SEEK_SET))
+      err = ZIP_ERRNO;
+  }
+
+  /* the deflate data must end at the trailer and match it, and gives the
+     length, of which ISIZE has only the low 32 bits */
+  if (err == ZIP_OK) {
+    usize = gzInflatedSize(&io, in, body, buffer, &check);
+    if (usize == (ZPOS64_T)-1 || check != crc ||
+        (usize & 0xffffffff) != gzGet32(trail + 4))
+      err = ZIP_BADZIPFILE;
+    else if (io.zseek64_file(io.opaque, in, start, ZLIB_FILEFUNC_SEEK_SET))
+      err = ZIP_ERRNO;
+  }
+
+  if (err == ZIP_OK) {
+    memset(&zi, 0, sizeof(zi));
+    mtime = (time_t)gzGet32(head + 4);
+    if (mtime == 0)
+      mtime = time(NULL);
+    t = localtime(&mtime);
+    if (t != NULL) {
+      zi.tmz_date.tm_sec = t->tm_sec;
+      zi.tmz_date.tm_min = t->tm_min;
+      zi.tmz_date.tm_hour = t->tm_hour;
+      zi.tmz_date.tm_mday = t->tm_mday;
+      zi.tmz_date.tm_mon = t->tm_mon;
+      zi.tmz_date.tm_year = t->tm_year;
+    }
+    level = head[8] == 2 ? 9 : head[8] == 4 ? 1 : Z_DEFAULT_COMPRESSION;
+    err = zipOpenNewFileInZip2_64(dest, name, &zi, NULL, 0, NULL, 0, NULL,
+                                  Z_DEFLATED, level, 1,
+                                  body >= 0xffffffff || usize >= 0xffffffff);
+    if (err == ZIP_OK) {
+      while (err == ZIP_OK && body) {
+        got = body < COPY_BUFSIZE ? (uLong)body : COPY_BUFSIZE;
+        if (io.zread_file(io.opaque, in, buffer, got) != got)
+          err = ZIP_ERRNO;
+        else
+          err = zipWriteInFileInZip(dest, buffer, (unsigned)got);
+        body -= got;
+      }
+      n = zipCloseFileInZipRaw64(dest, usize, crc);
+      if (err == ZIP_OK)
+        err = n;
+    }
+  }
+
+  io.zclose_file(io.opaque, in);
+  free(buffer);
+  return err;
+}
@@ -16,6 +16,7 @@ extern "C" {
 #endif
 
 #include "unzip.h"
+#include "zip.h"
 
 /* Repair a ZIP file (missing central directory)
    file: file to recover
@@ -28,6 +29,36 @@ extern int ZEXPORT unzRepair(const char* file,
                              uLong* nRecovered,
                              uLong* bytesRecovered);
 
+/* Copy the current entry of src to dest as it is, without decompressing and
+   compressing it again, with its name, comment, extra fields, date,
+   attributes and CRC. Entries that are encrypted with a data descriptor
+   cannot be copied, and give ZIP_PARAMERROR. The compressed data is moved
+   in blocks of a megabyte, directly between the files and the buffer.
+*/
+extern int ZEXPORT zipCopyFileInZipRaw(zipFile dest, unzFile src);
+
+/* Write a new archive dest with the entries of src for which keep() returns
+   true, or all of them if keep is NULL, copied with zipCopyFileInZipRaw(),
+   and the comment of src. This removes entries from an archive in the time
+   it takes to copy the rest. To replace an entry, leave it out, and then add
+   the new one with zipOpen64(dest, APPEND_STATUS_ADDINZIP).
+*/
+extern int ZEXPORT zipRewrite(const char* src, const char* dest,
+                              int (*keep)(void* opaque, const char* name,
+                                          const unz_file_info64* info),
+                              void* opaque);
+
+/* Add the gzip file gzfile to dest as the entry name, moving its deflate data
+   as it is, with the CRC from the gzip trailer and the time from the gzip
+   header, so that a .gz file goes into a ZIP file without being compressed
+   again. The deflate data is decompressed once, without writing anything, to
+   check that it ends exactly at the trailer and matches its CRC, and to get
+   the length, which could be 4 GB or more. A file of several gzip members,
+   or with anything after the trailer, gives ZIP_BADZIPFILE.
+*/
+extern int ZEXPORT zipAddGzip(zipFile dest, const char* name,
+                              const char* gzfile);
+
 
 #ifdef __cplusplus
 }
@@ -74,6 +74,7 @@
 
 #include <zlib/zlib.h>
 #include "unzip.h"
+#include "wzaes.h"
 
 #ifdef STDC
 #  include <stddef.h>
@@ -121,6 +122,9 @@ const char unz_copyright[] =
 typedef struct unz_file_info64_internal_s
 {
     ZPOS64_T offset_curfile;/* relative offset of local header 8 bytes */
+    uLong aes_version;      /* AE-1 or AE-2 for an AES entry, else 0 */
+    int aes_strength;       /* its key strength, 1 to 3 */
+    uLong aes_method;       /* its real compression method */
 } unz_file_info64_internal;
 
 
@@ -152,6 +156,8 @@ typedef struct
     uLong compression_method;   /* compression method (0==store) */
     ZPOS64_T byte_before_the_zipfile;/* byte before the zipfile, (>0 for sfx)*/
     int   raw;
+    int   check_crc;            /* false for AE-2, which stores no CRC */
+    wzaes_ctx* aes;             /* AES keys when decrypting an AES entry */
 } file_in_zip64_read_info_s;
 
 
@@ -850,6 +856,9 @@ local int unz64local_GetCurrentFileInfoInternal(unzFile file,
     if (unz64local_getLong(&s->z_filefunc, s->filestream,&uL) != UNZ_OK)
         err=UNZ_ERRNO;
     file_info_internal.offset_curfile = uL;
+    file_info_internal.aes_version = 0;
+    file_info_internal.aes_strength = 0;
+    file_info_internal.aes_method = 0;
 
     lSeek+=file_info.size_filename;
     if ((err==UNZ_OK) && (szFileName!=NULL))
@@ -952,6 +961,22 @@ local int unz64local_GetCurrentFileInfoInternal(unzFile file,
                 }
 
             }
+            /* WinZip AES: version, "AE", key strength and real method */
+            else if ((headerId == WZAES_HEADERID) && (dataSize >= 7))
+            {
+                unsigned char aes[7];
+                if (ZREAD64(s->z_filefunc, s->filestream,aes,7) != 7)
+                    err=UNZ_ERRNO;
+                else if ((aes[2] == 'A') && (aes[3] == 'E') &&
+                         (aes[4] >= 1) && (aes[4] <= 3))
+                {
+                    file_info_internal.aes_version = aes[0] | ((uLong)aes[1] << 8);
+                    file_info_internal.aes_strength = aes[4];
+                    file_info_internal.aes_method = aes[5] | ((uLong)aes[6] << 8);
+                }
+                if (ZSEEK64(s->z_filefunc, s->filestream,dataSize-7,ZLIB_FILEFUNC_SEEK_CUR)!=0)
+                    err=UNZ_ERRNO;
+            }
             else
             {
                 if (ZSEEK64(s->z_filefunc, s->filestream,dataSize,ZLIB_FILEFUNC_SEEK_CUR)!=0)
@@ -1297,7 +1322,8 @@ local int unz64local_CheckCurrentFileCoherencyHeader(unz64_s* s, uInt* piSizeVar
 /* #ifdef HAVE_BZIP2 */
                          (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
 /* #endif */
-                         (s->cur_file_info.compression_method!=Z_DEFLATED))
+                         (s->cur_file_info.compression_method!=Z_DEFLATED) &&
+                         (s->cur_file_info.compression_method!=WZAES_METHOD))
         err=UNZ_BADZIPFILE;
 
     if (unz64local_getLong(&s->z_filefunc, s->filestream,&uData) != UNZ_OK) /* date/time */
@@ -1348,11 +1374,9 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
     file_in_zip64_read_info_s* pfile_in_zip_read_info;
     ZPOS64_T offset_local_extrafield;  /* offset of the local extra field */
     uInt  size_local_extrafield;    /* size of the local extra field */
+    uLong compression_method;
 #    ifndef NOUNCRYPT
     char source[12];
-#    else
-    if (password != NULL)
-        return UNZ_PARAMERROR;
 #    endif
 
     if (file==NULL)
@@ -1361,6 +1385,27 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
     if (!s->current_file_ok)
         return UNZ_PARAMERROR;
 
+    /* an AES entry is read as is when raw without a password, otherwise
+       it is decrypted and its real method is used */
+    compression_method = s->cur_file_info.compression_method;
+    if (compression_method == WZAES_METHOD)
+    {
+        if (s->cur_file_info_internal.aes_strength == 0)
+            return UNZ_BADZIPFILE;
+#    ifdef NOCRYPT
+        if (password != NULL)
+            return UNZ_PARAMERROR;
+#    endif
+        if ((password == NULL) && (!raw))
+            return UNZ_PARAMERROR;
+        if (password != NULL)
+            compression_method = s->cur_file_info_internal.aes_method;
+    }
+#    ifdef NOUNCRYPT
+    else if (password != NULL)
+        return UNZ_PARAMERROR;
+#    endif
+
     if (s->pfile_in_zip_read != NULL)
         unzCloseCurrentFile(file);
 
@@ -1376,6 +1421,8 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
     pfile_in_zip_read_info->size_local_extrafield = size_local_extrafield;
     pfile_in_zip_read_info->pos_local_extrafield=0;
     pfile_in_zip_read_info->raw=raw;
+    pfile_in_zip_read_info->check_crc=1;
+    pfile_in_zip_read_info->aes=NULL;
 
     if (pfile_in_zip_read_info->read_buffer==NULL)
     {
@@ -1386,7 +1433,7 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
     pfile_in_zip_read_info->stream_initialised=0;
 
     if (method!=NULL)
-        *method = (int)s->cur_file_info.compression_method;
+        *method = (int)compression_method;
 
     if (level!=NULL)
     {
@@ -1399,25 +1446,26 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
         }
     }
 
-    if ((s->cur_file_info.compression_method!=0) &&
+    if ((compression_method!=0) &&
 /* #ifdef HAVE_BZIP2 */
-        (s->cur_file_info.compression_method!=Z_BZIP2ED) &&
+        (compression_method!=Z_BZIP2ED) &&
 /* #endif */
-        (s->cur_file_info.compression_method!=Z_DEFLATED))
+        (compression_method!=Z_DEFLATED) &&
+        (compression_method!=WZAES_METHOD))
 
         err=UNZ_BADZIPFILE;
 
     pfile_in_zip_read_info->crc32_wait=s->cur_file_info.crc;
     pfile_in_zip_read_info->crc32=0;
     pfile_in_zip_read_info->total_out_64=0;
-    pfile_in_zip_read_info->compression_method = s->cur_file_info.compression_method;
+    pfile_in_zip_read_info->compression_method = compression_method;
     pfile_in_zip_read_info->filestream=s->filestream;
     pfile_in_zip_read_info->z_filefunc=s->z_filefunc;
     pfile_in_zip_read_info->byte_before_the_zipfile=s->byte_before_the_zipfile;
 
     pfile_in_zip_read_info->stream.total_out = 0;
 
-    if ((s->cur_file_info.compression_method==Z_BZIP2ED) && (!raw))
+    if ((compression_method==Z_BZIP2ED) && (!raw))
     {
 #ifdef HAVE_BZIP2
       pfile_in_zip_read_info->bstream.bzalloc = (void *(*) (void *, int, int))0;
@@ -1444,7 +1492,7 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
       pfile_in_zip_read_info->raw=1;
 #endif
     }
-    else if ((s->cur_file_info.compression_method==Z_DEFLATED) && (!raw))
+    else if ((compression_method==Z_DEFLATED) && (!raw))
     {
       pfile_in_zip_read_info->stream.zalloc = (alloc_func)0;
       pfile_in_zip_read_info->stream.zfree = (free_func)0;
@@ -1484,6 +1532,46 @@ extern int ZEXPORT unzOpenCurrentFile3(unzFile file, int* method,
     s->pfile_in_zip_read = pfile_in_zip_read_info;
                 s->encrypted = 0;
 
+#    ifndef NOCRYPT
+    if ((password != NULL) && (s->cur_file_info.compression_method == WZAES_METHOD))
+    {
+        /* check the password against the verification value after the salt,
+           and leave the authentication code out of the data */
+        int strength = s->cur_file_info_internal.aes_strength;
+        unsigned char head[16 + WZAES_PWV_SIZE], pwv[WZAES_PWV_SIZE];
+        uInt size_head = WZAES_SALT_SIZE(strength) + WZAES_PWV_SIZE;
+
+        if (s->cur_file_info.compressed_size < size_head + WZAES_MAC_SIZE)
+            err = UNZ_BADZIPFILE;
+        else if ((pfile_in_zip_read_info->aes = (wzaes_ctx*)ALLOC(sizeof(wzaes_ctx))) == NULL)
+            err = UNZ_INTERNALERROR;
+        else if ((ZSEEK64(s->z_filefunc, s->filestream,
+                          pfile_in_zip_read_info->pos_in_zipfile +
+                             pfile_in_zip_read_info->byte_before_the_zipfile,
+                          ZLIB_FILEFUNC_SEEK_SET)!=0) ||
+                 (ZREAD64(s->z_filefunc, s->filestream,head,size_head)!=size_head))
+            err = UNZ_ERRNO;
+        else
+        {
+            wzaes_init(pfile_in_zip_read_info->aes, password, strength, head, pwv);
+            if (memcmp(pwv, head + size_head - WZAES_PWV_SIZE, WZAES_PWV_SIZE) != 0)
+                err = UNZ_BADPASSWORD;
+        }
+        if (err != UNZ_OK)
+        {
+            free(pfile_in_zip_read_info->aes);
+            pfile_in_zip_read_info->aes = NULL;
+            unzCloseCurrentFile(file);
+            return err;
+        }
+
+        pfile_in_zip_read_info->pos_in_zipfile += size_head;
+        pfile_in_zip_read_info->rest_read_compressed -= size_head + WZAES_MAC_SIZE;
+        pfile_in_zip_read_info->check_crc = s->cur_file_info_internal.aes_version != 2;
+        return UNZ_OK;
+    }
+#    endif
+
 #    ifndef NOUNCRYPT
     if (password != NULL)
     {
@@ -1586,6 +1674,40 @@ extern int ZEXPORT unzReadCurrentFile(unzFile file, voidp buf, unsigned len) {
 
     while (pfile_in_zip_read_info->stream.avail_out>0)
     {
+        /* raw data going to a buffer at least as large as read_buffer is read
+           directly into it, to copy entries between archives at disk speed */
+        if ((pfile_in_zip_read_info->raw) && (!s->encrypted) &&
+            (pfile_in_zip_read_info->aes==NULL) &&
+            (pfile_in_zip_read_info->stream.avail_in==0) &&
+            (pfile_in_zip_read_info->rest_read_compressed>0) &&
+            (pfile_in_zip_read_info->stream.avail_out>=UNZ_BUFSIZE))
+        {
+            uInt uReadThis = pfile_in_zip_read_info->stream.avail_out;
+            if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
+                uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+            if (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                      pfile_in_zip_read_info->filestream,
+                      pfile_in_zip_read_info->pos_in_zipfile +
+                         pfile_in_zip_read_info->byte_before_the_zipfile,
+                         ZLIB_FILEFUNC_SEEK_SET)!=0)
+                return UNZ_ERRNO;
+            if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                      pfile_in_zip_read_info->filestream,
+                      pfile_in_zip_read_info->stream.next_out,
+                      uReadThis)!=uReadThis)
+                return UNZ_ERRNO;
+
+            pfile_in_zip_read_info->pos_in_zipfile += uReadThis;
+            pfile_in_zip_read_info->rest_read_compressed-=uReadThis;
+            pfile_in_zip_read_info->total_out_64 += uReadThis;
+            pfile_in_zip_read_info->rest_read_uncompressed-=uReadThis;
+            pfile_in_zip_read_info->stream.avail_out -= uReadThis;
+            pfile_in_zip_read_info->stream.next_out += uReadThis;
+            pfile_in_zip_read_info->stream.total_out += uReadThis;
+            iRead += uReadThis;
+            continue;
+        }
+
         if ((pfile_in_zip_read_info->stream.avail_in==0) &&
             (pfile_in_zip_read_info->rest_read_compressed>0))
         {
@@ -1607,6 +1729,13 @@ extern int ZEXPORT unzReadCurrentFile(unzFile file, voidp buf, unsigned len) {
                 return UNZ_ERRNO;
 
 
+#            ifndef NOCRYPT
+            if (pfile_in_zip_read_info->aes != NULL)
+                wzaes_decrypt(pfile_in_zip_read_info->aes,
+                              (unsigned char*)pfile_in_zip_read_info->read_buffer,
+                              uReadThis);
+#            endif
+
 #            ifndef NOUNCRYPT
             if(s->encrypted)
             {
@@ -1648,9 +1777,11 @@ extern int ZEXPORT unzReadCurrentFile(unzFile file, voidp buf, unsigned len) {
 
             pfile_in_zip_read_info->total_out_64 = pfile_in_zip_read_info->total_out_64 + uDoCopy;
 
-            pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
-                                pfile_in_zip_read_info->stream.next_out,
-                                uDoCopy);
+            /* the CRC is of the uncompressed data, so not checked when raw */
+            if (!pfile_in_zip_read_info->raw)
+                pfile_in_zip_read_info->crc32 = crc32(pfile_in_zip_read_info->crc32,
+                                    pfile_in_zip_read_info->stream.next_out,
+                                    uDoCopy);
             pfile_in_zip_read_info->rest_read_uncompressed-=uDoCopy;
             pfile_in_zip_read_info->stream.avail_in -= uDoCopy;
             pfile_in_zip_read_info->stream.avail_out -= uDoCopy;
@@ -1884,10 +2015,57 @@ extern int ZEXPORT unzCloseCurrentFile(unzFile file) {
     if ((pfile_in_zip_read_info->rest_read_uncompressed == 0) &&
         (!pfile_in_zip_read_info->raw))
     {
-        if (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait)
+        if ((pfile_in_zip_read_info->check_crc) &&
+            (pfile_in_zip_read_info->crc32 != pfile_in_zip_read_info->crc32_wait))
             err=UNZ_CRCERROR;
     }
 
+#    ifndef NOCRYPT
+    if (pfile_in_zip_read_info->aes != NULL)
+    {
+        /* once all the data is out, authenticate the rest of the encrypted
+           data, and compare the code that follows it */
+        unsigned char mac[WZAES_MAC_SIZE], stored[WZAES_MAC_SIZE];
+        int check = pfile_in_zip_read_info->raw ?
+                    pfile_in_zip_read_info->rest_read_compressed == 0 :
+                    pfile_in_zip_read_info->rest_read_uncompressed == 0;
+
+        if (check && (ZSEEK64(pfile_in_zip_read_info->z_filefunc,
+                              pfile_in_zip_read_info->filestream,
+                              pfile_in_zip_read_info->pos_in_zipfile +
+                                 pfile_in_zip_read_info->byte_before_the_zipfile,
+                              ZLIB_FILEFUNC_SEEK_SET)!=0))
+            check = 0;
+        while (check && (pfile_in_zip_read_info->rest_read_compressed > 0))
+        {
+            uInt uReadThis = UNZ_BUFSIZE;
+            if (pfile_in_zip_read_info->rest_read_compressed<uReadThis)
+                uReadThis = (uInt)pfile_in_zip_read_info->rest_read_compressed;
+            if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                        pfile_in_zip_read_info->filestream,
+                        pfile_in_zip_read_info->read_buffer,
+                        uReadThis)!=uReadThis)
+                check = 0;
+            else
+                wzaes_decrypt(pfile_in_zip_read_info->aes,
+                              (unsigned char*)pfile_in_zip_read_info->read_buffer,
+                              uReadThis);
+            pfile_in_zip_read_info->rest_read_compressed -= uReadThis;
+        }
+        wzaes_finish(pfile_in_zip_read_info->aes, mac);
+        if (check)
+        {
+            if (ZREAD64(pfile_in_zip_read_info->z_filefunc,
+                        pfile_in_zip_read_info->filestream,
+                        stored,WZAES_MAC_SIZE)!=WZAES_MAC_SIZE)
+                err=UNZ_ERRNO;
+            else if ((err==UNZ_OK) && (memcmp(mac, stored, WZAES_MAC_SIZE) != 0))
+                err=UNZ_CRCERROR;
+        }
+        free(pfile_in_zip_read_info->aes);
+    }
+#    endif
+
 
     free(pfile_in_zip_read_info->read_buffer);
     pfile_in_zip_read_info->read_buffer = NULL;
@@ -0,0 +1,582 @@
+/* wzaes.c -- WinZip AES encryption (AE-1 and AE-2) for minizip
+
+   For conditions of distribution and use, see copyright notice in zlib.h
+
+   See wzaes.h for the format. Only the AES encryption direction is needed,
+   since counter mode decrypts by encrypting the counter too. Encryption and
+   the HMAC go through the data together in pieces of WZAES_PIECE bytes, so
+   that the second pass over each piece finds it in the cache.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "wzaes.h"
+
+/* the system source of random bytes for the salt */
+#if defined(_WIN32)
+#  define WZAES_BCRYPT
+#  include <windows.h>
+#  include <bcrypt.h>
+#  ifdef _MSC_VER
+#    pragma comment(lib, "bcrypt.lib")
+#  endif
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+      defined(__NetBSD__) || defined(__DragonFly__)
+#  define WZAES_ARC4RANDOM
+#elif defined(__unix__) || defined(__unix)
+#  define WZAES_URANDOM
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  ifdef __linux__
+#    include <sys/syscall.h>
+#  endif
+#endif
+
+#ifndef local
+#  define local static
+#endif
+
+#define WZAES_PIECE 4096            /* bytes encrypted before hashing them */
+#define WZAES_ITER 1000             /* PBKDF2 iterations */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define WZAES_X86
+#  include <cpuid.h>
+#  include <wmmintrin.h>
+#  define WZAES_TARGET __attribute__((target("aes,sse2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  define WZAES_X86
+#  include <intrin.h>
+#  include <wmmintrin.h>
+#  define WZAES_TARGET
+#elif defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_AES)
+#  define WZAES_ARM
+#  include <arm_neon.h>
+#endif
+
+/* ===========================================================================
+ * AES
+ */
+
+local const unsigned char sbox[256] = {
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b,
+    0xfe, 0xd7, 0xab, 0x76, 0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0, 0xb7, 0xfd, 0x93, 0x26,
+    0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2,
+    0xeb, 0x27, 0xb2, 0x75, 0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84, 0x53, 0xd1, 0x00, 0xed,
+    0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f,
+    0x50, 0x3c, 0x9f, 0xa8, 0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2, 0xcd, 0x0c, 0x13, 0xec,
+    0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14,
+    0xde, 0x5e, 0x0b, 0xdb, 0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79, 0xe7, 0xc8, 0x37, 0x6d,
+    0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f,
+    0x4b, 0xbd, 0x8b, 0x8a, 0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e, 0xe1, 0xf8, 0x98, 0x11,
+    0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f,
+    0xb0, 0x54, 0xbb, 0x16
+};
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define XTIME(x) ((unsigned)(((x) << 1) ^ ((x) & 0x80 ? 0x11b : 0)))
+
+local uint32_t get32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+local void put32(unsigned char* p, uint32_t x) {
+    p[0] = (unsigned char)(x >> 24);
+    p[1] = (unsigned char)(x >> 16);
+    p[2] = (unsigned char)(x >> 8);
+    p[3] = (unsigned char)x;
+}
+
+local uint32_t sub_word(uint32_t x) {
+    return ((uint32_t)sbox[x >> 24] << 24) |
+           ((uint32_t)sbox[(x >> 16) & 0xff] << 16) |
+           ((uint32_t)sbox[(x >> 8) & 0xff] << 8) | sbox[x & 0xff];
+}
+
+/* whether the AES instructions can be used */
+local int have_hw(void) {
+#if defined(WZAES_X86) && defined(__GNUC__)
+    unsigned a, b, c, d;
+
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & (1U << 25)) != 0;
+#elif defined(WZAES_X86)
+    int info[4];
+
+    __cpuid(info, 1);
+    return (info[2] & (1 << 25)) != 0;
+#elif defined(WZAES_ARM)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* expand the key of 4, 6 or 8 words, and make the round table */
+local void aes_setkey(wzaes_ctx* ctx, const unsigned char* key, int nk) {
+    int i, n = 4 * (nk + 7);
+    unsigned rcon = 1, s;
+    uint32_t t;
+
+    ctx->rounds = nk + 6;
+    for (i = 0; i < nk; i++)
+        ctx->rk[i] = get32(key + 4 * i);
+    for (; i < n; i++) {
+        t = ctx->rk[i - 1];
+        if (i % nk == 0) {
+            t = sub_word((t << 8) | (t >> 24)) ^ ((uint32_t)rcon << 24);
+            rcon = XTIME(rcon);
+        }
+        else if (nk > 6 && i % nk == 4)
+            t = sub_word(t);
+        ctx->rk[i] = ctx->rk[i - nk] ^ t;
+    }
+    for (i = 0; i < n; i++)
+        put32(ctx->rkb + 4 * i, ctx->rk[i]);
+
+    /* te[x] is the MixColumns column of sbox[x], rotated for the other rows */
+    for (i = 0; i < 256; i++) {
+        s = sbox[i];
+        ctx->te[i] = ((uint32_t)XTIME(s) << 24) | ((uint32_t)s << 16) |
+                     ((uint32_t)s << 8) | (XTIME(s) ^ s);
+    }
+    ctx->hw = have_hw();
+}
+
+/* encrypt the block in to out with the tables */
+local void aes_block(const wzaes_ctx* ctx, const unsigned char* in,
+                     unsigned char* out) {
+    const uint32_t *rk = ctx->rk, *te = ctx->te;
+    uint32_t s0, s1, s2, s3, t0, t1, t2, t3;
+    int r;
+
+    s0 = get32(in) ^ rk[0];
+    s1 = get32(in + 4) ^ rk[1];
+    s2 = get32(in + 8) ^ rk[2];
+    s3 = get32(in + 12) ^ rk[3];
+    for (r = 1; r < ctx->rounds; r++) {
+        rk += 4;
+        t0 = te[s0 >> 24] ^ ROR(te[(s1 >> 16) & 0xff], 8) ^
+             ROR(te[(s2 >> 8) & 0xff], 16) ^ ROR(te[s3 & 0xff], 24) ^ rk[0];
+        t1 = te[s1 >> 24] ^ ROR(te[(s2 >> 16) & 0xff], 8) ^
+             ROR(te[(s3 >> 8) & 0xff], 16) ^ ROR(te[s0 & 0xff], 24) ^ rk[1];
+        t2 = te[s2 >> 24] ^ ROR(te[(s3 >> 16) & 0xff], 8) ^
+             ROR(te[(s0 >> 8) & 0xff], 16) ^ ROR(te[s1 & 0xff], 24) ^ rk[2];
+        t3 = te[s3 >> 24] ^ ROR(te[(s0 >> 16) & 0xff], 8) ^
+             ROR(te[(s1 >> 8) & 0xff], 16) ^ ROR(te[s2 & 0xff], 24) ^ rk[3];
+        s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+    }
+    rk += 4;
+#define LAST(a, b, c, d) (((uint32_t)sbox[(a) >> 24] << 24) ^ \
+                          ((uint32_t)sbox[((b) >> 16) & 0xff] << 16) ^ \
+                          ((uint32_t)sbox[((c) >> 8) & 0xff] << 8) ^ \
+                          sbox[(d) & 0xff])
+    put32(out, LAST(s0, s1, s2, s3) ^ rk[0]);
+    put32(out + 4, LAST(s1, s2, s3, s0) ^ rk[1]);
+    put32(out + 8, LAST(s2, s3, s0, s1) ^ rk[2]);
+    put32(out + 12, LAST(s3, s0, s1, s2) ^ rk[3]);
+#undef LAST
+}
+
+/* counter block n: n + 1 little-endian in the first eight bytes, as the
+   WinZip implementation starts its counter at one */
+local void ctr_block(unsigned char* blk, uint64_t n) {
+    int i;
+
+    n++;
+    for (i = 0; i < 8; i++, n >>= 8)
+        blk[i] = (unsigned char)n;
+    memset(blk + 8, 0, 8);
+}
+
+/* xor the key stream of n blocks into buf with the tables */
+local void ctr_soft(wzaes_ctx* ctx, unsigned char* buf, size_t n) {
+    unsigned char blk[16];
+    int i;
+
+    while (n--) {
+        ctr_block(blk, ctx->ctr++);
+        aes_block(ctx, blk, blk);
+        for (i = 0; i < 16; i++)
+            buf[i] ^= blk[i];
+        buf += 16;
+    }
+}
+
+#if defined(WZAES_X86)
+
+/* xor the key stream of n blocks into buf with AES-NI, four at a time to
+   keep the AES unit busy */
+WZAES_TARGET local void ctr_hw(wzaes_ctx* ctx, unsigned char* buf, size_t n) {
+    __m128i k[15], b0, b1, b2, b3;
+    int r, nr = ctx->rounds;
+    uint64_t c = ctx->ctr + 1;
+
+    for (r = 0; r <= nr; r++)
+        k[r] = _mm_loadu_si128((const __m128i*)(ctx->rkb + 16 * r));
+    for (; n >= 4; n -= 4, buf += 64, c += 4) {
+        b0 = _mm_xor_si128(_mm_set_epi64x(0, (long long)c), k[0]);
+        b1 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 1)), k[0]);
+        b2 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 2)), k[0]);
+        b3 = _mm_xor_si128(_mm_set_epi64x(0, (long long)(c + 3)), k[0]);
+        for (r = 1; r < nr; r++) {
+            b0 = _mm_aesenc_si128(b0, k[r]);
+            b1 = _mm_aesenc_si128(b1, k[r]);
+            b2 = _mm_aesenc_si128(b2, k[r]);
+            b3 = _mm_aesenc_si128(b3, k[r]);
+        }
+        b0 = _mm_aesenclast_si128(b0, k[nr]);
+        b1 = _mm_aesenclast_si128(b1, k[nr]);
+        b2 = _mm_aesenclast_si128(b2, k[nr]);
+        b3 = _mm_aesenclast_si128(b3, k[nr]);
+        _mm_storeu_si128((__m128i*)buf, _mm_xor_si128(b0,
+                         _mm_loadu_si128((const __m128i*)buf)));
+        _mm_storeu_si128((__m128i*)(buf + 16), _mm_xor_si128(b1,
+                         _mm_loadu_si128((const __m128i*)(buf + 16))));
+        _mm_storeu_si128((__m128i*)(buf + 32), _mm_xor_si128(b2,
+                         _mm_loadu_si128((const __m128i*)(buf + 32))));
+        _mm_storeu_si128((__m128i*)(buf + 48), _mm_xor_si128(b3,
+                         _mm_loadu_si128((const __m128i*)(buf + 48))));
+    }
+    for (; n; n--, buf += 16, c++) {
+        b0 = _mm_xor_si128(_mm_set_epi64x(0, (long long)c), k[0]);
+        for (r = 1; r < nr; r++)
+            b0 = _mm_aesenc_si128(b0, k[r]);
+        b0 = _mm_aesenclast_si128(b0, k[nr]);
+        _mm_storeu_si128((__m128i*)buf, _mm_xor_si128(b0,
+                         _mm_loadu_si128((const __m128i*)buf)));
+    }
+    ctx->ctr = c - 1;
+}
+
+#elif defined(WZAES_ARM)
+
+/* xor the key stream of n blocks into buf with the ARMv8 instructions, which
+   add the round key before the substitution rather than after the mixing */
+local void ctr_hw(wzaes_ctx* ctx, unsigned char* buf, size_t n) {
+    uint8x16_t k[15], b;
+    unsigned char blk[16];
+    int r, nr = ctx->rounds;
+
+    for (r = 0; r <= nr; r++)
+        k[r] = vld1q_u8(ctx->rkb + 16 * r);
+    for (; n; n--, buf += 16) {
+        ctr_block(blk, ctx->ctr++);
+        b = vld1q_u8(blk);
+        for (r = 0; r < nr - 1; r++)
+            b = vaesmcq_u8(vaeseq_u8(b, k[r]));
+        b = veorq_u8(vaeseq_u8(b, k[nr - 1]), k[nr]);
+        vst1q_u8(buf, veorq_u8(b, vld1q_u8(buf)));
+    }
+}
+
+#else
+
+#  define ctr_hw ctr_soft
+
+#endif
+
+/* xor the key stream into len bytes of buf */
+local void ctr_xor(wzaes_ctx* ctx, unsigned char* buf, size_t len) {
+    size_t n;
+
+    while (len && ctx->left) {
+        *buf++ ^= ctx->ks[16 - ctx->left--];
+        len--;
+    }
+    n = len >> 4;
+    if (n) {
+        if (ctx->hw)
+            ctr_hw(ctx, buf, n);
+        else
+            ctr_soft(ctx, buf, n);
+        buf += n << 4;
+        len &= 15;
+    }
+    if (len) {
+        memset(ctx->ks, 0, 16);
+        ctr_soft(ctx, ctx->ks, 1);
+        ctx->left = 16;
+        while (len--)
+            *buf++ ^= ctx->ks[16 - ctx->left--];
+    }
+}
+
+/* ===========================================================================
+ * SHA-1 and HMAC-SHA1
+ */
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* The SHA-1 step functions, the message word for step i from a ring of
+   sixteen, and five steps renaming the variables rather than moving them.
+   The steps are all written out, which with the ring is more than twice as
+   fast as looping over an array of eighty words. */
+#define F1(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define F2(b, c, d) ((b) ^ (c) ^ (d))
+#define F3(b, c, d) (((b) & (c)) | ((d) & ((b) | (c))))
+#define X(i) ((i) < 16 ? w[(i) & 15] : \
+    (w[(i) & 15] = ROL(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ \
+                       w[((i) + 2) & 15] ^ w[(i) & 15], 1)))
+#define STEP(a, b, c, d, e, f, k, i) \
+    e += ROL(a, 5) + f(b, c, d) + (k) + X(i), b = ROL(b, 30)
+#define STEP5(f, k, i) \
+    STEP(a, b, c, d, e, f, k, i); \
+    STEP(e, a, b, c, d, f, k, (i) + 1); \
+    STEP(d, e, a, b, c, f, k, (i) + 2); \
+    STEP(c, d, e, a, b, f, k, (i) + 3); \
+    STEP(b, c, d, e, a, f, k, (i) + 4)
+
+local void sha1_block(uint32_t* h, const unsigned char* p) {
+    uint32_t w[16], a, b, c, d, e;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = get32(p + 4 * i);
+    a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    STEP5(F1, 0x5a827999, 0);
+    STEP5(F1, 0x5a827999, 5);
+    STEP5(F1, 0x5a827999, 10);
+    STEP5(F1, 0x5a827999, 15);
+    STEP5(F2, 0x6ed9eba1, 20);
+    STEP5(F2, 0x6ed9eba1, 25);
+    STEP5(F2, 0x6ed9eba1, 30);
+    STEP5(F2, 0x6ed9eba1, 35);
+    STEP5(F3, 0x8f1bbcdc, 40);
+    STEP5(F3, 0x8f1bbcdc, 45);
+    STEP5(F3, 0x8f1bbcdc, 50);
+    STEP5(F3, 0x8f1bbcdc, 55);
+    STEP5(F2, 0xca62c1d6, 60);
+    STEP5(F2, 0xca62c1d6, 65);
+    STEP5(F2, 0xca62c1d6, 70);
+    STEP5(F2, 0xca62c1d6, 75);
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+}
+
+local void sha1_init(wzaes_sha1* s) {
+    s->h[0] = 0x67452301;
+    s->h[1] = 0xefcdab89;
+    s->h[2] = 0x98badcfe;
+    s->h[3] = 0x10325476;
+    s->h[4] = 0xc3d2e1f0;
+    s->len = 0;
+}
+
+local void sha1_update(wzaes_sha1* s, const unsigned char* p, size_t len) {
+    unsigned have = (unsigned)(s->len & 63), n;
+
+    s->len += len;
+    if (have) {
+        n = 64 - have < len ? 64 - have : (unsigned)len;
+        memcpy(s->buf + have, p, n);
+        p += n;
+        len -= n;
+        if (have + n < 64)
+            return;
+        sha1_block(s->h, s->buf);
+    }
+    for (; len >= 64; len -= 64, p += 64)
+        sha1_block(s->h, p);
+    memcpy(s->buf, p, len);
+}
+
+local void sha1_final(wzaes_sha1* s, unsigned char* md) {
+    unsigned char pad[72];
+    uint64_t bits = s->len << 3;
+    unsigned n = (unsigned)(55 - (s->len & 63)) % 64 + 1, i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++)
+        pad[n + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha1_update(s, pad, n + 8);
+    for (i = 0; i < 5; i++)
+        put32(md + 4 * i, s->h[i]);
+}
+
+/* set inner and outer to the SHA-1 states after the HMAC key pads */
+local void hmac_init(wzaes_sha1* inner, wzaes_sha1* outer,
+                     const unsigned char* key, size_t len) {
+    unsigned char pad[64], md[20];
+    wzaes_sha1 s;
+    int i;
+
+    if (len > 64) {
+        sha1_init(&s);
+        sha1_update(&s, key, len);
+        sha1_final(&s, md);
+        key = md;
+        len = 20;
+    }
+    memset(pad, 0, sizeof(pad));
+    memcpy(pad, key, len);
+    for (i = 0; i < 64; i++)
+        pad[i] ^= 0x36;
+    sha1_init(inner);
+    sha1_update(inner, pad, 64);
+    for (i = 0; i < 64; i++)
+        pad[i] ^= 0x36 ^ 0x5c;
+    sha1_init(outer);
+    sha1_update(outer, pad, 64);
+}
+
+/* finish the HMAC whose message went into inner */
+local void hmac_final(wzaes_sha1* inner, const wzaes_sha1* outer,
+                      unsigned char* md) {
+    wzaes_sha1 s = *outer;
+
+    sha1_final(inner, md);
+    sha1_update(&s, md, 20);
+    sha1_final(&s, md);
+}
+
+/* PBKDF2-HMAC-SHA1 of the password and salt with iter iterations, len bytes
+   into dk */
+local void pbkdf2(const char* password, const unsigned char* salt,
+                  unsigned salt_len, unsigned iter, unsigned char* dk,
+                  unsigned len) {
+    wzaes_sha1 inner, outer, s;
+    unsigned char u[20], t[20], num[4];
+    unsigned block, i, j, n;
+
+    hmac_init(&inner, &outer, (const unsigned char*)password,
+              strlen(password));
+    for (block = 1; len; block++) {
+        put32(num, block);
+        s = inner;
+        sha1_update(&s, salt, salt_len);
+        sha1_update(&s, num, 4);
+        hmac_final(&s, &outer, u);
+        memcpy(t, u, 20);
+        for (j = 1; j < iter; j++) {
+            s = inner;
+            sha1_update(&s, u, 20);
+            hmac_final(&s, &outer, u);
+            for (i = 0; i < 20; i++)
+                t[i] ^= u[i];
+        }
+        n = len < 20 ? len : 20;
+        memcpy(dk, t, n);
+        dk += n;
+        len -= n;
+    }
+}
+
+/* ===========================================================================
+ * Entry points
+ */
+
+/* clear secrets in a way the compiler does not drop */
+local void wipe(void* p, size_t len) {
+    volatile unsigned char* v = (volatile unsigned char*)p;
+
+    while (len--)
+        *v++ = 0;
+}
+
+int wzaes_init(wzaes_ctx* ctx, const char* password, int strength,
+               const unsigned char* salt, unsigned char* pwv) {
+    unsigned char dk[2 * 32 + WZAES_PWV_SIZE];
+    unsigned klen;
+
+    if (strength < 1 || strength > 3)
+        return -1;
+    klen = 8 + 8 * (unsigned)strength;
+    pbkdf2(password, salt, WZAES_SALT_SIZE(strength), WZAES_ITER, dk,
+           2 * klen + WZAES_PWV_SIZE);
+    aes_setkey(ctx, dk, (int)klen / 4);
+    hmac_init(&ctx->inner, &ctx->outer, dk + klen, klen);
+    memcpy(pwv, dk + 2 * klen, WZAES_PWV_SIZE);
+    wipe(dk, sizeof(dk));
+    ctx->ctr = 0;
+    ctx->left = 0;
+    return 0;
+}
+
+void wzaes_encrypt(wzaes_ctx* ctx, unsigned char* buf, unsigned len) {
+    unsigned n;
+
+    for (; len; buf += n, len -= n) {
+        n = len < WZAES_PIECE ? len : WZAES_PIECE;
+        ctr_xor(ctx, buf, n);
+        sha1_update(&ctx->inner, buf, n);
+    }
+}
+
+void wzaes_decrypt(wzaes_ctx* ctx, unsigned char* buf, unsigned len) {
+    unsigned n;
+
+    for (; len; buf += n, len -= n) {
+        n = len < WZAES_PIECE ? len : WZAES_PIECE;
+        sha1_update(&ctx->inner, buf, n);
+        ctr_xor(ctx, buf, n);
+    }
+}
+
+void wzaes_finish(wzaes_ctx* ctx, unsigned char* mac) {
+    unsigned char md[20];
+
+    hmac_final(&ctx->inner, &ctx->outer, md);
+    memcpy(mac, md, WZAES_MAC_SIZE);
+    wipe(ctx, sizeof(wzaes_ctx));
+}
+
+int wzaes_salt(unsigned char* salt, unsigned len) {
+#if defined(WZAES_BCRYPT)
+    return BCryptGenRandom(NULL, salt, len,
+                           BCRYPT_USE_SYSTEM_PREFERRED_RNG) == 0 ? 0 : -1;
+#elif defined(WZAES_ARC4RANDOM)
+    arc4random_buf(salt, len);
+    return 0;
+#elif defined(WZAES_URANDOM)
+    long got;
+    int fd;
+
+#  ifdef SYS_getrandom
+    /* getrandom() without /dev, in a chroot or out of descriptors */
+    while (len) {
+        got = syscall(SYS_getrandom, salt, len, 0);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        salt += got;
+        len -= (unsigned)got;
+    }
+    if (len == 0)
+        return 0;
+#  endif
+    do {
+        fd = open("/dev/urandom", O_RDONLY);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1)
+        return -1;
+    while (len) {
+        got = (long)read(fd, salt, len);
+        if (got == -1 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            break;
+        salt += got;
+        len -= (unsigned)got;
+    }
+    close(fd);
+    return len ? -1 : 0;
+#else
+    (void)salt;
+    (void)len;
+    return -1;
+#endif
+}
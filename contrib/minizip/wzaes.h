@@ -0,0 +1,68 @@
+/* wzaes.h -- WinZip AES encryption (AE-1 and AE-2) for minizip
+
+   For conditions of distribution and use, see copyright notice in zlib.h
+
+   An AES entry has compression method 99, and an extra field with header ID
+   0x9901 holding the AE version, the key size and the real method. Its data
+   is a salt, a two-byte password verification value, the compressed data
+   encrypted with AES in counter mode, and the first ten bytes of an
+   HMAC-SHA1 of the encrypted data. The AES and HMAC keys and the
+   verification value come from the password and salt with PBKDF2-HMAC-SHA1,
+   1000 iterations. AE-1 keeps the CRC of the data, AE-2 stores zero there.
+
+   The AES rounds use the AES-NI instructions when the processor has them, or
+   the ARMv8 crypto extensions when compiled for them, and tables otherwise.
+*/
+
+#ifndef _WZAES_H
+#define _WZAES_H
+
+#include <stdint.h>
+
+#define WZAES_METHOD      99        /* compression method of AES entries */
+#define WZAES_HEADERID    0x9901    /* extra field with the real method */
+#define WZAES_EXTRA_SIZE  11        /* that field with its header */
+#define WZAES_PWV_SIZE    2         /* password verification value */
+#define WZAES_MAC_SIZE    10        /* authentication code after the data */
+
+/* salt length for key strength 1, 2 or 3 (AES-128, AES-192, AES-256) */
+#define WZAES_SALT_SIZE(strength) (4 + 4 * (strength))
+
+typedef struct {
+    uint32_t h[5];                  /* hash so far */
+    uint64_t len;                   /* bytes hashed */
+    unsigned char buf[64];          /* partial block */
+} wzaes_sha1;
+
+typedef struct {
+    uint32_t rk[60];                /* round keys as big-endian words */
+    unsigned char rkb[240];         /* same as bytes, for the instructions */
+    uint32_t te[256];               /* round table for the portable code */
+    int rounds;                     /* 10, 12 or 14 */
+    int hw;                         /* true to use the AES instructions */
+    uint64_t ctr;                   /* counter blocks used */
+    unsigned char ks[16];           /* key stream of the last block */
+    unsigned left;                  /* bytes of ks not used yet */
+    wzaes_sha1 inner, outer;        /* HMAC states after the key pads */
+} wzaes_ctx;
+
+/* Derive the keys for password and salt with key strength 1, 2 or 3, and
+   store the password verification value in pwv. Return 0, or -1 if the
+   strength is not valid. */
+int wzaes_init(wzaes_ctx* ctx, const char* password, int strength,
+               const unsigned char* salt, unsigned char* pwv);
+
+/* Encrypt or decrypt len bytes of buf in place, updating the HMAC with the
+   encrypted bytes in the same pass. */
+void wzaes_encrypt(wzaes_ctx* ctx, unsigned char* buf, unsigned len);
+void wzaes_decrypt(wzaes_ctx* ctx, unsigned char* buf, unsigned len);
+
+/* Store the WZAES_MAC_SIZE bytes of authentication code of the data so far
+   in mac, and erase the keys. */
+void wzaes_finish(wzaes_ctx* ctx, unsigned char* mac);
+
+/* Fill salt with len random bytes from the system. Return 0, or -1 if there
+   is no system source of random bytes, or it failed. */
+int wzaes_salt(unsigned char* salt, unsigned len);
+
+#endif /* _WZAES_H */
@@ -29,6 +29,7 @@
 #include <time.h>
 #include <zlib/zlib.h>
 #include "zip.h"
+#include "wzaes.h"
 
 #ifdef STDC
 #  include <stddef.h>
@@ -155,7 +156,9 @@ typedef struct
     unsigned long keys[3];     /* keys defining the pseudo-random sequence */
     const z_crc_t* pcrc_32_tab;
     unsigned crypt_header_size;
+    wzaes_ctx* aes_ctx;        /* AES keys, or NULL for the traditional ones */
 #endif
+    int  aes;                  /* AES key strength, or 0 if not AES */
 } curfile64_info;
 
 typedef struct
@@ -917,6 +920,17 @@ extern zipFile ZEXPORT zipOpen64(const void* pathname, int append) {
     return zipOpen3(pathname,append,NULL,NULL);
 }
 
+/* the WinZip AES extra field, for AE-2 with the key strength and the real
+   compression method */
+local void zip64local_putAesExtra(unsigned char* p, int aes, int method) {
+  zip64local_putValue_inmemory(p, WZAES_HEADERID, 2);
+  zip64local_putValue_inmemory(p+2, WZAES_EXTRA_SIZE-4, 2);
+  zip64local_putValue_inmemory(p+4, 2, 2);            /* AE-2 */
+  zip64local_putValue_inmemory(p+6, 'A' | ('E' << 8), 2);
+  zip64local_putValue_inmemory(p+8, (ZPOS64_T)aes, 1);
+  zip64local_putValue_inmemory(p+9, (ZPOS64_T)method, 2);
+}
+
 local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt size_extrafield_local, const void* extrafield_local) {
   /* write the local header */
   int err;
@@ -927,7 +941,9 @@ local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt s
 
   if (err==ZIP_OK)
   {
-    if(zi->ci.zip64)
+    if(zi->ci.aes || zi->ci.method == WZAES_METHOD)
+      err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)51,2);/* version needed to extract */
+    else if(zi->ci.zip64)
       err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)45,2);/* version needed to extract */
     else
       err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)20,2);/* version needed to extract */
@@ -937,7 +953,7 @@ local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt s
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.flag,2);
 
   if (err==ZIP_OK)
-    err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.method,2);
+    err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)(zi->ci.aes ? WZAES_METHOD : zi->ci.method),2);
 
   if (err==ZIP_OK)
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)zi->ci.dosDate,4);
@@ -968,6 +984,9 @@ local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt s
     size_extrafield += 20;
   }
 
+  if(zi->ci.aes)
+    size_extrafield += WZAES_EXTRA_SIZE;
+
   if (err==ZIP_OK)
     err = zip64local_putValue(&zi->z_filefunc,zi->filestream,(uLong)size_extrafield,2);
 
@@ -1002,6 +1021,14 @@ local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt s
       err = zip64local_putValue(&zi->z_filefunc, zi->filestream, (ZPOS64_T)CompressedSize,8);
   }
 
+  if ((err==ZIP_OK) && (zi->ci.aes))
+  {
+      unsigned char aes_extra[WZAES_EXTRA_SIZE];
+      zip64local_putAesExtra(aes_extra, zi->ci.aes, zi->ci.method);
+      if (ZWRITE64(zi->z_filefunc, zi->filestream, aes_extra, WZAES_EXTRA_SIZE) != WZAES_EXTRA_SIZE)
+        err = ZIP_ERRNO;
+  }
+
   return err;
 }
 
@@ -1013,33 +1040,41 @@ local int Write_LocalFileHeader(zip64_internal* zi, const char* filename, uInt s
  It is not done here because then we need to realloc a new buffer since parameters are 'const' and I want to minimize
  unnecessary allocations.
  */
-extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, const zip_fileinfo* zipfi,
-                                           const void* extrafield_local, uInt size_extrafield_local,
-                                           const void* extrafield_global, uInt size_extrafield_global,
-                                           const char* comment, int method, int level, int raw,
-                                           int windowBits,int memLevel, int strategy,
-                                           const char* password, uLong crcForCrypting,
-                                           uLong versionMadeBy, uLong flagBase, int zip64) {
+extern int ZEXPORT zipOpenNewFileInZip5(zipFile file, const char* filename, const zip_fileinfo* zipfi,
+                                        const void* extrafield_local, uInt size_extrafield_local,
+                                        const void* extrafield_global, uInt size_extrafield_global,
+                                        const char* comment, int method, int level, int raw,
+                                        int windowBits,int memLevel, int strategy,
+                                        const char* password, uLong crcForCrypting,
+                                        uLong versionMadeBy, uLong flagBase, int zip64,
+                                        int aes) {
     zip64_internal* zi;
     uInt size_filename;
     uInt size_comment;
+    uInt size_aes;
     uInt i;
     int err = ZIP_OK;
 
 #    ifdef NOCRYPT
     (crcForCrypting);
-    if (password != NULL)
+    if ((password != NULL) || (aes != 0))
         return ZIP_PARAMERROR;
 #    endif
 
     if (file == NULL)
         return ZIP_PARAMERROR;
 
+    if ((aes != 0) && ((password == NULL) || (aes < 1) || (aes > 3)))
+        return ZIP_PARAMERROR;
+
+    /* an AES entry can be copied raw, with its extra fields */
 #ifdef HAVE_BZIP2
-    if ((method!=0) && (method!=Z_DEFLATED) && (method!=Z_BZIP2ED))
+    if ((method!=0) && (method!=Z_DEFLATED) && (method!=Z_BZIP2ED) &&
+        ((method!=WZAES_METHOD) || (!raw) || (aes != 0)))
       return ZIP_PARAMERROR;
 #else
-    if ((method!=0) && (method!=Z_DEFLATED))
+    if ((method!=0) && (method!=Z_DEFLATED) &&
+        ((method!=WZAES_METHOD) || (!raw) || (aes != 0)))
       return ZIP_PARAMERROR;
 #endif
 
@@ -1051,7 +1086,8 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, c
     // The extra field length must fit in 16 bits. If the member also requires
     // a Zip64 extra block, that will also need to fit within that 16-bit
     // length, but that will be checked for later.
-    if ((size_extrafield_local>0xffff) || (size_extrafield_global>0xffff))
+    size_aes = aes != 0 ? WZAES_EXTRA_SIZE : 0;
+    if ((size_extrafield_local+size_aes>0xffff) || (size_extrafield_global+size_aes>0xffff))
         return ZIP_PARAMERROR;
 
     zi = (zip64_internal*)file;
@@ -1101,24 +1137,24 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, c
     zi->ci.raw = raw;
     zi->ci.pos_local_header = ZTELL64(zi->z_filefunc,zi->filestream);
 
-    zi->ci.size_centralheader = SIZECENTRALHEADER + size_filename + size_extrafield_global + size_comment;
+    zi->ci.size_centralheader = SIZECENTRALHEADER + size_filename + size_extrafield_global + size_aes + size_comment;
     zi->ci.size_centralExtraFree = 32; // Extra space we have reserved in case we need to add ZIP64 extra info data
 
     zi->ci.central_header = (char*)ALLOC((uInt)zi->ci.size_centralheader + zi->ci.size_centralExtraFree);
 
-    zi->ci.size_centralExtra = size_extrafield_global;
+    zi->ci.size_centralExtra = size_extrafield_global + size_aes;
     zip64local_putValue_inmemory(zi->ci.central_header,(uLong)CENTRALHEADERMAGIC,4);
     /* version info */
     zip64local_putValue_inmemory(zi->ci.central_header+4,(uLong)versionMadeBy,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+6,(uLong)20,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+6,(uLong)(aes != 0 || method == WZAES_METHOD ? 51 : 20),2);
     zip64local_putValue_inmemory(zi->ci.central_header+8,(uLong)zi->ci.flag,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+10,(uLong)zi->ci.method,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+10,(uLong)(aes != 0 ? WZAES_METHOD : zi->ci.method),2);
     zip64local_putValue_inmemory(zi->ci.central_header+12,(uLong)zi->ci.dosDate,4);
     zip64local_putValue_inmemory(zi->ci.central_header+16,(uLong)0,4); /*crc*/
     zip64local_putValue_inmemory(zi->ci.central_header+20,(uLong)0,4); /*compr size*/
     zip64local_putValue_inmemory(zi->ci.central_header+24,(uLong)0,4); /*uncompr size*/
     zip64local_putValue_inmemory(zi->ci.central_header+28,(uLong)size_filename,2);
-    zip64local_putValue_inmemory(zi->ci.central_header+30,(uLong)size_extrafield_global,2);
+    zip64local_putValue_inmemory(zi->ci.central_header+30,(uLong)zi->ci.size_centralExtra,2);
     zip64local_putValue_inmemory(zi->ci.central_header+32,(uLong)size_comment,2);
     zip64local_putValue_inmemory(zi->ci.central_header+34,(uLong)0,2); /*disk nm start*/
 
@@ -1144,13 +1180,18 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, c
         *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+i) =
               *(((const char*)extrafield_global)+i);
 
+    if (aes != 0)
+        zip64local_putAesExtra((unsigned char*)zi->ci.central_header+SIZECENTRALHEADER+size_filename+
+                               size_extrafield_global, aes, method);
+
     for (i=0;i<size_comment;i++)
         *(zi->ci.central_header+SIZECENTRALHEADER+size_filename+
-              size_extrafield_global+i) = *(comment+i);
+              size_extrafield_global+size_aes+i) = *(comment+i);
     if (zi->ci.central_header == NULL)
         return ZIP_INTERNALERROR;
 
     zi->ci.zip64 = zip64;
+    zi->ci.aes = aes;
     zi->ci.totalCompressedData = 0;
     zi->ci.totalUncompressedData = 0;
     zi->ci.pos_zip64extrainfo = 0;
@@ -1212,7 +1253,33 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, c
 
 #    ifndef NOCRYPT
     zi->ci.crypt_header_size = 0;
-    if ((err==Z_OK) && (password != NULL))
+    zi->ci.aes_ctx = NULL;
+    if ((err==Z_OK) && (aes != 0))
+    {
+        unsigned char bufHead[16 + WZAES_PWV_SIZE];
+        unsigned int sizeHead = WZAES_SALT_SIZE(aes) + WZAES_PWV_SIZE;
+        zi->ci.aes_ctx = (wzaes_ctx*)ALLOC(sizeof(wzaes_ctx));
+        if (zi->ci.aes_ctx == NULL)
+            err = ZIP_INTERNALERROR;
+        else if (wzaes_salt(bufHead, WZAES_SALT_SIZE(aes)) != 0)
+        {
+            /* no salt from the system: a guessable one would weaken the
+               keys, so do not write the entry */
+            free(zi->ci.aes_ctx);
+            zi->ci.aes_ctx = NULL;
+            err = ZIP_INTERNALERROR;
+        }
+        else
+        {
+            zi->ci.encrypt = 1;
+            wzaes_init(zi->ci.aes_ctx, password, aes, bufHead, bufHead + WZAES_SALT_SIZE(aes));
+            zi->ci.crypt_header_size = sizeHead;
+
+            if (ZWRITE64(zi->z_filefunc,zi->filestream,bufHead,sizeHead) != sizeHead)
+                    err = ZIP_ERRNO;
+        }
+    }
+    else if ((err==Z_OK) && (password != NULL))
     {
         unsigned char bufHead[RAND_HEAD_LEN];
         unsigned int sizeHead;
@@ -1233,6 +1300,21 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, c
     return err;
 }
 
+extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file, const char* filename, const zip_fileinfo* zipfi,
+                                           const void* extrafield_local, uInt size_extrafield_local,
+                                           const void* extrafield_global, uInt size_extrafield_global,
+                                           const char* comment, int method, int level, int raw,
+                                           int windowBits,int memLevel, int strategy,
+                                           const char* password, uLong crcForCrypting,
+                                           uLong versionMadeBy, uLong flagBase, int zip64) {
+    return zipOpenNewFileInZip5(file, filename, zipfi,
+                                extrafield_local, size_extrafield_local,
+                                extrafield_global, size_extrafield_global,
+                                comment, method, level, raw,
+                                windowBits, memLevel, strategy,
+                                password, crcForCrypting, versionMadeBy, flagBase, zip64, 0);
+}
+
 extern int ZEXPORT zipOpenNewFileInZip4(zipFile file, const char* filename, const zip_fileinfo* zipfi,
                                         const void* extrafield_local, uInt size_extrafield_local,
                                         const void* extrafield_global, uInt size_extrafield_global,
@@ -1332,8 +1414,11 @@ local int zip64FlushWriteBuffer(zip64_internal* zi) {
 #ifndef NOCRYPT
         uInt i;
         int t;
-        for (i=0;i<zi->ci.pos_in_buffered_data;i++)
-            zi->ci.buffered_data[i] = zencode(zi->ci.keys, zi->ci.pcrc_32_tab, zi->ci.buffered_data[i],t);
+        if (zi->ci.aes_ctx != NULL)
+            wzaes_encrypt(zi->ci.aes_ctx, zi->ci.buffered_data, zi->ci.pos_in_buffered_data);
+        else
+            for (i=0;i<zi->ci.pos_in_buffered_data;i++)
+                zi->ci.buffered_data[i] = zencode(zi->ci.keys, zi->ci.pcrc_32_tab, zi->ci.buffered_data[i],t);
 #endif
     }
 
@@ -1373,7 +1458,23 @@ extern int ZEXPORT zipWriteInFileInZip(zipFile file, const void* buf, unsigned i
     if (zi->in_opened_file_inzip == 0)
         return ZIP_PARAMERROR;
 
-    zi->ci.crc32 = crc32(zi->ci.crc32,buf,(uInt)len);
+    /* raw data large enough to fill buffered_data is written directly, to
+       copy entries between archives at disk speed -- the CRC is given to
+       zipCloseFileInZipRaw() then */
+    if ((zi->ci.raw) && (zi->ci.encrypt == 0) && (len >= Z_BUFSIZE))
+    {
+        if (zi->ci.pos_in_buffered_data > 0 &&
+            zip64FlushWriteBuffer(zi) == ZIP_ERRNO)
+            return ZIP_ERRNO;
+        if (ZWRITE64(zi->z_filefunc,zi->filestream,buf,len) != len)
+            return ZIP_ERRNO;
+        zi->ci.totalCompressedData += len;
+        zi->ci.totalUncompressedData += len;
+        return ZIP_OK;
+    }
+
+    if (!zi->ci.raw)
+        zi->ci.crc32 = crc32(zi->ci.crc32,buf,(uInt)len);
 
 #ifdef HAVE_BZIP2
     if(zi->ci.method == Z_BZIP2ED && (!zi->ci.raw))
@@ -1559,6 +1660,23 @@ extern int ZEXPORT zipCloseFileInZipRaw64(zipFile file, ZPOS64_T uncompressed_si
     }
     compressed_size = zi->ci.totalCompressedData;
 
+#    ifndef NOCRYPT
+    if (zi->ci.aes_ctx != NULL)
+    {
+        /* AE-2: the authentication code follows the data, and the CRC is
+           not stored, since the code checks the data */
+        unsigned char mac[WZAES_MAC_SIZE];
+        wzaes_finish(zi->ci.aes_ctx, mac);
+        free(zi->ci.aes_ctx);
+        zi->ci.aes_ctx = NULL;
+        if ((err==ZIP_OK) &&
+            (ZWRITE64(zi->z_filefunc,zi->filestream,mac,WZAES_MAC_SIZE) != WZAES_MAC_SIZE))
+            err = ZIP_ERRNO;
+        zi->ci.crypt_header_size += WZAES_MAC_SIZE;
+        crc32 = 0;
+    }
+#    endif
+
 #    ifndef NOCRYPT
     compressed_size += zi->ci.crypt_header_size;
 #    endif
@@ -305,6 +305,39 @@ extern int ZEXPORT zipOpenNewFileInZip4_64(zipFile file,
     flag : value for flag field (compression level info will be added)
  */
 
+extern int ZEXPORT zipOpenNewFileInZip5(zipFile file,
+                                        const char* filename,
+                                        const zip_fileinfo* zipfi,
+                                        const void* extrafield_local,
+                                        uInt size_extrafield_local,
+                                        const void* extrafield_global,
+                                        uInt size_extrafield_global,
+                                        const char* comment,
+                                        int method,
+                                        int level,
+                                        int raw,
+                                        int windowBits,
+                                        int memLevel,
+                                        int strategy,
+                                        const char* password,
+                                        uLong crcForCrypting,
+                                        uLong versionMadeBy,
+                                        uLong flagBase,
+                                        int zip64,
+                                        int aes);
+/*
+  Same than zipOpenNewFileInZip4_64, except
+    aes : 0 for the traditional PKWARE encryption when password is not NULL,
+          or 1, 2 or 3 to encrypt with WinZip AES (AE-2) with a 128, 192 or
+          256-bit key, password then being required and crcForCrypting unused
+
+  The salt of an AES entry comes from the system's source of random bytes,
+  and ZIP_INTERNALERROR is returned if there is none.
+
+  An entry opened with raw set may also be given method 99, to copy an AES
+  entry as read with unzOpenCurrentFile2(), with its 0x9901 extra fields.
+ */
+
 
 extern int ZEXPORT zipWriteInFileInZip(zipFile file,
                                        const void* buf,
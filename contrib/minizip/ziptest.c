@@ -0,0 +1,533 @@
+/* ziptest.c -- tests of the minizip additions
+
+   For conditions of distribution and use, see copyright notice in zlib.h
+
+   Known-answer tests of the WinZip AES primitives, and round trips through
+   zip and unzip. Run by "make test". wzaes.c is included rather than linked,
+   so that its local functions can be tested against the published vectors.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zip.h"
+#include "unzip.h"
+#include "mztools.h"
+#include "wzaes.c"
+
+#define TESTZIP "ziptest.zip"
+#define TESTGZ "ziptest.gz"
+#define TESTCOPY "ziptest2.zip"
+
+#define CHECK_ERR(err, msg) { \
+    if (err != 0) { \
+        fprintf(stderr, "%s error: %d\n", msg, err); \
+        exit(1); \
+    } \
+}
+
+/* ===========================================================================
+ * Decode the hex string hex into out, and return its length in bytes
+ */
+static unsigned unhex(const char* hex, unsigned char* out) {
+    unsigned n = 0;
+    int hi, lo;
+
+    while (hex[0] && hex[1]) {
+        hi = hex[0] <= '9' ? hex[0] - '0' : (hex[0] | 0x20) - 'a' + 10;
+        lo = hex[1] <= '9' ? hex[1] - '0' : (hex[1] | 0x20) - 'a' + 10;
+        out[n++] = (unsigned char)(hi << 4 | lo);
+        hex += 2;
+    }
+    return n;
+}
+
+/* ===========================================================================
+ * Exit with a message if the len bytes at got are not those of the hex string
+ * want
+ */
+static void check_hex(const char* what, const unsigned char* got,
+                      const char* want) {
+    unsigned char buf[64];
+    unsigned n = unhex(want, buf);
+
+    if (memcmp(got, buf, n)) {
+        fprintf(stderr, "%s: wrong answer\n", what);
+        exit(1);
+    }
+}
+
+/* ===========================================================================
+ * Fill len bytes at data with words, some of them repeated
+ */
+static void fill_words(unsigned char* data, unsigned long len,
+                       unsigned long seed) {
+    unsigned long i;
+
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (unsigned char)(i > 1000 && (seed >> 16) % 3 == 0 ?
+                                  data[i - 1000 + (seed >> 20) % 8] :
+                                  (seed >> 18) % 6 == 0 ? ' ' :
+                                  'a' + (seed >> 22) % 8);
+    }
+}
+
+/* ===========================================================================
+ * Test the AES block cipher with the examples of FIPS-197 appendices B and
+ * C, and the AES instructions, when there are any, against the tables in
+ * counter mode
+ */
+static void test_aes(void) {
+    static const struct {
+        const char *key, *in, *out;
+    } kat[] = {
+        {"2b7e151628aed2a6abf7158809cf4f3c",
+         "3243f6a8885a308d313198a2e0370734",
+         "3925841d02dc09fbdc118597196a0b32"},
+        {"000102030405060708090a0b0c0d0e0f",
+         "00112233445566778899aabbccddeeff",
+         "69c4e0d86a7b0430d8cdb78070b4c55a"},
+        {"000102030405060708090a0b0c0d0e0f1011121314151617",
+         "00112233445566778899aabbccddeeff",
+         "dda97ca4864cdfe06eaf70a0ec0d7191"},
+        {"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+         "00112233445566778899aabbccddeeff",
+         "8ea2b7ca516745bfeafc49904b496089"}
+    };
+    wzaes_ctx* ctx;
+    unsigned char key[32], in[16], out[16], soft[1000], hard[1000];
+    unsigned i, n;
+
+    ctx = (wzaes_ctx*)malloc(sizeof(wzaes_ctx));
+    if (ctx == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < sizeof(kat) / sizeof(kat[0]); i++) {
+        n = unhex(kat[i].key, key);
+        unhex(kat[i].in, in);
+        aes_setkey(ctx, key, (int)n / 4);
+        aes_block(ctx, in, out);
+        check_hex("AES", out, kat[i].out);
+    }
+
+    for (i = 0; i < sizeof(soft); i++)
+        soft[i] = (unsigned char)(i * 7);
+    memcpy(hard, soft, sizeof(soft));
+    aes_setkey(ctx, key, 8);
+    if (ctx->hw) {
+        ctx->ctr = 0, ctx->left = 0;
+        ctx->hw = 0;
+        ctr_xor(ctx, soft, 3);
+        ctr_xor(ctx, soft + 3, sizeof(soft) - 3);
+        ctx->ctr = 0, ctx->left = 0;
+        ctx->hw = 1;
+        ctr_xor(ctx, hard, 3);
+        ctr_xor(ctx, hard + 3, sizeof(hard) - 3);
+        if (memcmp(soft, hard, sizeof(soft))) {
+            fprintf(stderr, "AES instructions and tables differ\n");
+            exit(1);
+        }
+    }
+    printf("AES: FIPS-197 ok, %s\n", ctx->hw ? "instructions ok" :
+           "no instructions");
+    free(ctx);
+}
+
+/* ===========================================================================
+ * Test HMAC-SHA1 with cases 1, 2 and 6 of RFC 2202, and PBKDF2-HMAC-SHA1 with
+ * the vectors of RFC 6070
+ */
+static void test_hmac_pbkdf2(void) {
+    static const struct {
+        const char *pw, *salt;
+        unsigned iter, len;
+        const char* dk;
+    } kdf[] = {
+        {"password", "salt", 1, 20,
+         "0c60c80f961f0e71f3a9b524af6012062fe037a6"},
+        {"password", "salt", 2, 20,
+         "ea6c014dc72d6f8ccd1ed92ace1d41f0d8de8957"},
+        {"password", "salt", 4096, 20,
+         "4b007901b765489abead49d926f721d065a429c1"},
+        {"passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt",
+         4096, 25, "3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038"}
+    };
+    wzaes_sha1 inner, outer;
+    unsigned char key[80], md[25];
+    const char* msg;
+    unsigned i;
+
+    memset(key, 0x0b, 20);
+    hmac_init(&inner, &outer, key, 20);
+    msg = "Hi There";
+    sha1_update(&inner, (const unsigned char*)msg, strlen(msg));
+    hmac_final(&inner, &outer, md);
+    check_hex("HMAC-SHA1", md, "b617318655057264e28bc0b6fb378c8ef146be00");
+
+    hmac_init(&inner, &outer, (const unsigned char*)"Jefe", 4);
+    msg = "what do ya want for nothing?";
+    sha1_update(&inner, (const unsigned char*)msg, strlen(msg));
+    hmac_final(&inner, &outer, md);
+    check_hex("HMAC-SHA1", md, "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79");
+
+    memset(key, 0xaa, 80);
+    hmac_init(&inner, &outer, key, 80);
+    msg = "Test Using Larger Than Block-Size Key - Hash Key First";
+    sha1_update(&inner, (const unsigned char*)msg, strlen(msg));
+    hmac_final(&inner, &outer, md);
+    check_hex("HMAC-SHA1", md, "aa4ae5e15272d00e95705637ce8a3b55ed402112");
+
+    for (i = 0; i < sizeof(kdf) / sizeof(kdf[0]); i++) {
+        pbkdf2(kdf[i].pw, (const unsigned char*)kdf[i].salt,
+               (unsigned)strlen(kdf[i].salt), kdf[i].iter, md, kdf[i].len);
+        check_hex("PBKDF2-HMAC-SHA1", md, kdf[i].dk);
+    }
+    printf("HMAC-SHA1: RFC 2202 ok, PBKDF2: RFC 6070 ok\n");
+}
+
+/* ===========================================================================
+ * Read the entry name of the archive path with password, and check that it
+ * holds the len bytes at data. Return the result of closing it.
+ */
+static int read_entry_in(const char* path, const char* name,
+                         const char* password, const unsigned char* data,
+                         unsigned long len) {
+    unzFile uf;
+    unsigned char* buf;
+    int err, got;
+
+    buf = (unsigned char*)malloc(len + 1);
+    uf = unzOpen64(path);
+    if (buf == NULL || uf == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        exit(1);
+    }
+    err = unzLocateFile(uf, name, 0);
+    CHECK_ERR(err, "unzLocateFile");
+    err = unzOpenCurrentFilePassword(uf, password);
+    if (err != UNZ_OK) {
+        unzClose(uf);
+        free(buf);
+        return err;
+    }
+    got = unzReadCurrentFile(uf, buf, (unsigned)len + 1);
+    err = unzCloseCurrentFile(uf);
+    if (err == UNZ_OK && (got != (int)len || memcmp(buf, data, len))) {
+        fprintf(stderr, "%s: wrong data\n", name);
+        exit(1);
+    }
+    unzClose(uf);
+    free(buf);
+    return err;
+}
+
+/* ===========================================================================
+ * Read the entry name of TESTZIP, as read_entry_in()
+ */
+static int read_entry(const char* name, const char* password,
+                      const unsigned char* data, unsigned long len) {
+    return read_entry_in(TESTZIP, name, password, data, len);
+}
+
+/* ===========================================================================
+ * Write an archive with AES entries of all three strengths and a plain one,
+ * read them back, and check that a wrong password and a changed byte of
+ * encrypted data are caught, the latter in a stored entry where only the
+ * authentication code can catch it
+ */
+static void test_aes_zip(void) {
+    static const char* names[] = {"plain", "aes128", "aes192", "aes256"};
+    unsigned char* data;
+    unsigned long len = 100000;
+    zip_fileinfo zi;
+    zipFile zf;
+    unzFile uf;
+    ZPOS64_T pos;
+    FILE* f;
+    int err, i, c;
+
+    data = (unsigned char*)malloc(len);
+    if (data == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fill_words(data, len, 11);
+    memset(&zi, 0, sizeof(zi));
+    zf = zipOpen64(TESTZIP, APPEND_STATUS_CREATE);
+    if (zf == NULL) {
+        fprintf(stderr, "cannot create %s\n", TESTZIP);
+        exit(1);
+    }
+    for (i = 0; i < 4; i++) {
+        err = zipOpenNewFileInZip5(zf, names[i], &zi, NULL, 0, NULL, 0, NULL,
+                                   i == 2 ? 0 : Z_DEFLATED, 6, 0, -MAX_WBITS,
+                                   8, Z_DEFAULT_STRATEGY,
+                                   i ? "secret" : NULL, 0, 0, 0, 0, i);
+        CHECK_ERR(err, "zipOpenNewFileInZip5");
+        err = zipWriteInFileInZip(zf, data, (unsigned)len);
+        CHECK_ERR(err, "zipWriteInFileInZip");
+        err = zipCloseFileInZip(zf);
+        CHECK_ERR(err, "zipCloseFileInZip");
+    }
+    err = zipClose(zf, NULL);
+    CHECK_ERR(err, "zipClose");
+
+    for (i = 0; i < 4; i++) {
+        err = read_entry(names[i], i ? "secret" : NULL, data, len);
+        CHECK_ERR(err, names[i]);
+    }
+    if (read_entry("aes256", "guess", data, len) != UNZ_BADPASSWORD) {
+        fprintf(stderr, "AES entry opened with a wrong password\n");
+        exit(1);
+    }
+
+    /* change a byte of the encrypted data of aes192, after its salt and
+       password verification value */
+    uf = unzOpen64(TESTZIP);
+    err = uf == NULL ? UNZ_ERRNO : unzLocateFile(uf, "aes192", 0);
+    CHECK_ERR(err, "unzLocateFile");
+    err = unzOpenCurrentFile2(uf, NULL, NULL, 1);
+    CHECK_ERR(err, "unzOpenCurrentFile2");
+    pos = unzGetCurrentFileZStreamPos64(uf);
+    unzCloseCurrentFile(uf);
+    unzClose(uf);
+    f = fopen(TESTZIP, "r+b");
+    if (f == NULL || fseek(f, (long)pos + WZAES_SALT_SIZE(2) +
+                              WZAES_PWV_SIZE + 100, SEEK_SET) ||
+        (c = getc(f)) == EOF ||
+        fseek(f, -1L, SEEK_CUR) || putc(c ^ 1, f) == EOF || fclose(f)) {
+        fprintf(stderr, "cannot change %s\n", TESTZIP);
+        exit(1);
+    }
+    if (read_entry("aes192", "secret", data, len) != UNZ_CRCERROR) {
+        fprintf(stderr, "changed AES entry not caught\n");
+        exit(1);
+    }
+    printf("zipOpenNewFileInZip5(): AES round trip ok\n");
+    remove(TESTZIP);
+    free(data);
+}
+
+/* ===========================================================================
+ * Write TESTGZ as count gzip members of the len bytes at data, the second
+ * and later appended, followed by the string tail, if not NULL
+ */
+static void write_gz(const unsigned char* data, unsigned long len, int count,
+                     const char* tail) {
+    gzFile gz;
+    FILE* f;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        gz = gzopen(TESTGZ, i ? "ab" : "wb");
+        if (gz == NULL || gzwrite(gz, data, (unsigned)len) != (int)len ||
+            gzclose(gz) != Z_OK) {
+            fprintf(stderr, "cannot write %s\n", TESTGZ);
+            exit(1);
+        }
+    }
+    if (tail != NULL) {
+        f = fopen(TESTGZ, "ab");
+        if (f == NULL || fputs(tail, f) == EOF || fclose(f)) {
+            fprintf(stderr, "cannot write %s\n", TESTGZ);
+            exit(1);
+        }
+    }
+}
+
+/* ===========================================================================
+ * Test zipAddGzip() with a gzip file of one member, which goes in as it is,
+ * and with a file of two members and one with data after the trailer, which
+ * must be refused rather than give a bad entry
+ */
+static void test_add_gzip(void) {
+    unsigned char* data;
+    unsigned long len = 100000;
+    zipFile zf;
+    int err;
+
+    data = (unsigned char*)malloc(len);
+    if (data == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fill_words(data, len, 13);
+    zf = zipOpen64(TESTZIP, APPEND_STATUS_CREATE);
+    if (zf == NULL) {
+        fprintf(stderr, "cannot create %s\n", TESTZIP);
+        exit(1);
+    }
+    write_gz(data, len, 1, NULL);
+    err = zipAddGzip(zf, "one", TESTGZ);
+    CHECK_ERR(err, "zipAddGzip");
+    write_gz(data, len, 2, NULL);
+    if (zipAddGzip(zf, "two", TESTGZ) != ZIP_BADZIPFILE) {
+        fprintf(stderr, "zipAddGzip took two gzip members\n");
+        exit(1);
+    }
+    write_gz(data, len, 1, "trailing garbage");
+    if (zipAddGzip(zf, "tail", TESTGZ) != ZIP_BADZIPFILE) {
+        fprintf(stderr, "zipAddGzip took data after the trailer\n");
+        exit(1);
+    }
+    err = zipClose(zf, NULL);
+    CHECK_ERR(err, "zipClose");
+    err = read_entry("one", NULL, data, len);
+    CHECK_ERR(err, "one");
+    printf("zipAddGzip(): one member ok, two members and trailing data "
+           "refused\n");
+    remove(TESTGZ);
+    remove(TESTZIP);
+    free(data);
+}
+
+/* ===========================================================================
+ * Return the compressed data of the entry name of the archive path, as it
+ * is stored, in allocated memory, and its length in *len
+ */
+static unsigned char* read_raw(const char* path, const char* name,
+                               unsigned long* len) {
+    unz_file_info64 info;
+    unsigned char* buf;
+    unzFile uf;
+    int err, got = -1;
+
+    uf = unzOpen64(path);
+    err = uf == NULL ? UNZ_ERRNO : unzLocateFile(uf, name, 0);
+    if (err == UNZ_OK)
+        err = unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0, NULL, 0);
+    if (err == UNZ_OK)
+        err = unzOpenCurrentFile2(uf, NULL, NULL, 1);
+    CHECK_ERR(err, name);
+    *len = (unsigned long)info.compressed_size;
+    buf = (unsigned char*)malloc(*len + 1);
+    if (buf != NULL)
+        got = unzReadCurrentFile(uf, buf, (unsigned)*len + 1);
+    if (got != (int)*len) {
+        fprintf(stderr, "%s: cannot read %s raw\n", path, name);
+        exit(1);
+    }
+    unzCloseCurrentFile(uf);
+    unzClose(uf);
+    return buf;
+}
+
+/* ===========================================================================
+ * Keep all the entries of an archive but the one named by opaque
+ */
+static int keep_entry(void* opaque, const char* name,
+                      const unz_file_info64* info) {
+    (void)info;
+    return strcmp(name, (const char*)opaque) != 0;
+}
+
+/* ===========================================================================
+ * Test zipRewrite(), and so zipCopyFileInZipRaw(), on an archive with stored,
+ * deflated, AES and traditionally encrypted entries, dropping one of them:
+ * the others must be copied byte for byte and unzip to the same data, save
+ * the traditional one, which unzip does not decrypt, with their comments and
+ * that of the archive kept
+ */
+static void test_rewrite(void) {
+    static const char* names[] = {"stored", "deflated", "aes", "pkware",
+                                  "dropped"};
+    unsigned char *data, *was, *now;
+    unsigned long len = 100000, crc, wasLen, nowLen;
+    char comment[32];
+    zip_fileinfo zi;
+    unz_file_info64 info;
+    unz_global_info64 global;
+    zipFile zf;
+    unzFile uf;
+    int err, i, n;
+
+    data = (unsigned char*)malloc(len);
+    if (data == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    fill_words(data, len, 17);
+    crc = crc32(0L, data, (unsigned)len);
+    memset(&zi, 0, sizeof(zi));
+    zf = zipOpen64(TESTZIP, APPEND_STATUS_CREATE);
+    if (zf == NULL) {
+        fprintf(stderr, "cannot create %s\n", TESTZIP);
+        exit(1);
+    }
+    for (i = 0; i < 5; i++) {
+        err = zipOpenNewFileInZip5(zf, names[i], &zi, NULL, 0, NULL, 0,
+                                   names[i], i ? Z_DEFLATED : 0, 6, 0,
+                                   -MAX_WBITS, 8, Z_DEFAULT_STRATEGY,
+                                   i == 2 || i == 3 ? "secret" : NULL,
+                                   i == 3 ? crc : 0, 0, 0, 0, i == 2 ? 3 : 0);
+        CHECK_ERR(err, "zipOpenNewFileInZip5");
+        err = zipWriteInFileInZip(zf, data, (unsigned)len);
+        CHECK_ERR(err, "zipWriteInFileInZip");
+        err = zipCloseFileInZip(zf);
+        CHECK_ERR(err, "zipCloseFileInZip");
+    }
+    err = zipClose(zf, "the archive");
+    CHECK_ERR(err, "zipClose");
+
+    err = zipRewrite(TESTZIP, TESTCOPY, keep_entry, (void*)"dropped");
+    CHECK_ERR(err, "zipRewrite");
+    for (i = 0; i < 4; i++) {
+        was = read_raw(TESTZIP, names[i], &wasLen);
+        now = read_raw(TESTCOPY, names[i], &nowLen);
+        if (nowLen != wasLen || memcmp(now, was, wasLen)) {
+            fprintf(stderr, "%s: %s changed\n", TESTCOPY, names[i]);
+            exit(1);
+        }
+        free(now);
+        free(was);
+        if (i != 3) {
+            err = read_entry_in(TESTCOPY, names[i], i == 2 ? "secret" : NULL,
+                                data, len);
+            CHECK_ERR(err, names[i]);
+        }
+    }
+
+    uf = unzOpen64(TESTCOPY);
+    err = uf == NULL ? UNZ_ERRNO : unzGetGlobalInfo64(uf, &global);
+    CHECK_ERR(err, "unzGetGlobalInfo64");
+    n = unzGetGlobalComment(uf, comment, sizeof(comment));
+    if (global.number_entry != 4 || n < 0 ||
+        strcmp(comment, "the archive") ||
+        unzLocateFile(uf, "dropped", 0) != UNZ_END_OF_LIST_OF_FILE) {
+        fprintf(stderr, "%s: wrong entries\n", TESTCOPY);
+        exit(1);
+    }
+    for (i = 0; i < 4; i++) {
+        err = unzLocateFile(uf, names[i], 0);
+        if (err == UNZ_OK)
+            err = unzGetCurrentFileInfo64(uf, &info, NULL, 0, NULL, 0,
+                                          comment, sizeof(comment));
+        if (err != UNZ_OK || strcmp(comment, names[i]) ||
+            info.compression_method != (uLong)(i == 0 ? 0 : i == 2 ?
+                                                99 : Z_DEFLATED) ||
+            ((info.flag & 1) != 0) != (i == 2 || i == 3)) {
+            fprintf(stderr, "%s: wrong entry %s\n", TESTCOPY, names[i]);
+            exit(1);
+        }
+    }
+    unzClose(uf);
+    printf("zipRewrite(): stored, deflated and encrypted entries ok\n");
+    remove(TESTCOPY);
+    remove(TESTZIP);
+    free(data);
+}
+
+/* ===========================================================================
+ * Usage:  ziptest
+ */
+int main(void) {
+    test_aes();
+    test_hmac_pbkdf2();
+    test_aes_zip();
+    test_add_gzip();
+    test_rewrite();
+    return 0;
+}
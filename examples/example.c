@@ -16,6 +16,24 @@
 #  include <stdlib.h>
 #endif
 
+#if defined(HAVE_PTHREAD) && defined(__STDC_VERSION__) && \
+    __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#  include <pthread.h>
+#  define TEST_SHARED           /* gzopen() has "m" */
+#endif
+
+#if defined(Z_HAVE_UNISTD_H) && !defined(_WIN32)
+#  include <unistd.h>
+#  include <fcntl.h>
+#  define TEST_NONBLOCK         /* pipes can be non-blocking */
+#endif
+
+#if defined(TEST_NONBLOCK) && defined(HAVE_POSIX_FADVISE) && \
+    defined(__linux__)
+#  include <sys/mman.h>
+#  define TEST_DROP             /* 's' drops what was read from the cache */
+#endif
+
 #if defined(VMS) || defined(RISCOS)
 #  define TESTFILE "foo-gz"
 #else
@@ -488,59 +506,2342 @@ static void test_dict_inflate(Byte *compr, uLong comprLen, Byte *uncompr,
 }
 
 /* ===========================================================================
- * Usage:  example [output.gz  [input.gz]]
+ * Test deflate() with the adaptive level controller
  */
+static void test_adapt(void) {
+    z_stream c_stream, d_stream;
+    Byte *data, *compr, *uncompr;
+    uLong len = 1L << 20, bound, bytes[10], switches, total;
+    unsigned long seed = 1;
+    int err, n;
+    uLong i;
+
+    data = (Byte *)malloc(len);
+    uncompr = (Byte *)malloc(len);
+    compr = (Byte *)malloc(2 * len);
+    if (data == Z_NULL || uncompr == Z_NULL || compr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {         /* words from a small alphabet */
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 7 == 0 ? ' ' : 'a' + (seed >> 20) % 8);
+    }
 
-int main(int argc, char *argv[]) {
-    Byte *compr, *uncompr;
-    uLong uncomprLen = 20000;
-    uLong comprLen = 3 * uncomprLen;
-    static const char* myVersion = ZLIB_VERSION;
+    /* a range of one level forces that level, whatever the timing */
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit(&c_stream, Z_DEFAULT_COMPRESSION);
+    CHECK_ERR(err, "deflateInit");
+    err = deflateAdapt(&c_stream, 1000, 0, 3, 3);
+    if (err == Z_STREAM_ERROR) {
+        printf("deflateAdapt(): not compiled in\n");
+        deflateEnd(&c_stream);
+        free(data);
+        free(uncompr);
+        free(compr);
+        return;
+    }
+    CHECK_ERR(err, "deflateAdapt");
+    c_stream.next_in = data;
+    c_stream.avail_in = (uInt)len;
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)(2 * len);
+    err = deflate(&c_stream, Z_FINISH);
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "deflate should report Z_STREAM_END\n");
+        exit(1);
+    }
+    err = deflateAdaptStats(&c_stream, bytes, &switches);
+    CHECK_ERR(err, "deflateAdaptStats");
+    if (bytes[3] != len || switches != 1) {
+        fprintf(stderr, "deflateAdapt did not force level 3\n");
+        exit(1);
+    }
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
 
-    if (zlibVersion()[0] != myVersion[0]) {
-        fprintf(stderr, "incompatible zlib version\n");
+    /* an unreachable rate walks down the ladder, one chunk at a time */
+    err = deflateInit(&c_stream, Z_BEST_COMPRESSION);
+    CHECK_ERR(err, "deflateInit");
+    err = deflateAdapt(&c_stream, 0xffffffffUL, 0, 0, 9);
+    CHECK_ERR(err, "deflateAdapt");
+    bound = 2 * len;
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)bound;
+    for (i = 0; i < len; i += 4096) {
+        c_stream.next_in = data + i;
+        c_stream.avail_in = 4096;
+        err = deflate(&c_stream, i + 4096 < len ? Z_NO_FLUSH : Z_FINISH);
+        if (err != Z_OK && err != Z_STREAM_END) {
+            fprintf(stderr, "adaptive deflate error: %d\n", err);
+            exit(1);
+        }
+    }
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "deflate should report Z_STREAM_END\n");
         exit(1);
+    }
+    err = deflateAdaptStats(&c_stream, bytes, &switches);
+    CHECK_ERR(err, "deflateAdaptStats");
+    for (total = 0, n = 0; n < 10; n++)
+        total += bytes[n];
+    if (total != len) {
+        fprintf(stderr, "deflateAdaptStats counted %lu bytes\n", total);
+        exit(1);
+    }
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
 
-    } else if (strcmp(zlibVersion(), ZLIB_VERSION) != 0) {
-        fprintf(stderr, "warning: different zlib version linked: %s\n",
-                zlibVersion());
+    d_stream.zalloc = zalloc;
+    d_stream.zfree = zfree;
+    d_stream.opaque = (voidpf)0;
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uInt)c_stream.total_out;
+    err = inflateInit(&d_stream);
+    CHECK_ERR(err, "inflateInit");
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = (uInt)len;
+    err = inflate(&d_stream, Z_FINISH);
+    if (err != Z_STREAM_END || d_stream.total_out != len ||
+        memcmp(data, uncompr, len)) {
+        fprintf(stderr, "bad inflate of adaptive deflate\n");
+        exit(1);
     }
+    err = inflateEnd(&d_stream);
+    CHECK_ERR(err, "inflateEnd");
+    printf("deflateAdapt(): %lu level changes, %lu bytes at the last level\n",
+           switches, bytes[0]);
 
-    printf("zlib version %s = 0x%04x, compile flags = 0x%lx\n",
-            ZLIB_VERSION, ZLIB_VERNUM, zlibCompileFlags());
+    /* the move into the range 7..9 that deflateAdapt() asks for is not made
+       once deflateParams() sets level 0, and the stream stays valid when
+       going back to a compressing level after storing */
+    err = deflateInit(&c_stream, Z_DEFAULT_COMPRESSION);
+    CHECK_ERR(err, "deflateInit");
+    err = deflateAdapt(&c_stream, 1, 0, 7, 9);
+    CHECK_ERR(err, "deflateAdapt");
+    err = deflateParams(&c_stream, 0, Z_DEFAULT_STRATEGY);
+    CHECK_ERR(err, "deflateParams");
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)bound;
+    for (i = 0; i < len; i += 4096) {
+        if (i == len / 2) {
+            err = deflateAdaptStats(&c_stream, Z_NULL, &switches);
+            CHECK_ERR(err, "deflateAdaptStats");
+            if (switches != 0) {
+                fprintf(stderr, "deflateAdapt changed level 0\n");
+                exit(1);
+            }
+            err = deflateParams(&c_stream, 6, Z_DEFAULT_STRATEGY);
+            CHECK_ERR(err, "deflateParams");
+        }
+        c_stream.next_in = data + i;
+        c_stream.avail_in = 4096;
+        err = deflate(&c_stream, i + 4096 < len ? Z_NO_FLUSH : Z_FINISH);
+        if (err != Z_OK && err != Z_STREAM_END) {
+            fprintf(stderr, "adaptive deflate error: %d\n", err);
+            exit(1);
+        }
+    }
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
 
-    compr    = (Byte*)calloc((uInt)comprLen, 1);
-    uncompr  = (Byte*)calloc((uInt)uncomprLen, 1);
-    /* compr and uncompr are cleared to avoid reading uninitialized
-     * data and to ensure that uncompr compresses well.
-     */
-    if (compr == Z_NULL || uncompr == Z_NULL) {
-        printf("out of memory\n");
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uInt)c_stream.total_out;
+    err = inflateInit(&d_stream);
+    CHECK_ERR(err, "inflateInit");
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = (uInt)len;
+    err = inflate(&d_stream, Z_FINISH);
+    if (err != Z_STREAM_END || d_stream.total_out != len ||
+        memcmp(data, uncompr, len)) {
+        fprintf(stderr, "bad inflate of adaptive deflate after level 0\n");
         exit(1);
     }
+    err = inflateEnd(&d_stream);
+    CHECK_ERR(err, "inflateEnd");
 
-#ifdef Z_SOLO
-    (void)argc;
-    (void)argv;
+    free(data);
+    free(uncompr);
+    free(compr);
+}
+
+#ifndef Z_SOLO
+/* ===========================================================================
+ * Test deflateEstimate() against the actual compressed sizes
+ */
+static void test_estimate(void) {
+    z_stream c_stream;
+    Byte *data, *compr;
+    uLong len = 1L << 18, sizes[10], errors[10], clen, i;
+    unsigned long seed = 7;
+    int err, level;
+
+    data = (Byte *)malloc(len);
+    compr = (Byte *)malloc(compressBound(len));
+    if (data == Z_NULL || compr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {         /* words from a small alphabet */
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 7 == 0 ? ' ' : 'a' + (seed >> 20) % 8);
+    }
+
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit(&c_stream, Z_DEFAULT_COMPRESSION);
+    CHECK_ERR(err, "deflateInit");
+    err = deflateEstimate(&c_stream, data, len, sizes, errors);
+    CHECK_ERR(err, "deflateEstimate");
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+
+    for (level = 0; level <= 9; level += 3) {
+        clen = compressBound(len);
+        err = compress2(compr, &clen, data, len, level);
+        CHECK_ERR(err, "compress2");
+        if (clen + errors[level] < sizes[level] ||
+            clen > sizes[level] + errors[level]) {
+            fprintf(stderr, "deflateEstimate level %d: %lu +/- %lu, not %lu\n",
+                    level, sizes[level], errors[level], clen);
+            exit(1);
+        }
+    }
+    printf("deflateEstimate(): %lu +/- %lu bytes at level 6\n",
+           sizes[6], errors[6]);
+
+    free(data);
+    free(compr);
+}
+
+/* ===========================================================================
+ * Test compressFiltered() and uncompressFiltered() on a series of doubles,
+ * also with the filter subfield after 100 bytes of another, zfilter() and
+ * zunfilter() in place on a series of 32-bit counters, and zfilter() of
+ * elements of 2, 4 and 8 bytes against a byte at a time difference
+ */
+static void test_filter(void) {
+    double *series;
+    Byte *compr, *uncompr, *counters, extra[110];
+    uLong n = 32768, len = n * sizeof(double), plain, filtered, outLen, i;
+    unsigned long seed = 3, count = 1000000;
+    unsigned size, k, d, borrow;
+    double x = 100.0;
+    z_stream c_stream;
+    gz_header head;
+    int err;
+
+    series = (double *)malloc(len);
+    compr = (Byte *)malloc(compressBound(len) + 24);
+    uncompr = (Byte *)malloc(len);
+    counters = (Byte *)malloc(4 * n + 3);
+    if (series == NULL || compr == Z_NULL || uncompr == Z_NULL ||
+        counters == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++) {           /* random walk */
+        seed = seed * 1103515245UL + 12345UL;
+        x += ((long)((seed >> 16) & 0x3ff) - 512) / 4096.0;
+        series[i] = x;
+    }
+
+    plain = compressBound(len);
+    err = compress2(compr, &plain, (const Bytef *)series, len, 6);
+    CHECK_ERR(err, "compress2");
+    filtered = compressBound(len) + 24;
+    err = compressFiltered(compr, &filtered, (const Bytef *)series, len, 6,
+                           Z_FILTER_XOR | Z_FILTER_SHUFFLE, sizeof(double));
+    CHECK_ERR(err, "compressFiltered");
+    outLen = len;
+    err = uncompressFiltered(uncompr, &outLen, compr, filtered);
+    CHECK_ERR(err, "uncompressFiltered");
+    if (outLen != len || memcmp(uncompr, series, len)) {
+        fprintf(stderr, "bad uncompressFiltered\n");
+        exit(1);
+    }
+    if (filtered >= plain) {
+        fprintf(stderr, "compressFiltered: %lu bytes, not better than %lu\n",
+                filtered, plain);
+        exit(1);
+    }
+
+    /* a "ZF" subfield beyond the first 64 bytes of the extra field */
+    memset(extra, 'x', sizeof(extra));
+    extra[0] = 'X';
+    extra[1] = 'Y';
+    extra[2] = 100 - 4;
+    extra[3] = 0;
+    extra[100] = 'Z';
+    extra[101] = 'F';
+    extra[102] = 2;
+    extra[103] = 0;
+    extra[104] = Z_FILTER_XOR | Z_FILTER_SHUFFLE;
+    extra[105] = sizeof(double);
+    memset(&head, 0, sizeof(head));
+    head.extra = extra;
+    head.extra_len = 106;
+    err = zfilter(counters, (const Bytef *)series, 4 * n,
+                  Z_FILTER_XOR | Z_FILTER_SHUFFLE, sizeof(double));
+    CHECK_ERR(err, "zfilter");
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit2(&c_stream, 6, Z_DEFLATED, 31, 8, Z_DEFAULT_STRATEGY);
+    CHECK_ERR(err, "deflateInit2");
+    err = deflateSetHeader(&c_stream, &head);
+    CHECK_ERR(err, "deflateSetHeader");
+    c_stream.next_in = counters;
+    c_stream.avail_in = (uInt)(4 * n);
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)(compressBound(len) + 24);
+    err = deflate(&c_stream, Z_FINISH);
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "deflate should report Z_STREAM_END\n");
+        exit(1);
+    }
+    filtered = c_stream.total_out;
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+    outLen = len;
+    err = uncompressFiltered(uncompr, &outLen, compr, filtered);
+    CHECK_ERR(err, "uncompressFiltered");
+    if (outLen != 4 * n || memcmp(uncompr, series, 4 * n)) {
+        fprintf(stderr, "bad uncompressFiltered of a long extra field\n");
+        exit(1);
+    }
+
+    for (i = 0; i < n; i++) {           /* little-endian counters, odd tail */
+        seed = seed * 1103515245UL + 12345UL;
+        count += (seed >> 16) & 15;
+        counters[4 * i] = (Byte)count;
+        counters[4 * i + 1] = (Byte)(count >> 8);
+        counters[4 * i + 2] = (Byte)(count >> 16);
+        counters[4 * i + 3] = (Byte)(count >> 24);
+    }
+    counters[4 * n] = 1;
+    counters[4 * n + 1] = 2;
+    counters[4 * n + 2] = 3;
+    memcpy(uncompr, counters, 4 * n + 3);
+    err = zfilter(counters, counters, 4 * n + 3, Z_FILTER_DELTA, 4);
+    CHECK_ERR(err, "zfilter");
+    for (i = 4; i < 4 * n; i++)
+        if (i % 4 && counters[i]) {
+            fprintf(stderr, "bad zfilter\n");
+            exit(1);
+        }
+    err = zunfilter(counters, counters, 4 * n + 3, Z_FILTER_DELTA, 4);
+    CHECK_ERR(err, "zunfilter");
+    if (memcmp(uncompr, counters, 4 * n + 3)) {
+        fprintf(stderr, "bad zunfilter\n");
+        exit(1);
+    }
+
+    for (size = 2; size <= 8; size <<= 1) {
+        for (i = 0; i < 4 * n; i++) {
+            seed = seed * 1103515245UL + 12345UL;
+            uncompr[i] = (Byte)(seed >> 16);
+        }
+        err = zfilter(counters, uncompr, 4 * n, Z_FILTER_DELTA, size);
+        CHECK_ERR(err, "zfilter");
+        for (i = 0; i < 4 * n; i += size)
+            for (k = 0, borrow = 0; k < size; k++) {
+                d = uncompr[i + k] - (i ? uncompr[i - size + k] : 0) - borrow;
+                borrow = (d >> 8) & 1;
+                if (counters[i + k] != (Byte)d) {
+                    fprintf(stderr, "bad zfilter of size %u\n", size);
+                    exit(1);
+                }
+            }
+        err = zunfilter(counters, counters, 4 * n, Z_FILTER_DELTA, size);
+        CHECK_ERR(err, "zunfilter");
+        if (memcmp(uncompr, counters, 4 * n)) {
+            fprintf(stderr, "bad zunfilter of size %u\n", size);
+            exit(1);
+        }
+    }
+    printf("compressFiltered(): %lu bytes instead of %lu\n", filtered, plain);
+
+    free(series);
+    free(compr);
+    free(uncompr);
+    free(counters);
+}
+
+/* ===========================================================================
+ * Test compressImage() and uncompressImage() on a smooth RGB image, and each
+ * scanline filter type on its own
+ */
+static void test_image(void) {
+    Byte *image, *compr, *uncompr;
+    uLong w = 256, h = 192, len = w * h * 3, bound, none, adaptive, x, y;
+    unsigned long seed = 7;
+    int err, type;
+
+    bound = compressBound(len + h);
+    image = (Byte *)malloc(len);
+    compr = (Byte *)malloc(bound);
+    uncompr = (Byte *)malloc(len);
+    if (image == Z_NULL || compr == Z_NULL || uncompr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (y = 0; y < h; y++)             /* gradients with a little noise */
+        for (x = 0; x < w; x++) {
+            seed = seed * 1103515245UL + 12345UL;
+            image[3 * (y * w + x)] = (Byte)(x + ((seed >> 16) & 3));
+            image[3 * (y * w + x) + 1] = (Byte)(y + x / 2);
+            image[3 * (y * w + x) + 2] = (Byte)((x * y) >> 6);
+        }
+
+    for (type = Z_ROW_NONE; type <= Z_ROW_PAETH; type++) {
+        compr[0] = 0;
+        for (y = 0; y < h; y++) {
+            err = zfilterRow(compr, image + y * w * 3,
+                             y ? image + (y - 1) * w * 3 : Z_NULL, w * 3, 3,
+                             type);
+            CHECK_ERR(err, "zfilterRow");
+            err = zunfilterRow(uncompr + y * w * 3, compr,
+                               y ? uncompr + (y - 1) * w * 3 : Z_NULL,
+                               w * 3, 3);
+            CHECK_ERR(err, "zunfilterRow");
+        }
+        if (compr[0] != type || memcmp(image, uncompr, len)) {
+            fprintf(stderr, "bad zunfilterRow, type %d\n", type);
+            exit(1);
+        }
+    }
+
+    none = bound;
+    err = compressImage(compr, &none, image, h, w * 3, 3, 6, Z_ROW_NONE);
+    CHECK_ERR(err, "compressImage");
+    adaptive = bound;
+    err = compressImage(compr, &adaptive, image, h, w * 3, 3, 6,
+                        Z_ROW_ADAPTIVE);
+    CHECK_ERR(err, "compressImage");
+    memset(uncompr, 0, len);
+    err = uncompressImage(uncompr, h, w * 3, 3, compr, adaptive);
+    CHECK_ERR(err, "uncompressImage");
+    if (memcmp(image, uncompr, len)) {
+        fprintf(stderr, "bad uncompressImage\n");
+        exit(1);
+    }
+    if (adaptive >= none) {
+        fprintf(stderr, "compressImage: %lu bytes, not better than %lu\n",
+                adaptive, none);
+        exit(1);
+    }
+    if (uncompressImage(uncompr, h, w * 3, 3, compr, adaptive - 1) !=
+            Z_DATA_ERROR ||
+        uncompressImage(uncompr, h - 1, w * 3, 3, compr, adaptive) !=
+            Z_DATA_ERROR) {
+        fprintf(stderr, "uncompressImage accepted a bad stream\n");
+        exit(1);
+    }
+    printf("compressImage(): %lu bytes instead of %lu\n", adaptive, none);
+
+    free(image);
+    free(compr);
+    free(uncompr);
+}
+
+/* ===========================================================================
+ * Test read/write of .gz files large enough for the io_uring backend, when
+ * built, to take over: seek back and forth, both in gzip and transparent
+ * files, with a flush and an offset check while writing
+ */
+static void test_gzio_large(const char *fname) {
+#ifdef NO_GZCOMPRESS
+    fprintf(stderr, "NO_GZCOMPRESS -- gz* functions cannot compress\n");
 #else
-    test_compress(compr, comprLen, uncompr, uncomprLen);
+    Byte *data, *back;
+    uLong len = 4000000L, i, got;
+    unsigned long seed = 5;
+    z_off_t flushed;
+    gzFile file;
+    int err, raw;
 
-    test_gzio((argc > 1 ? argv[1] : TESTFILE),
-              uncompr, uncomprLen);
+    data = (Byte *)malloc(len);
+    back = (Byte *)malloc(len);
+    if (data == Z_NULL || back == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 23 + 'a');
+    }
+
+    for (raw = 0; raw < 2; raw++) {
+        file = gzopen(fname, raw ? "wbT" : "wb1");
+        if (file == NULL) {
+            fprintf(stderr, "gzopen error\n");
+            exit(1);
+        }
+        flushed = 0;
+        for (i = 0; i < len; i += got) {
+            got = len - i < 100000L ? len - i : 100000L;
+            if (gzwrite(file, data + i, (unsigned)got) != (int)got) {
+                fprintf(stderr, "gzwrite err: %s\n", gzerror(file, &err));
+                exit(1);
+            }
+            if (i == len / 2) {
+                gzflush(file, Z_SYNC_FLUSH);
+                flushed = gzoffset(file);
+            }
+        }
+        if (flushed <= 0 || (raw && flushed != (z_off_t)(len / 2 + got))) {
+            fprintf(stderr, "gzoffset error after gzflush: %ld\n",
+                    (long)flushed);
+            exit(1);
+        }
+        gzclose(file);
+
+        file = gzopen(fname, raw ? "rbs" : "rb");
+        if (file == NULL) {
+            fprintf(stderr, "gzopen error\n");
+            exit(1);
+        }
+        for (i = 0; i < len; i += got) {
+            got = len - i < 65536L ? len - i : 65536L;
+            if (gzread(file, back + i, (unsigned)got) != (int)got) {
+                fprintf(stderr, "gzread err: %s\n", gzerror(file, &err));
+                exit(1);
+            }
+        }
+        if (memcmp(data, back, len) || gzread(file, back, 1) != 0 ||
+            !gzeof(file)) {
+            fprintf(stderr, "bad gzread of large file\n");
+            exit(1);
+        }
+        if (gzseek(file, 1000000L, SEEK_SET) != 1000000L ||
+            gzread(file, back, 1000) != 1000 ||
+            memcmp(data + 1000000L, back, 1000) ||
+            gzseek(file, 2000000L, SEEK_CUR) != 3001000L ||
+            gzread(file, back, 1000) != 1000 ||
+            memcmp(data + 3001000L, back, 1000) ||
+            (raw && gzoffset(file) < 3002000L)) {
+            fprintf(stderr, "bad gzseek in large file\n");
+            exit(1);
+        }
+        gzclose(file);
+    }
+    printf("gzread() of large files after gzseek\n");
+
+    free(data);
+    free(back);
 #endif
+}
 
-    test_deflate(compr, comprLen);
-    test_inflate(compr, comprLen, uncompr, uncomprLen);
+/* in-memory file for test_gzio_funcs() */
+typedef struct {
+    Byte *buf;
+    uLong len, pos, max;
+    unsigned chunk;         /* length returned by mem_fetch() */
+    int closed;
+} memfile;
+
+static int mem_read(voidp opaque, voidp buf, unsigned len) {
+    memfile *mem = (memfile *)opaque;
+
+    if (len > mem->len - mem->pos)
+        len = (unsigned)(mem->len - mem->pos);
+    memcpy(buf, mem->buf + mem->pos, len);
+    mem->pos += len;
+    return (int)len;
+}
 
-    test_large_deflate(compr, comprLen, uncompr, uncomprLen);
-    test_large_inflate(compr, comprLen, uncompr, uncomprLen);
+static int mem_write(voidp opaque, voidpc buf, unsigned len) {
+    memfile *mem = (memfile *)opaque;
 
-    test_flush(compr, &comprLen);
-    test_sync(compr, comprLen, uncompr, uncomprLen);
-    comprLen = 3 * uncomprLen;
+    if (len > mem->max - mem->pos)
+        return -1;
+    memcpy(mem->buf + mem->pos, buf, len);
+    mem->pos += len;
+    if (mem->len < mem->pos)
+        mem->len = mem->pos;
+    return (int)len;
+}
 
-    test_dict_deflate(compr, comprLen);
-    test_dict_inflate(compr, comprLen, uncompr, uncomprLen);
+static z_off64_t mem_seek(voidp opaque, z_off64_t offset, int whence) {
+    memfile *mem = (memfile *)opaque;
+
+    offset += whence == SEEK_CUR ? (z_off64_t)mem->pos :
+              whence == SEEK_END ? (z_off64_t)mem->len : 0;
+    if (offset < 0 || offset > (z_off64_t)mem->len)
+        return -1;
+    mem->pos = (uLong)offset;
+    return offset;
+}
+
+static const unsigned char *mem_fetch(voidp opaque, unsigned *len) {
+    memfile *mem = (memfile *)opaque;
+
+    *len = mem->len - mem->pos < mem->chunk ?
+           (unsigned)(mem->len - mem->pos) : mem->chunk;
+    mem->pos += *len;
+    return mem->buf + mem->pos - *len;
+}
+
+static int mem_close(voidp opaque) {
+    ((memfile *)opaque)->closed++;
+    return 0;
+}
+
+/* ===========================================================================
+ * Test gzopen_funcs() on a memory buffer: write lines, read them back with
+ * fetch() in small pieces, then with read() and seek()
+ */
+static void test_gzio_funcs(void) {
+#ifdef NO_GZCOMPRESS
+    fprintf(stderr, "NO_GZCOMPRESS -- gz* functions cannot compress\n");
+#else
+    gz_funcs funcs;
+    memfile mem;
+    gzFile file;
+    char line[40], want[40];
+    z_off_t pos = 0;
+    int i, err;
+
+    mem.max = 100000L;
+    mem.buf = (Byte *)malloc(mem.max);
+    if (mem.buf == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    mem.len = mem.pos = 0;
+    mem.closed = 0;
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.write = mem_write;
+    funcs.close = mem_close;
+    file = gzopen_funcs(&funcs, &mem, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "gzopen_funcs error\n");
+        exit(1);
+    }
+    for (i = 0; i < 2000; i++)
+        if (gzprintf(file, "line %d of 2000\n", i) <= 0) {
+            fprintf(stderr, "gzprintf err: %s\n", gzerror(file, &err));
+            exit(1);
+        }
+    if (gzclose(file) != Z_OK || mem.closed != 1) {
+        fprintf(stderr, "gzclose error with gzopen_funcs\n");
+        exit(1);
+    }
+
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.fetch = mem_fetch;
+    for (mem.chunk = 100; mem.chunk; mem.chunk /= 100) {
+        mem.pos = 0;
+        file = gzopen_funcs(&funcs, &mem, "rb");
+        for (i = 0; i < 2000; i++) {
+            sprintf(want, "line %d of 2000\n", i);
+            if (gzgets(file, line, sizeof(line)) == NULL ||
+                strcmp(line, want)) {
+                fprintf(stderr, "bad gzgets with fetch of %u: %s\n",
+                        mem.chunk, gzerror(file, &err));
+                exit(1);
+            }
+        }
+        if (gzread(file, line, 1) != 0 || !gzeof(file) ||
+            gzseek(file, 0, SEEK_SET) != -1) {
+            fprintf(stderr, "gzopen_funcs error at end of fetch\n");
+            exit(1);
+        }
+        gzclose(file);
+    }
+
+    funcs.fetch = Z_NULL;
+    funcs.read = mem_read;
+    funcs.seek = mem_seek;
+    mem.pos = 0;
+    file = gzopen_funcs(&funcs, &mem, "rb");
+    for (i = 0; i < 1000; i++)
+        pos += (z_off_t)strlen(gzgets(file, line, sizeof(line)));
+    if (gzseek(file, pos, SEEK_SET) != pos || gzoffset(file) <= 0 ||
+        gzgets(file, line, sizeof(line)) == NULL ||
+        strcmp(line, "line 1000 of 2000\n") || gzrewind(file) ||
+        gzgets(file, line, sizeof(line)) == NULL ||
+        strcmp(line, "line 0 of 2000\n")) {
+        fprintf(stderr, "bad gzseek with gzopen_funcs\n");
+        exit(1);
+    }
+    gzclose(file);
+    printf("gzopen_funcs(): %lu bytes in memory\n", mem.len);
+
+    /* data that is not gzip, in one chunk much larger than the buffers */
+    free(mem.buf);
+    mem.len = mem.max = 200000L;
+    mem.buf = (Byte *)malloc(mem.max);
+    if (mem.buf == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < (int)mem.len; i++)
+        mem.buf[i] = (Byte)('a' + i % 26);
+    memset(&funcs, 0, sizeof(funcs));
+    funcs.fetch = mem_fetch;
+    mem.pos = 0;
+    mem.chunk = (unsigned)mem.len;
+    file = gzopen_funcs(&funcs, &mem, "rb");
+    for (pos = 0; pos < (z_off_t)mem.len; pos += i) {
+        i = gzread(file, line, sizeof(line));
+        if (i <= 0 || memcmp(line, mem.buf + pos, (size_t)i)) {
+            fprintf(stderr, "bad gzread of a large fetch: %s\n",
+                    gzerror(file, &err));
+            exit(1);
+        }
+    }
+    if (pos != (z_off_t)mem.len || gzread(file, line, 1) != 0 ||
+        !gzdirect(file) || !gzeof(file)) {
+        fprintf(stderr, "gzopen_funcs error at end of a large fetch\n");
+        exit(1);
+    }
+    gzclose(file);
+
+    free(mem.buf);
+#endif
+}
+
+/* ===========================================================================
+ * Test gzgetline() and gzgetlines() on lines of all lengths, one of them
+ * longer than the buffers, and a last line with no newline
+ */
+static void test_gzio_lines(const char *fname) {
+#ifdef NO_GZCOMPRESS
+    fprintf(stderr, "NO_GZCOMPRESS -- gz* functions cannot compress\n");
+#else
+    char *text, *back;
+    const char *str;
+    gz_line lines[64];
+    uLong len = 0, got, count, i;
+    z_size_t n;
+    unsigned k, batch;
+    gzFile file;
+    int err;
+
+    text = (char *)malloc(600000L);
+    back = (char *)malloc(600000L);
+    if (text == Z_NULL || back == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < 3000; i++) {
+        n = i == 1500 ? 100000L : i % 97;
+        memset(text + len, 'a' + (int)(i % 26), n);
+        len += n;
+        text[len++] = '\n';
+    }
+    memcpy(text + len, "tail", 4);
+    len += 4;
+
+    file = gzopen(fname, "wb");
+    if (file == NULL || gzwrite(file, text, (unsigned)len) != (int)len) {
+        fprintf(stderr, "gzwrite error\n");
+        exit(1);
+    }
+    gzclose(file);
+
+    /* one line at a time, then in batches through a small buffer */
+    for (batch = 1; batch <= 64; batch += 63) {
+        file = gzopen(fname, "rb");
+        if (file == NULL) {
+            fprintf(stderr, "gzopen error\n");
+            exit(1);
+        }
+        if (batch > 1)
+            gzbuffer(file, 1024);
+        got = count = 0;
+        for (;;) {
+            if (batch == 1) {
+                str = gzgetline(file, &n);
+                if (str == NULL)
+                    break;
+                lines[0].str = str;
+                lines[0].len = n;
+                k = 1;
+            }
+            else if ((k = gzgetlines(file, lines, batch)) == 0)
+                break;
+            for (i = 0; i < k; i++) {
+                n = lines[i].len;
+                if (n == 0 || got + n > len ||
+                    memchr(lines[i].str, '\n', n - 1) != NULL ||
+                    (lines[i].str[n - 1] != '\n' && got + n != len)) {
+                    fprintf(stderr, "bad line %lu from gzgetlines\n", count);
+                    exit(1);
+                }
+                memcpy(back + got, lines[i].str, n);
+                got += n;
+                count++;
+            }
+        }
+        if (gzerror(file, &err), err != Z_OK || !gzeof(file) ||
+            got != len || count != 3001 || memcmp(text, back, len)) {
+            fprintf(stderr, "bad gzgetlines of %u\n", batch);
+            exit(1);
+        }
+        gzclose(file);
+    }
+    printf("gzgetline(): %lu lines\n", count);
+
+    free(text);
+    free(back);
+#endif
+}
+
+/* ===========================================================================
+ * Test gzcopyfd() to a temporary file, from part way through a gzip file and
+ * a file that is not gzip
+ */
+static void test_gzcopyfd(const char *fname) {
+#ifdef NO_GZCOMPRESS
+    fprintf(stderr, "NO_GZCOMPRESS -- gz* functions cannot compress\n");
+#else
+    Byte *data, *back;
+    uLong len = 1000000L, i;
+    unsigned long seed = 7;
+    z_off64_t got;
+    gzFile file;
+    FILE *out;
+    int raw, err;
+
+    data = (Byte *)malloc(len);
+    back = (Byte *)malloc(len);
+    if (data == Z_NULL || back == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 11 + 'a');
+    }
+
+    for (raw = 0; raw < 2; raw++) {
+        file = gzopen(fname, raw ? "wbT" : "wb");
+        if (file == NULL || gzwrite(file, data, (unsigned)len) != (int)len) {
+            fprintf(stderr, "gzwrite error\n");
+            exit(1);
+        }
+        gzclose(file);
+
+        out = tmpfile();
+        file = gzopen(fname, "rb");
+        if (out == NULL || file == NULL) {
+            fprintf(stderr, "gzopen error\n");
+            exit(1);
+        }
+        if (gzread(file, back, 1000) != 1000) {
+            fprintf(stderr, "gzread err: %s\n", gzerror(file, &err));
+            exit(1);
+        }
+        got = gzcopyfd(file, fileno(out));
+        if (got != (z_off64_t)(len - 1000) || !gzeof(file) ||
+            gztell(file) != (z_off_t)len || gzread(file, back, 1) != 0) {
+            fprintf(stderr, "gzcopyfd err: %s\n", gzerror(file, &err));
+            exit(1);
+        }
+        gzclose(file);
+        rewind(out);
+        if (fread(back + 1000, 1, len, out) != len - 1000 ||
+            memcmp(data, back, len)) {
+            fprintf(stderr, "bad gzcopyfd\n");
+            exit(1);
+        }
+        fclose(out);
+    }
+    printf("gzcopyfd(): %lu bytes\n", len - 1000);
+
+    free(data);
+    free(back);
+#endif
+}
+
+#ifdef TEST_SHARED
+#define SHARED_THREADS 4
+#define SHARED_RECORDS 20000
+#define SHARED_BIG 300000L
+
+static gzFile shared_file;
+static char *shared_big;
+
+/* writer thread for test_gzio_shared(): numbered lines written every way,
+   one line too big to be copied, and a few flushes, level changes and looks
+   at the error */
+static void *shared_writer(void *arg) {
+    int id = (int)(size_t)arg, i, n, ok = 1;
+    char rec[40];
+
+    for (i = 0; i < SHARED_RECORDS; i++) {
+        switch (i % 3) {
+        case 0:
+            ok &= gzprintf(shared_file, "thread %d record %d\n", id, i) > 0;
+            break;
+        case 1:
+            n = sprintf(rec, "thread %d record %d\n", id, i);
+            ok &= gzwrite(shared_file, rec, (unsigned)n) == n;
+            break;
+        default:
+            sprintf(rec, "thread %d record %d\n", id, i);
+            ok &= gzputs(shared_file, rec) > 0;
+        }
+        if (i == SHARED_RECORDS / 2)
+            ok &= gzwrite(shared_file, shared_big, SHARED_BIG) == SHARED_BIG;
+        if (i % 5000 == 4999)
+            ok &= gzflush(shared_file, Z_SYNC_FLUSH) == Z_OK;
+        if (i % 5000 == 2499) {
+            ok &= gzsetparams(shared_file, id & 1 ? 1 : 6,
+                              Z_DEFAULT_STRATEGY) == Z_OK;
+            gzerror(shared_file, &n);
+            ok &= n == Z_OK;
+        }
+    }
+    return ok ? arg : NULL;
+}
+
+/* ===========================================================================
+ * Test "m" in the gzopen() mode: several threads write to the same file, and
+ * each line must come back whole, with the lines of each thread in order
+ */
+static void test_gzio_shared(const char *fname) {
+    pthread_t threads[SHARED_THREADS];
+    int next[SHARED_THREADS], i, id, rec, bigs = 0;
+    void *ret;
+    char line[40];
+    const char *str;
+    z_size_t len;
+    gzFile file;
+
+    shared_big = (char *)malloc(SHARED_BIG);
+    if (shared_big == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(shared_big, 'x', SHARED_BIG - 1);
+    shared_big[SHARED_BIG - 1] = '\n';
+
+    shared_file = gzopen(fname, "wbm");
+    if (shared_file == NULL) {
+        fprintf(stderr, "gzopen error\n");
+        exit(1);
+    }
+    for (i = 0; i < SHARED_THREADS; i++)
+        if (pthread_create(threads + i, NULL, shared_writer,
+                           (void *)(size_t)(i + 1))) {
+            fprintf(stderr, "pthread_create error\n");
+            exit(1);
+        }
+    for (i = 0; i < SHARED_THREADS; i++)
+        if (pthread_join(threads[i], &ret) || ret == NULL) {
+            fprintf(stderr, "shared gzwrite error\n");
+            exit(1);
+        }
+    if (gzclose(shared_file) != Z_OK) {
+        fprintf(stderr, "gzclose error\n");
+        exit(1);
+    }
+
+    file = gzopen(fname, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "gzopen error\n");
+        exit(1);
+    }
+    memset(next, 0, sizeof(next));
+    while ((str = gzgetline(file, &len)) != NULL) {
+        if (len == SHARED_BIG && memcmp(str, shared_big, len) == 0) {
+            bigs++;
+            continue;
+        }
+        if (len < sizeof(line)) {
+            memcpy(line, str, len);
+            line[len] = 0;
+        }
+        if (len >= sizeof(line) || line[len - 1] != '\n' ||
+            sscanf(line, "thread %d record %d", &id, &rec) != 2 ||
+            id < 1 || id > SHARED_THREADS || rec != next[id - 1]++) {
+            fprintf(stderr, "bad shared line: %.*s\n", (int)len, str);
+            exit(1);
+        }
+    }
+    gzclose(file);
+    for (i = 0; i < SHARED_THREADS; i++)
+        if (next[i] != SHARED_RECORDS)
+            bigs = -1;
+    if (bigs != SHARED_THREADS) {
+        fprintf(stderr, "missing shared lines\n");
+        exit(1);
+    }
+    printf("gzopen(\"wbm\"): %d threads\n", SHARED_THREADS);
+    free(shared_big);
+}
+#endif
+
+#ifdef TEST_NONBLOCK
+/* ===========================================================================
+ * Test "n" in the gzopen() mode: both ends of a non-blocking pipe are driven
+ * from one loop, writing until the pipe is full, then reading until it is
+ * empty, as an event loop would
+ */
+static void test_gzio_nonblock(void) {
+    Byte *data, *back;
+    uLong len = 1000000L, put = 0, got = 0, i;
+    unsigned long seed = 11;
+    int fds[2], n, err, flushed = 0, blocks = 0;
+    gzFile out, in;
+
+    data = (Byte *)malloc(len);
+    back = (Byte *)malloc(len + 1);
+    if (data == Z_NULL || back == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 11 + 'a');
+    }
+    if (pipe(fds) || fcntl(fds[0], F_SETFL, O_NONBLOCK) ||
+        fcntl(fds[1], F_SETFL, O_NONBLOCK)) {
+        fprintf(stderr, "pipe error\n");
+        exit(1);
+    }
+    out = gzdopen(fds[1], "wbn");
+    in = gzdopen(fds[0], "rbn");
+    if (out == NULL || in == NULL) {
+        fprintf(stderr, "gzdopen error\n");
+        exit(1);
+    }
+
+    for (;;) {
+        /* write until the pipe is full, finishing the stream at the end */
+        while (put < len) {
+            n = gzwrite(out, data + put, (unsigned)(len - put < 100000L ?
+                                                    len - put : 100000L));
+            put += (uLong)n;
+            if (n == 0 || gzblocked(out))
+                break;
+        }
+        if (put < len && !gzblocked(out)) {
+            fprintf(stderr, "gzwrite err: %s\n", gzerror(out, &err));
+            exit(1);
+        }
+        if (put == len && !flushed) {
+            err = gzflush(out, Z_FINISH);
+            if (err == Z_OK) {
+                gzclose(out);
+                flushed = 1;
+            }
+            else if (err != Z_BUF_ERROR || !gzblocked(out)) {
+                fprintf(stderr, "gzflush err: %d\n", err);
+                exit(1);
+            }
+        }
+
+        /* read until the pipe is empty, or to the end once it is closed */
+        do {
+            n = gzread(in, back + got, (unsigned)(len + 1 - got));
+            if (n < 0) {
+                fprintf(stderr, "gzread err: %s\n", gzerror(in, &err));
+                exit(1);
+            }
+            got += (uLong)n;
+        } while (n > 0);
+        if (!gzblocked(in))
+            break;
+        blocks++;
+    }
+    if (!flushed || got != len || !gzeof(in) || memcmp(data, back, len)) {
+        fprintf(stderr, "bad non-blocking gzread\n");
+        exit(1);
+    }
+    gzclose(in);
+    printf("gzopen(\"n\"): %lu bytes through a pipe, %d blocks\n", len,
+           blocks);
+
+    free(data);
+    free(back);
+}
+#endif
+
+#ifdef TEST_DROP
+#define DROP_MB 40              /* megabytes in the file */
+#define DROP_GONE 8             /* leading ones that must leave the cache */
+
+/* ===========================================================================
+ * Return the number of pages of the first len bytes of the file fname that
+ * are in the page cache, or -1 if that cannot be told
+ */
+static long cached_pages(const char *fname, size_t len) {
+    unsigned char *vec;
+    void *map;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE), n, i;
+    long count = -1;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    n = (len + page - 1) / page;
+    vec = (unsigned char *)malloc(n);
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (vec != NULL && map != MAP_FAILED && mincore(map, len, vec) == 0)
+        for (count = 0, i = 0; i < n; i++)
+            count += vec[i] & 1;
+    if (map != MAP_FAILED)
+        munmap(map, len);
+    free(vec);
+    close(fd);
+    return count;
+}
+
+/* ===========================================================================
+ * Test "s" in the gzopen() mode: reading a file that is in the page cache,
+ * asking for the offset after every read, must drop what is well behind from
+ * the cache -- when the file system drops pages at all
+ */
+static void test_gzio_drop(const char *fname) {
+    Byte *data;
+    uLong len = 1048576L, crc, back, i;
+    size_t gone = (size_t)DROP_GONE << 20;
+    unsigned long seed = 13;
+    long cached;
+    int n, fd, drops;
+    gzFile file;
+
+    data = (Byte *)malloc(len);
+    if (data == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(seed >> 16);
+    }
+    crc = crc32(0L, Z_NULL, 0);
+    file = gzopen(fname, "wb0s");
+    if (file == NULL) {
+        fprintf(stderr, "gzopen error\n");
+        exit(1);
+    }
+    for (n = 0; n < DROP_MB; n++) {
+        data[0] = (Byte)n;
+        crc = crc32(crc, data, (uInt)len);
+        if (gzwrite(file, data, (unsigned)len) != (int)len ||
+            gzoffset(file) <= 0) {
+            fprintf(stderr, "gzwrite error\n");
+            exit(1);
+        }
+    }
+    if (gzclose(file) != Z_OK) {
+        fprintf(stderr, "gzclose error\n");
+        exit(1);
+    }
+
+    /* drop the file from the cache to see that this file system can, then
+       read it all back in */
+    fd = open(fname, O_RDONLY);
+    if (fd == -1 || fsync(fd) ||
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED)) {
+        fprintf(stderr, "cannot sync %s\n", fname);
+        exit(1);
+    }
+    drops = cached_pages(fname, gone) == 0;
+    while (read(fd, data, (size_t)len) > 0)
+        ;
+    close(fd);
+    drops = drops && cached_pages(fname, gone) > 0;
+
+    file = gzopen(fname, "rbs");
+    if (file == NULL) {
+        fprintf(stderr, "gzopen error\n");
+        exit(1);
+    }
+    back = crc32(0L, Z_NULL, 0);
+    for (n = 0; n < DROP_MB; n++) {
+        if (gzread(file, data, (unsigned)len) != (int)len ||
+            gzoffset(file) <= 0 || gztell(file) != (z_off_t)(len * (n + 1))) {
+            fprintf(stderr, "gzread error\n");
+            exit(1);
+        }
+        back = crc32(back, data, (uInt)len);
+    }
+    cached = cached_pages(fname, gone);
+    gzclose(file);
+    if (back != crc || (drops && cached != 0)) {
+        fprintf(stderr, "bad gzopen(\"rbs\"): %ld pages left\n", cached);
+        exit(1);
+    }
+    printf("gzopen(\"s\"): %s\n", drops ? "read pages dropped" :
+           "file system keeps its pages");
+    free(data);
+}
+#endif
+
+/* a range of words to sum for test_zpool(), split in halves run as tasks */
+typedef struct {
+    z_executor *pool;
+    const uLong *words;
+    uLong n, sum;
+} sum_job;
+
+static void sum_task(voidp arg) {
+    sum_job *job = (sum_job *)arg, half[2];
+    voidp group;
+    int k;
+
+    if (job->n <= 1000) {
+        for (job->sum = 0; job->n; job->n--)
+            job->sum += job->words[job->n - 1];
+        return;
+    }
+    group = job->pool->group(job->pool->opaque);
+    for (k = 0; k < 2; k++) {
+        half[k].pool = job->pool;
+        half[k].words = job->words + (k ? job->n >> 1 : 0);
+        half[k].n = k ? job->n - (job->n >> 1) : job->n >> 1;
+        if (group == Z_NULL || job->pool->submit(job->pool->opaque, group,
+                                                  sum_task, half + k))
+            sum_task(half + k);
+    }
+    if (group != Z_NULL)
+        job->pool->wait(job->pool->opaque, group);
+    job->sum = half[0].sum + half[1].sum;
+}
+
+/* ===========================================================================
+ * Test the default executor from zpoolCreate() with tasks that submit tasks
+ * and wait for them
+ */
+static void test_zpool(void) {
+    static const unsigned threads[2] = {0, 3};
+    uLong *words, n = 1000000L, i, want = 0;
+    z_executor *pool;
+    sum_job job;
+    int t;
+
+    words = (uLong *)malloc(n * sizeof(uLong));
+    if (words == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < n; i++)
+        want += words[i] = i * 7 % 1009;
+    for (t = 0; t < 2; t++) {
+        pool = zpoolCreate(threads[t]);
+        if (pool == Z_NULL || pool->threads == 0) {
+            fprintf(stderr, "zpoolCreate error\n");
+            exit(1);
+        }
+        job.pool = pool;
+        job.words = words;
+        job.n = n;
+        sum_task(&job);
+        if (job.sum != want) {
+            fprintf(stderr, "bad zpool sum\n");
+            exit(1);
+        }
+        if (t == 0)
+            printf("zpoolCreate(): %u threads\n", pool->threads);
+        zpoolFree(pool);
+    }
+    free(words);
+}
+
+/* largest allocation and number of allocations for test_uncompress_alloc() */
+static uLong alloc_max, alloc_count;
+
+static void *count_alloc(void *q, unsigned n, unsigned m) {
+    (void)q;
+    if ((uLong)n * m > alloc_max)
+        alloc_max = (uLong)n * m;
+    alloc_count++;
+    return calloc(n, m);
+}
+
+static void count_free(void *q, void *p) {
+    (void)q;
+    free(p);
+}
+
+/* ===========================================================================
+ * Test uncompressAlloc() with and without a size hint, and gunzipAlloc(),
+ * which should allocate the output once, at its exact size
+ */
+static void test_uncompress_alloc(void) {
+    Byte *data, *compr, *out;
+    uLong len = 300000, bound, comprLen, used, i, hint;
+    uLongf outLen;
+    unsigned long seed = 5;
+    z_stream c_stream;
+    int err, gz;
+
+    bound = compressBound(len) + 18;
+    data = (Byte *)malloc(len);
+    compr = (Byte *)malloc(bound);
+    if (data == Z_NULL || compr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 5 + 'a');
+    }
+
+    for (gz = 0; gz < 2; gz++) {
+        c_stream.zalloc = zalloc;
+        c_stream.zfree = zfree;
+        c_stream.opaque = (voidpf)0;
+        err = deflateInit2(&c_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                           gz ? 31 : 15, 8, Z_DEFAULT_STRATEGY);
+        CHECK_ERR(err, "deflateInit2");
+        c_stream.next_in = data;
+        c_stream.avail_in = (uInt)len;
+        c_stream.next_out = compr;
+        c_stream.avail_out = (uInt)bound;
+        err = deflate(&c_stream, Z_FINISH);
+        if (err != Z_STREAM_END) {
+            fprintf(stderr, "deflate should report Z_STREAM_END\n");
+            exit(1);
+        }
+        used = c_stream.total_out;
+        err = deflateEnd(&c_stream);
+        CHECK_ERR(err, "deflateEnd");
+
+        /* no hint, the right hint, and a hint too small */
+        for (hint = 0; hint < (gz ? 1UL : 3UL); hint++) {
+            alloc_max = alloc_count = 0;
+            comprLen = gz ? used : used + 10;   /* trailing bytes left */
+            if (gz)
+                err = gunzipAlloc(&out, &outLen, compr, &comprLen,
+                                  count_alloc, count_free, Z_NULL);
+            else
+                err = uncompressAlloc(&out, &outLen, compr, &comprLen,
+                                      hint == 0 ? 0 : hint == 1 ? len :
+                                      len / 3, count_alloc, count_free,
+                                      Z_NULL);
+            CHECK_ERR(err, gz ? "gunzipAlloc" : "uncompressAlloc");
+            if (outLen != len || comprLen != used ||
+                memcmp(out, data, len) ||
+                ((gz || hint == 1) && alloc_max != len)) {
+                fprintf(stderr, "bad %s\n",
+                        gz ? "gunzipAlloc" : "uncompressAlloc");
+                exit(1);
+            }
+            count_free(Z_NULL, out);
+        }
+    }
+
+    /* truncated input */
+    comprLen = used / 2;
+    err = gunzipAlloc(&out, &outLen, compr, &comprLen, Z_NULL, Z_NULL,
+                      Z_NULL);
+    if (err != Z_DATA_ERROR || out != Z_NULL || outLen != 0) {
+        fprintf(stderr, "gunzipAlloc should report Z_DATA_ERROR\n");
+        exit(1);
+    }
+    printf("uncompressAlloc(), gunzipAlloc(): %lu bytes\n", len);
+
+    free(data);
+    free(compr);
+}
+
+/* ===========================================================================
+ * Test rewrap() between each pair of formats, which should give the same
+ * bytes as compressing in the new format, and in place
+ */
+static void test_rewrap(void) {
+    static const int bits[3] = {-15, 15, 31};
+    Byte *data, *wrap[3], *out;
+    uLong len = 100000, bound, used[3], i, srcLen;
+    uLongf outLen;
+    unsigned long seed = 7;
+    z_stream c_stream;
+    int err, from, to, k;
+
+    bound = compressBound(len) + 18;
+    data = (Byte *)malloc(len);
+    out = (Byte *)malloc(bound);
+    if (data == Z_NULL || out == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % 7 + 'a');
+    }
+
+    for (from = 0; from < 3; from++) {
+        wrap[from] = (Byte *)malloc(bound);
+        if (wrap[from] == Z_NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        c_stream.zalloc = zalloc;
+        c_stream.zfree = zfree;
+        c_stream.opaque = (voidpf)0;
+        err = deflateInit2(&c_stream, 9, Z_DEFLATED, bits[from], 8,
+                           Z_DEFAULT_STRATEGY);
+        CHECK_ERR(err, "deflateInit2");
+        c_stream.next_in = data;
+        c_stream.avail_in = (uInt)len;
+        c_stream.next_out = wrap[from];
+        c_stream.avail_out = (uInt)bound;
+        err = deflate(&c_stream, Z_FINISH);
+        if (err != Z_STREAM_END) {
+            fprintf(stderr, "deflate should report Z_STREAM_END\n");
+            exit(1);
+        }
+        used[from] = c_stream.total_out;
+        err = deflateEnd(&c_stream);
+        CHECK_ERR(err, "deflateEnd");
+    }
+
+    /* the source has trailing bytes, and zlib or gzip is detected -- a
+       header made from raw deflate has the default level */
+    for (from = 0; from < 3; from++)
+        for (to = 0; to < 3; to++) {
+            srcLen = used[from] + 5;
+            outLen = bound;
+            err = rewrap(out, &outLen, bits[to], wrap[from], &srcLen,
+                         from ? 47 : -15);
+            CHECK_ERR(err, "rewrap");
+            if (from == 0 && to) {
+                k = to == 1 ? 1 : 8;
+                if (out[k] == (to == 1 ? 0x9c : 0))
+                    out[k] = wrap[to][k];
+            }
+            if (srcLen != used[from] || outLen != used[to] ||
+                memcmp(out, wrap[to], outLen)) {
+                fprintf(stderr, "bad rewrap from %d to %d\n", from, to);
+                exit(1);
+            }
+        }
+
+    /* gzip to zlib in place, and back */
+    srcLen = outLen = used[2];
+    err = rewrap(wrap[2], &outLen, 15, wrap[2], &srcLen, 31);
+    CHECK_ERR(err, "rewrap");
+    srcLen = outLen;
+    outLen = bound;
+    err = rewrap(wrap[2], &outLen, 31, wrap[2], &srcLen, 15);
+    CHECK_ERR(err, "rewrap");
+    if (outLen != used[2] || memcmp(wrap[2], out, outLen)) {
+        fprintf(stderr, "bad rewrap in place\n");
+        exit(1);
+    }
+
+    /* too little room, and truncated or corrupted input */
+    srcLen = used[1];
+    outLen = used[2] - 1;
+    err = rewrap(out, &outLen, 31, wrap[1], &srcLen, 15);
+    if (err != Z_BUF_ERROR) {
+        fprintf(stderr, "rewrap should report Z_BUF_ERROR\n");
+        exit(1);
+    }
+    srcLen = used[1] - 1;
+    outLen = bound;
+    err = rewrap(out, &outLen, 31, wrap[1], &srcLen, 15);
+    if (err != Z_DATA_ERROR) {
+        fprintf(stderr, "rewrap should report Z_DATA_ERROR\n");
+        exit(1);
+    }
+    srcLen = used[1];
+    wrap[1][used[1] - 1] ^= 1;
+    err = rewrap(out, &outLen, -15, wrap[1], &srcLen, 15);
+    if (err != Z_DATA_ERROR) {
+        fprintf(stderr, "rewrap should report a bad check value\n");
+        exit(1);
+    }
+    printf("rewrap(): %lu bytes\n", used[0]);
+
+    for (from = 0; from < 3; from++)
+        free(wrap[from]);
+    free(out);
+    free(data);
+}
+
+/* ===========================================================================
+ * Fill len bytes at data with runs of zeros or of a byte up to 64 long, and
+ * some random bytes, as in images or tables
+ */
+static void fill_runs(Byte *data, uLong len, unsigned long seed) {
+    uLong i = 0;
+    unsigned n, k;
+    int run;
+    Byte b;
+
+    while (i < len) {
+        seed = seed * 1103515245UL + 12345UL;
+        n = 1 + (unsigned)(seed >> 16) % 64;
+        b = (Byte)((seed >> 8) & 3 ? 0 : seed >> 24);
+        run = ((seed >> 20) & 7) != 0;
+        for (k = 0; k < n && i < len; k++) {
+            if (!run) {
+                seed = seed * 1103515245UL + 12345UL;
+                b = (Byte)(seed >> 16);
+            }
+            data[i++] = b;
+        }
+    }
+}
+
+/* ===========================================================================
+ * Test recompress() on a gzip stream with fixed codes, which should come out
+ * smaller as zlib, and decompress to the same data, and on the output of
+ * deflate() for runs, which should not come out larger
+ */
+static void test_recompress(void) {
+    Byte *data, *fixed, *out, *back;
+    uLong len = 300000, bound, used, made, i, srcLen;
+    uLongf outLen, backLen;
+    unsigned long seed = 9;
+    z_stream c_stream;
+    int err, level;
+
+    bound = compressBound(len) + 18;
+    data = (Byte *)malloc(len);
+    fixed = (Byte *)malloc(bound);
+    out = (Byte *)malloc(bound);
+    back = (Byte *)malloc(len);
+    if (data == Z_NULL || fixed == Z_NULL || out == Z_NULL || back == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)((seed >> 16) % (i < len / 2 ? 4 : 40) + 'a');
+    }
+
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit2(&c_stream, 1, Z_DEFLATED, 31, 8, Z_FIXED);
+    CHECK_ERR(err, "deflateInit2");
+    c_stream.next_in = data;
+    c_stream.avail_in = (uInt)len;
+    c_stream.next_out = fixed;
+    c_stream.avail_out = (uInt)bound;
+    err = deflate(&c_stream, Z_FINISH);
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "deflate should report Z_STREAM_END\n");
+        exit(1);
+    }
+    used = c_stream.total_out;
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+
+    srcLen = used + 3;
+    outLen = bound;
+    err = recompress(out, &outLen, 15, fixed, &srcLen, 47);
+    CHECK_ERR(err, "recompress");
+    made = outLen;
+    backLen = len;
+    err = uncompress(back, &backLen, out, outLen);
+    CHECK_ERR(err, "uncompress");
+    if (srcLen != used || outLen >= used - used / 10 || backLen != len ||
+        memcmp(back, data, len)) {
+        fprintf(stderr, "bad recompress\n");
+        exit(1);
+    }
+
+    /* truncated input, and too little room */
+    srcLen = used - 1;
+    outLen = bound;
+    err = recompress(out, &outLen, 15, fixed, &srcLen, 31);
+    if (err != Z_DATA_ERROR) {
+        fprintf(stderr, "recompress should report Z_DATA_ERROR\n");
+        exit(1);
+    }
+    srcLen = used;
+    outLen = 100;
+    err = recompress(out, &outLen, 15, fixed, &srcLen, 31);
+    if (err != Z_BUF_ERROR) {
+        fprintf(stderr, "recompress should report Z_BUF_ERROR\n");
+        exit(1);
+    }
+    printf("recompress(): %lu fixed to %lu dynamic\n", used, made);
+
+    /* the blocks of deflate() for runs are hard to beat, but never lost */
+    fill_runs(data, len, 3);
+    for (level = 1; level <= 9; level += level == 1 ? 5 : 3) {
+        used = bound;
+        err = compress2(fixed, &used, data, len, level);
+        CHECK_ERR(err, "compress2");
+        srcLen = used;
+        outLen = bound;
+        err = recompress(out, &outLen, 15, fixed, &srcLen, 15);
+        CHECK_ERR(err, "recompress");
+        backLen = len;
+        err = uncompress(back, &backLen, out, outLen);
+        CHECK_ERR(err, "uncompress");
+        if (srcLen != used || outLen > used || backLen != len ||
+            memcmp(back, data, len)) {
+            fprintf(stderr, "bad recompress of level %d runs\n", level);
+            exit(1);
+        }
+    }
+    printf("recompress(): runs not enlarged\n");
+
+    free(back);
+    free(out);
+    free(fixed);
+    free(data);
+}
+
+/* ===========================================================================
+ * Test inflateTokens(): rebuild the data from the tokens alone
+ */
+static void test_inflate_tokens(Byte *compr, uLong comprLen,
+                                Byte *uncompr, uLong uncomprLen) {
+    Byte tokens[1024], *t;
+    z_stream d_stream;
+    z_tokens tok;
+    uLong len = (uLong)strlen(hello) + 1, i, n, dist, matches = 0;
+    int err;
+
+    err = compress(compr, &comprLen, (const Bytef *)hello, len);
+    CHECK_ERR(err, "compress");
+
+    d_stream.zalloc = zalloc;
+    d_stream.zfree = zfree;
+    d_stream.opaque = (voidpf)0;
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uInt)comprLen;
+    err = inflateInit(&d_stream);
+    CHECK_ERR(err, "inflateInit");
+    tok.next = tokens;
+    tok.avail = sizeof(tokens);
+    err = inflateTokens(&d_stream, &tok);
+    CHECK_ERR(err, "inflateTokens");
+    d_stream.next_out = uncompr;
+    d_stream.avail_out = (uInt)uncomprLen;
+    err = inflate(&d_stream, Z_FINISH);
+    if (err != Z_STREAM_END || tok.total != (uLong)(tok.next - tokens)) {
+        fprintf(stderr, "inflate with tokens should report Z_STREAM_END\n");
+        exit(1);
+    }
+    err = inflateEnd(&d_stream);
+    CHECK_ERR(err, "inflateEnd");
+
+    /* literal runs and matches, after one block header */
+    memset(uncompr, 0, uncomprLen);
+    n = 0;
+    for (t = tokens; t < tok.next; ) {
+        if (*t < 0x7f) {
+            for (i = 0; i <= *t; i++)
+                uncompr[n++] = t[i + 1];
+            t += *t + 2;
+        }
+        else if (*t == 0x7f) {
+            if (t != tokens || t[1] != 3) {
+                fprintf(stderr, "bad block token\n");
+                exit(1);
+            }
+            t += 2;
+        }
+        else {
+            dist = ((t[0] & 0x7f) << 8 | t[1]) + 1;
+            for (i = 0; i < t[2] + 3U; i++, n++)
+                uncompr[n] = uncompr[n - dist];
+            matches++;
+            t += 3;
+        }
+    }
+    if (n != len || strcmp((char*)uncompr, hello) || matches == 0) {
+        fprintf(stderr, "bad tokens\n");
+        exit(1);
+    }
+    printf("inflateTokens(): %lu token bytes, %lu matches\n", tok.total,
+           matches);
+}
+
+/* ===========================================================================
+ * Test inflateTokens() on a stream of dynamic and stored blocks, taking the
+ * tokens through a buffer just large enough for the largest block header,
+ * and rebuild the data from them
+ */
+static void test_inflate_tokens_blocks(void) {
+    Byte tokens[170], *data, *compr, *back, *out, *t;
+    uLong len = 120000, bound, n = 0, i, dist, calls = 0;
+    unsigned long seed = 21;
+    unsigned blocks[3] = {0, 0, 0}, size;
+    z_stream c_stream, d_stream;
+    z_tokens tok;
+    int err;
+
+    bound = compressBound(len);
+    data = (Byte *)malloc(len);
+    compr = (Byte *)malloc(bound);
+    back = (Byte *)malloc(len);
+    out = (Byte *)malloc(len);
+    if (data == Z_NULL || compr == Z_NULL || back == Z_NULL || out == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {     /* words, some of them repeated */
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(i > 1000 && (seed >> 16) % 3 == 0 ?
+                         data[i - 1000 + (seed >> 20) % 8] :
+                         (seed >> 18) % 6 == 0 ? ' ' : 'a' + (seed >> 22) % 8);
+    }
+
+    /* a third at level 6, a third stored, and a third at level 6 again */
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit(&c_stream, 6);
+    CHECK_ERR(err, "deflateInit");
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)bound;
+    for (i = 0; i < 3; i++) {
+        if (i) {
+            err = deflateParams(&c_stream, i == 1 ? 0 : 6,
+                                Z_DEFAULT_STRATEGY);
+            CHECK_ERR(err, "deflateParams");
+        }
+        c_stream.next_in = data + i * (len / 3);
+        c_stream.avail_in = (uInt)(len / 3);
+        err = deflate(&c_stream, i == 2 ? Z_FINISH : Z_NO_FLUSH);
+        if (err != (i == 2 ? Z_STREAM_END : Z_OK)) {
+            fprintf(stderr, "deflate error: %d\n", err);
+            exit(1);
+        }
+    }
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+
+    d_stream.zalloc = zalloc;
+    d_stream.zfree = zfree;
+    d_stream.opaque = (voidpf)0;
+    d_stream.next_in = compr;
+    d_stream.avail_in = (uInt)c_stream.total_out;
+    err = inflateInit(&d_stream);
+    CHECK_ERR(err, "inflateInit");
+    err = inflateTokens(&d_stream, &tok);
+    CHECK_ERR(err, "inflateTokens");
+    d_stream.next_out = out;
+    d_stream.avail_out = (uInt)len;
+    do {
+        tok.next = tokens;
+        tok.avail = sizeof(tokens);
+        err = inflate(&d_stream, Z_NO_FLUSH);
+        if ((err != Z_OK && err != Z_STREAM_END) || ++calls > len) {
+            fprintf(stderr, "inflate with tokens error: %d\n", err);
+            exit(1);
+        }
+        for (t = tokens; t < tok.next; ) {
+            if (*t < 0x7f) {
+                for (i = 0; i <= *t; i++)
+                    back[n++] = t[i + 1];
+                t += *t + 2;
+            }
+            else if (*t == 0x7f) {      /* dynamic: two code lengths a byte */
+                size = (t[1] >> 1) & 3;
+                blocks[size]++;
+                t += size == 0 ? 4 : size == 1 ? 2 :
+                     4 + (t[2] + 257 + t[3] + 1 + 1) / 2;
+            }
+            else {
+                dist = ((t[0] & 0x7f) << 8 | t[1]) + 1;
+                for (i = 0; i < t[2] + 3U; i++, n++)
+                    back[n] = back[n - dist];
+                t += 3;
+            }
+        }
+    } while (err != Z_STREAM_END);
+    err = inflateEnd(&d_stream);
+    CHECK_ERR(err, "inflateEnd");
+    if (n != len || memcmp(back, data, len) || memcmp(out, data, len) ||
+        blocks[0] == 0 || blocks[2] < 2) {
+        fprintf(stderr, "bad tokens of blocks\n");
+        exit(1);
+    }
+    printf("inflateTokens(): %u stored and %u dynamic blocks through %u "
+           "bytes\n", blocks[0], blocks[2], (unsigned)sizeof(tokens));
+    free(out);
+    free(back);
+    free(compr);
+    free(data);
+}
+
+/* ===========================================================================
+ * Test that compressParallel() makes the same bytes with no executor and with
+ * pools of 1, 4 and 64 threads, in the zlib and gzip formats
+ */
+static void test_compress_parallel(void) {
+    static const unsigned threads[4] = {0, 1, 4, 64};
+    static const int wbits[2] = {15, 31};
+    Byte *data, *first, *compr, *out;
+    uLong len = 1500000L, bound, firstLen, i;
+    uLongf comprLen, outLen;
+    unsigned long seed = 17;
+    z_executor *pool;
+    int err, w, t;
+
+    bound = compressParallelBound(len);
+    data = (Byte *)malloc(len);
+    first = (Byte *)malloc(bound);
+    compr = (Byte *)malloc(bound);
+    if (data == Z_NULL || first == Z_NULL || compr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(i % 3000 < 1000 ? seed >> 16 :
+                                           (seed >> 16) % 7 + 'a');
+    }
+
+    for (w = 0; w < 2; w++) {
+        firstLen = 0;
+        for (t = 0; t < 4; t++) {
+            pool = Z_NULL;
+            if (threads[t]) {
+                pool = zpoolCreate(threads[t]);
+                if (pool == Z_NULL) {
+                    fprintf(stderr, "zpoolCreate error\n");
+                    exit(1);
+                }
+            }
+            comprLen = bound;
+            err = compressParallel(t ? compr : first, &comprLen, data, len,
+                                   Z_DEFAULT_COMPRESSION, wbits[w], pool);
+            CHECK_ERR(err, "compressParallel");
+            zpoolFree(pool);
+            if (t == 0)
+                firstLen = comprLen;
+            else if (comprLen != firstLen || memcmp(compr, first, comprLen)) {
+                fprintf(stderr, "compressParallel differs with %u threads\n",
+                        threads[t]);
+                exit(1);
+            }
+        }
+
+        /* it decompresses as a single stream */
+        comprLen = firstLen;
+        err = w ? gunzipAlloc(&out, &outLen, first, &comprLen, Z_NULL, Z_NULL,
+                              Z_NULL) :
+                  uncompressAlloc(&out, &outLen, first, &comprLen, len, Z_NULL,
+                                  Z_NULL, Z_NULL);
+        CHECK_ERR(err, "compressParallel decompress");
+        if (outLen != len || comprLen != firstLen || memcmp(out, data, len)) {
+            fprintf(stderr, "bad compressParallel data\n");
+            exit(1);
+        }
+        free(out);
+    }
+
+    comprLen = firstLen / 2;
+    if (compressParallel(compr, &comprLen, data, len, 6, 15, Z_NULL) !=
+        Z_BUF_ERROR) {
+        fprintf(stderr, "compressParallel overflowed\n");
+        exit(1);
+    }
+    printf("compressParallel(): %lu bytes to %lu\n", len, firstLen);
+
+    free(data);
+    free(first);
+    free(compr);
+}
+
+/* ===========================================================================
+ * Test deflateBoundRemaining() part way through streams of half random, half
+ * repetitive data, and compressFit() on data that does not compress
+ */
+static void test_bound(void) {
+    Byte *data, *compr, *uncompr;
+    uLong len = 200000, bound = compressBound(200000), stored, outLen;
+    uLong owed[8], done[8], total, i;
+    static const int levels[3] = {0, 1, 6}, wbits[2] = {15, 31};
+    unsigned long seed = 11;
+    z_stream c_stream;
+    int err, l, w, step;
+
+    data = (Byte *)malloc(len);
+    compr = (Byte *)malloc(bound);
+    uncompr = (Byte *)malloc(len);
+    if (data == Z_NULL || compr == Z_NULL || uncompr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(i < len / 2 ? seed >> 16 : i % 251 % 17);
+    }
+
+    for (l = 0; l < 3; l++)
+        for (w = 0; w < 2; w++) {
+            c_stream.zalloc = zalloc;
+            c_stream.zfree = zfree;
+            c_stream.opaque = (voidpf)0;
+            err = deflateInit2(&c_stream, levels[l], Z_DEFLATED, wbits[w], 8,
+                               Z_DEFAULT_STRATEGY);
+            CHECK_ERR(err, "deflateInit2");
+            c_stream.next_in = data;
+            c_stream.next_out = compr;
+            c_stream.avail_out = (uInt)bound;
+            for (step = 0; step < 8; step++) {
+                c_stream.avail_in = (uInt)(len / 8);
+                owed[step] = deflateBoundRemaining(&c_stream,
+                                                   len - (step + 1) * (len / 8));
+                done[step] = c_stream.total_out;
+                err = deflate(&c_stream, step < 7 ? Z_NO_FLUSH : Z_FINISH);
+            }
+            CHECK_ERR(err == Z_STREAM_END ? Z_OK : err, "deflate");
+            total = c_stream.total_out;
+            err = deflateEnd(&c_stream);
+            CHECK_ERR(err, "deflateEnd");
+            for (step = 0; step < 8; step++)
+                if (done[step] + owed[step] < total) {
+                    fprintf(stderr, "deflateBoundRemaining: %lu + %lu < %lu\n",
+                            done[step], owed[step], total);
+                    exit(1);
+                }
+        }
+
+    stored = len / 2 + 5 * (len / 2 / 65535 + 1) + 6;
+    outLen = stored;
+    err = compressFit(compr, &outLen, data, len / 2, 9);
+    CHECK_ERR(err, "compressFit");
+    if (stored >= compressBound(len / 2) || outLen > stored) {
+        fprintf(stderr, "bad compressFit size %lu\n", outLen);
+        exit(1);
+    }
+    i = len;
+    err = uncompress(uncompr, &i, compr, outLen);
+    CHECK_ERR(err, "uncompress");
+    if (i != len / 2 || memcmp(data, uncompr, i)) {
+        fprintf(stderr, "bad compressFit data\n");
+        exit(1);
+    }
+    outLen = stored;
+    err = compressFit(compr, &outLen, data + len / 2, len / 2, 9);
+    CHECK_ERR(err, "compressFit");
+    if (outLen >= len / 20) {
+        fprintf(stderr, "compressFit stored compressible data\n");
+        exit(1);
+    }
+    outLen = len / 2;
+    if (compressFit(compr, &outLen, data, len / 2, 9) != Z_BUF_ERROR) {
+        fprintf(stderr, "compressFit overflowed\n");
+        exit(1);
+    }
+    printf("deflateBoundRemaining(): %lu bytes owed at the start, %lu used\n",
+           owed[0], total);
+
+    free(data);
+    free(compr);
+    free(uncompr);
+}
+
+/* ===========================================================================
+ * A change made by test_matcher() before a step of a stream compressed in
+ * pieces: select matcher if level is -1, else set level. The list ends with
+ * a step of -1.
+ */
+typedef struct {
+    int step, matcher, level;
+} match_step;
+
+/* ===========================================================================
+ * Compress len bytes at data with matcher at level, all at once if steps is
+ * NULL, or else in 40 pieces with sync flushes, making the changes of steps
+ * on the way and copying the stream before the end. Check the data, and
+ * return the compressed length.
+ */
+static uLong test_matcher(Byte *data, uLong len, int matcher, int level,
+                          const match_step *steps) {
+    Byte *compr, *copy, *uncompr;
+    uLong bound, outLen, total;
+    z_stream c_stream, c_copy;
+    int err, step;
+
+    bound = compressBound(len) + 1024;
+    compr = (Byte *)malloc(bound);
+    copy = (Byte *)malloc(bound);
+    uncompr = (Byte *)malloc(len);
+    if (compr == Z_NULL || copy == Z_NULL || uncompr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit(&c_stream, level);
+    CHECK_ERR(err, "deflateInit");
+    if (deflateMatcher(&c_stream, 3) != Z_STREAM_ERROR) {
+        fprintf(stderr, "deflateMatcher accepted a bad finder\n");
+        exit(1);
+    }
+    err = deflateMatcher(&c_stream, matcher);
+    CHECK_ERR(err, "deflateMatcher");
+    c_stream.next_in = data;
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)bound;
+    if (steps == NULL) {
+        c_stream.avail_in = (uInt)len;
+        err = deflate(&c_stream, Z_FINISH);
+    }
+    else {
+        for (step = 0; step < 40; step++) {
+            for (; steps->step == step; steps++) {
+                if (steps->level == -1) {
+                    err = deflateMatcher(&c_stream, steps->matcher);
+                    CHECK_ERR(err, "deflateMatcher");
+                }
+                else {
+                    err = deflateParams(&c_stream, steps->level,
+                                        Z_DEFAULT_STRATEGY);
+                    CHECK_ERR(err, "deflateParams");
+                }
+            }
+            c_stream.avail_in = (uInt)(step < 39 ? len / 40 :
+                                       len - 39 * (len / 40));
+            err = deflate(&c_stream, step % 3 ? Z_NO_FLUSH : Z_SYNC_FLUSH);
+            CHECK_ERR(err, "deflate");
+        }
+        err = deflateCopy(&c_copy, &c_stream);
+        CHECK_ERR(err, "deflateCopy");
+        c_copy.next_out = copy + (c_stream.next_out - compr);
+        memcpy(copy, compr, (size_t)(c_stream.next_out - compr));
+        err = deflate(&c_copy, Z_FINISH);
+        if (err != Z_STREAM_END) {
+            fprintf(stderr, "deflate should report Z_STREAM_END\n");
+            exit(1);
+        }
+        err = deflateEnd(&c_copy);
+        CHECK_ERR(err, "deflateEnd");
+        err = deflate(&c_stream, Z_FINISH);
+    }
+    if (err != Z_STREAM_END) {
+        fprintf(stderr, "deflate should report Z_STREAM_END\n");
+        exit(1);
+    }
+    total = c_stream.total_out;
+    if (steps != NULL && memcmp(compr, copy, total)) {
+        fprintf(stderr, "bad deflateCopy with matcher %d\n", matcher);
+        exit(1);
+    }
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+
+    outLen = len;
+    err = uncompress(uncompr, &outLen, compr, total);
+    CHECK_ERR(err, "uncompress");
+    if (outLen != len || memcmp(data, uncompr, len)) {
+        fprintf(stderr, "bad data with matcher %d\n", matcher);
+        exit(1);
+    }
+
+    free(compr);
+    free(copy);
+    free(uncompr);
+    return total;
+}
+
+/* ===========================================================================
+ * Compress the data named what with matcher and with the hash chains at
+ * level, and check that matcher does not make more than percent % more.
+ */
+static void compare_matcher(const char *what, Byte *data, uLong len,
+                            int matcher, int level, uLong percent) {
+    uLong chain, other;
+
+    chain = test_matcher(data, len, Z_MATCH_CHAIN, level, NULL);
+    other = test_matcher(data, len, matcher, level, NULL);
+    if (other > chain + chain * percent / 100) {
+        fprintf(stderr, "matcher %d compressed %s to %lu at level %d, "
+                "chains to %lu\n", matcher, what, other, level, chain);
+        exit(1);
+    }
+    printf("deflateMatcher(): %s at level %d, chains %lu, %s %lu\n", what,
+           level, chain, matcher == Z_MATCH_TREE ? "trees" : "buckets", other);
+}
+
+/* ===========================================================================
+ * Test deflateMatcher() with Z_MATCH_TREE against the hash chains at levels
+ * 8 and 9 on words, on periodic data, and on runs, where it only skips the
+ * strings inside of the runs, and switched with the other finders and levels
+ * in the middle of a stream
+ */
+static void test_match_tree(void) {
+    static const match_step steps[] = {
+        {10, Z_MATCH_CHAIN, -1}, {15, Z_MATCH_TREE, -1}, {20, 0, 2},
+        {25, 0, 8}, {-1, 0, 0}
+    };
+    Byte *data;
+    uLong len = 400000, i;
+    unsigned long seed = 3;
+
+    data = (Byte *)malloc(len);
+    if (data == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {     /* words, and runs of one byte */
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(i % 20000 < 1000 ? 'z' : (seed >> 16) % 7 == 0 ?
+                         ' ' : 'a' + (seed >> 20) % 4);
+    }
+    compare_matcher("words", data, len, Z_MATCH_TREE, 9, 2);
+    test_matcher(data, len, Z_MATCH_TREE, 9, steps);
+
+    for (i = 0; i < len; i++)
+        data[i] = (Byte)"abcdefghij"[i % 10];
+    compare_matcher("periodic data", data, len, Z_MATCH_TREE, 8, 2);
+    compare_matcher("periodic data", data, len, Z_MATCH_TREE, 9, 2);
+
+    fill_runs(data, len, 5);
+    compare_matcher("runs", data, len, Z_MATCH_TREE, 8, 5);
+    compare_matcher("runs", data, len, Z_MATCH_TREE, 9, 5);
+    free(data);
+}
+
+/* ===========================================================================
+ * Test deflateMatcher() with Z_MATCH_BUCKET, against the hash chains at levels
+ * 6 and 9, and switched with the other finders and levels in the middle of a
+ * stream
+ */
+static void test_match_bucket(void) {
+    static const match_step steps[] = {
+        {8, Z_MATCH_CHAIN, -1}, {12, Z_MATCH_BUCKET, -1}, {16, 0, 6},
+        {20, Z_MATCH_TREE, -1}, {24, Z_MATCH_BUCKET, -1}, {28, 0, 0},
+        {32, 0, 4}, {-1, 0, 0}
+    };
+    Byte *data;
+    uLong len = 400000, i;
+    unsigned long seed = 5;
+
+    data = (Byte *)malloc(len);
+    if (data == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < len; i++) {     /* words, some of them repeated */
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(i > 1000 && (seed >> 16) % 3 == 0 ?
+                         data[i - 1000 + (seed >> 20) % 8] :
+                         (seed >> 18) % 6 == 0 ? ' ' : 'a' + (seed >> 22) % 8);
+    }
+    compare_matcher("words", data, len, Z_MATCH_BUCKET, 6, 5);
+    compare_matcher("words", data, len, Z_MATCH_BUCKET, 9, 5);
+    test_matcher(data, len, Z_MATCH_BUCKET, 2, steps);
+    free(data);
+}
+
+/* ===========================================================================
+ * Test the Huffman codes of deflate on skewed frequencies, which need their
+ * lengths limited to 15 bits, and on many small messages
+ */
+static void test_huffman(void) {
+    Byte *data, *compr, *uncompr, t;
+    uLong len = 0, bound, i, j, a = 1, b = 1, outLen, comprLen;
+    unsigned long seed = 7;
+    z_stream c_stream;
+    int err, sym;
+
+    data = (Byte *)malloc(200000);
+    bound = compressBound(200000);
+    compr = (Byte *)malloc(bound);
+    uncompr = (Byte *)malloc(200000);
+    if (data == Z_NULL || compr == Z_NULL || uncompr == Z_NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for (sym = 0; sym < 26; sym++) {    /* Fibonacci frequencies, shuffled */
+        for (j = 0; j < a && len < 200000; j++)
+            data[len++] = (Byte)(sym * 9);
+        b += a;
+        a = b - a;
+    }
+    for (i = len - 1; i > 0; i--) {
+        seed = seed * 1103515245UL + 12345UL;
+        j = (seed >> 8) % (i + 1);
+        t = data[i];
+        data[i] = data[j];
+        data[j] = t;
+    }
+
+    c_stream.zalloc = zalloc;
+    c_stream.zfree = zfree;
+    c_stream.opaque = (voidpf)0;
+    err = deflateInit2(&c_stream, 6, Z_DEFLATED, 15, 8, Z_HUFFMAN_ONLY);
+    CHECK_ERR(err, "deflateInit2");
+    c_stream.next_in = data;
+    c_stream.avail_in = (uInt)len;
+    c_stream.next_out = compr;
+    c_stream.avail_out = (uInt)bound;
+    err = deflate(&c_stream, Z_FINISH);
+    CHECK_ERR(err == Z_STREAM_END ? Z_OK : err, "deflate");
+    comprLen = c_stream.total_out;
+    err = deflateEnd(&c_stream);
+    CHECK_ERR(err, "deflateEnd");
+    outLen = len;
+    err = uncompress(uncompr, &outLen, compr, comprLen);
+    CHECK_ERR(err, "uncompress");
+    if (outLen != len || memcmp(data, uncompr, len)) {
+        fprintf(stderr, "bad data with limited code lengths\n");
+        exit(1);
+    }
+    printf("Huffman codes: %lu skewed bytes to %lu", len, comprLen);
+
+    for (i = 1; i < 3000; i += 7) {     /* small messages of text */
+        for (j = 0; j < i; j++) {
+            seed = seed * 1103515245UL + 12345UL;
+            data[j] = (Byte)((seed >> 16) % 5 == 0 ? ' ' :
+                             'a' + (seed >> 20) % (1 + i % 26));
+        }
+        comprLen = bound;
+        err = compress2(compr, &comprLen, data, i, (int)(i % 10));
+        CHECK_ERR(err, "compress2");
+        outLen = i;
+        err = uncompress(uncompr, &outLen, compr, comprLen);
+        CHECK_ERR(err, "uncompress");
+        if (outLen != i || memcmp(data, uncompr, i)) {
+            fprintf(stderr, "bad small message of %lu bytes\n", i);
+            exit(1);
+        }
+    }
+    printf(", small messages ok\n");
+
+    free(data);
+    free(compr);
+    free(uncompr);
+}
+#endif /* !Z_SOLO */
+
+/* ===========================================================================
+ * Test crc32_multi() and adler32_multi() against crc32_z() and adler32_z() on
+ * a batch of buffers of mixed lengths, with running and initial checksums
+ */
+static void test_checksum_multi(void) {
+    static Byte data[12000];
+    const Bytef *buf[301];
+    z_size_t len[301];
+    uLong crc[301], adler[301], i;
+    unsigned long seed = 11;
+
+    for (i = 0; i < sizeof(data); i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        data[i] = (Byte)(seed >> 16);
+    }
+    for (i = 0; i < 301; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        buf[i] = i % 50 == 7 ? Z_NULL : data + (seed >> 16) % 4000;
+        len[i] = buf[i] == Z_NULL ? 0 :
+                 i % 40 == 3 ? 6000 + i : (seed >> 8) % (i % 3 ? 600 : 9);
+        crc[i] = i & 1 ? 0 : seed & 0xffffffffUL;
+        adler[i] = i & 1 ? 1 : ((seed >> 4) % 65521) << 16 | seed % 65521;
+    }
+    crc32_multi(crc, buf, len, 301);
+    adler32_multi(adler, buf, len, 301);
+
+    seed = 11;
+    for (i = 0; i < sizeof(data); i++)
+        seed = seed * 1103515245UL + 12345UL;
+    for (i = 0; i < 301; i++) {
+        seed = seed * 1103515245UL + 12345UL;
+        if (crc[i] != crc32_z(i & 1 ? 0 : seed & 0xffffffffUL, buf[i],
+                              len[i]) ||
+            adler[i] != (buf[i] == Z_NULL ? 1 :
+                         adler32_z(i & 1 ? 1 : ((seed >> 4) % 65521) << 16 |
+                                   seed % 65521, buf[i], len[i]))) {
+            fprintf(stderr, "bad checksum of buffer %lu\n", i);
+            exit(1);
+        }
+    }
+    printf("crc32_multi(), adler32_multi(): 301 buffers ok\n");
+}
+
+/* ===========================================================================
+ * Usage:  example [output.gz  [input.gz]]
+ */
+
+int main(int argc, char *argv[]) {
+    Byte *compr, *uncompr;
+    uLong uncomprLen = 20000;
+    uLong comprLen = 3 * uncomprLen;
+    static const char* myVersion = ZLIB_VERSION;
+
+    if (zlibVersion()[0] != myVersion[0]) {
+        fprintf(stderr, "incompatible zlib version\n");
+        exit(1);
+
+    } else if (strcmp(zlibVersion(), ZLIB_VERSION) != 0) {
+        fprintf(stderr, "warning: different zlib version linked: %s\n",
+                zlibVersion());
+    }
+
+    printf("zlib version %s = 0x%04x, compile flags = 0x%lx\n",
+            ZLIB_VERSION, ZLIB_VERNUM, zlibCompileFlags());
+
+    compr    = (Byte*)calloc((uInt)comprLen, 1);
+    uncompr  = (Byte*)calloc((uInt)uncomprLen, 1);
+    /* compr and uncompr are cleared to avoid reading uninitialized
+     * data and to ensure that uncompr compresses well.
+     */
+    if (compr == Z_NULL || uncompr == Z_NULL) {
+        printf("out of memory\n");
+        exit(1);
+    }
+
+#ifdef Z_SOLO
+    (void)argc;
+    (void)argv;
+#else
+    test_compress(compr, comprLen, uncompr, uncomprLen);
+
+    test_gzio((argc > 1 ? argv[1] : TESTFILE),
+              uncompr, uncomprLen);
+#endif
+
+    test_deflate(compr, comprLen);
+    test_inflate(compr, comprLen, uncompr, uncomprLen);
+    test_inflate_tokens(compr, comprLen, uncompr, uncomprLen);
+    test_inflate_tokens_blocks();
+
+    test_large_deflate(compr, comprLen, uncompr, uncomprLen);
+    test_large_inflate(compr, comprLen, uncompr, uncomprLen);
+
+    test_flush(compr, &comprLen);
+    test_sync(compr, comprLen, uncompr, uncomprLen);
+    comprLen = 3 * uncomprLen;
+
+    test_dict_deflate(compr, comprLen);
+    test_dict_inflate(compr, comprLen, uncompr, uncomprLen);
+
+    test_adapt();
+    test_checksum_multi();
+#ifndef Z_SOLO
+    test_estimate();
+    test_filter();
+    test_image();
+    test_bound();
+    test_match_tree();
+    test_match_bucket();
+    test_huffman();
+    test_uncompress_alloc();
+    test_rewrap();
+    test_recompress();
+    test_zpool();
+    test_compress_parallel();
+    test_gzio_large(argc > 1 ? argv[1] : TESTFILE);
+    test_gzio_funcs();
+    test_gzio_lines(argc > 1 ? argv[1] : TESTFILE);
+    test_gzcopyfd(argc > 1 ? argv[1] : TESTFILE);
+#ifdef TEST_SHARED
+    test_gzio_shared(argc > 1 ? argv[1] : TESTFILE);
+#endif
+#ifdef TEST_NONBLOCK
+    test_gzio_nonblock();
+#endif
+#ifdef TEST_DROP
+    test_gzio_drop(argc > 1 ? argv[1] : TESTFILE);
+#endif
+#endif
 
     free(compr);
     free(uncompr);
@@ -28,6 +28,24 @@
    the cost of a larger memory footprint */
 /* #define LIT_MEM */
 
+/* define HEAP_TREES to build the Huffman trees with a heap, as zlib did before,
+   instead of sorting the frequencies and building the tree in place, which is
+   faster for small blocks and gives codes of the same total length */
+
+/* define NO_ADAPT when compiling to leave out the adaptive level controller
+   (deflateAdapt()). It needs a CPU clock and is never available in FASTEST or
+   Z_SOLO builds. */
+#if !defined(NO_ADAPT) && !defined(FASTEST) && !defined(Z_SOLO)
+#  define ADAPT
+#endif
+
+/* define NO_LOOPS_15_8 when compiling to leave out the copies of the match
+   loops made for windowBits 15 and memLevel 8, the defaults, in which the
+   window and hash sizes are constants. Never used in FASTEST builds. */
+#if !defined(NO_LOOPS_15_8) && !defined(FASTEST)
+#  define LOOPS_15_8
+#endif
+
 /* ===========================================================================
  * Internal compression state.
  */
@@ -102,6 +120,30 @@ typedef unsigned IPos;
  * save space in the various tables. IPos is used only for parameter passing.
  */
 
+#define BUCKET_WAYS 10
+/* Number of strings kept in each bucket of Z_MATCH_BUCKET */
+
+/* A hash bucket of Z_MATCH_BUCKET, the size of a cache line. The strings are
+ * in a ring, newest at next - 1, with their first four bytes as two shorts so
+ * that most candidates can be passed over without looking at the window.
+ */
+typedef struct bucket_s {
+    Pos pos[BUCKET_WAYS];       /* window index of each string, or NIL */
+    ush key[2][BUCKET_WAYS];    /* its bytes 0-1 and 2-3, low byte first */
+    ush next;                   /* slot of the next string inserted */
+    ush pad;                    /* to make 64 bytes */
+} FAR bucket;
+
+typedef enum {
+    need_more,      /*!< block not completed, need more input or more output */
+    block_done,     /*!< block flush performed */
+    finish_started, /*!< finish started, need only output at next deflate */
+    finish_done     /*!< finish done, accept no more input or output */
+} block_state;
+
+/*! Compression function. Returns the block state after the call. */
+typedef block_state (*compress_func)(struct internal_state FAR *s, int flush);
+
 /*! Deflate internal state */
 typedef struct internal_state {
     z_streamp strm;      /*!< pointer back to this zlib stream */
@@ -189,10 +231,37 @@ typedef struct internal_state {
     int level;    /*!< compression level (1..9) */
     int strategy; /*!< favor or force Huffman coding*/
 
+    compress_func func;
+    /*!< Function of the level, chosen for the window and hash sizes when the
+     * level is set.
+     */
+
     uInt good_match;
     /*!< Use a faster search when the previous match is longer than this */
 
     int nice_match; /*!< Stop searching when current match exceeds this */
+
+    int matcher;         /*!< Z_MATCH_CHAIN, Z_MATCH_TREE or Z_MATCH_BUCKET */
+
+    Posf *tree_head;     /*!< Roots of the binary trees of Z_MATCH_TREE, one
+                         per hash value, or Z_NULL until it is selected. */
+
+    Posf *tree_son;      /*!< Smaller and greater children of each string in
+                         the trees, as pairs indexed by window index modulo
+                         wSize, like prev. */
+
+    uInt tree_next;      /*!< First string not yet inserted in the trees */
+
+    uInt tree_dist;      /*!< The bytes of the window up to tree_end are */
+    uInt tree_end;       /*!< equal to those tree_dist before them, from the
+                         last string that overlapped a match on */
+
+    bucket *buckets;     /*!< Buckets of Z_MATCH_BUCKET, aligned on 64 bytes
+                         in bucket_mem, or Z_NULL until it is selected. */
+
+    voidpf bucket_mem;   /*!< Allocation holding the buckets */
+
+    uInt bucket_bits;    /*!< log2(number of buckets) */
     ///@}
                 /*! \name used by trees.c: */
     ///@{
@@ -276,6 +345,23 @@ typedef struct internal_state {
      * updated to the new high water mark.
      */
 
+#ifdef ADAPT
+                /*! \name used by the adaptive level controller: */
+    ///@{
+    ulg   adapt_rate;     /*!< target input rate in KB/s, 0 for none */
+    ulg   adapt_latency;  /*!< bound for one deflate() call in us, 0 for none */
+    int   adapt_min;      /*!< lowest rung allowed (0 is Huffman only) */
+    int   adapt_max;      /*!< highest rung allowed */
+    int   adapt_strategy; /*!< strategy used on rungs 1..9 */
+    int   adapt_want;     /*!< rung to switch to at next call, -1 if none */
+    int   adapt_calm;     /*!< consecutive windows well within budget */
+    ulg   adapt_bytes;    /*!< input bytes in the current sampling window */
+    ulg   adapt_usec;     /*!< time spent in the current sampling window */
+    ulg   adapt_worst;    /*!< slowest call in the current window, in us */
+    ulg   adapt_hist[10]; /*!< input bytes compressed on each rung */
+    ulg   adapt_switches; /*!< number of rung changes made */
+    ///@}
+#endif
 } FAR deflate_state;
 
 /* Output a byte on the stream.
@@ -307,6 +393,7 @@ void ZLIB_INTERNAL _tr_flush_bits(deflate_state *s);
 void ZLIB_INTERNAL _tr_align(deflate_state *s);
 void ZLIB_INTERNAL _tr_stored_block(deflate_state *s, charf *buf,
                                     ulg stored_len, int last);
+ulg ZLIB_INTERNAL _tr_block_bits(deflate_state *s);
 
 #define d_code(dist) \
    ((dist) < 256 ? _dist_code[dist] : _dist_code[256+((dist)>>7)])
@@ -315,9 +402,6 @@ void ZLIB_INTERNAL _tr_stored_block(deflate_state *s, charf *buf,
  * used.
  */
 
-#ifndef ZLIB_DEBUG
-/* Inline versions of _tr_tally for speed: */
-
 #if defined(GEN_TREES_H) || !defined(STDC)
   extern uch ZLIB_INTERNAL _length_code[];
   extern uch ZLIB_INTERNAL _dist_code[];
@@ -326,6 +410,9 @@ void ZLIB_INTERNAL _tr_stored_block(deflate_state *s, charf *buf,
   extern const uch ZLIB_INTERNAL _dist_code[];
 #endif
 
+#ifndef ZLIB_DEBUG
+/* Inline versions of _tr_tally for speed: */
+
 #ifdef LIT_MEM
 # define _tr_tally_lit(s, c, flush) \
   { uch cc = (c); \
@@ -137,6 +137,16 @@
 #  endif
 #endif
 
+/* true if the last read or write failed only because the file is in
+   non-blocking mode and would have blocked */
+#if defined(EAGAIN) && defined(EWOULDBLOCK) && EAGAIN != EWOULDBLOCK
+#  define GZ_AGAIN() (errno == EAGAIN || errno == EWOULDBLOCK)
+#elif defined(EAGAIN)
+#  define GZ_AGAIN() (errno == EAGAIN)
+#else
+#  define GZ_AGAIN() 0
+#endif
+
 /* provide prototypes for these when building zlib without LFS */
 #if !defined(_LARGEFILE64_SOURCE) || _LFS64_LARGEFILE-0 == 0
     ZEXTERN gzFile ZEXPORT gzopen64 (const char *, const char *);
@@ -156,6 +166,19 @@
    twice this must be able to fit in an unsigned type) */
 #define GZBUFSIZE 8192
 
+/* largest buffer size chosen automatically for a regular file, and buffer
+   size for pipes and sockets -- see gz_tune() */
+#define GZBUFMAX 262144
+#define GZPIPESIZE 65536
+
+/* number of consecutive reads filling the input buffer before the buffers
+   are doubled, up to GZBUFMAX */
+#define GZ_GROW_AFTER 4
+
+/* with 's' in the mode, bytes read or written that are kept in the page
+   cache behind the current position */
+#define GZ_DROP 8388608L
+
 /* gzip modes, also provide a little integrity check on the passed structure */
 #define GZ_NONE 0
 #define GZ_READ 7247
@@ -167,6 +190,25 @@
 #define COPY 1      /* copy input directly */
 #define GZIP 2      /* decompress a gzip stream */
 
+/* io_uring backend for file i/o on Linux, see gzuring.c -- it is set up
+   after GZ_URING_AFTER blocking reads or writes, so that small files are not
+   worth the set up */
+#if defined(HAVE_IO_URING) && !defined(NO_IO_URING)
+#  define GZ_URING
+#  define GZ_URING_AFTER 4
+typedef struct gz_uring_s gz_uring;
+#endif
+
+/* ring for several threads writing to one file, see gzshared.c -- needs C11
+   atomics */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+    !defined(__STDC_NO_ATOMICS__) && !defined(NO_GZSHARED) && \
+    !defined(NO_GZCOMPRESS)
+#  define GZ_SHARED
+#  define GZ_SHARED_RING 1048576        /* size of the ring, a power of 2 */
+typedef struct gz_shared_s gz_shared;
+#endif
+
 /*! internal gzip file state data structure */
 typedef struct {
     /*! exposed contents for gzgetc() macro
@@ -179,19 +221,33 @@ typedef struct {
         /*! \name used for both reading and writing */
         ///@{
     int mode;               /*!< see gzip modes above */
-    int fd;                 /*!< file descriptor */
+    int fd;                 /*!< file descriptor, -1 if using funcs */
+    gz_funcs funcs;         /*!< callbacks from gzopen_funcs() */
+    voidp opaque;           /*!< opaque pointer for the callbacks */
     char *path;             /*!< path or fd for error messages */
     unsigned size;          /*!< buffer size, zero if not allocated yet */
     unsigned want;          /*!< requested buffer size, default is GZBUFSIZE */
     unsigned char *in;      /*!< input buffer (double-sized when writing) */
     unsigned char *out;     /*!< output buffer (double-sized when reading) */
-    int direct;             /*!< 0 if processing gzip, 1 if transparent @}*/
+    int direct;             /*!< 0 if processing gzip, 1 if transparent */
+    int grow;               /*!< true to grow the buffers on sequential reads */
+    int stream;             /*!< true to drop i/o from the page cache ('s') */
+    int nonblock;           /*!< true to return when i/o would block ('n') */
+    int again;              /*!< true if the last i/o would have blocked */
+    z_off64_t ioff;         /*!< file offset after the last read or write */
+    z_off64_t drop;         /*!< offset up to which the cache was dropped @}*/
         /*! \name just for reading */
         ///@{
     int how;                /*!< 0: get header, 1: copy, 2: decompress */
     z_off64_t start;        /*!< where the gzip data started, for rewinding */
     int eof;                /*!< true if end of input file reached */
-    int past;               /*!< true if read requested past end @}*/
+    int past;               /*!< true if read requested past end */
+    unsigned full;          /*!< consecutive reads that filled the buffer */
+    const unsigned char *chunk; /*!< unused part of the last funcs.fetch() */
+    unsigned chunk_len;     /*!< length of that part */
+    char *line;             /*!< line assembled by gzgetlines(), or NULL */
+    z_size_t line_size;     /*!< allocated size of line */
+    z_size_t kept;          /*!< start of a line in line, to be continued @}*/
         /*! \name just for writing */
         ///@{
     int level;              /*!< compression level */
@@ -205,6 +261,15 @@ typedef struct {
         ///@{
     int err;                /*!< error code */
     char *msg;              /*!< error message @}*/
+#ifdef GZ_URING
+        /*! \name io_uring backend */
+        ///@{
+    gz_uring *uring;        /*!< read-ahead or write-behind ring, or NULL */
+    unsigned ios;           /*!< blocking reads or writes so far @}*/
+#endif
+#ifdef GZ_SHARED
+    gz_shared *shared;      /*!< ring for concurrent writers ('m'), or NULL */
+#endif
         /*! zlib inflate or deflate stream */
     z_stream strm;          /* stream structure in-place (not a pointer) */
 } gz_state;
@@ -212,6 +277,38 @@ typedef gz_state FAR *gz_statep;
 
 /* shared functions */
 void ZLIB_INTERNAL gz_error (gz_statep, int, const char *);
+z_off64_t ZLIB_INTERNAL gz_lseek(gz_statep, z_off64_t, int);
+int ZLIB_INTERNAL gz_sysclose(gz_statep);
+void ZLIB_INTERNAL gz_advise(gz_statep, unsigned);
+z_size_t ZLIB_INTERNAL gz_write(gz_statep, voidpc, z_size_t);
+#ifdef GZ_URING
+void ZLIB_INTERNAL gz_uring_start(gz_statep);
+int ZLIB_INTERNAL gz_uring_read(gz_statep, unsigned char *, unsigned,
+                                unsigned *);
+int ZLIB_INTERNAL gz_uring_write(gz_statep, const unsigned char *, unsigned);
+z_off64_t ZLIB_INTERNAL gz_uring_tell(gz_statep);
+int ZLIB_INTERNAL gz_uring_stop(gz_statep);
+void ZLIB_INTERNAL gz_uring_end(gz_statep);
+#endif
+#ifdef GZ_SHARED
+int ZLIB_INTERNAL gz_shared_init(gz_statep);
+int ZLIB_INTERNAL gz_shared_put(gz_statep, const void *, z_size_t);
+void ZLIB_INTERNAL gz_shared_lock(gz_statep);
+void ZLIB_INTERNAL gz_shared_unlock(gz_statep);
+int ZLIB_INTERNAL gz_shared_err(gz_statep);
+void ZLIB_INTERNAL gz_shared_error(gz_statep, int, const char *);
+void ZLIB_INTERNAL gz_shared_end(gz_statep);
+/* get or set the error from a thread that does not hold the ring -- only the
+   thread compressing may use state->err and state->msg directly */
+#  define GZ_ERR(state) \
+    ((state)->shared != NULL ? gz_shared_err(state) : (state)->err)
+#  define GZ_ERROR(state, err, msg) \
+    ((state)->shared != NULL ? gz_shared_error(state, err, msg) : \
+                               gz_error(state, err, msg))
+#else
+#  define GZ_ERR(state) ((state)->err)
+#  define GZ_ERROR(state, err, msg) gz_error(state, err, msg)
+#endif
 #if defined UNDER_CE
 char ZLIB_INTERNAL *gz_strwinerror (DWORD error);
 #endif
@@ -11,3 +11,4 @@
 */
 
 void ZLIB_INTERNAL inflate_fast (z_streamp strm, unsigned start);
+void ZLIB_INTERNAL inflate_fast_tokens (z_streamp strm, unsigned start);
@@ -79,6 +79,10 @@ typedef enum {
         CHECK -> LENGTH -> DONE
  */
 
+/* The tokens written after inflateTokens(), see its description */
+#define TOK_RUN 127         /* longest literal run */
+#define TOK_BLOCK 0x7f      /* first byte of a block token */
+
 /*! State maintained between inflate() calls -- approximately 7K bytes, not
    including the allocated sliding window, which is up to 32K bytes. */
 struct inflate_state {
@@ -94,6 +98,9 @@ struct inflate_state {
     unsigned long check;        /*!< protected copy of check value */
     unsigned long total;        /*!< protected copy of output count */
     gz_headerp head;            /*!< where to save gzip header information */
+    z_tokensp tok;              /*!< where to write tokens, or Z_NULL */
+    unsigned char FAR *run;     /*!< count of the open literal run in tok, or
+                                   Z_NULL if none */
         /*! \name sliding window 
         @{*/
     unsigned wbits;             /*!< log base 2 of requested window size */
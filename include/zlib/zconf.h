@@ -30,10 +30,16 @@
 #  define adler32_combine       z_adler32_combine
 #  define adler32_combine64     z_adler32_combine64
 #  define adler32_z             z_adler32_z
+#  define adler32_multi         z_adler32_multi
 #  ifndef Z_SOLO
 #    define compress              z_compress
 #    define compress2             z_compress2
 #    define compressBound         z_compressBound
+#    define compressFiltered      z_compressFiltered
+#    define compressFit           z_compressFit
+#    define compressImage         z_compressImage
+#    define compressParallel      z_compressParallel
+#    define compressParallelBound z_compressParallelBound
 #  endif
 #  define crc32                 z_crc32
 #  define crc32_combine         z_crc32_combine
@@ -41,16 +47,22 @@
 #  define crc32_combine_gen     z_crc32_combine_gen
 #  define crc32_combine_gen64   z_crc32_combine_gen64
 #  define crc32_combine_op      z_crc32_combine_op
+#  define crc32_multi           z_crc32_multi
 #  define crc32_z               z_crc32_z
 #  define deflate               z_deflate
+#  define deflateAdapt          z_deflateAdapt
+#  define deflateAdaptStats     z_deflateAdaptStats
 #  define deflateBound          z_deflateBound
+#  define deflateBoundRemaining z_deflateBoundRemaining
 #  define deflateCopy           z_deflateCopy
 #  define deflateEnd            z_deflateEnd
+#  define deflateEstimate       z_deflateEstimate
 #  define deflateGetDictionary  z_deflateGetDictionary
 #  define deflateInit           z_deflateInit
 #  define deflateInit2          z_deflateInit2
 #  define deflateInit2_         z_deflateInit2_
 #  define deflateInit_          z_deflateInit_
+#  define deflateMatcher        z_deflateMatcher
 #  define deflateParams         z_deflateParams
 #  define deflatePending        z_deflatePending
 #  define deflatePrime          z_deflatePrime
@@ -62,14 +74,17 @@
 #  define deflate_copyright     z_deflate_copyright
 #  define get_crc_table         z_get_crc_table
 #  ifndef Z_SOLO
+#    define gunzipAlloc           z_gunzipAlloc
 #    define gz_error              z_gz_error
 #    define gz_intmax             z_gz_intmax
 #    define gz_strwinerror        z_gz_strwinerror
+#    define gzblocked             z_gzblocked
 #    define gzbuffer              z_gzbuffer
 #    define gzclearerr            z_gzclearerr
 #    define gzclose               z_gzclose
 #    define gzclose_r             z_gzclose_r
 #    define gzclose_w             z_gzclose_w
+#    define gzcopyfd              z_gzcopyfd
 #    define gzdirect              z_gzdirect
 #    define gzdopen               z_gzdopen
 #    define gzeof                 z_gzeof
@@ -79,11 +94,14 @@
 #    define gzfwrite              z_gzfwrite
 #    define gzgetc                z_gzgetc
 #    define gzgetc_               z_gzgetc_
+#    define gzgetline             z_gzgetline
+#    define gzgetlines            z_gzgetlines
 #    define gzgets                z_gzgets
 #    define gzoffset              z_gzoffset
 #    define gzoffset64            z_gzoffset64
 #    define gzopen                z_gzopen
 #    define gzopen64              z_gzopen64
+#    define gzopen_funcs          z_gzopen_funcs
 #    ifdef _WIN32
 #      define gzopen_w              z_gzopen_w
 #    endif
@@ -123,22 +141,36 @@
 #  define inflateSetDictionary  z_inflateSetDictionary
 #  define inflateSync           z_inflateSync
 #  define inflateSyncPoint      z_inflateSyncPoint
+#  define inflateTokens         z_inflateTokens
 #  define inflateUndermine      z_inflateUndermine
 #  define inflateValidate       z_inflateValidate
 #  define inflate_copyright     z_inflate_copyright
 #  define inflate_fast          z_inflate_fast
 #  define inflate_table         z_inflate_table
 #  ifndef Z_SOLO
+#    define recompress            z_recompress
+#    define rewrap                z_rewrap
 #    define uncompress            z_uncompress
 #    define uncompress2           z_uncompress2
+#    define uncompressAlloc       z_uncompressAlloc
+#    define uncompressFiltered    z_uncompressFiltered
+#    define uncompressImage       z_uncompressImage
 #  endif
 #  define zError                z_zError
 #  ifndef Z_SOLO
 #    define zcalloc               z_zcalloc
 #    define zcfree                z_zcfree
 #  endif
+#  define zfilter               z_zfilter
+#  define zfilterRow            z_zfilterRow
 #  define zlibCompileFlags      z_zlibCompileFlags
 #  define zlibVersion           z_zlibVersion
+#  ifndef Z_SOLO
+#    define zpoolCreate           z_zpoolCreate
+#    define zpoolFree             z_zpoolFree
+#  endif
+#  define zunfilter             z_zunfilter
+#  define zunfilterRow          z_zunfilterRow
 
 /* all zlib typedefs in zlib.h and zconf.h */
 #  define Byte                  z_Byte
@@ -148,6 +180,8 @@
 #  define free_func             z_free_func
 #  ifndef Z_SOLO
 #    define gzFile                z_gzFile
+#    define gz_funcs              z_gz_funcs
+#    define gz_line               z_gz_line
 #  endif
 #  define gz_header             z_gz_header
 #  define gz_headerp            z_gz_headerp
@@ -163,6 +197,10 @@
 #  define voidpf                z_voidpf
 
 /* all zlib structs in zlib.h and zconf.h */
+#  ifndef Z_SOLO
+#    define gz_funcs_s            z_gz_funcs_s
+#    define gz_line_s             z_gz_line_s
+#  endif
 #  define gz_header_s           z_gz_header_s
 #  define internal_state        z_internal_state
 
@@ -180,6 +180,39 @@ typedef struct gz_header_s {
 
 typedef gz_header *gz_headerp;
 
+/*!
+  Where inflate() writes the tokens of the deflate data after inflateTokens()
+*/
+typedef struct z_tokens_s {
+    Bytef   *next;      ///< next token byte goes here
+    uInt    avail;      ///< remaining free space at next
+    uLong   total;      ///< total number of token bytes written so far
+} z_tokens;
+
+typedef z_tokens *z_tokensp;
+
+/*!
+  Executor for the parallel work of zlib, so that it runs on the threads of
+  the application instead of threads of its own.
+
+  group returns a new wait group, or Z_NULL if out of memory.  submit queues
+  task(arg) in the group, to be run on any thread, and returns 0, or nonzero
+  if it could not, in which case zlib runs the task itself.  wait returns
+  once all the tasks submitted in the group have run, and frees the group.
+  Tasks can submit tasks and wait for them, so wait should run queued tasks
+  rather than just block.  threads is the number of tasks worth running at
+  once, used to size the work.  Each function gets opaque.  zpoolCreate()
+  returns the default executor, a work-stealing thread pool.
+*/
+typedef struct z_executor_s {
+    voidp (*group)(voidp opaque);
+    int (*submit)(voidp opaque, voidp group, void (*task)(voidp arg),
+                  voidp arg);
+    void (*wait)(voidp opaque, voidp group);
+    unsigned threads;
+    voidp opaque;
+} z_executor;
+
 
                         /* constants */
 
@@ -230,6 +263,13 @@ typedef gz_header *gz_headerp;
 #define Z_DEFAULT_STRATEGY    0
 ///@}
 
+/// \name Match finders for deflateMatcher()
+///@{
+#define Z_MATCH_CHAIN         0   ///< hash chains, the default
+#define Z_MATCH_TREE          1   ///< binary trees, for level 9
+#define Z_MATCH_BUCKET        2   ///< cache-line buckets, for levels 6 to 9
+///@}
+
 /// \name Possible values of the data_type field for deflate()
 ///@{
 #define Z_BINARY   0
@@ -238,6 +278,23 @@ typedef gz_header *gz_headerp;
 #define Z_UNKNOWN  2
 ///@}
 
+/// \name Filters for zfilter() and compressFiltered()
+///@{
+#define Z_FILTER_DELTA    1   ///< difference from the previous element
+#define Z_FILTER_XOR      2   ///< exclusive-or with the previous element
+#define Z_FILTER_SHUFFLE  4   ///< group the bytes by position in the element
+///@}
+
+/// \name PNG scanline filter types for zfilterRow() and compressImage()
+///@{
+#define Z_ROW_NONE      0   ///< unchanged
+#define Z_ROW_SUB       1   ///< difference from the pixel to the left
+#define Z_ROW_UP        2   ///< difference from the pixel above
+#define Z_ROW_AVERAGE   3   ///< difference from the mean of left and above
+#define Z_ROW_PAETH     4   ///< difference from the Paeth predictor
+#define Z_ROW_ADAPTIVE  5   ///< pick the best of the above for each row
+///@}
+
 /// The deflate compression method (the only one supported in this version)
 #define Z_DEFLATED   8
 
@@ -295,9 +352,31 @@ int ZEXPORT deflateTune(z_streamp strm,
                         int nice_length,
                         int max_chain);
 
+int ZEXPORT deflateMatcher(z_streamp strm,
+                           int matcher);
+
+int ZEXPORT deflateAdapt(z_streamp strm,
+                         uLong rate,
+                         uLong latency,
+                         int min_level,
+                         int max_level);
+
+int ZEXPORT deflateAdaptStats(z_streamp strm,
+                              uLong *bytes,
+                              uLong *switches);
+
 uLong ZEXPORT deflateBound(z_streamp strm,
                            uLong sourceLen);
 
+uLong ZEXPORT deflateBoundRemaining(z_streamp strm,
+                                    uLong sourceLen);
+
+int ZEXPORT deflateEstimate(z_streamp strm,
+                            const Bytef *source,
+                            uLong sourceLen,
+                            uLong *sizes,
+                            uLong *errors);
+
 int ZEXPORT deflatePending(z_streamp strm,
                            unsigned *pending,
                            int *bits);
@@ -336,6 +415,9 @@ long ZEXPORT inflateMark(z_streamp strm);
 int ZEXPORT inflateGetHeader(z_streamp strm,
                              gz_headerp head);
 
+int ZEXPORT inflateTokens(z_streamp strm,
+                          z_tokensp tok);
+
 ///  Input function used by inflateBack()
 typedef unsigned (*in_func)(void*, const unsigned char* *);
 
@@ -373,12 +455,57 @@ int ZEXPORT compress2(Bytef *dest,   uLongf *destLen,
 
 uLong ZEXPORT compressBound(uLong sourceLen);
 
+int ZEXPORT compressFit(Bytef *dest, uLongf *destLen,
+                        const Bytef *source, uLong sourceLen, int level);
+
 int ZEXPORT uncompress(Bytef *dest,   uLongf *destLen,
                        const Bytef *source, uLong sourceLen);
 
 int ZEXPORT uncompress2(Bytef *dest,   uLongf *destLen,
                         const Bytef *source, uLong *sourceLen);
 
+int ZEXPORT uncompressAlloc(Bytef **dest, uLongf *destLen,
+                            const Bytef *source, uLong *sourceLen,
+                            uLong sizeHint, alloc_func zalloc,
+                            free_func zfree, voidpf opaque);
+
+int ZEXPORT gunzipAlloc(Bytef **dest, uLongf *destLen, const Bytef *source,
+                        uLong *sourceLen, alloc_func zalloc, free_func zfree,
+                        voidpf opaque);
+
+int ZEXPORT rewrap(Bytef *dest, uLongf *destLen, int destBits,
+                   const Bytef *source, uLong *sourceLen, int sourceBits);
+
+int ZEXPORT recompress(Bytef *dest, uLongf *destLen, int destBits,
+                       const Bytef *source, uLong *sourceLen,
+                       int sourceBits);
+
+int ZEXPORT compressFiltered(Bytef *dest, uLongf *destLen,
+                             const Bytef *source, uLong sourceLen,
+                             int level, int filter, unsigned size);
+
+int ZEXPORT uncompressFiltered(Bytef *dest, uLongf *destLen,
+                               const Bytef *source, uLong sourceLen);
+
+int ZEXPORT compressImage(Bytef *dest, uLongf *destLen, const Bytef *image,
+                          uLong height, z_size_t rowLen, unsigned bpp,
+                          int level, int type);
+
+int ZEXPORT uncompressImage(Bytef *image, uLong height, z_size_t rowLen,
+                            unsigned bpp, const Bytef *source,
+                            uLong sourceLen);
+
+z_executor * ZEXPORT zpoolCreate(unsigned threads);
+
+void ZEXPORT zpoolFree(z_executor *pool);
+
+int ZEXPORT compressParallel(Bytef *dest, uLongf *destLen,
+                             const Bytef *source, uLong sourceLen,
+                             int level, int windowBits,
+                             const z_executor *exec);
+
+uLong ZEXPORT compressParallelBound(uLong sourceLen);
+
 ///@}
 
 /*!
@@ -408,8 +535,31 @@ struct gzFile_s {
 
 typedef struct gzFile_s *gzFile;
 
+/*!
+  Callbacks used by gzopen_funcs() in place of a file descriptor.
+
+  Each callback gets the opaque pointer given to gzopen_funcs(). read, write
+  and seek behave as read(), write() and lseek(), returning -1 on error with
+  errno set for gzerror(). fetch, if not Z_NULL, is used for reading instead
+  of read: it returns a pointer to the next bytes of the source, owned by the
+  source and valid until the next call of fetch or of a seek that moves the
+  position, and sets *len to their number, or to zero at the end. It returns
+  Z_NULL on error. seek and close may be Z_NULL, in which case the gzFile
+  cannot seek in the compressed data, and nothing is done on close.
+*/
+typedef struct gz_funcs_s {
+    int (*read)(voidp opaque, voidp buf, unsigned len);
+    int (*write)(voidp opaque, voidpc buf, unsigned len);
+    z_off64_t (*seek)(voidp opaque, z_off64_t offset, int whence);
+    int (*close)(voidp opaque);
+    const unsigned char *(*fetch)(voidp opaque, unsigned *len);
+} gz_funcs;
+
 gzFile ZEXPORT gzdopen(int fd, const char *mode);
 
+gzFile ZEXPORT gzopen_funcs(const gz_funcs *funcs, voidp opaque,
+                            const char *mode);
+
 int ZEXPORT gzbuffer(gzFile file, unsigned size);
 
 int ZEXPORT gzsetparams(gzFile file, int level, int strategy);
@@ -430,6 +580,21 @@ int ZEXPORT gzputs(gzFile file, const char *s);
 
 char* ZEXPORT gzgets(gzFile file, char *buf, int len);
 
+/*!
+  A line returned by gzgetlines(): len bytes at str, including the newline
+  unless it is the last line of the file and has none. Not null-terminated.
+*/
+typedef struct gz_line_s {
+    const char *str;
+    z_size_t len;
+} gz_line;
+
+const char * ZEXPORT gzgetline(gzFile file, z_size_t *len);
+
+unsigned ZEXPORT gzgetlines(gzFile file, gz_line *lines, unsigned max);
+
+z_off64_t ZEXPORT gzcopyfd(gzFile file, int fd);
+
 int ZEXPORT gzputc(gzFile file, int c);
 
 int ZEXPORT gzgetc(gzFile file);
@@ -444,6 +609,8 @@ int ZEXPORT gzeof(gzFile file);
 
 int ZEXPORT gzdirect(gzFile file);
 
+int ZEXPORT gzblocked(gzFile file);
+
 int ZEXPORT gzclose(gzFile file);
 
 int ZEXPORT gzclose_r(gzFile file);
@@ -473,6 +640,11 @@ uLong ZEXPORT crc32(uLong crc, const Bytef *buf, uInt len);
 uLong ZEXPORT crc32_z(uLong crc, const Bytef *buf,
                       z_size_t len);
 
+void ZEXPORT adler32_multi(uLong *adler, const Bytef * const *buf,
+                           const z_size_t *len, unsigned count);
+void ZEXPORT crc32_multi(uLong *crc, const Bytef * const *buf,
+                         const z_size_t *len, unsigned count);
+
 /*
 ZEXTERN uLong ZEXPORT crc32_combine_gen(z_off_t len2);
 
@@ -483,6 +655,26 @@ ZEXTERN uLong ZEXPORT crc32_combine_gen(z_off_t len2);
 ZEXTERN uLong ZEXPORT crc32_combine_op(uLong crc1, uLong crc2, uLong op);
 
 
+                        /* data filters */
+
+/*
+     These functions rewrite arrays of numeric data or image scanlines so that
+   they compress better, and restore them after decompression. See filter.c.
+*/
+
+int ZEXPORT zfilter(Bytef *dest, const Bytef *source, z_size_t len,
+                    int filter, unsigned size);
+
+int ZEXPORT zunfilter(Bytef *dest, const Bytef *source, z_size_t len,
+                      int filter, unsigned size);
+
+int ZEXPORT zfilterRow(Bytef *dest, const Bytef *row, const Bytef *prior,
+                       z_size_t len, unsigned bpp, int type);
+
+int ZEXPORT zunfilterRow(Bytef *row, const Bytef *source, const Bytef *prior,
+                         z_size_t len, unsigned bpp);
+
+
                         /* various hacks, don't look :) */
 
 /* deflateInit and inflateInit are macros to allow checking the zlib version
@@ -264,6 +264,7 @@ extern const char * const z_errmsg[10]; /* indexed by 2-zlib_error */
    voidpf ZLIB_INTERNAL zcalloc(voidpf opaque, unsigned items,
                                 unsigned size);
    void ZLIB_INTERNAL zcfree(voidpf opaque, voidpf ptr);
+   ulg ZLIB_INTERNAL z_thread_usec(void);
 #endif
 
 #define ZALLOC(strm, items, size) \
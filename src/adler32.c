@@ -154,6 +154,118 @@ uLong ZEXPORT adler32(uLong adler, const Bytef *buf, uInt len) {
     return adler32_z(adler, buf, len);
 }
 
+/* ========================================================================= */
+/* adler32_multi() keeps LANES buffers going at once, so that the additions of
+   each, which depend on one another, overlap with those of the others --
+   buffers shorter than LANE_MIN gain nothing from that, and are done directly
+   by adler32_z() */
+#define LANES 4
+#define LANE_MIN 128
+
+/* a buffer of adler32_multi() in a lane */
+typedef struct {
+    const Bytef *next;          /* next byte to do */
+    z_size_t left;              /* bytes left */
+    unsigned long adler, sum2;  /* component sums so far */
+    unsigned since;             /* bytes summed since the last modulo */
+    unsigned item;              /* index of the buffer */
+} adler_lane;
+
+#define LANE1(a, s, p) {a += *p++; s += a;}
+
+/*!
+  Update the running Adler-32 checksums adler[0..count-1] with the bytes
+  buf[i][0..len[i]-1] of each buffer, as adler32_z() would one at a time.
+
+  This is for batches of many small messages. Four buffers of at least 128
+  bytes are worked on at once, in interleaved lanes, and the next buffer takes
+  the place of each one that is done, so that the lanes are kept busy when the
+  lengths differ. The last buffers of the batch, and the shorter ones, are
+  done by adler32_z(). If buf[i] is Z_NULL, adler[i] is set to the initial
+  value of an Adler-32, as returned by adler32_z().
+*/
+void ZEXPORT adler32_multi(uLong *adler, const Bytef * const *buf,
+                           const z_size_t *len, unsigned count) {
+    adler_lane lane[LANES];
+    const Bytef *p0, *p1, *p2, *p3;
+    unsigned long a0, a1, a2, a3, s0, s1, s2, s3;
+    z_size_t run, i;
+    unsigned next = 0, active = 0, k;
+
+    for (;;) {
+        /* put the next buffers in the empty lanes */
+        while (active < LANES && next < count) {
+            if (buf[next] == Z_NULL)
+                adler[next] = 1L;
+            else if (len[next] < LANE_MIN)
+                adler[next] = adler32_z(adler[next], buf[next], len[next]);
+            else {
+                lane[active].next = buf[next];
+                lane[active].left = len[next];
+                lane[active].adler = adler[next] & 0xffff;
+                lane[active].sum2 = (adler[next] >> 16) & 0xffff;
+                lane[active].since = 0;
+                lane[active].item = next;
+                active++;
+            }
+            next++;
+        }
+        if (active < LANES)
+            break;
+
+        /* run the lanes together until one is done or needs a modulo */
+        run = lane[0].left;
+        for (k = 0; k < LANES; k++) {
+            if (lane[k].left < run)
+                run = lane[k].left;
+            if (NMAX - lane[k].since < run)
+                run = NMAX - lane[k].since;
+        }
+        p0 = lane[0].next, a0 = lane[0].adler, s0 = lane[0].sum2;
+        p1 = lane[1].next, a1 = lane[1].adler, s1 = lane[1].sum2;
+        p2 = lane[2].next, a2 = lane[2].adler, s2 = lane[2].sum2;
+        p3 = lane[3].next, a3 = lane[3].adler, s3 = lane[3].sum2;
+        for (i = 0; i < run; i++) {
+            LANE1(a0, s0, p0);
+            LANE1(a1, s1, p1);
+            LANE1(a2, s2, p2);
+            LANE1(a3, s3, p3);
+        }
+        lane[0].next = p0, lane[0].adler = a0, lane[0].sum2 = s0;
+        lane[1].next = p1, lane[1].adler = a1, lane[1].sum2 = s1;
+        lane[2].next = p2, lane[2].adler = a2, lane[2].sum2 = s2;
+        lane[3].next = p3, lane[3].adler = a3, lane[3].sum2 = s3;
+
+        /* reduce the sums that are due, and finish the buffers that are
+           done, emptying their lanes */
+        for (k = 0; k < LANES; k++) {
+            lane[k].left -= run;
+            lane[k].since += (unsigned)run;
+            if (lane[k].left == 0 || lane[k].since == NMAX) {
+                MOD(lane[k].adler);
+                MOD(lane[k].sum2);
+                lane[k].since = 0;
+            }
+        }
+        for (k = 0; k < active;) {
+            if (lane[k].left == 0) {
+                adler[lane[k].item] = lane[k].adler | (lane[k].sum2 << 16);
+                lane[k] = lane[--active];
+            }
+            else
+                k++;
+        }
+    }
+
+    /* finish the buffers that are left one at a time */
+    for (k = 0; k < active; k++) {
+        MOD(lane[k].adler);
+        MOD(lane[k].sum2);
+        adler[lane[k].item] = adler32_z(lane[k].adler | (lane[k].sum2 << 16),
+                                        lane[k].next, lane[k].left);
+    }
+}
+
 /* ========================================================================= */
 /*!
   Combine two Adler-32 checksums into one.
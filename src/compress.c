@@ -8,7 +8,7 @@
 /* @(#) $Id$ */
 
 #define ZLIB_INTERNAL
-#include <zlib/zlib.h>
+#include "zutil.h"
 
 /* =========================================================================== */
 /*!
@@ -95,3 +95,285 @@ uLong ZEXPORT compressBound(uLong sourceLen) {
     return sourceLen + (sourceLen >> 12) + (sourceLen >> 14) +
            (sourceLen >> 25) + 13;
 }
+
+/* =========================================================================== */
+/*!
+  Compresses the source buffer into a destination buffer that may be smaller
+  than compressBound(sourceLen), storing the data uncompressed if it does not
+  fit once compressed.
+
+  \param dest       destination buffer
+  \param destLen    on entry, the size of dest; on exit, the size of the
+                    compressed data
+  \param source     data to compress
+  \param sourceLen  length of the data
+  \param level      compression level, as in compress2()
+
+  The data is first compressed as with compress2(), which stops as soon as
+  the destination is full. If it did not fit, and destLen is at least
+  sourceLen + 5 * (sourceLen / 65535 + 1) + 6, the data is written instead as
+  a zlib stream of stored blocks of 65535 bytes, which any inflate decodes.
+  That is tighter than compressBound(), and a caller that knows its data
+  compresses well can pass an even smaller buffer and still only fail when
+  neither form fits.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_BUF_ERROR if there was not enough room in the output buffer for
+          either the compressed or the stored data
+  \return Z_STREAM_ERROR if the level parameter is invalid
+*/
+int ZEXPORT compressFit(Bytef *dest, uLongf *destLen, const Bytef *source,
+                        uLong sourceLen, int level) {
+    uLong left, stored, len, check;
+    int err;
+
+    left = *destLen;
+    err = compress2(dest, destLen, source, sourceLen, level);
+    stored = sourceLen + 5 * (sourceLen / 65535 + 1) + 6;
+    if (err != Z_BUF_ERROR || left < stored)
+        return err;
+    *destLen = stored - 5 * (sourceLen && sourceLen % 65535 == 0);
+
+    /* zlib header for no compression, 0x7801 being a multiple of 31 */
+    check = adler32_z(1L, source, sourceLen);
+    *dest++ = 0x78;
+    *dest++ = 0x01;
+    do {
+        len = sourceLen > 65535 ? 65535 : sourceLen;
+        sourceLen -= len;
+        *dest++ = (Bytef)(sourceLen == 0);  /* BFINAL, BTYPE 00 */
+        *dest++ = (Bytef)len;
+        *dest++ = (Bytef)(len >> 8);
+        *dest++ = (Bytef)~len;
+        *dest++ = (Bytef)(~len >> 8);
+        zmemcpy(dest, source, len);
+        dest += len;
+        source += len;
+    } while (sourceLen);
+    *dest++ = (Bytef)(check >> 24);
+    *dest++ = (Bytef)(check >> 16);
+    *dest++ = (Bytef)(check >> 8);
+    *dest = (Bytef)check;
+    return Z_OK;
+}
+
+/* chunks of input compressed independently by compressParallel() */
+#define PAR_CHUNK 131072U
+#define PAR_DICT 32768U
+
+/* a chunk of compressParallel() input, and what it compresses to */
+typedef struct {
+    const Bytef *in;            /* the chunk */
+    uInt len;                   /* its length */
+    uInt dict;                  /* input before it to prime deflate with */
+    int level;                  /* compression level */
+    int last;                   /* true to end the deflate stream */
+    int gzip;                   /* true for a CRC-32, false for Adler-32 */
+    Bytef *out;                 /* compressed chunk, allocated */
+    uLong outLen;               /* its length */
+    uLong check;                /* check value of the chunk */
+    int err;                    /* Z_OK or an error from deflate */
+} par_chunk;
+
+/* ===========================================================================
+ * Compress a chunk as a piece of a raw deflate stream, primed with the input
+ * just before it and ending on a byte boundary with a sync flush, or with
+ * the last block if it is the last chunk.  This is the task that
+ * compressParallel() gives the executor.
+ */
+local void par_deflate(voidp arg) {
+    par_chunk *c = (par_chunk *)arg;
+    z_stream strm;
+    uLong size;
+    int err;
+
+    c->out = Z_NULL;
+    c->check = c->gzip ? crc32(0L, c->in, c->len) : adler32(1L, c->in, c->len);
+    strm.zalloc = (alloc_func)0;
+    strm.zfree = (free_func)0;
+    strm.opaque = (voidpf)0;
+    err = deflateInit2(&strm, c->level, Z_DEFLATED, -MAX_WBITS,
+                       DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (err == Z_OK && c->dict)
+        err = deflateSetDictionary(&strm, c->in - c->dict, c->dict);
+    if (err != Z_OK) {
+        deflateEnd(&strm);
+        c->err = err;
+        return;
+    }
+
+    /* room for the chunk as stored blocks, and the sync marker */
+    size = deflateBound(&strm, c->len) + 16;
+    c->out = (Bytef *)malloc(size);
+    if (c->out == Z_NULL) {
+        deflateEnd(&strm);
+        c->err = Z_MEM_ERROR;
+        return;
+    }
+    strm.next_in = (const Bytef *)c->in;
+    strm.avail_in = c->len;
+    strm.next_out = c->out;
+    strm.avail_out = (uInt)size;
+    err = deflate(&strm, c->last ? Z_FINISH : Z_SYNC_FLUSH);
+    c->outLen = size - strm.avail_out;
+    deflateEnd(&strm);
+    c->err = err == (c->last ? Z_STREAM_END : Z_OK) && strm.avail_in == 0 &&
+             strm.avail_out ? Z_OK : Z_BUF_ERROR;
+}
+
+/*!
+  Returns an upper bound on the compressed size after compressParallel() on
+  sourceLen bytes, in any of its formats.
+*/
+uLong ZEXPORT compressParallelBound(uLong sourceLen) {
+    return compressBound(sourceLen) + 12 +
+           16 * (sourceLen / PAR_CHUNK + 1);
+}
+
+/* =========================================================================== */
+/*!
+  Compresses the source buffer into the destination buffer, with the pieces
+  of the work run in parallel by an executor, and with output that does not
+  depend on the executor or on its number of threads.
+
+  \param dest       destination buffer
+  \param destLen    on entry, the size of dest, which can be
+                    compressParallelBound(sourceLen); on exit, the size of
+                    the compressed data
+  \param source     data to compress
+  \param sourceLen  length of the data
+  \param level      compression level, as in compress2()
+  \param windowBits MAX_WBITS for a zlib stream, MAX_WBITS + 16 for gzip, or
+                    -MAX_WBITS for raw deflate
+  \param exec       executor to run the work on, such as from zpoolCreate(),
+                    or Z_NULL to do it all in this thread
+
+  The source is cut in chunks of 128K, each compressed by a task of its own,
+  primed with the 32K of source before it.  All but the last chunk end with
+  a sync flush, so that their outputs can just be put one after the other,
+  and the check values of the chunks are combined.  Where the chunks and
+  flushes fall depends only on sourceLen, so the output is the same byte for
+  byte whatever the number of threads, and only depends on the source, level
+  and windowBits.  It is a little larger than that of compress2(), by the
+  priming that is lost at the start of each chunk and 5 bytes per flush.
+  At most twice exec->threads chunks are in memory at once.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_BUF_ERROR if there was not enough room in the output buffer
+  \return Z_STREAM_ERROR if level or windowBits is invalid
+*/
+int ZEXPORT compressParallel(Bytef *dest, uLongf *destLen,
+                             const Bytef *source, uLong sourceLen,
+                             int level, int windowBits,
+                             const z_executor *exec) {
+    par_chunk *chunks;
+    uLong left, check, pos, flags;
+    unsigned wave, n, k;
+    voidp group;
+    int err = Z_OK, gzip;
+
+    if (level == Z_DEFAULT_COMPRESSION)
+        level = 6;
+    if (level < 0 || level > 9 || (windowBits != MAX_WBITS &&
+        windowBits != MAX_WBITS + 16 && windowBits != -MAX_WBITS))
+        return Z_STREAM_ERROR;
+    gzip = windowBits > MAX_WBITS;
+
+    /* the header, as deflate() would write it */
+    left = *destLen;
+    *destLen = 0;
+    if (windowBits == MAX_WBITS) {
+        if (left < 2)
+            return Z_BUF_ERROR;
+        flags = (0x78UL << 8) | ((uLong)(level < 2 ? 0 : level < 6 ? 1 :
+                                         level == 6 ? 2 : 3) << 6);
+        flags += 31 - flags % 31;
+        dest[0] = (Bytef)(flags >> 8);
+        dest[1] = (Bytef)flags;
+        *destLen = 2;
+    }
+    else if (gzip) {
+        if (left < 10)
+            return Z_BUF_ERROR;
+        zmemzero(dest, 10);
+        dest[0] = 31;
+        dest[1] = 139;
+        dest[2] = Z_DEFLATED;
+        dest[8] = level == 9 ? 2 : level < 2 ? 4 : 0;
+        dest[9] = OS_CODE;
+        *destLen = 10;
+    }
+
+    /* compress the chunks a wave at a time, and append them in order */
+    wave = exec == Z_NULL || exec->threads < 2 ? 2 : 2 * exec->threads;
+    chunks = (par_chunk *)malloc(wave * sizeof(par_chunk));
+    if (chunks == Z_NULL)
+        return Z_MEM_ERROR;
+    check = gzip ? 0 : 1;
+    pos = 0;
+    do {
+        group = exec == Z_NULL ? Z_NULL : exec->group(exec->opaque);
+        for (n = 0; n < wave && (n == 0 || pos < sourceLen); n++) {
+            chunks[n].in = source + pos;
+            chunks[n].len = (uInt)(sourceLen - pos < PAR_CHUNK ?
+                                   sourceLen - pos : PAR_CHUNK);
+            chunks[n].dict = pos < PAR_DICT ? (uInt)pos : PAR_DICT;
+            chunks[n].level = level;
+            pos += chunks[n].len;
+            chunks[n].last = pos == sourceLen;
+            chunks[n].gzip = gzip;
+            if (group == Z_NULL ||
+                exec->submit(exec->opaque, group, par_deflate, chunks + n))
+                par_deflate(chunks + n);
+        }
+        if (group != Z_NULL)
+            exec->wait(exec->opaque, group);
+        for (k = 0; k < n; k++) {
+            if (err == Z_OK && chunks[k].err != Z_OK)
+                err = chunks[k].err;
+            if (err == Z_OK && left - *destLen < chunks[k].outLen)
+                err = Z_BUF_ERROR;
+            if (err == Z_OK) {
+                zmemcpy(dest + *destLen, chunks[k].out,
+                        (uInt)chunks[k].outLen);
+                *destLen += chunks[k].outLen;
+                check = gzip ?
+                    crc32_combine(check, chunks[k].check, chunks[k].len) :
+                    adler32_combine(check, chunks[k].check, chunks[k].len);
+            }
+            free(chunks[k].out);
+        }
+    } while (err == Z_OK && pos < sourceLen);
+    free(chunks);
+    if (err != Z_OK)
+        return err;
+
+    /* the trailer */
+    if (windowBits == MAX_WBITS) {
+        if (left - *destLen < 4)
+            return Z_BUF_ERROR;
+        dest += *destLen;
+        dest[0] = (Bytef)(check >> 24);
+        dest[1] = (Bytef)(check >> 16);
+        dest[2] = (Bytef)(check >> 8);
+        dest[3] = (Bytef)check;
+        *destLen += 4;
+    }
+    else if (gzip) {
+        if (left - *destLen < 8)
+            return Z_BUF_ERROR;
+        dest += *destLen;
+        dest[0] = (Bytef)check;
+        dest[1] = (Bytef)(check >> 8);
+        dest[2] = (Bytef)(check >> 16);
+        dest[3] = (Bytef)(check >> 24);
+        dest[4] = (Bytef)sourceLen;
+        dest[5] = (Bytef)(sourceLen >> 8);
+        dest[6] = (Bytef)(sourceLen >> 16);
+        dest[7] = (Bytef)(sourceLen >> 24);
+        *destLen += 8;
+    }
+    return Z_OK;
+}
@@ -141,8 +141,8 @@ local z_word_t byte_swap(z_word_t word) {
    local z_crc_t FAR x2n_table[32];
 #else
 /* =========================================================================
- * Tables for byte-wise and braided CRC-32 calculations, and a table of powers
- * of x for combining CRC-32s, all made by make_crc_table().
+ * Tables for byte-wise, four-byte and braided CRC-32 calculations, and a table
+ * of powers of x for combining CRC-32s, all made by make_crc_table().
  */
 #  include "crc32.h"
 #endif
@@ -190,10 +190,11 @@ local z_crc_t x2nmodp(z_off64_t n, unsigned k) {
 
 #ifdef DYNAMIC_CRC_TABLE
 /* =========================================================================
- * Build the tables for byte-wise and braided CRC-32 calculations, and a table
- * of powers of x for combining CRC-32s.
+ * Build the tables for byte-wise, four-byte and braided CRC-32 calculations,
+ * and a table of powers of x for combining CRC-32s.
  */
 local z_crc_t FAR crc_table[256];
+local z_crc_t FAR crc_lane_table[4][256];
 #ifdef W
    local z_word_t FAR crc_big_table[256];
    local z_crc_t FAR crc_braid_table[W][256];
@@ -324,6 +325,17 @@ local void make_crc_table(void) {
 #endif
     }
 
+    /* initialize the tables of bytes followed by zeros for four bytes at a
+       time in crc32_multi() */
+    for (i = 0; i < 256; i++) {
+        p = crc_table[i];
+        crc_lane_table[0][i] = p;
+        for (j = 1; j < 4; j++) {
+            p = (p >> 8) ^ crc_table[p & 0xff];
+            crc_lane_table[j][i] = p;
+        }
+    }
+
     /* initialize the x^2^n mod p(x) table */
     p = (z_crc_t)1 << 30;         /* x^1 */
     x2n_table[0] = p;
@@ -365,6 +377,18 @@ local void make_crc_table(void) {
         fprintf(out,
             "};\n");
 
+        /* write out the four byte CRC tables for crc32_multi() to crc32.h */
+        fprintf(out,
+            "\n"
+            "local const z_crc_t FAR crc_lane_table[][256] = {\n");
+        for (k = 0; k < 4; k++) {
+            fprintf(out, "   {");
+            write_table(out, crc_lane_table[k], 256);
+            fprintf(out, "}%s", k < 3 ? ",\n" : "");
+        }
+        fprintf(out,
+            "};\n");
+
         /* write out big-endian CRC table for 64-bit z_word_t to crc32.h */
         fprintf(out,
             "\n"
@@ -1040,6 +1064,131 @@ unsigned long ZEXPORT crc32(unsigned long crc, const unsigned char FAR *buf,
     return crc32_z(crc, buf, len);
 }
 
+/* =========================================================================
+ * crc32_multi() keeps LANES buffers going at once, so that the latencies of
+ * their table lookups, or of the CRC instruction, overlap. Each lane does
+ * four bytes per step, as a word made up from the bytes, so that there is no
+ * alignment to do first and no braids to combine at the end.
+ */
+#define LANES 4
+
+#ifdef ARMCRC32
+#  define LANE_STEP(c, p) \
+    do { \
+        z_crc_t word = (z_crc_t)(p)[0] | ((z_crc_t)(p)[1] << 8) | \
+                       ((z_crc_t)(p)[2] << 16) | ((z_crc_t)(p)[3] << 24); \
+        __asm__ volatile("crc32w %w0, %w0, %w1" : "+r"(c) : "r"(word)); \
+        p += 4; \
+    } while (0)
+#else
+#  define LANE_STEP(c, p) \
+    do { \
+        c ^= (z_crc_t)(p)[0] | ((z_crc_t)(p)[1] << 8) | \
+             ((z_crc_t)(p)[2] << 16) | ((z_crc_t)(p)[3] << 24); \
+        c = crc_lane_table[3][c & 0xff] ^ \
+            crc_lane_table[2][(c >> 8) & 0xff] ^ \
+            crc_lane_table[1][(c >> 16) & 0xff] ^ \
+            crc_lane_table[0][c >> 24]; \
+        p += 4; \
+    } while (0)
+#endif
+
+/* a buffer of crc32_multi() in a lane, with its CRC pre-conditioned */
+typedef struct {
+    const unsigned char FAR *next;      /* next byte to do */
+    z_size_t left;                      /* bytes left */
+    z_crc_t crc;                        /* CRC so far */
+    unsigned item;                      /* index of the buffer */
+} crc_lane;
+
+/* ========================================================================= */
+/*!
+  Update the running CRC-32s crc[0..count-1] with the bytes buf[i][0..len[i]-1]
+  of each buffer, as crc32_z() would one at a time.
+
+  This is for batches of many small messages, where calling crc32_z() for
+  each costs more than the CRC. Four buffers are worked on at once, in
+  interleaved lanes, and the next buffer takes the place of each one that is
+  done, so that the lanes are kept busy when the lengths differ. The last
+  buffers of the batch are finished by crc32_z(). If buf[i] is Z_NULL, crc[i]
+  is set to the initial value of a CRC-32, as returned by crc32_z().
+*/
+void ZEXPORT crc32_multi(unsigned long FAR *crc,
+                         const unsigned char FAR * const FAR *buf,
+                         const z_size_t FAR *len, unsigned count) {
+    crc_lane lane[LANES];
+    const unsigned char FAR *p0, FAR *p1, FAR *p2, FAR *p3;
+    z_crc_t c0, c1, c2, c3;
+    z_size_t run, i;
+    unsigned next = 0, active = 0, k;
+
+#ifdef DYNAMIC_CRC_TABLE
+    once(&made, make_crc_table);
+#endif /* DYNAMIC_CRC_TABLE */
+
+    for (;;) {
+        /* put the next buffers in the empty lanes */
+        while (active < LANES && next < count) {
+            if (buf[next] == Z_NULL)
+                crc[next] = 0;
+            else {
+                lane[active].next = buf[next];
+                lane[active].left = len[next];
+                lane[active].crc = (z_crc_t)((~crc[next]) & 0xffffffff);
+                lane[active].item = next;
+                active++;
+            }
+            next++;
+        }
+        if (active < LANES)
+            break;
+
+        /* run the lanes together for the words of the shortest one */
+        run = lane[0].left;
+        for (k = 1; k < LANES; k++)
+            if (lane[k].left < run)
+                run = lane[k].left;
+        run >>= 2;
+        p0 = lane[0].next, c0 = lane[0].crc;
+        p1 = lane[1].next, c1 = lane[1].crc;
+        p2 = lane[2].next, c2 = lane[2].crc;
+        p3 = lane[3].next, c3 = lane[3].crc;
+        for (i = 0; i < run; i++) {
+            LANE_STEP(c0, p0);
+            LANE_STEP(c1, p1);
+            LANE_STEP(c2, p2);
+            LANE_STEP(c3, p3);
+        }
+        lane[0].next = p0, lane[0].crc = c0;
+        lane[1].next = p1, lane[1].crc = c1;
+        lane[2].next = p2, lane[2].crc = c2;
+        lane[3].next = p3, lane[3].crc = c3;
+
+        /* finish the buffers with less than a word left, and empty their
+           lanes */
+        for (k = 0; k < LANES; k++)
+            lane[k].left -= run << 2;
+        for (k = 0; k < active;) {
+            if (lane[k].left < 4) {
+                p0 = lane[k].next, c0 = lane[k].crc;
+                while (lane[k].left) {
+                    lane[k].left--;
+                    c0 = (c0 >> 8) ^ crc_table[(c0 ^ *p0++) & 0xff];
+                }
+                crc[lane[k].item] = c0 ^ 0xffffffff;
+                lane[k] = lane[--active];
+            }
+            else
+                k++;
+        }
+    }
+
+    /* finish the buffers that are left one at a time */
+    for (k = 0; k < active; k++)
+        crc[lane[k].item] = crc32_z(lane[k].crc ^ 0xffffffff, lane[k].next,
+                                    lane[k].left);
+}
+
 /* ========================================================================= */
 uLong ZEXPORT crc32_combine64(uLong crc1, uLong crc2, z_off64_t len2) {
 #ifdef DYNAMIC_CRC_TABLE
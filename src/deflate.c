@@ -61,23 +61,25 @@
 const char deflate_copyright[] =
    " deflate 1.3.0.1 Copyright 1995-2023 Jean-loup Gailly and Mark Adler ";
 
-typedef enum {
-    need_more,      /* block not completed, need more input or more output */
-    block_done,     /* block flush performed */
-    finish_started, /* finish started, need only more output at next deflate */
-    finish_done     /* finish done, accept no more input or output */
-} block_state;
-
-typedef block_state (*compress_func)(deflate_state *s, int flush);
-/* Compression function. Returns the block state after the call. */
-
 local block_state deflate_stored(deflate_state *s, int flush);
 local block_state deflate_fast(deflate_state *s, int flush);
 #ifndef FASTEST
 local block_state deflate_slow(deflate_state *s, int flush);
 #endif
+#ifdef LOOPS_15_8
+local block_state deflate_fast_15_8(deflate_state *s, int flush);
+local block_state deflate_slow_15_8(deflate_state *s, int flush);
+#endif
+#ifndef FASTEST
+local void bucket_insert(deflate_state *s, IPos str);
+#endif
 local block_state deflate_rle(deflate_state *s, int flush);
 local block_state deflate_huff(deflate_state *s, int flush);
+#ifdef ADAPT
+local int adapt_switch(deflate_state *s);
+local void adapt_update(deflate_state *s, ulg bytes, ulg usec);
+#endif
+local void leave_stored(deflate_state *s);
 
 /* ===========================================================================
  * Local data
@@ -139,8 +141,13 @@ local const config configuration_table[10] = {
  * IN  assertion: all calls to UPDATE_HASH are made with consecutive input
  *    characters, so that a running hash key can be computed from the previous
  *    key instead of complete recalculation each time.
+ * H_SHIFT(), H_MASK() and W_MASK() are constants in the loops made for
+ *    windowBits 15 and memLevel 8 by including deflate_loops.h.
  */
-#define UPDATE_HASH(s,h,c) (h = (((h) << s->hash_shift) ^ (c)) & s->hash_mask)
+#define H_SHIFT(s) ((s)->hash_shift)
+#define H_MASK(s) ((s)->hash_mask)
+#define W_MASK(s) ((s)->w_mask)
+#define UPDATE_HASH(s,h,c) (h = (((h) << H_SHIFT(s)) ^ (c)) & H_MASK(s))
 
 
 /* ===========================================================================
@@ -161,10 +168,32 @@ local const config configuration_table[10] = {
 #else
 #define INSERT_STRING(s, str, match_head) \
    (UPDATE_HASH(s, s->ins_h, s->window[(str) + (MIN_MATCH-1)]), \
-    match_head = s->prev[(str) & s->w_mask] = s->head[s->ins_h], \
+    match_head = s->prev[(str) & W_MASK(s)] = s->head[s->ins_h], \
     s->head[s->ins_h] = (Pos)(str))
 #endif
 
+/* ===========================================================================
+ * Empty the binary trees of Z_MATCH_TREE or the buckets of Z_MATCH_BUCKET,
+ * whichever is in use. tree_son[] will be initialized on the fly. The strings
+ * still in the window are inserted again in the trees by tree_match() as far
+ * back as MAX_DIST, while the buckets start empty.
+ */
+#ifdef FASTEST
+#define CLEAR_MATCHER(s)
+#else
+#define CLEAR_MATCHER(s) \
+    do { \
+        if (s->matcher == Z_MATCH_TREE) \
+            zmemzero((Bytef *)s->tree_head, \
+                     (unsigned)s->hash_size * sizeof(*s->tree_head)); \
+        else if (s->matcher == Z_MATCH_BUCKET) \
+            zmemzero((Bytef *)s->buckets, \
+                     (unsigned)sizeof(bucket) << s->bucket_bits); \
+        s->tree_next = 0; \
+        s->tree_dist = s->tree_end = 0; \
+    } while (0)
+#endif
+
 /* ===========================================================================
  * Initialize the hash table (avoiding 64K overflow for 16 bit systems).
  * prev[] will be initialized on the fly.
@@ -174,6 +203,7 @@ local const config configuration_table[10] = {
         s->head[s->hash_size - 1] = NIL; \
         zmemzero((Bytef *)s->head, \
                  (unsigned)(s->hash_size - 1)*sizeof(*s->head)); \
+        CLEAR_MATCHER(s); \
     } while (0)
 
 /* ===========================================================================
@@ -207,6 +237,42 @@ local void slide_hash(deflate_state *s) {
          * its value will never be used.
          */
     } while (--n);
+    if (s->matcher == Z_MATCH_TREE) {
+        unsigned live = 0;
+
+        n = s->hash_size;
+        p = &s->tree_head[n];
+        do {
+            m = *--p;
+            *p = (Pos)(m >= wsize ? m - wsize : NIL);
+            live |= *p;
+        } while (--n);
+        /* If no root is left, neither is any string below one, all of which
+         * are older, as happens when a repeat is not inserted, and tree_son[]
+         * is initialized on the fly again.
+         */
+        n = live ? wsize << 1 : 0;
+        p = &s->tree_son[n];
+        while (n) {
+            m = *--p;
+            *p = (Pos)(m >= wsize ? m - wsize : NIL);
+            n--;
+        }
+        s->tree_next = s->tree_next >= wsize ? s->tree_next - wsize : 0;
+        s->tree_end = s->tree_end >= wsize ? s->tree_end - wsize : 0;
+    }
+    else if (s->matcher == Z_MATCH_BUCKET) {
+        bucket *b = s->buckets + ((ulg)1 << s->bucket_bits);
+        do {
+            b--;
+            n = BUCKET_WAYS;
+            p = &b->pos[n];
+            do {
+                m = *--p;
+                *p = (Pos)(m >= wsize ? m - wsize : NIL);
+            } while (--n);
+        } while (b != s->buckets);
+    }
 #endif
 }
 
@@ -317,6 +383,8 @@ local void fill_window(deflate_state *s) {
                 UPDATE_HASH(s, s->ins_h, s->window[str + MIN_MATCH-1]);
 #ifndef FASTEST
                 s->prev[str & s->w_mask] = s->head[s->ins_h];
+                if (s->matcher == Z_MATCH_BUCKET)
+                    bucket_insert(s, str);
 #endif
                 s->head[s->ins_h] = (Pos)str;
                 str++;
@@ -565,6 +633,11 @@ int ZEXPORT deflateInit2_(z_streamp strm, int level, int method,
     s->window = (Bytef *) ZALLOC(strm, s->w_size, 2*sizeof(Byte));
     s->prev   = (Posf *)  ZALLOC(strm, s->w_size, sizeof(Pos));
     s->head   = (Posf *)  ZALLOC(strm, s->hash_size, sizeof(Pos));
+    s->matcher = Z_MATCH_CHAIN;
+    s->tree_head = s->tree_son = Z_NULL;    /* allocated by deflateMatcher() */
+    s->buckets = Z_NULL;
+    s->bucket_mem = Z_NULL;
+    s->bucket_bits = s->hash_bits - 3;
 
     s->high_water = 0;      /* nothing written to s->window yet */
 
@@ -639,6 +712,10 @@ int ZEXPORT deflateInit2_(z_streamp strm, int level, int method,
     s->level = level;
     s->strategy = strategy;
     s->method = (Byte)method;
+#ifdef ADAPT
+    s->adapt_rate = s->adapt_latency = 0;   /* controller off */
+    s->adapt_want = -1;
+#endif
 
     return deflateReset(strm);
 }
@@ -752,6 +829,11 @@ int ZEXPORT deflateSetDictionary(z_streamp strm, const Bytef *dictionary,
             UPDATE_HASH(s, s->ins_h, s->window[str + MIN_MATCH-1]);
 #ifndef FASTEST
             s->prev[str & s->w_mask] = s->head[s->ins_h];
+            /* bucket_insert() reads a fourth byte, which can be past the
+               window for the last string */
+            if (s->matcher == Z_MATCH_BUCKET &&
+                str + MIN_MATCH < s->window_size)
+                bucket_insert(s, str);
 #endif
             s->head[s->ins_h] = (Pos)str;
             str++;
@@ -846,6 +928,27 @@ int ZEXPORT deflateResetKeep(z_streamp strm) {
     return Z_OK;
 }
 
+/* ===========================================================================
+ * Return the compression function of level for the window and hash sizes of
+ * s, which is the copy with those sizes as constants when they are the
+ * defaults.
+ */
+local compress_func level_func(deflate_state *s, int level) {
+    compress_func func = configuration_table[level].func;
+
+#ifdef LOOPS_15_8
+    if (s->w_bits == 15 && s->hash_bits == 15) {
+        if (func == deflate_fast)
+            return deflate_fast_15_8;
+        if (func == deflate_slow)
+            return deflate_slow_15_8;
+    }
+#else
+    (void)s;
+#endif
+    return func;
+}
+
 /* ===========================================================================
  * Initialize the "longest match" routines for a new zlib stream
  */
@@ -860,6 +963,7 @@ local void lm_init(deflate_state *s) {
     s->good_match       = configuration_table[s->level].good_length;
     s->nice_match       = configuration_table[s->level].nice_length;
     s->max_chain_length = configuration_table[s->level].max_chain;
+    s->func = level_func(s, s->level);
 
     s->strstart = 0;
     s->block_start = 0L;
@@ -868,6 +972,12 @@ local void lm_init(deflate_state *s) {
     s->match_length = s->prev_length = MIN_MATCH-1;
     s->match_available = 0;
     s->ins_h = 0;
+#ifdef ADAPT
+    s->adapt_calm = 0;
+    s->adapt_bytes = s->adapt_usec = s->adapt_worst = 0;
+    zmemzero(s->adapt_hist, sizeof(s->adapt_hist));
+    s->adapt_switches = 0;
+#endif
 }
 
 /* ========================================================================= */
@@ -1045,19 +1155,18 @@ int ZEXPORT deflateParams(z_streamp strm, int level, int strategy) {
         if (strm->avail_in || (s->strstart - s->block_start) + s->lookahead)
             return Z_BUF_ERROR;
     }
+#ifdef ADAPT
+    s->adapt_want = -1;         /* the controller goes on from this level */
+#endif
     if (s->level != level) {
-        if (s->level == 0 && s->matches != 0) {
-            if (s->matches == 1)
-                slide_hash(s);
-            else
-                CLEAR_HASH(s);
-            s->matches = 0;
-        }
+        if (s->level == 0)
+            leave_stored(s);
         s->level = level;
         s->max_lazy_match   = configuration_table[level].max_lazy;
         s->good_match       = configuration_table[level].good_length;
         s->nice_match       = configuration_table[level].nice_length;
         s->max_chain_length = configuration_table[level].max_chain;
+        s->func = level_func(s, level);
     }
     s->strategy = strategy;
     return Z_OK;
@@ -1088,6 +1197,280 @@ int ZEXPORT deflateTune(z_streamp strm, int good_length, int max_lazy,
     return Z_OK;
 }
 
+/* ===========================================================================
+ * Allocate the buckets of Z_MATCH_BUCKET, one more than needed so that they
+ * can start on a 64-byte boundary. Leave s->buckets Z_NULL if out of memory.
+ */
+local void bucket_alloc(deflate_state *s) {
+    z_streamp strm = s->strm;
+
+    s->bucket_mem = ZALLOC(strm, (1U << s->bucket_bits) + 1, sizeof(bucket));
+    s->buckets = s->bucket_mem == Z_NULL ? Z_NULL : (bucket *)
+        ((Bytef *)s->bucket_mem + ((0 - (z_size_t)s->bucket_mem) & 63));
+}
+
+/* ========================================================================= */
+/*!
+  Select how deflate searches the window for matches.
+
+  \param strm     deflate stream
+  \param matcher  Z_MATCH_CHAIN for the hash chains searched by all levels by
+                  default, Z_MATCH_TREE for binary trees, or Z_MATCH_BUCKET
+                  for buckets of recent strings
+
+  Z_MATCH_TREE keeps the strings of the window sorted in a binary tree for
+  each hash value, as LZMA's bt4 match finder does. Each string is inserted
+  by walking the tree from its root, which also finds the longest match, so
+  that the strings that the hash chains would look at one by one are skipped
+  at once when they cannot match longer. The walk stops after
+  max_chain / 16 + 16 nodes, where max_chain is 1024 at level 8 and 4096 at
+  level 9, which bounds the time spent per byte. Unlike the chains, every
+  string is walked, also inside of matches, save for the strings inside of a
+  run or other repeat that overlaps itself, which are not inserted. It is
+  meant for level 9, where on text it takes about a fifth less time than the
+  chains for the same output, and on runs of bytes about a third of the time
+  for 3 to 4% more output. Periodic data such as a short string repeated
+  compresses the same, for about a fifth more time. At level 8, where the
+  chains are shorter, it takes about a third more time on text, and at levels
+  4 to 7 several times the time of the chains. It takes
+  3 * 2^(windowBits + 1) bytes more memory with the default memLevel,
+  allocated on the first selection. Levels 1 to 3 keep using the hash chains.
+
+  Z_MATCH_BUCKET replaces the hash chains with 2^(memLevel + 4) buckets of 64
+  bytes, the size of a cache line, each holding the last ten strings with
+  its hash and their first four bytes. A search reads one bucket instead of
+  following the chain through prev[], which costs a cache miss per string
+  tried, and compares only the strings whose first bytes can make a longer
+  match. At most ten strings are tried, or max_chain if less, so it pays
+  only where the chains are long: on text it takes about a third less time
+  than the chains at level 6, and a fifth to a third of their time at levels
+  8 and 9, for 3 to 5% more output. At levels 1 to 5 it is slower than the
+  chains. On periodic data, or other data where the chains end early on a
+  long match, it is slower at every level, for the same output. It takes
+  256K more memory with the default memLevel, allocated on the first
+  selection.
+
+  deflateMatcher() may be called at any time, also between deflate() calls in
+  the middle of a block. The trees are kept up to date only while they are
+  selected, and are built again from the window when selected anew. The
+  buckets start empty when selected, and the hash chains start empty when
+  going back from the buckets, which costs some compression for a window.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory for the trees or buckets
+  \return Z_STREAM_ERROR if the stream state is inconsistent, matcher is not
+          valid, or Z_MATCH_TREE is asked and the library was compiled with
+          FASTEST
+*/
+int ZEXPORT deflateMatcher(z_streamp strm, int matcher) {
+    deflate_state *s;
+
+    if (deflateStateCheck(strm)) return Z_STREAM_ERROR;
+    s = strm->state;
+#ifdef FASTEST
+    (void)s;
+    return matcher == Z_MATCH_CHAIN ? Z_OK : Z_STREAM_ERROR;
+#else
+    if (matcher != Z_MATCH_CHAIN && matcher != Z_MATCH_TREE &&
+        matcher != Z_MATCH_BUCKET)
+        return Z_STREAM_ERROR;
+    if (s->matcher == matcher)
+        return Z_OK;
+    if (matcher == Z_MATCH_BUCKET && s->buckets == Z_NULL) {
+        bucket_alloc(s);
+        if (s->buckets == Z_NULL)
+            return Z_MEM_ERROR;
+    }
+    if (matcher == Z_MATCH_TREE && s->tree_head == Z_NULL) {
+        s->tree_head = (Posf *) ZALLOC(strm, s->hash_size, sizeof(Pos));
+        s->tree_son  = (Posf *) ZALLOC(strm, s->w_size, 2*sizeof(Pos));
+        if (s->tree_head == Z_NULL || s->tree_son == Z_NULL) {
+            TRY_FREE(strm, s->tree_son);
+            TRY_FREE(strm, s->tree_head);
+            s->tree_head = s->tree_son = Z_NULL;
+            return Z_MEM_ERROR;
+        }
+    }
+    if (s->matcher == Z_MATCH_BUCKET) {
+        /* the hash chains were not kept up to date, nor was ins_h, which is
+           set for the next string inserted, at strstart */
+        s->matcher = matcher;
+        CLEAR_HASH(s);
+        s->ins_h = s->window[s->strstart];
+        UPDATE_HASH(s, s->ins_h, s->window[s->strstart + 1]);
+    }
+    else {
+        s->matcher = matcher;
+        CLEAR_MATCHER(s);
+    }
+    return Z_OK;
+#endif
+}
+
+/* ========================================================================= */
+/*!
+  Let deflate pick the compression level by itself in order to stay within a
+  throughput or latency budget, while compressing as well as the budget
+  allows.
+
+  \param strm       deflate stream
+  \param rate       target input rate in KB/s (units of 1024 bytes per second
+                    of CPU time of the thread), or 0 for no rate target
+  \param latency    upper bound, in microseconds of CPU time, for one call of
+                    deflate(), or 0 for no latency bound
+  \param min_level  lowest level the controller may select (0..9)
+  \param max_level  highest level the controller may select (1..9)
+
+  Once enabled, deflate() measures the CPU time of the calling thread that it
+  spends compressing, and the amount of input consumed. Where the system has
+  no clock for the thread, clock() is used instead, and the time of other
+  threads of the process then counts as well. Every 64K of input, if the
+  measured rate is below `rate`, the next lower level is selected. The level
+  is raised again only after two consecutive sampling windows ran at least
+  50% faster than `rate` and no call took more than half of `latency`. A
+  single deflate() call taking longer than `latency` makes the controller
+  step down immediately.
+
+  The levels form a ladder going from `min_level` to `max_level`. Levels 1..9
+  use the entries of the configuration table with the strategy the stream had
+  when deflateAdapt() was called. A `min_level` of 0 adds a last rung below
+  level 1 using Huffman-only coding (Z_HUFFMAN_ONLY). Stored blocks are never
+  selected. A change takes effect at the start of the next deflate() call;
+  unlike deflateParams(), it does not end the current deflate block, except
+  when a pending lazy match literal has to be emitted and fills the block.
+
+  If the current level is outside the range, it is moved inside at the next
+  call of deflate(). Calling deflateAdapt() with both `rate` and `latency` 0
+  turns the controller off and leaves the level where it is. deflateParams()
+  can still be used and the controller continues from the new level; it is
+  paused while level 0 is in effect.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if the stream state is inconsistent, a parameter is
+          invalid, the current level is 0, or the library was compiled with
+          FASTEST, Z_SOLO or NO_ADAPT.
+*/
+int ZEXPORT deflateAdapt(z_streamp strm, uLong rate, uLong latency,
+                         int min_level, int max_level) {
+#ifdef ADAPT
+    deflate_state *s;
+    int rung;
+
+    if (deflateStateCheck(strm)) return Z_STREAM_ERROR;
+    s = strm->state;
+    if (rate == 0 && latency == 0) {
+        s->adapt_rate = s->adapt_latency = 0;
+        s->adapt_want = -1;
+        return Z_OK;
+    }
+    if (s->level == 0 || min_level < 0 || max_level > 9 ||
+        max_level < 1 || min_level > max_level)
+        return Z_STREAM_ERROR;
+
+    s->adapt_rate = rate;
+    s->adapt_latency = latency;
+    s->adapt_min = min_level;
+    s->adapt_max = max_level;
+    s->adapt_strategy = s->strategy == Z_HUFFMAN_ONLY ? Z_DEFAULT_STRATEGY :
+                        s->strategy;
+    s->adapt_calm = 0;
+    s->adapt_bytes = s->adapt_usec = s->adapt_worst = 0;
+
+    rung = s->strategy == Z_HUFFMAN_ONLY ? 0 : s->level;
+    s->adapt_want = rung < min_level ? min_level :
+                    rung > max_level ? max_level : -1;
+    return Z_OK;
+#else
+    (void)strm;
+    (void)rate;
+    (void)latency;
+    (void)min_level;
+    (void)max_level;
+    return Z_STREAM_ERROR;
+#endif
+}
+
+/* ========================================================================= */
+/*!
+  Return statistics of the adaptive level controller.
+
+  \param strm      deflate stream
+  \param bytes     if not Z_NULL, array of 10 values that receives the number
+                   of input bytes compressed at each level since the last
+                   deflateInit() or deflateReset(). Index 0 counts the bytes
+                   compressed on the Huffman-only rung.
+  \param switches  if not Z_NULL, receives the number of level changes made
+                   by the controller
+
+  The counters are only updated while the controller is on.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if the stream state is inconsistent or the
+          controller is not compiled in
+*/
+int ZEXPORT deflateAdaptStats(z_streamp strm, uLong *bytes, uLong *switches) {
+#ifdef ADAPT
+    deflate_state *s;
+    int n;
+
+    if (deflateStateCheck(strm)) return Z_STREAM_ERROR;
+    s = strm->state;
+    if (bytes != Z_NULL)
+        for (n = 0; n < 10; n++)
+            bytes[n] = s->adapt_hist[n];
+    if (switches != Z_NULL)
+        *switches = s->adapt_switches;
+    return Z_OK;
+#else
+    (void)strm;
+    (void)bytes;
+    (void)switches;
+    return Z_STREAM_ERROR;
+#endif
+}
+
+/* ===========================================================================
+ * Return the number of bytes the zlib or gzip wrapper adds to the deflate
+ * data, including the header supplied by deflateSetHeader(), if any.
+ */
+local uLong wrap_len(deflate_state *s) {
+    uLong wraplen;
+
+    switch (s->wrap) {
+    case 0:                                 /* raw deflate */
+        wraplen = 0;
+        break;
+    case 1:                                 /* zlib wrapper */
+        wraplen = 6 + (s->strstart ? 4 : 0);
+        break;
+#ifdef GZIP
+    case 2:                                 /* gzip wrapper */
+        wraplen = 18;
+        if (s->gzhead != Z_NULL) {          /* user-supplied gzip header */
+            Bytef *str;
+            if (s->gzhead->extra != Z_NULL)
+                wraplen += 2 + s->gzhead->extra_len;
+            str = s->gzhead->name;
+            if (str != Z_NULL)
+                do {
+                    wraplen++;
+                } while (*str++);
+            str = s->gzhead->comment;
+            if (str != Z_NULL)
+                do {
+                    wraplen++;
+                } while (*str++);
+            if (s->gzhead->hcrc)
+                wraplen += 2;
+        }
+        break;
+#endif
+    default:                                /* for compiler happiness */
+        wraplen = 6;
+    }
+    return wraplen;
+}
+
 /* ========================================================================= */
 /*!
   Returns an upper bound on the compressed size after
@@ -1145,38 +1528,7 @@ uLong ZEXPORT deflateBound(z_streamp strm, uLong sourceLen) {
 
     /* compute wrapper length */
     s = strm->state;
-    switch (s->wrap) {
-    case 0:                                 /* raw deflate */
-        wraplen = 0;
-        break;
-    case 1:                                 /* zlib wrapper */
-        wraplen = 6 + (s->strstart ? 4 : 0);
-        break;
-#ifdef GZIP
-    case 2:                                 /* gzip wrapper */
-        wraplen = 18;
-        if (s->gzhead != Z_NULL) {          /* user-supplied gzip header */
-            Bytef *str;
-            if (s->gzhead->extra != Z_NULL)
-                wraplen += 2 + s->gzhead->extra_len;
-            str = s->gzhead->name;
-            if (str != Z_NULL)
-                do {
-                    wraplen++;
-                } while (*str++);
-            str = s->gzhead->comment;
-            if (str != Z_NULL)
-                do {
-                    wraplen++;
-                } while (*str++);
-            if (s->gzhead->hcrc)
-                wraplen += 2;
-        }
-        break;
-#endif
-    default:                                /* for compiler happiness */
-        wraplen = 6;
-    }
+    wraplen = wrap_len(s);
 
     /* if not default parameters, return one of the conservative bounds */
     if (s->w_bits != 15 || s->hash_bits != 8 + 7)
@@ -1189,6 +1541,392 @@ uLong ZEXPORT deflateBound(z_streamp strm, uLong sourceLen) {
            (sourceLen >> 25) + 13 - 6 + wraplen;
 }
 
+/* ========================================================================= */
+/*!
+  Returns an upper bound on the output that deflate() has yet to produce on
+  this stream, if sourceLen more bytes of input are provided and the stream is
+  then finished with Z_FINISH.
+
+  \param strm       deflate stream, possibly in the middle of compressing
+  \param sourceLen  input still to be provided, not counting strm->avail_in
+
+  Unlike deflateBound(), which covers a whole stream from its start, the
+  bound counts only what is still owed: the output held in the pending
+  buffer, the input buffered in the window that has not been emitted in a
+  block yet, the unread strm->avail_in and sourceLen, and the part of the
+  zlib or gzip wrapper not yet written. It also accounts for the current
+  level: at level 0, stored blocks are never shorter than the window or the
+  pending buffer, whichever is smaller, except for the last one, for an
+  overhead of ~0.015% with the default parameters. The strategy does not
+  matter, since any block that would expand is emitted as a stored block
+  instead.
+
+  As with deflateBound(), the bound holds only if no flush other than
+  Z_NO_FLUSH or Z_FINISH is used from here on, and if the compression
+  parameters are not changed.
+
+  \return the bound, or deflateBound(strm, sourceLen) if the stream state is
+          invalid
+ */
+uLong ZEXPORT deflateBoundRemaining(z_streamp strm, uLong sourceLen) {
+    deflate_state *s;
+    uLong len, wraplen, min_block;
+
+    if (deflateStateCheck(strm))
+        return deflateBound(strm, sourceLen);
+    s = strm->state;
+
+    /* input not yet emitted in a block */
+    len = (uLong)((long)s->strstart - s->block_start) + s->lookahead +
+          strm->avail_in + sourceLen;
+
+    /* wrapper still to write -- all of it until the header is out */
+    if (s->status != BUSY_STATE && s->status != FINISH_STATE)
+        wraplen = wrap_len(s);
+    else
+        wraplen = s->wrap == 1 ? 4 : s->wrap == 2 ? 8 : 0;
+    wraplen += s->pending + ((s->bi_valid + 7) >> 3);
+
+    /* stored blocks of at least min_block bytes, plus a last one */
+    if (s->level == 0) {
+        min_block = s->pending_buf_size - 6 < s->w_size ?
+                    s->pending_buf_size - 6 : s->w_size;
+        return len + 5 * (len / min_block + 1) + wraplen;
+    }
+
+    /* otherwise, the same bounds as deflateBound() on what is left */
+    if (s->w_bits != 15 || s->hash_bits != 8 + 7) {
+        if (s->w_bits <= s->hash_bits)
+            return len + (len >> 3) + (len >> 8) + (len >> 9) + 4 + wraplen;
+        return len + (len >> 5) + (len >> 7) + (len >> 11) + 7 + wraplen;
+    }
+    return len + (len >> 12) + (len >> 14) + (len >> 25) + 7 + wraplen;
+}
+
+/* ===========================================================================
+ * Compressibility estimate. Up to EST_CHUNKS samples of EST_CHUNK bytes are
+ * scanned with a greedy, single probe version of deflate_fast() that uses the
+ * deflate hash function on a table of 1 << EST_HBITS entries. Matches are not
+ * inserted in the table, nor extended past the end of a sample.
+ */
+#define EST_CHUNK 8192
+#define EST_CHUNKS 8
+#define EST_HBITS 12
+#define EST_HSHIFT ((EST_HBITS + MIN_MATCH-1) / MIN_MATCH)
+#define EST_HASH(p) \
+    (((((unsigned)(p)[0] << EST_HSHIFT ^ (p)[1]) << EST_HSHIFT) ^ (p)[2]) & \
+     ((1 << EST_HBITS) - 1))
+
+/* Result of scanning one sample */
+typedef struct est_chunk_s {
+    ulg len;        /* bytes in the sample */
+    ulg lits;       /* bytes left as literals */
+    ulg matches;    /* number of matches */
+    ulg dbits;      /* bits for the matches with dynamic codes */
+    ulg fbits;      /* bits for the matches with fixed codes */
+    ulg runs;       /* number of runs of four or more equal bytes */
+    ulg run_len;    /* bytes in those runs that distance-one matches cover */
+} est_chunk;
+
+/* 256 * log2(1 + i/32), for est_log2() */
+local const uch est_mant[32] = {
+    0, 11, 22, 33, 44, 54, 63, 73, 82, 92, 100, 109, 118, 126, 134, 142,
+    150, 157, 165, 172, 179, 186, 193, 200, 207, 213, 220, 226, 232, 238,
+    244, 250};
+
+/* Weights in 1/256 units of the probed match cost for levels 1..9, fitted by
+   least squares to the output of deflate on a mix of text, markup, source
+   code, executables and random data, and the model allowance for each level
+   in percent, which covers the worst relative error of that fit. Higher
+   levels find longer and closer matches than the probe, hence the decreasing
+   weights. */
+local const uch est_match[10] = {0, 176, 165, 156, 144, 136, 132, 130, 128,
+                                 128};
+local const uch est_slack[10] = {1, 22, 24, 26, 25, 26, 25, 22, 23, 23};
+
+/* ===========================================================================
+ * Return 256 * log2(x) for x > 0, within 1/64 of a bit.
+ */
+local ulg est_log2(ulg x) {
+    int k = 0;
+
+    while (x >> (k + 1))
+        k++;
+    x = k >= 5 ? x >> (k - 5) : x << (5 - k);
+    return ((ulg)k << 8) + est_mant[x & 31];
+}
+
+/* ===========================================================================
+ * Return the number of extra bits after the code for a match length, and
+ * for a match distance.
+ */
+local int est_lextra(unsigned len) {
+    int k = 0;
+
+    if (len < 11 || len == MAX_MATCH)
+        return 0;
+    len -= MIN_MATCH;
+    while (len >> (k + 1))
+        k++;
+    return k - 2;
+}
+
+local int est_dextra(unsigned dist) {
+    int k = 0;
+
+    if (dist < 5)
+        return 0;
+    dist--;
+    while (dist >> (k + 1))
+        k++;
+    return k - 1;
+}
+
+/* ===========================================================================
+ * Scan the sample buf[0..len-1], accumulating its literals in lit[] and the
+ * rest in *c. Matches are limited to max_dist.
+ */
+local void est_scan(const Bytef *buf, ulg len, ush *head, unsigned max_dist,
+                    ulg *lit, est_chunk *c) {
+    ulg i = 0, run = 1;
+    unsigned h, n, dist;
+
+    zmemzero((Bytef *)head, sizeof(ush) << EST_HBITS);
+    zmemzero((Bytef *)c, sizeof(est_chunk));
+    c->len = len;
+    while (i < len) {
+        n = 0;
+        if (i + MIN_MATCH <= len) {
+            h = (unsigned)EST_HASH(buf + i);
+            if (head[h]) {
+                dist = (unsigned)i - (head[h] - 1);
+                if (dist <= max_dist)
+                    while (n < MAX_MATCH && i + n < len &&
+                           buf[i + n] == buf[i + n - dist])
+                        n++;
+            }
+            head[h] = (ush)(i + 1);
+        }
+        if (n >= MIN_MATCH) {
+            c->matches++;
+            c->dbits += 11 + est_lextra(n) + est_dextra(dist);
+            c->fbits += (n < 115 ? 7 : 8) + 5 + est_lextra(n) +
+                        est_dextra(dist);
+            i += n;
+            run = 1;
+            continue;
+        }
+        if (i && buf[i] == buf[i - 1]) {
+            if (++run == 4) {
+                c->runs++;
+                c->run_len += 3;
+            }
+            else if (run > 4 && (run - 1) % MAX_MATCH)
+                c->run_len++;
+        }
+        else
+            run = 1;
+        lit[buf[i++]]++;
+        c->lits++;
+    }
+}
+
+/* ===========================================================================
+ * Return the order-0 entropy in bits of the n symbols counted in freq[0..255],
+ * times n.
+ */
+local double est_entropy(const ulg *freq, ulg n) {
+    double bits = 0;
+    int k;
+
+    for (k = 0; k < 256; k++)
+        if (freq[k])
+            bits += (double)freq[k] * (est_log2(n) - est_log2(freq[k]));
+    return bits / 256;
+}
+
+/* ===========================================================================
+ * Return the square root of x >= 0, by Newton's method.
+ */
+local double est_sqrt(double x) {
+    double r = x > 1 ? x : 1;
+    int k;
+
+    if (x <= 0)
+        return 0;
+    for (k = 0; k < 64; k++)
+        r = (r + x / r) / 2;
+    return r;
+}
+
+/* ========================================================================= */
+/*!
+  Estimate the size deflate() would produce for each compression level,
+  without compressing.
+
+  \param strm       deflate stream, initialized with deflateInit() or
+                    deflateInit2()
+  \param source     data to be compressed
+  \param sourceLen  length of the data
+  \param sizes      array of 10 values that receives the estimated compressed
+                    size, wrapper included, for levels 0..9 with the strategy,
+                    window size, wrapper and gzip header of the stream
+  \param errors     if not Z_NULL, array of 10 values that receives, for each
+                    level, the error bound of the estimate in bytes
+
+  The estimate is built from up to 64K of the source, taken as eight evenly
+  spaced samples of 8K (the whole source if shorter). Each sample gets a
+  single pass of a greedy match finder that probes the deflate hash of the
+  next three bytes once and does not insert matched strings. The order-0
+  entropy of the remaining literals then gives their cost; matches are costed
+  from their length and distance codes, weighted for each level by a factor
+  fitted to the output of deflate on a mix of data. Strategies
+  Z_HUFFMAN_ONLY, Z_RLE and Z_FIXED are modeled by their own rules, and no
+  estimate is larger than the size of stored blocks.
+
+  For large sources the work is a small fraction of compressing at level 1,
+  since it is bounded by the samples and skips both the Huffman coding and
+  the output. The error bound adds twice the standard error of the samples
+  to a fixed allowance for the model of each level. It is a rough guide: data
+  with repetitions at distances greater than 8K within the window, or that
+  changes character between samples, will compress better or worse than
+  estimated.
+
+  The stream itself is not changed and can be used for compression as usual.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if the stream state is inconsistent or sizes is Z_NULL
+  \return Z_MEM_ERROR if there was not enough memory for the probe table
+*/
+int ZEXPORT deflateEstimate(z_streamp strm, const Bytef *source,
+                            uLong sourceLen, uLong *sizes, uLong *errors) {
+    deflate_state *s;
+    ush *head;
+    ulg lit[256], all[256];
+    est_chunk c[EST_CHUNKS], t;
+    ulg len, k, syms;
+    uLong wraplen, stored;
+    double scale, hlit, hall, flbits, mean, var, err, bits, mw, tree;
+    int count, level;
+
+    if (deflateStateCheck(strm) || sizes == Z_NULL ||
+        (source == Z_NULL && sourceLen != 0))
+        return Z_STREAM_ERROR;
+    s = strm->state;
+    wraplen = wrap_len(s);
+    stored = sourceLen + 5 * (sourceLen / 65535 + 1) + wraplen;
+    if (sourceLen == 0) {
+        for (level = 0; level < 10; level++) {
+            sizes[level] = (level ? 2 : 5) + wraplen;
+            if (errors != Z_NULL)
+                errors[level] = 0;
+        }
+        return Z_OK;
+    }
+
+    /* scan the samples */
+    head = (ush *) ZALLOC(strm, 1 << EST_HBITS, sizeof(ush));
+    if (head == Z_NULL)
+        return Z_MEM_ERROR;
+    zmemzero((Bytef *)lit, sizeof(lit));
+    if (sourceLen <= (uLong)EST_CHUNK * EST_CHUNKS) {
+        count = (int)((sourceLen + EST_CHUNK - 1) / EST_CHUNK);
+        for (k = 0; k < (ulg)count; k++) {
+            len = sourceLen - k * EST_CHUNK;
+            est_scan(source + k * EST_CHUNK, len < EST_CHUNK ? len : EST_CHUNK,
+                     head, MAX_DIST(s), lit, c + k);
+        }
+    }
+    else {
+        count = EST_CHUNKS;
+        for (k = 0; k < EST_CHUNKS; k++)
+            est_scan(source + (sourceLen - EST_CHUNK) / (EST_CHUNKS - 1) * k,
+                     EST_CHUNK, head, MAX_DIST(s), lit, c + k);
+    }
+    ZFREE(strm, head);
+
+    zmemzero((Bytef *)&t, sizeof(t));
+    for (k = 0; k < (ulg)count; k++) {
+        t.len += c[k].len;
+        t.lits += c[k].lits;
+        t.matches += c[k].matches;
+        t.dbits += c[k].dbits;
+        t.fbits += c[k].fbits;
+        t.runs += c[k].runs;
+        t.run_len += c[k].run_len;
+    }
+
+    /* entropy of the literals, and of all the bytes assuming the matched ones
+       are distributed as the literals, plus the cost of fixed literal codes */
+    hlit = t.lits ? est_entropy(lit, t.lits) / t.lits : 0;
+    len = 0;
+    for (k = 0; k < 256; k++) {
+        all[k] = t.lits ? lit[k] + (ulg)((double)lit[k] / t.lits *
+                                         (t.len - t.lits)) : 0;
+        len += all[k];
+    }
+    hall = len ? est_entropy(all, len) / len : 0;
+    flbits = 0;
+    for (k = 0; k < 256; k++)
+        flbits += (double)lit[k] * (k < 144 ? 8 : 9);
+    scale = (double)sourceLen / t.len;
+
+    /* twice the standard error of the level 1 prediction over the samples,
+       when they do not cover the whole source */
+    err = 0;
+    if (t.len < sourceLen) {
+        mean = var = 0;
+        for (k = 0; k < (ulg)count; k++)
+            mean += (c[k].lits * hlit + c[k].dbits) / c[k].len;
+        mean /= count;
+        for (k = 0; k < (ulg)count; k++) {
+            bits = (c[k].lits * hlit + c[k].dbits) / c[k].len - mean;
+            var += bits * bits;
+        }
+        var /= count * (count - 1);
+        err = 2 * est_sqrt(var) * sourceLen / 8;
+    }
+
+    /* predict each level, with about 60 bytes of code description for each
+       dynamic block */
+    for (level = 0; level < 10; level++) {
+        if (level == 0)
+            bits = 8.0 * (stored - wraplen);
+        else {
+            mw = est_match[level] / 256.0;
+            tree = 60 * 8;
+            if (s->strategy == Z_HUFFMAN_ONLY) {
+                bits = t.len * hall;
+                syms = t.len;
+            }
+            else if (s->strategy == Z_RLE) {
+                bits = (t.len - t.run_len) * hall + t.runs * 9.0;
+                syms = t.len - t.run_len + t.runs;
+            }
+            else if (s->strategy == Z_FIXED) {
+                bits = flbits + t.fbits * mw;
+                syms = t.lits + t.matches;
+                tree = 0;
+            }
+            else {
+                bits = t.lits * hlit + t.dbits * mw;
+                syms = t.lits + t.matches;
+            }
+            bits = bits * scale +
+                   tree * ((ulg)(syms * scale) / (s->lit_bufsize - 1) + 1);
+        }
+        sizes[level] = (uLong)(bits / 8) + 1 + wraplen;
+        if (sizes[level] > stored)
+            sizes[level] = stored;
+        if (errors != Z_NULL)
+            errors[level] = (uLong)((double)sizes[level] *
+                                    est_slack[level] / 100 +
+                                    (level ? err * sizes[level] / sizes[1] :
+                                     0)) + 1;
+    }
+    return Z_OK;
+}
+
 /* =========================================================================
  * Put a short in the pending buffer. The 16-bit value is put in MSB order.
  * IN assertion: the stream state is correct and there is enough room in
@@ -1584,11 +2322,29 @@ int ZEXPORT deflate(z_streamp strm, int flush) {
     if (strm->avail_in != 0 || s->lookahead != 0 ||
         (flush != Z_NO_FLUSH && s->status != FINISH_STATE)) {
         block_state bstate;
+#ifdef ADAPT
+        ulg start = 0;
+        uLong in = strm->total_in;
+
+        if (s->adapt_rate || s->adapt_latency) {
+            if (s->level == 0)
+                s->adapt_want = -1;     /* paused while storing */
+            if (s->adapt_want >= 0 && adapt_switch(s)) {
+                s->last_flush = -1;
+                return Z_OK;
+            }
+            start = z_thread_usec();
+        }
+#endif
 
         bstate = s->level == 0 ? deflate_stored(s, flush) :
                  s->strategy == Z_HUFFMAN_ONLY ? deflate_huff(s, flush) :
                  s->strategy == Z_RLE ? deflate_rle(s, flush) :
-                 (*(configuration_table[s->level].func))(s, flush);
+                 (*(s->func))(s, flush);
+#ifdef ADAPT
+        if (s->adapt_rate || s->adapt_latency)
+            adapt_update(s, strm->total_in - in, z_thread_usec() - start);
+#endif
 
         if (bstate == finish_started || bstate == finish_done) {
             s->status = FINISH_STATE;
@@ -1683,6 +2439,9 @@ int ZEXPORT deflateEnd(z_streamp strm) {
     status = strm->state->status;
 
     /* Deallocate in reverse order of allocations: */
+    TRY_FREE(strm, strm->state->bucket_mem);
+    TRY_FREE(strm, strm->state->tree_son);
+    TRY_FREE(strm, strm->state->tree_head);
     TRY_FREE(strm, strm->state->pending_buf);
     TRY_FREE(strm, strm->state->head);
     TRY_FREE(strm, strm->state->prev);
@@ -1741,9 +2500,20 @@ int ZEXPORT deflateCopy (z_streamp dest, z_streamp source) {
     ds->prev   = (Posf *)  ZALLOC(dest, ds->w_size, sizeof(Pos));
     ds->head   = (Posf *)  ZALLOC(dest, ds->hash_size, sizeof(Pos));
     ds->pending_buf = (uchf *) ZALLOC(dest, ds->lit_bufsize, 4);
+    ds->tree_head = ds->tree_son = Z_NULL;
+    if (ss->tree_head != Z_NULL) {
+        ds->tree_head = (Posf *) ZALLOC(dest, ds->hash_size, sizeof(Pos));
+        ds->tree_son  = (Posf *) ZALLOC(dest, ds->w_size, 2*sizeof(Pos));
+    }
+    ds->buckets = Z_NULL;
+    ds->bucket_mem = Z_NULL;
+    if (ss->buckets != Z_NULL)
+        bucket_alloc(ds);
 
     if (ds->window == Z_NULL || ds->prev == Z_NULL || ds->head == Z_NULL ||
-        ds->pending_buf == Z_NULL) {
+        ds->pending_buf == Z_NULL || (ss->tree_head != Z_NULL &&
+        (ds->tree_head == Z_NULL || ds->tree_son == Z_NULL)) ||
+        (ss->buckets != Z_NULL && ds->buckets == Z_NULL)) {
         deflateEnd (dest);
         return Z_MEM_ERROR;
     }
@@ -1752,6 +2522,15 @@ int ZEXPORT deflateCopy (z_streamp dest, z_streamp source) {
     zmemcpy((voidpf)ds->prev, (voidpf)ss->prev, ds->w_size * sizeof(Pos));
     zmemcpy((voidpf)ds->head, (voidpf)ss->head, ds->hash_size * sizeof(Pos));
     zmemcpy(ds->pending_buf, ss->pending_buf, (uInt)ds->pending_buf_size);
+    if (ss->tree_head != Z_NULL) {
+        zmemcpy((voidpf)ds->tree_head, (voidpf)ss->tree_head,
+                ds->hash_size * sizeof(Pos));
+        zmemcpy((voidpf)ds->tree_son, (voidpf)ss->tree_son,
+                ds->w_size * 2 * sizeof(Pos));
+    }
+    if (ss->buckets != Z_NULL)
+        zmemcpy((voidpf)ds->buckets, (voidpf)ss->buckets,
+                (unsigned)sizeof(bucket) << ds->bucket_bits);
 
     ds->pending_out = ds->pending_buf + (ss->pending_out - ss->pending_buf);
 #ifdef LIT_MEM
@@ -1771,155 +2550,317 @@ int ZEXPORT deflateCopy (z_streamp dest, z_streamp source) {
 
 #ifndef FASTEST
 /* ===========================================================================
- * Set match_start to the longest match starting at the given string and
- * return its length. Matches shorter or equal to prev_length are discarded,
- * in which case the result is equal to prev_length and match_start is
- * garbage.
- * IN assertions: cur_match is the head of the hash chain for the current
- *   string (strstart) and its distance is <= MAX_DIST, and prev_length >= 1
- * OUT assertion: the match length is not greater than s->lookahead.
+ * Note that the len bytes at pos repeat those at match when they overlap
+ * them, as in runs and other periodic data, unless the repeat already known
+ * goes further. Since the strings are inserted in order, each byte from pos
+ * up to tree_end is then equal to the one tree_dist before it.
  */
-local uInt longest_match(deflate_state *s, IPos cur_match) {
-    unsigned chain_length = s->max_chain_length;/* max hash chain length */
-    register Bytef *scan = s->window + s->strstart; /* current string */
-    register Bytef *match;                      /* matched string */
-    register int len;                           /* length of current match */
-    int best_len = (int)s->prev_length;         /* best match length so far */
-    int nice_match = s->nice_match;             /* stop if match long enough */
-    IPos limit = s->strstart > (IPos)MAX_DIST(s) ?
-        s->strstart - (IPos)MAX_DIST(s) : NIL;
-    /* Stop when cur_match becomes <= limit. To simplify the code,
-     * we prevent matches with the string of window index 0.
-     */
-    Posf *prev = s->prev;
+#define TREE_REPEAT(s, pos, match, len) \
+    do { \
+        if ((pos) - (match) < (len) && (pos) + (len) > (s)->tree_end) { \
+            (s)->tree_dist = (pos) - (match); \
+            (s)->tree_end = (pos) + (len); \
+        } \
+    } while (0)
+
+/* ===========================================================================
+ * Number of strings inserted at the end of a repeat, whose tails differ from
+ * those tree_dist before them.
+ */
+#define TREE_KEEP 8
+
+/* ===========================================================================
+ * Extend the repeat known up to tree_end as far as the bytes before end
+ * allow, and return the number of its bytes from pos on, or 0 if pos is not
+ * in it. Each byte is compared once, however many strings of the repeat are
+ * looked at.
+ */
+local uInt tree_repeat(deflate_state *s, IPos pos, uInt end) {
+    Bytef *w = s->window;
+    uInt e = s->tree_end, dist = s->tree_dist;
+
+    if (e <= pos)
+        return 0;
+    while (e < end && w[e] == w[e - dist])
+        e++;
+    s->tree_end = e;
+    return e - pos;
+}
+
+/* ===========================================================================
+ * Insert the string at pos, which has avail >= MIN_MATCH valid bytes, in the
+ * binary tree for its hash value. The tree is walked down from the root, the
+ * newest string, comparing each string with the new one and going to its
+ * smaller or greater child. The strings passed on the way are relinked as the
+ * smaller and greater subtrees of the new string, which becomes the root. Each
+ * comparison can start where the closest smaller and greater strings so far
+ * stopped matching, since all of the strings below them share at least that
+ * much with the new one. A string equal to the new one up to nice_match bytes,
+ * or up to avail if less, cannot be ordered against it, and is replaced by it,
+ * the closer of the two. The walk stops at strings further than MAX_DIST, or
+ * after a number of nodes that depends on max_chain_length, dropping what is
+ * below, as this bounds the time spent on each string. A string met on the way
+ * that overlaps the new one is noted with TREE_REPEAT().
+ *
+ * If find is true, set match_start to the longest match on the way and return
+ * its length, or prev_length if no match is longer, like longest_match().
+ * Otherwise return 0.
+ */
+local uInt tree_insert(deflate_state *s, IPos pos, uInt avail, int find) {
+    Bytef *cur = s->window + pos;               /* new string */
+    Bytef *match;                               /* string in the tree */
+    Bytef *scan, *end;                          /* compare cur up to end */
+    Posf *left, *right;                         /* where to link the next
+                                                   smaller, greater string */
+    Posf *pair;                                 /* children of match */
     uInt wmask = s->w_mask;
+    uInt len, less = 0, more = 0;   /* matched bytes of the closest smaller
+                                       and greater strings */
+    uInt limit = (uInt)s->nice_match;           /* replace at this length */
+    uInt best = find ? s->prev_length : 0;
+    unsigned depth = (s->max_chain_length >> 4) + 16;
+    IPos cur_match, best_match = NIL;
+    IPos stop = pos > (IPos)MAX_DIST(s) ? pos - (IPos)MAX_DIST(s) : NIL;
+    uInt h;
+
+    if (limit > MAX_MATCH) limit = MAX_MATCH;
+    if (limit < MIN_MATCH) limit = MIN_MATCH;
+    if (limit > avail) limit = avail;
+    end = cur + limit;
+    h = (((uInt)cur[0] << s->hash_shift) ^ cur[1]) & s->hash_mask;
+    UPDATE_HASH(s, h, cur[2]);
+    cur_match = s->tree_head[h];
+    s->tree_head[h] = (Pos)pos;
+    left = s->tree_son + 2 * (pos & wmask);
+    right = left + 1;
 
-#ifdef UNALIGNED_OK
-    /* Compare two bytes at a time. Note: this is not always beneficial.
-     * Try with and without -DUNALIGNED_OK to check.
-     */
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH - 1;
-    register ush scan_start = *(ushf*)scan;
-    register ush scan_end   = *(ushf*)(scan + best_len - 1);
-#else
-    register Bytef *strend = s->window + s->strstart + MAX_MATCH;
-    register Byte scan_end1  = scan[best_len - 1];
-    register Byte scan_end   = scan[best_len];
-#endif
+    for (;;) {
+        if (cur_match <= stop || depth-- == 0) {
+            *left = *right = NIL;
+            break;
+        }
+        Assert(cur_match < pos, "no future");
+        match = s->window + cur_match;
+        pair = s->tree_son + 2 * (cur_match & wmask);
+        len = less < more ? less : more;
+        if (match[len] == cur[len]) {
+            /* Compare four bytes at a time up to limit, going past it by at
+             * most three bytes, which are in the window since limit is at
+             * most MAX_MATCH and pos <= strstart.
+             */
+            scan = cur + len;
+            match += len;
+            do {
+            } while (*++scan == *++match && *++scan == *++match &&
+                     *++scan == *++match && *++scan == *++match &&
+                     scan < end);
+            len = scan < end ? (uInt)(scan - cur) : limit;
+            match = s->window + cur_match;
+            TREE_REPEAT(s, pos, cur_match, len);
+            if (len > best) {
+                best = len;
+                best_match = cur_match;
+            }
+            if (len == limit) {
+                /* take the place of match, which has the same children */
+                *left = pair[0];
+                *right = pair[1];
+                break;
+            }
+        }
+        if (match[len] < cur[len]) {
+            *left = (Pos)cur_match;
+            left = pair + 1;
+            cur_match = *left;
+            less = len;
+        }
+        else {
+            *right = (Pos)cur_match;
+            right = pair;
+            cur_match = *right;
+            more = len;
+        }
+    }
 
-    /* The code is optimized for HASH_BITS >= 8 and MAX_MATCH-2 multiple of 16.
-     * It is easy to get rid of this optimization if necessary.
-     */
-    Assert(s->hash_bits >= 8 && MAX_MATCH == 258, "Code too clever");
+    if (!find)
+        return 0;
+    if (best_match != NIL) {
+        /* measure the match again from its start, since a match cut at
+           nice_match may be longer, and since strings inserted with less
+           avail or another nice_match can be out of order in the tree, which
+           makes the lengths found on the way only a guide */
+        match = s->window + best_match;
+        if (avail > MAX_MATCH) avail = MAX_MATCH;
+        len = 0;
+        while (len < avail && match[len] == cur[len])
+            len++;
+        TREE_REPEAT(s, pos, best_match, len);
+        if (len > s->prev_length) {
+            s->match_start = best_match;
+            return len;
+        }
+    }
+    return s->prev_length;
+}
 
-    /* Do not waste too much time if we already have a good match: */
-    if (s->prev_length >= s->good_match) {
-        chain_length >>= 2;
+/* ===========================================================================
+ * Insert the strings up to strstart in the binary trees of Z_MATCH_TREE,
+ * starting after the last one inserted, but no further back than MAX_DIST,
+ * and return the longest match for strstart as tree_insert() does, or
+ * MIN_MATCH-1 if find is false. The strings skipped by matches, given by
+ * deflateSetDictionary(), or added while the trees were not in use are caught
+ * up on here.
+ *
+ * The strings in a repeat noted by TREE_REPEAT() are not inserted, but for
+ * the last TREE_KEEP ones, since each is equal to the one tree_dist before it
+ * for the rest of the repeat. This keeps runs from costing a walk per byte
+ * through trees that hold the same run at every length, as with chains the
+ * strings inside a match are not searched. The match for strstart in such a
+ * repeat is the string tree_dist before it if the repeat reaches nice_match,
+ * which is the closest as long as the data keeps repeating, and is otherwise
+ * looked for in the tree.
+ * IN assertion: lookahead >= MIN_MATCH, so that all of the strings have at
+ *   least MIN_MATCH valid bytes.
+ */
+local uInt tree_match(deflate_state *s, int find) {
+    IPos pos = s->tree_next;
+    uInt end = s->strstart + s->lookahead;
+    uInt limit = (uInt)s->nice_match;
+    uInt len;
+
+    if (pos < s->strstart && s->strstart - pos > MAX_DIST(s))
+        pos = s->strstart - MAX_DIST(s);
+    while (pos < s->strstart) {
+        len = tree_repeat(s, pos, end);
+        if (len > TREE_KEEP)
+            pos += len - TREE_KEEP;
+        else {
+            tree_insert(s, pos, end - pos, 0);
+            pos++;
+        }
     }
-    /* Do not look for matches beyond the end of the input. This is necessary
-     * to make deflate deterministic.
-     */
-    if ((uInt)nice_match > s->lookahead) nice_match = (int)s->lookahead;
+    s->tree_next = pos > s->strstart ? pos : s->strstart + 1;
+
+    len = tree_repeat(s, s->strstart, end);
+    if (limit > MAX_MATCH) limit = MAX_MATCH;
+    if (limit > s->lookahead) limit = s->lookahead;
+    if (find && len >= limit) {
+        if (len > MAX_MATCH) len = MAX_MATCH;
+        if (len <= s->prev_length)
+            return s->prev_length;
+        s->match_start = s->strstart - s->tree_dist;
+        return len;
+    }
+    if (!find && (pos > s->strstart || len > TREE_KEEP))
+        return MIN_MATCH-1;
+    len = tree_insert(s, s->strstart, s->lookahead, find);
+    return find ? len : MIN_MATCH-1;
+}
 
-    Assert((ulg)s->strstart <= s->window_size - MIN_LOOKAHEAD,
-           "need lookahead");
+/* ===========================================================================
+ * First four bytes of the string at p, low byte first, which compilers read
+ * at once where they can, and the bucket of Z_MATCH_BUCKET for a string with
+ * that key, from a multiplicative hash of its first MIN_MATCH bytes.
+ */
+#define BUCKET_KEY(p) \
+    ((ulg)(p)[0] | ((ulg)(p)[1] << 8) | ((ulg)(p)[2] << 16) | \
+     ((ulg)(p)[3] << 24))
+#define BUCKET_OF(s, key) \
+    ((s)->buckets + (unsigned)((((key) & 0xffffffUL) * 2654435761UL & \
+                                0xffffffffUL) >> (32 - (s)->bucket_bits)))
 
-    do {
-        Assert(cur_match < s->strstart, "no future");
-        match = s->window + cur_match;
+/* ===========================================================================
+ * Insert the string at str in its bucket of Z_MATCH_BUCKET, in place of the
+ * oldest one there.
+ * IN assertion: the four bytes at str are in the window.
+ */
+local void bucket_insert(deflate_state *s, IPos str) {
+    ulg key = BUCKET_KEY(s->window + str);
+    bucket *b = BUCKET_OF(s, key);
+    unsigned i = b->next;
+
+    b->pos[i] = (Pos)str;
+    b->key[0][i] = (ush)key;
+    b->key[1][i] = (ush)(key >> 16);
+    b->next = (ush)(i + 1 == BUCKET_WAYS ? 0 : i + 1);
+}
 
-        /* Skip to next match if the match length cannot increase
-         * or if the match length is less than 2.  Note that the checks below
-         * for insufficient lookahead only occur occasionally for performance
-         * reasons.  Therefore uninitialized memory will be accessed, and
-         * conditional jumps will be made that depend on those values.
-         * However the length of the match is limited to the lookahead, so
-         * the output of deflate is not affected by the uninitialized values.
-         */
-#if (defined(UNALIGNED_OK) && MAX_MATCH == 258)
-        /* This code assumes sizeof(unsigned short) == 2. Do not use
-         * UNALIGNED_OK if your compiler uses a different size.
-         */
-        if (*(ushf*)(match + best_len - 1) != scan_end ||
-            *(ushf*)match != scan_start) continue;
-
-        /* It is not necessary to compare scan[2] and match[2] since they are
-         * always equal when the other bytes match, given that the hash keys
-         * are equal and that HASH_BITS >= 8. Compare 2 bytes at a time at
-         * strstart + 3, + 5, up to strstart + 257. We check for insufficient
-         * lookahead only every 4th comparison; the 128th check will be made
-         * at strstart + 257. If MAX_MATCH-2 is not a multiple of 8, it is
-         * necessary to put more guard bytes at the end of the window, or
-         * to check more often for insufficient lookahead.
-         */
-        Assert(scan[2] == match[2], "scan[2]?");
-        scan++, match++;
-        do {
-        } while (*(ushf*)(scan += 2) == *(ushf*)(match += 2) &&
-                 *(ushf*)(scan += 2) == *(ushf*)(match += 2) &&
-                 *(ushf*)(scan += 2) == *(ushf*)(match += 2) &&
-                 *(ushf*)(scan += 2) == *(ushf*)(match += 2) &&
-                 scan < strend);
-        /* The funny "do {}" generates better code on most compilers */
-
-        /* Here, scan <= window + strstart + 257 */
-        Assert(scan <= s->window + (unsigned)(s->window_size - 1),
-               "wild scan");
-        if (*scan == *match) scan++;
-
-        len = (MAX_MATCH - 1) - (int)(strend - scan);
-        scan = strend - (MAX_MATCH-1);
-
-#else /* UNALIGNED_OK */
-
-        if (match[best_len]     != scan_end  ||
-            match[best_len - 1] != scan_end1 ||
-            *match              != *scan     ||
-            *++match            != scan[1])      continue;
-
-        /* The check at best_len - 1 can be removed because it will be made
-         * again later. (This heuristic is not always a win.)
-         * It is not necessary to compare scan[2] and match[2] since they
-         * are always equal when the other bytes match, given that
-         * the hash keys are equal and that HASH_BITS >= 8.
-         */
-        scan += 2, match++;
-        Assert(*scan == *match, "match[2]?");
+/* ===========================================================================
+ * Look for a match to the string at strstart in its bucket of Z_MATCH_BUCKET
+ * if find is true, and then insert the string. The strings of the bucket are
+ * tried newest first, up to max_chain_length of them, and those whose first
+ * bytes differ from the ones needed to beat the best match so far are passed
+ * over without reading the window, so that a search costs one cache line for
+ * the bucket plus one for each string that is compared. Return the length of
+ * the longest match and set match_start, as longest_match() does, or return
+ * MIN_MATCH-1 if find is false.
+ * IN assertion: lookahead >= MIN_MATCH.
+ */
+local uInt bucket_match(deflate_state *s, int find) {
+    Bytef *scan = s->window + s->strstart;      /* current string */
+    Bytef *strend = scan + MAX_MATCH;
+    Bytef *match;
+    ulg key = BUCKET_KEY(scan), need;
+    bucket *b = BUCKET_OF(s, key);
+    unsigned i = b->next, chain = s->max_chain_length;
+    uInt best = s->prev_length, nice = (uInt)s->nice_match, len;
+    IPos cur, stop = s->strstart > (IPos)MAX_DIST(s) ?
+                     s->strstart - (IPos)MAX_DIST(s) : NIL;
 
-        /* We check for insufficient lookahead only every 8th comparison;
-         * the 256th check will be made at strstart + 258.
-         */
-        do {
-        } while (*++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 *++scan == *++match && *++scan == *++match &&
-                 scan < strend);
-
-        Assert(scan <= s->window + (unsigned)(s->window_size - 1),
-               "wild scan");
-
-        len = MAX_MATCH - (int)(strend - scan);
-        scan = strend - MAX_MATCH;
-
-#endif /* UNALIGNED_OK */
-
-        if (len > best_len) {
-            s->match_start = cur_match;
-            best_len = len;
-            if (len >= nice_match) break;
-#ifdef UNALIGNED_OK
-            scan_end = *(ushf*)(scan + best_len - 1);
-#else
-            scan_end1  = scan[best_len - 1];
-            scan_end   = scan[best_len];
-#endif
+    Assert((ulg)s->strstart <= s->window_size - MIN_LOOKAHEAD,
+           "need lookahead");
+
+    if (find) {
+        if (best >= s->good_match) chain >>= 2;
+        if (chain > BUCKET_WAYS) chain = BUCKET_WAYS;
+        if (nice > s->lookahead) nice = s->lookahead;
+
+        /* a longer match than best needs the same bytes 0-2, or 0-3 once
+           best has MIN_MATCH -- the keys are only a filter, since the bytes
+           after the input were not known when a string near its end was
+           inserted, and since the hash does not separate all strings */
+        need = best < MIN_MATCH ? 0xffffffUL : 0xffffffffUL;
+        while (chain--) {
+            i = i ? i - 1 : BUCKET_WAYS - 1;
+            cur = b->pos[i];
+            if (cur <= stop)
+                break;          /* empty, or too far as are all older ones */
+            Assert(cur < s->strstart, "no future");
+            if ((((ulg)b->key[1][i] << 16 | b->key[0][i]) ^ key) & need)
+                continue;
+            match = s->window + cur;
+            if (match[best] != scan[best] || match[0] != scan[0] ||
+                match[1] != scan[1] || match[2] != scan[2])
+                continue;
+
+            /* as in longest_match(), the last check is at strstart + 258 */
+            scan += 2;
+            match += 2;
+            do {
+            } while (*++scan == *++match && *++scan == *++match &&
+                     *++scan == *++match && *++scan == *++match &&
+                     *++scan == *++match && *++scan == *++match &&
+                     *++scan == *++match && *++scan == *++match &&
+                     scan < strend);
+            len = MAX_MATCH - (uInt)(strend - scan);
+            scan = strend - MAX_MATCH;
+            if (len > best) {
+                s->match_start = cur;
+                best = len;
+                need = 0xffffffffUL;
+                if (len >= nice) break;
+            }
         }
-    } while ((cur_match = prev[cur_match & wmask]) > limit
-             && --chain_length != 0);
+    }
 
-    if ((uInt)best_len <= s->lookahead) return (uInt)best_len;
-    return s->lookahead;
+    i = b->next;
+    b->pos[i] = (Pos)s->strstart;
+    b->key[0][i] = (ush)key;
+    b->key[1][i] = (ush)(key >> 16);
+    b->next = (ush)(i + 1 == BUCKET_WAYS ? 0 : i + 1);
+    if (!find)
+        return MIN_MATCH-1;
+    return best <= s->lookahead ? best : s->lookahead;
 }
 
 #else /* FASTEST */
@@ -2035,6 +2976,122 @@ local void check_match(deflate_state *s, IPos start, IPos match, int length) {
 /* Minimum of a and b. */
 #define MIN(a, b) ((a) > (b) ? (b) : (a))
 
+#ifdef ADAPT
+/* Input bytes in one sampling window of the adaptive controller, the least
+ * time worth measuring in a window, and the number of calm windows needed
+ * before moving up one level.
+ */
+#define ADAPT_WINDOW 65536L
+#define ADAPT_MIN_USEC 1000
+#define ADAPT_CALM 2
+
+/* ===========================================================================
+ * Compression function for a rung of the adaptive controller.
+ */
+local compress_func adapt_func(int level, int strategy) {
+    return strategy == Z_HUFFMAN_ONLY ? deflate_huff :
+           strategy == Z_RLE ? deflate_rle :
+           configuration_table[level].func;
+}
+
+/* ===========================================================================
+ * Move to the rung requested by adapt_update(). When leaving deflate_slow()
+ * the literal held back for a lazy match is emitted first, so that no block
+ * has to be ended as deflateParams() does. Return true if that literal filled
+ * the block and its compressed data could not be written out entirely, in
+ * which case deflate() must return for more output space.
+ */
+local int adapt_switch(deflate_state *s) {
+    int level, strategy;
+
+    level = s->adapt_want ? s->adapt_want : 1;
+    strategy = s->adapt_want ? s->adapt_strategy : Z_HUFFMAN_ONLY;
+    s->adapt_want = -1;
+    if (adapt_func(s->level, s->strategy) != adapt_func(level, strategy)) {
+        if (s->match_available) {
+            int bflush;
+            _tr_tally_lit(s, s->window[s->strstart - 1], bflush);
+            s->match_available = 0;
+            if (bflush) FLUSH_BLOCK_ONLY(s, 0);
+        }
+        s->match_length = s->prev_length = MIN_MATCH-1;
+    }
+    s->level = level;
+    s->strategy = strategy;
+    s->max_lazy_match   = configuration_table[level].max_lazy;
+    s->good_match       = configuration_table[level].good_length;
+    s->nice_match       = configuration_table[level].nice_length;
+    s->max_chain_length = configuration_table[level].max_chain;
+    s->func = level_func(s, level);
+    s->adapt_switches++;
+    return s->pending != 0;
+}
+
+/* ===========================================================================
+ * Account for one call of the compression function that consumed bytes of
+ * input in usec microseconds, and decide if the level should change.
+ */
+local void adapt_update(deflate_state *s, ulg bytes, ulg usec) {
+    int rung, step;
+
+    if (s->level == 0)
+        return;                         /* paused while storing */
+    rung = s->strategy == Z_HUFFMAN_ONLY ? 0 : s->level;
+    s->adapt_hist[rung] += bytes;
+    s->adapt_bytes += bytes;
+    s->adapt_usec += usec;
+    if (usec > s->adapt_worst)
+        s->adapt_worst = usec;
+
+    if (s->adapt_latency && usec > s->adapt_latency)
+        step = -1;                      /* this call alone broke the bound */
+    else if (s->adapt_bytes < ADAPT_WINDOW ||
+             (s->adapt_usec < ADAPT_MIN_USEC &&
+              s->adapt_bytes < (ADAPT_WINDOW << 4)))
+        return;                         /* not enough to judge yet */
+    else {
+        /* compare input KB/s against the target and the calm threshold */
+        double rate = s->adapt_usec == 0 ? 1e30 :
+                      (double)s->adapt_bytes * (1000000.0 / 1024) /
+                      s->adapt_usec;
+
+        if (s->adapt_rate && rate < s->adapt_rate)
+            step = -1;
+        else if ((s->adapt_rate == 0 ||
+                  rate >= s->adapt_rate + (s->adapt_rate >> 1)) &&
+                 (s->adapt_latency == 0 ||
+                  s->adapt_worst <= s->adapt_latency >> 1))
+            step = ++s->adapt_calm >= ADAPT_CALM;
+        else
+            step = 0, s->adapt_calm = 0;
+    }
+    s->adapt_bytes = s->adapt_usec = s->adapt_worst = 0;
+
+    if (step) {
+        s->adapt_calm = 0;
+        rung += step;
+        if (rung < s->adapt_min) rung = s->adapt_min;
+        if (rung > s->adapt_max) rung = s->adapt_max;
+        if (rung != (s->strategy == Z_HUFFMAN_ONLY ? 0 : s->level))
+            s->adapt_want = rung;
+    }
+}
+#endif /* ADAPT */
+
+/* ===========================================================================
+ * Prepare the hash table for matching again when leaving level 0, after
+ * deflate_stored() inserted no strings but moved the window s->matches times.
+ */
+local void leave_stored(deflate_state *s) {
+    if (s->matches != 0) {
+        if (s->matches == 1)
+            slide_hash(s);
+        else
+            CLEAR_HASH(s);
+        s->matches = 0;
+    }
+}
+
 /* ===========================================================================
  * Copy without compression as much as possible from the input stream, return
  * the current block state.
@@ -2227,234 +3284,35 @@ local block_state deflate_stored(deflate_state *s, int flush) {
     return last ? finish_started : need_more;
 }
 
-/* ===========================================================================
- * Compress as much as possible from the input stream, return the current
- * block state.
- * This function does not perform lazy evaluation of matches and inserts
- * new strings in the dictionary only for unmatched strings or for short
- * matches. It is used only for the fast compression options.
- */
-local block_state deflate_fast(deflate_state *s, int flush) {
-    IPos hash_head;       /* head of the hash chain */
-    int bflush;           /* set if current block must be flushed */
-
-    for (;;) {
-        /* Make sure that we always have enough lookahead, except
-         * at the end of the input file. We need MAX_MATCH bytes
-         * for the next match, plus MIN_MATCH bytes to insert the
-         * string following the next match.
-         */
-        if (s->lookahead < MIN_LOOKAHEAD) {
-            fill_window(s);
-            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
-                return need_more;
-            }
-            if (s->lookahead == 0) break; /* flush the current block */
-        }
-
-        /* Insert the string window[strstart .. strstart + 2] in the
-         * dictionary, and set hash_head to the head of the hash chain:
-         */
-        hash_head = NIL;
-        if (s->lookahead >= MIN_MATCH) {
-            INSERT_STRING(s, s->strstart, hash_head);
-        }
-
-        /* Find the longest match, discarding those <= prev_length.
-         * At this point we have always match_length < MIN_MATCH
-         */
-        if (hash_head != NIL && s->strstart - hash_head <= MAX_DIST(s)) {
-            /* To simplify the code, we prevent matches with the string
-             * of window index 0 (in particular we have to avoid a match
-             * of the string with itself at the start of the input file).
-             */
-            s->match_length = longest_match (s, hash_head);
-            /* longest_match() sets match_start */
-        }
-        if (s->match_length >= MIN_MATCH) {
-            check_match(s, s->strstart, s->match_start, s->match_length);
-
-            _tr_tally_dist(s, s->strstart - s->match_start,
-                           s->match_length - MIN_MATCH, bflush);
-
-            s->lookahead -= s->match_length;
-
-            /* Insert new strings in the hash table only if the match length
-             * is not too large. This saves time but degrades compression.
-             */
-#ifndef FASTEST
-            if (s->match_length <= s->max_insert_length &&
-                s->lookahead >= MIN_MATCH) {
-                s->match_length--; /* string at strstart already in table */
-                do {
-                    s->strstart++;
-                    INSERT_STRING(s, s->strstart, hash_head);
-                    /* strstart never exceeds WSIZE-MAX_MATCH, so there are
-                     * always MIN_MATCH bytes ahead.
-                     */
-                } while (--s->match_length != 0);
-                s->strstart++;
-            } else
-#endif
-            {
-                s->strstart += s->match_length;
-                s->match_length = 0;
-                s->ins_h = s->window[s->strstart];
-                UPDATE_HASH(s, s->ins_h, s->window[s->strstart + 1]);
-#if MIN_MATCH != 3
-                Call UPDATE_HASH() MIN_MATCH-3 more times
-#endif
-                /* If lookahead < MIN_MATCH, ins_h is garbage, but it does not
-                 * matter since it will be recomputed at next deflate call.
-                 */
-            }
-        } else {
-            /* No match, output a literal byte */
-            Tracevv((stderr,"%c", s->window[s->strstart]));
-            _tr_tally_lit(s, s->window[s->strstart], bflush);
-            s->lookahead--;
-            s->strstart++;
-        }
-        if (bflush) FLUSH_BLOCK(s, 0);
-    }
-    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
-    if (flush == Z_FINISH) {
-        FLUSH_BLOCK(s, 1);
-        return finish_done;
-    }
-    if (s->sym_next)
-        FLUSH_BLOCK(s, 0);
-    return block_done;
-}
-
-#ifndef FASTEST
-/* ===========================================================================
- * Same as above, but achieves better compression. We use a lazy
- * evaluation for matches: a match is finally adopted only if there is
- * no better match at the next window position.
- */
-local block_state deflate_slow(deflate_state *s, int flush) {
-    IPos hash_head;          /* head of hash chain */
-    int bflush;              /* set if current block must be flushed */
-
-    /* Process the input block. */
-    for (;;) {
-        /* Make sure that we always have enough lookahead, except
-         * at the end of the input file. We need MAX_MATCH bytes
-         * for the next match, plus MIN_MATCH bytes to insert the
-         * string following the next match.
-         */
-        if (s->lookahead < MIN_LOOKAHEAD) {
-            fill_window(s);
-            if (s->lookahead < MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
-                return need_more;
-            }
-            if (s->lookahead == 0) break; /* flush the current block */
-        }
-
-        /* Insert the string window[strstart .. strstart + 2] in the
-         * dictionary, and set hash_head to the head of the hash chain:
-         */
-        hash_head = NIL;
-        if (s->lookahead >= MIN_MATCH) {
-            INSERT_STRING(s, s->strstart, hash_head);
-        }
-
-        /* Find the longest match, discarding those <= prev_length.
-         */
-        s->prev_length = s->match_length, s->prev_match = s->match_start;
-        s->match_length = MIN_MATCH-1;
-
-        if (hash_head != NIL && s->prev_length < s->max_lazy_match &&
-            s->strstart - hash_head <= MAX_DIST(s)) {
-            /* To simplify the code, we prevent matches with the string
-             * of window index 0 (in particular we have to avoid a match
-             * of the string with itself at the start of the input file).
-             */
-            s->match_length = longest_match (s, hash_head);
-            /* longest_match() sets match_start */
-
-            if (s->match_length <= 5 && (s->strategy == Z_FILTERED
-#if TOO_FAR <= 32767
-                || (s->match_length == MIN_MATCH &&
-                    s->strstart - s->match_start > TOO_FAR)
+/* the match loops, longest_match(), deflate_fast() and deflate_slow() */
+#define LOOP(name) name
+#include "deflate_loops.h"
+#undef LOOP
+
+#ifdef LOOPS_15_8
+/* the same for windowBits 15 and memLevel 8, named with _15_8, with the
+   window and hash sizes as constants, so that the compiler can drop the loads
+   of the masks and fold them into the code */
+#undef H_SHIFT
+#undef H_MASK
+#undef W_MASK
+#undef MAX_DIST
+#define H_SHIFT(s) 5
+#define H_MASK(s) 0x7fffU
+#define W_MASK(s) 0x7fffU
+#define MAX_DIST(s) (32768U - MIN_LOOKAHEAD)
+#define LOOP(name) name##_15_8
+#include "deflate_loops.h"
+#undef LOOP
+#undef H_SHIFT
+#undef H_MASK
+#undef W_MASK
+#undef MAX_DIST
+#define H_SHIFT(s) ((s)->hash_shift)
+#define H_MASK(s) ((s)->hash_mask)
+#define W_MASK(s) ((s)->w_mask)
+#define MAX_DIST(s)  ((s)->w_size-MIN_LOOKAHEAD)
 #endif
-                )) {
-
-                /* If prev_match is also MIN_MATCH, match_start is garbage
-                 * but we will ignore the current match anyway.
-                 */
-                s->match_length = MIN_MATCH-1;
-            }
-        }
-        /* If there was a match at the previous step and the current
-         * match is not better, output the previous match:
-         */
-        if (s->prev_length >= MIN_MATCH && s->match_length <= s->prev_length) {
-            uInt max_insert = s->strstart + s->lookahead - MIN_MATCH;
-            /* Do not insert strings in hash table beyond this. */
-
-            check_match(s, s->strstart - 1, s->prev_match, s->prev_length);
-
-            _tr_tally_dist(s, s->strstart - 1 - s->prev_match,
-                           s->prev_length - MIN_MATCH, bflush);
-
-            /* Insert in hash table all strings up to the end of the match.
-             * strstart - 1 and strstart are already inserted. If there is not
-             * enough lookahead, the last two strings are not inserted in
-             * the hash table.
-             */
-            s->lookahead -= s->prev_length - 1;
-            s->prev_length -= 2;
-            do {
-                if (++s->strstart <= max_insert) {
-                    INSERT_STRING(s, s->strstart, hash_head);
-                }
-            } while (--s->prev_length != 0);
-            s->match_available = 0;
-            s->match_length = MIN_MATCH-1;
-            s->strstart++;
-
-            if (bflush) FLUSH_BLOCK(s, 0);
-
-        } else if (s->match_available) {
-            /* If there was no match at the previous position, output a
-             * single literal. If there was a match but the current match
-             * is longer, truncate the previous match to a single literal.
-             */
-            Tracevv((stderr,"%c", s->window[s->strstart - 1]));
-            _tr_tally_lit(s, s->window[s->strstart - 1], bflush);
-            if (bflush) {
-                FLUSH_BLOCK_ONLY(s, 0);
-            }
-            s->strstart++;
-            s->lookahead--;
-            if (s->strm->avail_out == 0) return need_more;
-        } else {
-            /* There is no previous match to compare with, wait for
-             * the next step to decide.
-             */
-            s->match_available = 1;
-            s->strstart++;
-            s->lookahead--;
-        }
-    }
-    Assert (flush != Z_NO_FLUSH, "no flush?");
-    if (s->match_available) {
-        Tracevv((stderr,"%c", s->window[s->strstart - 1]));
-        _tr_tally_lit(s, s->window[s->strstart - 1], bflush);
-        s->match_available = 0;
-    }
-    s->insert = s->strstart < MIN_MATCH-1 ? s->strstart : MIN_MATCH-1;
-    if (flush == Z_FINISH) {
-        FLUSH_BLOCK(s, 1);
-        return finish_done;
-    }
-    if (s->sym_next)
-        FLUSH_BLOCK(s, 0);
-    return block_done;
-}
-#endif /* FASTEST */
 
 /* ===========================================================================
  * For Z_RLE, simply look for runs of bytes, generate matches only of distance
@@ -0,0 +1,866 @@
+/*!
+  \file filter.c Reversible pre-filters for arrays of numeric data
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  Arrays of integers or floating point values compress poorly with deflate:
+  consecutive elements are seldom equal byte for byte, even when they are
+  close in value. The filters in this file rewrite such arrays so that deflate
+  finds more matches and a more skewed literal distribution:
+
+  - Z_FILTER_DELTA replaces each element by its difference from the previous
+    one, the elements being taken as little-endian unsigned integers.
+  - Z_FILTER_XOR replaces each element by its exclusive-or with the previous
+    one, which suits floating point values better than a difference.
+  - Z_FILTER_SHUFFLE groups the bytes of the elements by their position in
+    the element: all the first bytes, then all the second bytes, and so on.
+
+  Z_FILTER_SHUFFLE can be combined with one of the other two, in which case
+  the difference or exclusive-or is done first.
+
+  Images are better served by the scanline filters of PNG (RFC 2083), where
+  each row is predicted from the pixel to its left, the row above, or both,
+  and the filter type is recorded in a byte ahead of the row. zfilterRow() and
+  zunfilterRow() implement them, and compressImage() and uncompressImage()
+  run them interleaved with deflate and inflate.
+*/
+
+/* @(#) $Id$ */
+
+#define ZLIB_INTERNAL
+#include "zutil.h"
+
+#define FILTER_ALL (Z_FILTER_DELTA | Z_FILTER_XOR | Z_FILTER_SHUFFLE)
+
+/* gzip extra subfield identifying a filtered stream */
+#define FILTER_SI1 'Z'
+#define FILTER_SI2 'F'
+
+/* ===========================================================================
+ * Check the filter and element size. Return 0 if ok, 1 if not.
+ */
+local int filter_check(int filter, unsigned size) {
+    return (filter & ~FILTER_ALL) != 0 ||
+           (filter & (Z_FILTER_DELTA | Z_FILTER_XOR)) ==
+               (Z_FILTER_DELTA | Z_FILTER_XOR) ||
+           size < 1 || size > 255;
+}
+
+/* ===========================================================================
+ * Load and store little-endian integers of four and eight bytes, which
+ * compilers turn into single loads and stores where they can.
+ */
+local ulg get4(const Bytef *p) {
+    return (ulg)p[0] | ((ulg)p[1] << 8) | ((ulg)p[2] << 16) |
+           ((ulg)p[3] << 24);
+}
+
+local void put4(Bytef *p, ulg v) {
+    p[0] = (Byte)v;
+    p[1] = (Byte)(v >> 8);
+    p[2] = (Byte)(v >> 16);
+    p[3] = (Byte)(v >> 24);
+}
+
+#ifdef Z_U8
+local Z_U8 get8(const Bytef *p) {
+    return (Z_U8)get4(p) | ((Z_U8)get4(p + 4) << 32);
+}
+
+local void put8(Bytef *p, Z_U8 v) {
+    put4(p, (ulg)(v & 0xffffffff));
+    put4(p + 4, (ulg)(v >> 32));
+}
+#endif
+
+/* ===========================================================================
+ * Set out to cur minus prev if sub is true, cur plus prev if not, or cur
+ * exclusive-or prev if xor is true, as little-endian integers of size bytes.
+ * Return 1 if done, or 0 if size is not 2, 4 or 8, so that the caller must
+ * go a byte at a time. out may be the same as cur or prev.
+ */
+local int word_elem(Bytef *out, const Bytef *cur, const Bytef *prev,
+                    unsigned size, int xor, int sub) {
+    switch (size) {
+    case 2: {
+        unsigned a = cur[0] | ((unsigned)cur[1] << 8),
+                 b = prev[0] | ((unsigned)prev[1] << 8);
+        a = xor ? a ^ b : sub ? a - b : a + b;
+        out[0] = (Byte)a;
+        out[1] = (Byte)(a >> 8);
+        return 1;
+    }
+    case 4: {
+        ulg a = get4(cur), b = get4(prev);
+        put4(out, xor ? a ^ b : sub ? a - b : a + b);
+        return 1;
+    }
+#ifdef Z_U8
+    case 8: {
+        Z_U8 a = get8(cur), b = get8(prev);
+        put8(out, xor ? a ^ b : sub ? a - b : a + b);
+        return 1;
+    }
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* ===========================================================================
+ * Set out to the element cur filtered against the previous element prev, for
+ * elements of size bytes.
+ */
+local void filter_elem(Bytef *out, const Bytef *cur, const Bytef *prev,
+                       unsigned size, int filter) {
+    unsigned n, borrow = 0, d;
+
+    if ((filter & (Z_FILTER_DELTA | Z_FILTER_XOR)) &&
+        word_elem(out, cur, prev, size, filter & Z_FILTER_XOR, 1))
+        return;
+    if (filter & Z_FILTER_DELTA)
+        for (n = 0; n < size; n++) {
+            d = (unsigned)cur[n] - prev[n] - borrow;
+            out[n] = (Byte)d;
+            borrow = (d >> 8) & 1;
+        }
+    else if (filter & Z_FILTER_XOR)
+        for (n = 0; n < size; n++)
+            out[n] = cur[n] ^ prev[n];
+    else
+        zmemcpy(out, cur, size);
+}
+
+/* ===========================================================================
+ * Set out to the original element from the filtered element cur and the
+ * previous original element prev. This is the inverse of filter_elem().
+ */
+local void unfilter_elem(Bytef *out, const Bytef *cur, const Bytef *prev,
+                         unsigned size, int filter) {
+    unsigned n, carry = 0, d;
+
+    if ((filter & (Z_FILTER_DELTA | Z_FILTER_XOR)) &&
+        word_elem(out, cur, prev, size, filter & Z_FILTER_XOR, 0))
+        return;
+    if (filter & Z_FILTER_DELTA)
+        for (n = 0; n < size; n++) {
+            d = (unsigned)cur[n] + prev[n] + carry;
+            out[n] = (Byte)d;
+            carry = d >> 8;
+        }
+    else if (filter & Z_FILTER_XOR)
+        for (n = 0; n < size; n++)
+            out[n] = cur[n] ^ prev[n];
+    else
+        zmemcpy(out, cur, size);
+}
+
+/* ========================================================================= */
+/*!
+  Filter an array of elements before compressing it.
+
+  \param dest    destination buffer, of at least `len` bytes
+  \param source  array to filter
+  \param len     length of the array in bytes
+  \param filter  Z_FILTER_DELTA or Z_FILTER_XOR, optionally or'ed with
+                 Z_FILTER_SHUFFLE, or Z_FILTER_SHUFFLE alone
+  \param size    size of an element in bytes (1..255)
+
+  The array is taken as len / size elements of `size` bytes, and any bytes
+  left over at the end are copied unchanged. The first element is filtered
+  against an element of zeros. dest and source may be the same buffer, except
+  when Z_FILTER_SHUFFLE is used; they must not otherwise overlap.
+
+  The filter and the element size must be saved by some mechanism outside the
+  scope of this function for zunfilter() to undo the filter, like the gzip
+  extra field used by compressFiltered().
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT zfilter(Bytef *dest, const Bytef *source, z_size_t len,
+                    int filter, unsigned size) {
+    Byte last[255], elem[255];
+    z_size_t n, i;
+    unsigned k;
+
+    if (filter_check(filter, size) || (len && (dest == Z_NULL ||
+        source == Z_NULL)) || ((filter & Z_FILTER_SHUFFLE) && dest == source))
+        return Z_STREAM_ERROR;
+    n = len / size;
+    zmemzero(last, size);
+    for (i = 0; i < n; i++) {
+        filter_elem(elem, source + i * size, last, size, filter);
+        zmemcpy(last, source + i * size, size);
+        if (filter & Z_FILTER_SHUFFLE)
+            for (k = 0; k < size; k++)
+                dest[k * n + i] = elem[k];
+        else
+            zmemcpy(dest + i * size, elem, size);
+    }
+    if (dest != source)
+        for (i = n * size; i < len; i++)
+            dest[i] = source[i];
+    return Z_OK;
+}
+
+/* ========================================================================= */
+/*!
+  Undo zfilter() on decompressed data.
+
+  \param dest    destination buffer, of at least `len` bytes
+  \param source  filtered array
+  \param len     length of the array in bytes
+  \param filter  filter given to zfilter()
+  \param size    element size given to zfilter()
+
+  dest and source may be the same buffer, except when Z_FILTER_SHUFFLE is
+  used; they must not otherwise overlap.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT zunfilter(Bytef *dest, const Bytef *source, z_size_t len,
+                      int filter, unsigned size) {
+    Byte last[255], elem[255];
+    z_size_t n, i;
+    unsigned k;
+
+    if (filter_check(filter, size) || (len && (dest == Z_NULL ||
+        source == Z_NULL)) || ((filter & Z_FILTER_SHUFFLE) && dest == source))
+        return Z_STREAM_ERROR;
+    n = len / size;
+    zmemzero(last, size);
+    for (i = 0; i < n; i++) {
+        if (filter & Z_FILTER_SHUFFLE)
+            for (k = 0; k < size; k++)
+                elem[k] = source[k * n + i];
+        else
+            zmemcpy(elem, source + i * size, size);
+        unfilter_elem(last, elem, last, size, filter);
+        zmemcpy(dest + i * size, last, size);
+    }
+    if (dest != source)
+        for (i = n * size; i < len; i++)
+            dest[i] = source[i];
+    return Z_OK;
+}
+
+/* ===========================================================================
+ * Return the Paeth predictor of a (left), b (above) and c (above left).
+ */
+local int paeth(int a, int b, int c) {
+    int pa, pb, pc;
+
+    pa = b - c;
+    pb = a - c;
+    pc = pa + pb;
+    if (pa < 0) pa = -pa;
+    if (pb < 0) pb = -pb;
+    if (pc < 0) pc = -pc;
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/* ===========================================================================
+ * Filter row[0..len-1] with the given type into out[0..len-1]. prior is the
+ * previous unfiltered row, or Z_NULL for the first row.
+ */
+local void filter_row(Bytef *out, const Bytef *row, const Bytef *prior,
+                      z_size_t len, unsigned bpp, int type) {
+    z_size_t i;
+
+    if (bpp > len)
+        bpp = (unsigned)len;
+    switch (type) {
+    case Z_ROW_SUB:
+        for (i = 0; i < bpp; i++)
+            out[i] = row[i];
+        for (; i < len; i++)
+            out[i] = (Byte)(row[i] - row[i - bpp]);
+        break;
+    case Z_ROW_UP:
+        if (prior == Z_NULL)
+            zmemcpy(out, row, len);
+        else
+            for (i = 0; i < len; i++)
+                out[i] = (Byte)(row[i] - prior[i]);
+        break;
+    case Z_ROW_AVERAGE:
+        if (prior == Z_NULL) {
+            for (i = 0; i < bpp; i++)
+                out[i] = row[i];
+            for (; i < len; i++)
+                out[i] = (Byte)(row[i] - (row[i - bpp] >> 1));
+        }
+        else {
+            for (i = 0; i < bpp; i++)
+                out[i] = (Byte)(row[i] - (prior[i] >> 1));
+            for (; i < len; i++)
+                out[i] = (Byte)(row[i] -
+                                ((row[i - bpp] + prior[i]) >> 1));
+        }
+        break;
+    case Z_ROW_PAETH:
+        if (prior == Z_NULL) {          /* Paeth reduces to Sub */
+            filter_row(out, row, prior, len, bpp, Z_ROW_SUB);
+            break;
+        }
+        for (i = 0; i < bpp; i++)
+            out[i] = (Byte)(row[i] - prior[i]);
+        for (; i < len; i++)
+            out[i] = (Byte)(row[i] - paeth(row[i - bpp], prior[i],
+                                           prior[i - bpp]));
+        break;
+    default:
+        zmemcpy(out, row, len);
+    }
+}
+
+/* ===========================================================================
+ * Return the filter type with the least sum of the absolute values of the
+ * filtered bytes taken as signed, the heuristic recommended by the PNG
+ * specification. A candidate is abandoned as soon as its sum exceeds the best
+ * one so far.
+ */
+local int pick_row(const Bytef *row, const Bytef *prior, z_size_t len,
+                   unsigned bpp) {
+    int type, best = Z_ROW_NONE, pred, d;
+    z_size_t i;
+    ulg sum, least = (ulg)-1;
+
+    if (bpp > len)
+        bpp = (unsigned)len;
+    for (type = Z_ROW_NONE; type <= Z_ROW_PAETH; type++) {
+        if (prior == Z_NULL && (type == Z_ROW_UP || type == Z_ROW_PAETH))
+            continue;                   /* same as None and Sub */
+        sum = 0;
+        for (i = 0; i < len && sum < least; i++) {
+            switch (type) {
+            case Z_ROW_SUB:
+                pred = i < bpp ? 0 : row[i - bpp];
+                break;
+            case Z_ROW_UP:
+                pred = prior[i];
+                break;
+            case Z_ROW_AVERAGE:
+                pred = ((i < bpp ? 0 : row[i - bpp]) +
+                        (prior == Z_NULL ? 0 : prior[i])) >> 1;
+                break;
+            case Z_ROW_PAETH:
+                pred = i < bpp ? prior[i] :
+                       paeth(row[i - bpp], prior[i], prior[i - bpp]);
+                break;
+            default:
+                pred = 0;
+            }
+            d = (signed char)(row[i] - pred);
+            sum += (ulg)(d < 0 ? -d : d);
+        }
+        if (sum < least) {
+            least = sum;
+            best = type;
+        }
+    }
+    return best;
+}
+
+/* ========================================================================= */
+/*!
+  Filter one scanline of an image as PNG does.
+
+  \param dest    destination, of `len` + 1 bytes: the filter type followed by
+                 the filtered row
+  \param row     scanline to filter, of `len` bytes
+  \param prior   previous scanline, unfiltered, or Z_NULL for the first one
+  \param len     length of a scanline in bytes
+  \param bpp     bytes per complete pixel, rounded up to 1 (1..8 for PNG)
+  \param type    Z_ROW_NONE, Z_ROW_SUB, Z_ROW_UP, Z_ROW_AVERAGE or
+                 Z_ROW_PAETH, or Z_ROW_ADAPTIVE to pick the type per row
+
+  With Z_ROW_ADAPTIVE, each of the five filters is tried and the one that
+  yields the least sum of absolute values of the filtered bytes, taken as
+  signed, is used. That is the heuristic the PNG specification recommends for
+  truecolor and grayscale images of 8 bits or more; for palette images or
+  lower bit depths, Z_ROW_NONE usually does better. The output compresses
+  best with the Z_FILTERED strategy.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT zfilterRow(Bytef *dest, const Bytef *row, const Bytef *prior,
+                       z_size_t len, unsigned bpp, int type) {
+    if (dest == Z_NULL || (row == Z_NULL && len) || bpp < 1 ||
+        type < Z_ROW_NONE || type > Z_ROW_ADAPTIVE)
+        return Z_STREAM_ERROR;
+    if (type == Z_ROW_ADAPTIVE)
+        type = pick_row(row, prior, len, bpp);
+    dest[0] = (Byte)type;
+    filter_row(dest + 1, row, prior, len, bpp, type);
+    return Z_OK;
+}
+
+/* ========================================================================= */
+/*!
+  Undo zfilterRow() on one scanline.
+
+  \param row     destination, of `len` bytes
+  \param source  filtered scanline, of `len` + 1 bytes starting with the
+                 filter type
+  \param prior   previous scanline, already unfiltered, or Z_NULL for the
+                 first one
+  \param len     length of a scanline in bytes
+  \param bpp     bytes per complete pixel, as given to zfilterRow()
+
+  row and source + 1 may be the same buffer.
+
+  \return Z_OK if success
+  \return Z_DATA_ERROR if the filter type is invalid
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT zunfilterRow(Bytef *row, const Bytef *source, const Bytef *prior,
+                         z_size_t len, unsigned bpp) {
+    z_size_t i;
+    const Bytef *in;
+
+    if (row == Z_NULL || source == Z_NULL || bpp < 1)
+        return Z_STREAM_ERROR;
+    in = source + 1;
+    if (bpp > len)
+        bpp = (unsigned)len;
+    switch (source[0]) {
+    case Z_ROW_NONE:
+        if (row != in)
+            zmemcpy(row, in, len);
+        break;
+    case Z_ROW_SUB:
+        for (i = 0; i < bpp; i++)
+            row[i] = in[i];
+        for (; i < len; i++)
+            row[i] = (Byte)(in[i] + row[i - bpp]);
+        break;
+    case Z_ROW_UP:
+        for (i = 0; i < len; i++)
+            row[i] = (Byte)(in[i] + (prior == Z_NULL ? 0 : prior[i]));
+        break;
+    case Z_ROW_AVERAGE:
+        for (i = 0; i < len; i++)
+            row[i] = (Byte)(in[i] + (((i < bpp ? 0 : row[i - bpp]) +
+                                      (prior == Z_NULL ? 0 : prior[i])) >> 1));
+        break;
+    case Z_ROW_PAETH:
+        if (prior == Z_NULL) {
+            for (i = 0; i < bpp; i++)
+                row[i] = in[i];
+            for (; i < len; i++)
+                row[i] = (Byte)(in[i] + row[i - bpp]);
+            break;
+        }
+        for (i = 0; i < bpp; i++)
+            row[i] = (Byte)(in[i] + prior[i]);
+        for (; i < len; i++)
+            row[i] = (Byte)(in[i] + paeth(row[i - bpp], prior[i],
+                                          prior[i - bpp]));
+        break;
+    default:
+        return Z_DATA_ERROR;
+    }
+    return Z_OK;
+}
+
+#ifndef Z_SOLO
+
+/* ========================================================================= */
+/*!
+  Filter and compress an array of numeric elements into a gzip stream.
+
+  \param dest       destination buffer
+  \param destLen    on entry, the size of dest, which must be at least
+                    compressBound(sourceLen) + 24; on exit, the size of the
+                    compressed data
+  \param source     array to compress
+  \param sourceLen  length of the array in bytes
+  \param level      compression level, as in deflateInit()
+  \param filter     filter applied first, as in zfilter()
+  \param size       size of an element in bytes (1..255)
+
+  The source is filtered with zfilter() into a temporary buffer and
+  compressed in the gzip format. The filter and the element size are recorded
+  in a subfield of the gzip header extra field, with the identifier "ZF" and
+  two bytes of data: the filter and the element size. The output can be read
+  back with uncompressFiltered(). Other gzip decoders ignore the subfield and
+  return the filtered data.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_BUF_ERROR if there was not enough room in the output buffer
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT compressFiltered(Bytef *dest, uLongf *destLen,
+                             const Bytef *source, uLong sourceLen, int level,
+                             int filter, unsigned size) {
+    z_stream stream;
+    gz_header head;
+    Byte extra[6];
+    Bytef *work;
+    int err;
+    const uInt max = (uInt)-1;
+    uLong left;
+
+    if (filter_check(filter, size))
+        return Z_STREAM_ERROR;
+    left = *destLen;
+    *destLen = 0;
+
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    err = deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS + 16,
+                       DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK)
+        return err;
+    work = sourceLen > (uLong)max ? Z_NULL :
+           (Bytef *)ZALLOC(&stream, sourceLen ? (uInt)sourceLen : 1, 1);
+    if (work == Z_NULL) {
+        deflateEnd(&stream);
+        return Z_MEM_ERROR;
+    }
+    zfilter(work, source, sourceLen, filter, size);
+
+    extra[0] = FILTER_SI1;
+    extra[1] = FILTER_SI2;
+    extra[2] = 2;
+    extra[3] = 0;
+    extra[4] = (Byte)filter;
+    extra[5] = (Byte)size;
+    zmemzero((Bytef *)&head, sizeof(head));
+    head.os = OS_CODE;
+    head.extra = extra;
+    head.extra_len = sizeof(extra);
+    deflateSetHeader(&stream, &head);
+
+    stream.next_out = dest;
+    stream.avail_out = 0;
+    stream.next_in = work;
+    stream.avail_in = 0;
+
+    do {
+        if (stream.avail_out == 0) {
+            stream.avail_out = left > (uLong)max ? max : (uInt)left;
+            left -= stream.avail_out;
+        }
+        if (stream.avail_in == 0) {
+            stream.avail_in = sourceLen > (uLong)max ? max : (uInt)sourceLen;
+            sourceLen -= stream.avail_in;
+        }
+        err = deflate(&stream, sourceLen ? Z_NO_FLUSH : Z_FINISH);
+    } while (err == Z_OK);
+
+    *destLen = stream.total_out;
+    ZFREE(&stream, work);
+    deflateEnd(&stream);
+    return err == Z_STREAM_END ? Z_OK : err;
+}
+
+/* ========================================================================= */
+/*!
+  Decompress a gzip or zlib stream and undo the filter recorded by
+  compressFiltered().
+
+  \param dest       destination buffer
+  \param destLen    on entry, the size of dest, which must be large enough to
+                    hold the entire uncompressed data; on exit, the size of
+                    the uncompressed data
+  \param source     compressed data
+  \param sourceLen  length of the compressed data
+
+  A stream without the "ZF" subfield, including any zlib stream, is only
+  decompressed.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_BUF_ERROR if there was not enough room in the output buffer
+  \return Z_DATA_ERROR if the input data was corrupted or incomplete, or the
+          recorded filter is invalid
+*/
+int ZEXPORT uncompressFiltered(Bytef *dest, uLongf *destLen,
+                               const Bytef *source, uLong sourceLen) {
+    z_stream stream;
+    gz_header head;
+    Bytef *extra, *work;
+    int err, filter = 0;
+    unsigned size = 1, len, pos, xlen = 0;
+    const uInt max = (uInt)-1;
+    uLong left;
+
+    left = *destLen;
+    *destLen = 0;
+
+    stream.next_in = (const Bytef *)source;
+    stream.avail_in = 0;
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    err = inflateInit2(&stream, MAX_WBITS + 32);
+    if (err != Z_OK)
+        return err;
+
+    /* room for all of the extra field of a gzip header, whose length XLEN
+       follows the fixed part of the header when FLG.FEXTRA is set */
+    if (sourceLen >= 12 && source[0] == 31 && source[1] == 139 &&
+        (source[3] & 4))
+        xlen = source[10] + ((unsigned)source[11] << 8);
+    extra = (Bytef *)ZALLOC(&stream, xlen ? xlen : 1, 1);
+    if (extra == Z_NULL) {
+        inflateEnd(&stream);
+        return Z_MEM_ERROR;
+    }
+    zmemzero((Bytef *)&head, sizeof(head));
+    head.extra = extra;
+    head.extra_max = xlen;
+    inflateGetHeader(&stream, &head);
+
+    stream.next_out = dest;
+    stream.avail_out = 0;
+
+    do {
+        if (stream.avail_out == 0) {
+            stream.avail_out = left > (uLong)max ? max : (uInt)left;
+            left -= stream.avail_out;
+        }
+        if (stream.avail_in == 0) {
+            stream.avail_in = sourceLen > (uLong)max ? max : (uInt)sourceLen;
+            sourceLen -= stream.avail_in;
+        }
+        err = inflate(&stream, Z_NO_FLUSH);
+    } while (err == Z_OK);
+
+    *destLen = stream.total_out;
+    if (err != Z_STREAM_END)
+        err = err == Z_NEED_DICT ? Z_DATA_ERROR :
+              err == Z_BUF_ERROR && left + stream.avail_out ? Z_DATA_ERROR :
+              err;
+
+    /* look for the filter subfield, in all of the extra field */
+    else if (head.done == 1 && head.extra_len) {
+        err = Z_OK;
+        len = head.extra_len;
+        if (len > head.extra_max)
+            err = Z_DATA_ERROR;         /* cannot be, but would hide a ZF */
+        for (pos = 0; err == Z_OK && pos + 4 <= len;
+             pos += 4 + extra[pos + 2] + (extra[pos + 3] << 8))
+            if (extra[pos] == FILTER_SI1 && extra[pos + 1] == FILTER_SI2) {
+                if (extra[pos + 2] != 2 || extra[pos + 3] != 0 ||
+                    pos + 6 > len)
+                    err = Z_DATA_ERROR;
+                else {
+                    filter = extra[pos + 4];
+                    size = extra[pos + 5];
+                    if (filter_check(filter, size))
+                        err = Z_DATA_ERROR;
+                }
+                break;
+            }
+    }
+    else
+        err = Z_OK;
+
+    if (err == Z_OK && filter) {
+        if ((filter & Z_FILTER_SHUFFLE) == 0)
+            zunfilter(dest, dest, *destLen, filter, size);
+        else {
+            work = *destLen > (uLong)max ? Z_NULL :
+                   (Bytef *)ZALLOC(&stream, *destLen ? (uInt)*destLen : 1, 1);
+            if (work == Z_NULL)
+                err = Z_MEM_ERROR;
+            else {
+                zmemcpy(work, dest, *destLen);
+                zunfilter(dest, work, *destLen, filter, size);
+                ZFREE(&stream, work);
+            }
+        }
+    }
+    ZFREE(&stream, extra);
+    inflateEnd(&stream);
+    return err;
+}
+
+/* Rows are filtered or unfiltered this many bytes at a time, so that deflate
+   and inflate work on them while they are still in the cache. */
+#define IMAGE_BATCH 16384
+
+/* ========================================================================= */
+/*!
+  Filter the scanlines of an image and compress them into a zlib stream, as in
+  the IDAT chunks of a PNG file.
+
+  \param dest       destination buffer
+  \param destLen    on entry, the size of dest, which must be at least
+                    compressBound(height * (rowLen + 1)); on exit, the size of
+                    the compressed data
+  \param image      image, as `height` consecutive scanlines of `rowLen` bytes
+  \param height     number of scanlines
+  \param rowLen     length of a scanline in bytes
+  \param bpp        bytes per complete pixel, as in zfilterRow()
+  \param level      compression level, as in deflateInit()
+  \param type       filter type, as in zfilterRow()
+
+  Each scanline is filtered with zfilterRow() and deflated with the Z_FILTERED
+  strategy. Filtering is interleaved with compression, a few rows at a time,
+  so that the filtered image is never held in memory as a whole and deflate
+  reads each row while it is still in the cache.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_BUF_ERROR if there was not enough room in the output buffer
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT compressImage(Bytef *dest, uLongf *destLen, const Bytef *image,
+                          uLong height, z_size_t rowLen, unsigned bpp,
+                          int level, int type) {
+    z_stream stream;
+    Bytef *work;
+    int err;
+    const uInt max = (uInt)-1;
+    uLong left, y, rows, n;
+    z_size_t size = rowLen + 1;
+
+    left = *destLen;
+    *destLen = 0;
+    if (size == 0 || size > max / 2 || bpp < 1 ||
+        type < Z_ROW_NONE || type > Z_ROW_ADAPTIVE)
+        return Z_STREAM_ERROR;
+    rows = size < IMAGE_BATCH ? IMAGE_BATCH / size : 1;
+
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    err = deflateInit2(&stream, level, Z_DEFLATED, MAX_WBITS, DEF_MEM_LEVEL,
+                       Z_FILTERED);
+    if (err != Z_OK)
+        return err;
+    work = (Bytef *)ZALLOC(&stream, (uInt)(rows * size), 1);
+    if (work == Z_NULL) {
+        deflateEnd(&stream);
+        return Z_MEM_ERROR;
+    }
+
+    stream.next_out = dest;
+    stream.avail_out = 0;
+    stream.avail_in = 0;
+    y = 0;
+    do {
+        if (stream.avail_out == 0) {
+            stream.avail_out = left > (uLong)max ? max : (uInt)left;
+            left -= stream.avail_out;
+        }
+        if (stream.avail_in == 0 && y < height) {
+            for (n = 0; n < rows && y < height; n++, y++)
+                zfilterRow(work + n * size, image + y * rowLen,
+                           y ? image + (y - 1) * rowLen : Z_NULL,
+                           rowLen, bpp, type);
+            stream.next_in = work;
+            stream.avail_in = (uInt)(n * size);
+        }
+        err = deflate(&stream, y < height ? Z_NO_FLUSH : Z_FINISH);
+    } while (err == Z_OK);
+
+    *destLen = stream.total_out;
+    ZFREE(&stream, work);
+    deflateEnd(&stream);
+    return err == Z_STREAM_END ? Z_OK : err;
+}
+
+/* ========================================================================= */
+/*!
+  Decompress a zlib stream of filtered scanlines and undo the filters, the
+  reverse of compressImage().
+
+  \param image      destination, of `height` * `rowLen` bytes
+  \param height     number of scanlines
+  \param rowLen     length of a scanline in bytes
+  \param bpp        bytes per complete pixel, as given to compressImage()
+  \param source     compressed data
+  \param sourceLen  length of the compressed data
+
+  Scanlines are unfiltered a few at a time as they are inflated.
+
+  \return Z_OK if success
+  \return Z_MEM_ERROR if there was not enough memory
+  \return Z_DATA_ERROR if the input data was corrupted, did not hold exactly
+          `height` scanlines, or used an invalid filter type
+  \return Z_STREAM_ERROR if a parameter is invalid
+*/
+int ZEXPORT uncompressImage(Bytef *image, uLong height, z_size_t rowLen,
+                            unsigned bpp, const Bytef *source,
+                            uLong sourceLen) {
+    z_stream stream;
+    Bytef *work, *row;
+    Byte extra;
+    int err;
+    const uInt max = (uInt)-1;
+    uLong y, rows, n, i;
+    z_size_t size = rowLen + 1;
+
+    if (size == 0 || size > max / 2 || bpp < 1)
+        return Z_STREAM_ERROR;
+    rows = size < IMAGE_BATCH ? IMAGE_BATCH / size : 1;
+
+    stream.next_in = (const Bytef *)source;
+    stream.avail_in = 0;
+    stream.zalloc = (alloc_func)0;
+    stream.zfree = (free_func)0;
+    stream.opaque = (voidpf)0;
+    err = inflateInit(&stream);
+    if (err != Z_OK)
+        return err;
+    work = (Bytef *)ZALLOC(&stream, (uInt)(rows * size), 1);
+    if (work == Z_NULL) {
+        inflateEnd(&stream);
+        return Z_MEM_ERROR;
+    }
+
+    y = 0;
+    do {
+        /* inflate a batch of rows, or one byte past the last row to reach
+           the end of the stream */
+        n = height - y < rows ? height - y : rows;
+        if (n) {
+            stream.next_out = work;
+            stream.avail_out = (uInt)(n * size);
+        }
+        else {
+            stream.next_out = &extra;
+            stream.avail_out = 1;
+        }
+        do {
+            if (stream.avail_in == 0) {
+                stream.avail_in = sourceLen > (uLong)max ? max :
+                                                           (uInt)sourceLen;
+                sourceLen -= stream.avail_in;
+            }
+            err = inflate(&stream, Z_NO_FLUSH);
+        } while (err == Z_OK && stream.avail_out);
+        if (n == 0) {
+            if (stream.avail_out == 0)
+                err = Z_DATA_ERROR;     /* more data than scanlines */
+            break;
+        }
+        if (stream.avail_out)
+            break;
+
+        for (i = 0; i < n && err != Z_DATA_ERROR; i++, y++) {
+            row = image + y * rowLen;
+            if (zunfilterRow(row, work + i * size,
+                             y ? row - rowLen : Z_NULL, rowLen, bpp) != Z_OK)
+                err = Z_DATA_ERROR;
+        }
+    } while (err == Z_OK || (err == Z_STREAM_END && y < height));
+
+    ZFREE(&stream, work);
+    inflateEnd(&stream);
+    if (err == Z_STREAM_END && y == height)
+        return Z_OK;
+    return err == Z_MEM_ERROR ? err : Z_DATA_ERROR;
+}
+
+#endif /* !Z_SOLO */
@@ -7,6 +7,11 @@
 
 #include "gzguts.h"
 
+#if defined(Z_HAVE_UNISTD_H) && !defined(_WIN32)
+#  include <sys/stat.h>
+#  define GZ_TUNE
+#endif
+
 #if defined(_WIN32) && !defined(__BORLANDC__)
 #  define LSEEK _lseeki64
 #else
@@ -19,7 +24,9 @@
 
 /* Local functions */
 static void gz_reset (gz_statep);
-static gzFile gz_open (const void *, int, const char *);
+static void gz_tune (gz_statep);
+static gzFile gz_open (const void *, int, const char *, const gz_funcs *,
+                       voidp);
 
 #if defined UNDER_CE
 
@@ -79,18 +86,59 @@ static void gz_reset (gz_statep state)
     if (state->mode == GZ_READ) {   /* for reading ... */
         state->eof = 0;             /* not at end of file */
         state->past = 0;            /* have not read past end yet */
+        state->full = 0;            /* no run of full reads yet */
+        state->kept = 0;            /* no partial line */
         state->how = LOOK;          /* look for gzip header */
     }
     else                            /* for writing ... */
         state->reset = 0;           /* no deflateReset pending */
     state->seek = 0;                /* no seek request pending */
+    state->again = 0;               /* nothing would have blocked */
     gz_error(state, Z_OK, NULL);    /* clear error */
     state->x.pos = 0;               /* no uncompressed data yet */
     state->strm.avail_in = 0;       /* no input data yet */
 }
 
-/* Open a gzip file either by name or file descriptor. */
-gzFile gz_open (const void* path, int fd, const char* mode)
+/* Choose the buffer size for the file just opened from what fstat() says
+   about it, unless it is a terminal or something else unknown: a multiple of
+   the preferred block size for a regular file, but no more than needed to
+   read it whole, and a pipe's capacity for pipes and sockets. Sequential
+   reads of a regular file may later grow the buffers -- see gz_fetch(). */
+local void gz_tune (gz_statep state)
+{
+#ifdef GZ_TUNE
+    struct stat st;
+    unsigned want;
+
+    if (fstat(state->fd, &st) == -1)
+        return;
+    if (S_ISREG(st.st_mode)) {
+        want = st.st_blksize > GZBUFSIZE ? (st.st_blksize < GZBUFMAX ?
+                    (unsigned)st.st_blksize : GZBUFMAX) : GZBUFSIZE;
+        want = want < (GZBUFMAX >> 2) ? want << 2 : GZBUFMAX;
+        if (state->mode == GZ_READ) {
+            while (want > GZBUFSIZE && st.st_size <= (off_t)(want >> 1))
+                want >>= 1;
+            state->grow = 1;
+#ifdef HAVE_POSIX_FADVISE
+            posix_fadvise(state->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        }
+        state->want = want;
+    }
+    else {
+        state->stream = 0;
+        if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+            state->want = GZPIPESIZE;
+    }
+#else
+    (void)state;
+#endif
+}
+
+/* Open a gzip file either by name, file descriptor, or callbacks. */
+gzFile gz_open (const void* path, int fd, const char* mode,
+                const gz_funcs *funcs, voidp opaque)
 {
     gz_statep state;
     z_size_t len;
@@ -101,6 +149,9 @@ gzFile gz_open (const void* path, int fd, const char* mode)
 #ifdef O_EXCL
     int exclusive = 0;
 #endif
+#ifdef GZ_SHARED
+    int shared = 0;
+#endif
 
     /* check input */
     if (path == NULL)
@@ -113,12 +164,29 @@ gzFile gz_open (const void* path, int fd, const char* mode)
     state->size = 0;            /* no buffers allocated yet */
     state->want = GZBUFSIZE;    /* requested buffer size */
     state->msg = NULL;          /* no error message yet */
+    state->ioff = 0;            /* no file offset known yet */
+    state->drop = 0;
+#ifdef GZ_URING
+    state->uring = NULL;        /* no io_uring backend yet */
+    state->ios = 0;
+#endif
+#ifdef GZ_SHARED
+    state->shared = NULL;       /* single writer unless 'm' */
+#endif
+
+    state->line = NULL;         /* no gzgetlines() buffer yet */
+    state->line_size = 0;
+    state->kept = 0;
 
     /* interpret mode */
     state->mode = GZ_NONE;
     state->level = Z_DEFAULT_COMPRESSION;
     state->strategy = Z_DEFAULT_STRATEGY;
     state->direct = 0;
+    state->grow = 0;
+    state->stream = 0;
+    state->nonblock = 0;
+    state->again = 0;
     while (*mode) {
         if (*mode >= '0' && *mode <= '9')
             state->level = *mode - '0';
@@ -165,6 +233,17 @@ gzFile gz_open (const void* path, int fd, const char* mode)
             case 'T':
                 state->direct = 1;
                 break;
+            case 's':
+                state->stream = 1;
+                break;
+            case 'n':
+                state->nonblock = 1;
+                break;
+#ifdef GZ_SHARED
+            case 'm':
+                shared = 1;
+                break;
+#endif
             default:        /* could consider as an error, but just ignore */
                 ;
             }
@@ -236,27 +315,65 @@ gzFile gz_open (const void* path, int fd, const char* mode)
            O_TRUNC :
            O_APPEND)));
 
+    /* use the callbacks if provided, checking that the needed ones are */
+    state->chunk_len = 0;
+    if (funcs != NULL) {
+        if (state->mode == GZ_READ ? funcs->read == NULL &&
+                                     funcs->fetch == NULL :
+                                     funcs->write == NULL) {
+            free(state->path);
+            free(state);
+            return NULL;
+        }
+        state->funcs = *funcs;
+        state->opaque = opaque;
+        state->fd = -1;
+        state->stream = 0;
+    }
+
     /* open the file with the appropriate flags (or just use fd) */
-    state->fd = fd > -1 ? fd : (
+    else {
+        memset(&state->funcs, 0, sizeof(gz_funcs));
+        state->fd = fd > -1 ? fd : (
 #ifdef WIDECHAR
-        fd == -2 ? _wopen(path, oflag, 0666) :
+            fd == -2 ? _wopen(path, oflag, 0666) :
 #endif
-        open((const char *)path, oflag, 0666));
-    if (state->fd == -1) {
-        free(state->path);
-        free(state);
-        return NULL;
+            open((const char *)path, oflag, 0666));
+        if (state->fd == -1) {
+            free(state->path);
+            free(state);
+            return NULL;
+        }
     }
     if (state->mode == GZ_APPEND) {
-        LSEEK(state->fd, 0, SEEK_END);  /* so gzoffset() is correct */
+        gz_lseek(state, 0, SEEK_END);   /* so gzoffset() is correct */
         state->mode = GZ_WRITE;         /* simplify later checks */
     }
 
-    /* save the current position for rewinding (only if reading) */
-    if (state->mode == GZ_READ) {
-        state->start = LSEEK(state->fd, 0, SEEK_CUR);
-        if (state->start == -1) state->start = 0;
+#ifdef GZ_SHARED
+    /* set up the ring for concurrent writers, which have to wait for their
+       data to be written, so 'n' does not apply */
+    if (shared && state->mode == GZ_WRITE && gz_shared_init(state) == -1) {
+        if (fd < 0 && funcs == NULL)
+            close(state->fd);
+        free(state->path);
+        free(state);
+        return NULL;
     }
+    if (state->shared != NULL)
+        state->nonblock = 0;
+#endif
+
+    /* size the buffers and give hints for the kind of file opened */
+    if (state->fd != -1)
+        gz_tune(state);
+
+    /* save the current position for rewinding (only if reading) */
+    state->ioff = gz_lseek(state, 0, SEEK_CUR);
+    if (state->ioff == -1) state->ioff = 0;
+    state->drop = state->ioff;
+    if (state->mode == GZ_READ)
+        state->start = state->ioff;
 
     /* initialize stream */
     gz_reset(state);
@@ -283,6 +400,31 @@ gzFile gz_open (const void* path, int fd, const char* mode)
   "x" when writing will create the file exclusively, which fails if the file
   already exists.  On systems that support it, the addition of "e" when
   reading or writing will set the flag to close the file on an execve() call.
+  Where posix_fadvise() is available, the addition of "s" marks a streaming
+  use of a large file: what was read or written more than a few megabytes
+  behind the current position is dropped from the page cache as the file is
+  processed, instead of pushing out other cached data.
+
+    Where C11 atomics are available, the addition of "m" when writing lets
+  several threads write to the file at once with gzwrite(), gzfwrite(),
+  gzputs(), gzputc(), gzprintf() and gzflush().  The data of each call is
+  written whole, never mixed with that of another thread.  The other
+  functions must not be called while other threads write, and gzclose() only
+  once they are done.
+
+    The addition of "n" is for a descriptor in non-blocking mode, such as a
+  socket driven from an event loop.  A read or write that would block is then
+  not an error: gzread(), gzfread() and gzwrite() return the number of
+  uncompressed bytes they got through so far, which can be zero, gzgetc(),
+  gzputc() and gzgets() return -1 or NULL, gzgetlines() zero, gzprintf() zero
+  and gzflush() Z_BUF_ERROR, and gzblocked() then returns true.  The call is
+  repeated once the descriptor is ready, with the inflate or deflate state
+  left as it was.  gzgets() may return the first part of a line, and a
+  gzflush() that would block has to be repeated until it returns Z_OK before
+  writing more.  Forward seeks when writing are not supported, and gzclose()
+  waits for the descriptor to take the rest of the data, so the last
+  gzflush(file, Z_FINISH) is best done before it.  "n" has no effect with
+  "m".
 
     These functions, as well as gzip, will read and decode a sequence of gzip
   streams in a file.  The append function of gzopen() can be used to create
@@ -304,13 +446,13 @@ gzFile gz_open (const void* path, int fd, const char* mode)
 */
 gzFile ZEXPORT gzopen (const char* path, const char* mode)
 {
-    return gz_open(path, -1, mode);
+    return gz_open(path, -1, mode, Z_NULL, Z_NULL);
 }
 
 /* -- see zlib.h -- */
 gzFile ZEXPORT gzopen64 (const char* path, const char* mode)
 {
-    return gz_open(path, -1, mode);
+    return gz_open(path, -1, mode, Z_NULL, Z_NULL);
 }
 
 /*!
@@ -346,16 +488,96 @@ gzFile ZEXPORT gzdopen (int fd, const char* mode)
 #else
     sprintf(path, "<fd:%d>", fd);   /* for debugging */
 #endif
-    gz = gz_open(path, fd, mode);
+    gz = gz_open(path, fd, mode, Z_NULL, Z_NULL);
     free(path);
     return gz;
 }
 
+/*!
+  Associate a gzFile with callbacks that read, write, seek, and close any
+  byte source or sink, such as a memory buffer, a network object, or a
+  decrypting stream. The mode parameter is as in gzopen, except that 'x' and
+  'e' have no effect. opaque is passed to each callback.
+
+  When reading, funcs->read or funcs->fetch must be provided, and when
+  writing, funcs->write. When fetch is provided, inflate reads the compressed
+  data directly from the buffers it returns, without copying them. gzseek()
+  and gzrewind() work as with a file descriptor if funcs->seek is provided.
+  For appending, the compressed data is written after seeking to the end, if
+  funcs->seek is provided. gzclose() calls funcs->close, if provided.
+
+  \return NULL if there was insufficient memory to allocate the gzFile
+  state, if an invalid mode was specified, or if a callback needed for the
+  mode is missing.
+*/
+gzFile ZEXPORT gzopen_funcs (const gz_funcs *funcs, voidp opaque,
+                             const char *mode)
+{
+    if (funcs == NULL)
+        return NULL;
+    return gz_open("<funcs>", -1, mode, funcs, opaque);
+}
+
+/* Seek the file or the callback source like lseek(). When fetch() is used,
+   its unused data is accounted for, and dropped if the seek succeeds. Only a
+   move of the file offset restarts what gz_advise() drops from, so that
+   asking for the offset, as gzoffset() does, does not forget the range
+   pending. */
+z_off64_t ZLIB_INTERNAL gz_lseek (gz_statep state, z_off64_t offset,
+                                  int whence)
+{
+    z_off64_t ret;
+
+    if (state->fd != -1) {
+        ret = LSEEK(state->fd, offset, whence);
+        if (ret != -1 && ret != state->ioff)
+            state->ioff = state->drop = ret;
+        return ret;
+    }
+    if (state->funcs.seek == NULL)
+        return -1;
+    if (whence == SEEK_CUR && offset == 0) {   /* just asking */
+        ret = state->funcs.seek(state->opaque, 0, SEEK_CUR);
+        return ret == -1 ? -1 : ret - state->chunk_len;
+    }
+    if (whence == SEEK_CUR)
+        offset -= state->chunk_len;
+    ret = state->funcs.seek(state->opaque, offset, whence);
+    if (ret != -1)
+        state->chunk_len = 0;
+    return ret;
+}
+
+/* Account for n bytes just read or written at the file offset. With 's' in
+   the mode, tell the kernel that what is well behind it will not be needed
+   again, which for written data starts the writeback of what is still dirty
+   and drops the rest. */
+void ZLIB_INTERNAL gz_advise (gz_statep state, unsigned n)
+{
+    state->ioff += n;
+#ifdef HAVE_POSIX_FADVISE
+    if (state->stream && state->ioff - state->drop >= (GZ_DROP << 1)) {
+        posix_fadvise(state->fd, state->drop,
+                      state->ioff - GZ_DROP - state->drop,
+                      POSIX_FADV_DONTNEED);
+        state->drop = state->ioff - GZ_DROP;
+    }
+#endif
+}
+
+/* Close the file or the callback source -- return 0 or -1 like close(). */
+int ZLIB_INTERNAL gz_sysclose (gz_statep state)
+{
+    if (state->fd != -1)
+        return close(state->fd);
+    return state->funcs.close == NULL ? 0 : state->funcs.close(state->opaque);
+}
+
 /* -- see zlib.h -- */
 #ifdef WIDECHAR
 gzFile ZEXPORT gzopen_w (const wchar_t* path, const char* mode)
 {
-    return gz_open(path, -2, mode);
+    return gz_open(path, -2, mode, Z_NULL, Z_NULL);
 }
 #endif
 
@@ -363,7 +585,13 @@ gzFile ZEXPORT gzopen_w (const wchar_t* path, const char* mode)
   Set the internal buffer size used by this library's functions for file to
   size.
   
-  The default buffer size is 8192 bytes.  This function must be called
+  The default buffer size is 8192 bytes, or for a file opened by name or
+  descriptor, a size picked from what the system reports about it: a few
+  times the preferred block size for a regular file (up to 256K, and no more
+  than the file needs when reading), or 64K for a pipe or socket.  When
+  reading a regular file sequentially the buffers are then grown, up to 256K,
+  as long as reads keep filling them.  Calling gzbuffer() turns both off and
+  uses size as given.  This function must be called
   after gzopen() or gzdopen(), and before any other calls that read or write
   the file.  The buffer memory allocation is always deferred to the first read
   or write.  Three times that size in buffer space is allocated.  A larger
@@ -395,6 +623,7 @@ int ZEXPORT gzbuffer (gzFile file, unsigned size)
     if (size < 8)
         size = 8;               /* needed to behave well with flushing */
     state->want = size;
+    state->grow = 0;
     return 0;
 }
 
@@ -420,7 +649,11 @@ int ZEXPORT gzrewind(gzFile file)
         return -1;
 
     /* back up and start over */
-    if (LSEEK(state->fd, state->start, SEEK_SET) == -1)
+#ifdef GZ_URING
+    if (state->uring != NULL && gz_uring_stop(state) == -1)
+        return -1;
+#endif
+    if (gz_lseek(state, state->start, SEEK_SET) == -1)
         return -1;
     gz_reset(state);
     return 0;
@@ -473,7 +706,11 @@ z_off64_t ZEXPORT gzseek64 (gzFile file, z_off64_t offset, int whence)
     /* if within raw area while reading, just go there */
     if (state->mode == GZ_READ && state->how == COPY &&
             state->x.pos + offset >= 0) {
-        ret = LSEEK(state->fd, offset - (z_off64_t)state->x.have, SEEK_CUR);
+#ifdef GZ_URING
+        if (state->uring != NULL && gz_uring_stop(state) == -1)
+            return -1;
+#endif
+        ret = gz_lseek(state, offset - (z_off64_t)state->x.have, SEEK_CUR);
         if (ret == -1)
             return -1;
         state->x.have = 0;
@@ -497,6 +734,10 @@ z_off64_t ZEXPORT gzseek64 (gzFile file, z_off64_t offset, int whence)
             return -1;
     }
 
+    /* writing the zeros for a forward seek can't be left half done */
+    if (state->mode == GZ_WRITE && state->nonblock && offset)
+        return -1;
+
     /* if reading, skip what's in output buffer (one less gzgetc() check) */
     if (state->mode == GZ_READ) {
         n = GT_OFF(state->x.have) || (z_off64_t)state->x.have > offset ?
@@ -599,7 +840,12 @@ z_off64_t ZEXPORT gzoffset64(gzFile file)
         return -1;
 
     /* compute and return effective offset in file */
-    offset = LSEEK(state->fd, 0, SEEK_CUR);
+#ifdef GZ_URING
+    if (state->uring != NULL)
+        offset = gz_uring_tell(state);
+    else
+#endif
+    offset = gz_lseek(state, 0, SEEK_CUR);
     if (offset == -1)
         return -1;
     if (state->mode == GZ_READ)             /* reading */
@@ -652,6 +898,26 @@ int ZEXPORT gzeof (gzFile file)
     return state->mode == GZ_READ ? state->past : 0;
 }
 
+/*!
+  Return true (1) if the last read or write on file stopped because the file
+  was opened with "n" and the descriptor would have blocked, false (0)
+  otherwise.  The call can be repeated once the descriptor is ready.
+*/
+int ZEXPORT gzblocked (gzFile file)
+{
+    gz_statep state;
+
+    /* get internal structure and check integrity */
+    if (file == NULL)
+        return 0;
+    state = (gz_statep)file;
+    if (state->mode != GZ_READ && state->mode != GZ_WRITE)
+        return 0;
+
+    /* return would-block state */
+    return state->again;
+}
+
 /*!
   Return the error message for the last error which occurred on file.
 
@@ -670,6 +936,7 @@ int ZEXPORT gzeof (gzFile file)
 const char* ZEXPORT gzerror (gzFile file, int* errnum)
 {
     gz_statep state;
+    const char *msg;
 
     /* get internal structure and check integrity */
     if (file == NULL)
@@ -678,11 +945,22 @@ const char* ZEXPORT gzerror (gzFile file, int* errnum)
     if (state->mode != GZ_READ && state->mode != GZ_WRITE)
         return NULL;
 
+#ifdef GZ_SHARED
+    /* the error belongs to the thread compressing for the other writers */
+    if (state->shared != NULL)
+        gz_shared_lock(state);
+#endif
+
     /* return error information */
     if (errnum != NULL)
         *errnum = state->err;
-    return state->err == Z_MEM_ERROR ? "out of memory" :
-                                       (state->msg == NULL ? "" : state->msg);
+    msg = state->err == Z_MEM_ERROR ? "out of memory" :
+                                      (state->msg == NULL ? "" : state->msg);
+#ifdef GZ_SHARED
+    if (state->shared != NULL)
+        gz_shared_unlock(state);
+#endif
+    return msg;
 }
 
 /*!
@@ -707,7 +985,7 @@ void ZEXPORT gzclearerr (gzFile file)
         state->eof = 0;
         state->past = 0;
     }
-    gz_error(state, Z_OK, NULL);
+    GZ_ERROR(state, Z_OK, NULL);
 }
 
 /*!
@@ -5,7 +5,44 @@
   For conditions of distribution and use, see copyright notice in zlib.h
 */
 
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+#  ifndef _GNU_SOURCE
+#    define _GNU_SOURCE         /* for copy_file_range() and splice() */
+#  endif
+#endif
 #include "gzguts.h"
+#ifdef HAVE_COPY_FILE_RANGE
+#  include <sys/stat.h>
+#endif
+
+/*!
+  Get the next buffer from the fetch() callback of gzopen_funcs() -- return -1
+  on error, otherwise 0, with state->chunk_len zero at the end of the source.
+*/
+local int gz_next(gz_statep state) {
+    state->chunk = state->funcs.fetch(state->opaque, &state->chunk_len);
+    if (state->chunk == NULL) {
+        state->chunk_len = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*!
+  Read up to len bytes from the callbacks of gzopen_funcs(), like read().
+*/
+local int gz_sysread(gz_statep state, unsigned char *buf, unsigned len) {
+    if (state->funcs.fetch == NULL)
+        return state->funcs.read(state->opaque, buf, len);
+    if (state->chunk_len == 0 && gz_next(state) == -1)
+        return -1;
+    if (len > state->chunk_len)
+        len = state->chunk_len;
+    memcpy(buf, state->chunk, len);
+    state->chunk += len;
+    state->chunk_len -= len;
+    return (int)len;
+}
 
 /*!
   Use read() to load a buffer -- return -1 on error, otherwise 0.  Read from
@@ -18,22 +55,41 @@ local int gz_load(gz_statep state, unsigned char *buf, unsigned len,
     int ret;
     unsigned get, max = ((unsigned)-1 >> 2) + 1;
 
+#ifdef GZ_URING
+    if (state->uring == NULL && ++state->ios == GZ_URING_AFTER)
+        gz_uring_start(state);
+    if (state->uring != NULL) {
+        ret = gz_uring_read(state, buf, len, have);
+        if (ret == 0) {
+            state->full = *have == len ? state->full + 1 : 0;
+            gz_advise(state, *have);
+        }
+        return ret;
+    }
+#endif
     *have = 0;
+    state->again = 0;
     do {
         get = len - *have;
         if (get > max)
             get = max;
-        ret = read(state->fd, buf + *have, get);
+        ret = state->fd == -1 ? gz_sysread(state, buf + *have, get) :
+                                read(state->fd, buf + *have, get);
         if (ret <= 0)
             break;
         *have += (unsigned)ret;
     } while (*have < len);
     if (ret < 0) {
-        gz_error(state, Z_ERRNO, zstrerror());
-        return -1;
+        if (!state->nonblock || !GZ_AGAIN()) {
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        state->again = *have == 0;      /* not the end, come back later */
     }
-    if (ret == 0)
+    else if (ret == 0)
         state->eof = 1;
+    state->full = *have == len ? state->full + 1 : 0;
+    gz_advise(state, *have);
     return 0;
 }
 
@@ -53,6 +109,23 @@ local int gz_avail(gz_statep state) {
     if (state->err != Z_OK && state->err != Z_BUF_ERROR)
         return -1;
     if (state->eof == 0) {
+        if (strm->avail_in == 0 && state->funcs.fetch != NULL) {
+            /* have inflate read the fetched buffer in place, no more than a
+               buffer full at a time so that it can still be copied */
+            if (state->chunk_len == 0 && gz_next(state) == -1) {
+                gz_error(state, Z_ERRNO, zstrerror());
+                return -1;
+            }
+            if (state->chunk_len == 0)
+                state->eof = 1;
+            got = state->chunk_len < state->size ? state->chunk_len :
+                                                   state->size;
+            strm->next_in = state->chunk;
+            strm->avail_in = got;
+            state->chunk += got;
+            state->chunk_len -= got;
+            return 0;
+        }
         if (strm->avail_in) {       /* copy what's there to the start */
             unsigned char *p = state->in;
             unsigned const char *q = strm->next_in;
@@ -118,6 +191,15 @@ local int gz_look(gz_statep state) {
             return 0;
     }
 
+    /* a non-blocking read or a fetch() chunk can stop between the magic
+       bytes -- wait for the second one unless the file ends there */
+    if (strm->avail_in == 1 &&
+        (state->nonblock || state->funcs.fetch != NULL) && !state->eof &&
+        !state->again && gz_avail(state) == -1)
+        return -1;
+    if (strm->avail_in == 1 && state->again)
+        return 0;
+
     /* look for gzip magic bytes -- if there, do gzip decoding (note: there is
        a logical dilemma here when considering the case of a partially written
        gzip file, to wit, if a single 31 byte is written, then we cannot tell
@@ -171,6 +253,8 @@ local int gz_decomp(gz_statep state) {
         if (strm->avail_in == 0 && gz_avail(state) == -1)
             return -1;
         if (strm->avail_in == 0) {
+            if (state->again)       /* would block -- not the end */
+                break;
             gz_error(state, Z_BUF_ERROR, "unexpected end of file");
             break;
         }
@@ -205,6 +289,36 @@ local int gz_decomp(gz_statep state) {
     return 0;
 }
 
+/* Double the buffers after a run of reads that filled the input buffer, as
+   when a large file is read sequentially.  Assumes state->x.have is 0.  Any
+   input not yet used is moved to the new input buffer.  If memory runs out,
+   the buffers are kept as they are and not grown again. */
+local void gz_grow(gz_statep state) {
+    unsigned size = state->size << 1;
+    unsigned char *in, *out;
+
+    if (!state->grow || state->full < GZ_GROW_AFTER || state->size >= GZBUFMAX)
+        return;
+    state->full = 0;
+    in = (unsigned char *)malloc(size);
+    out = (unsigned char *)malloc(size << 1);
+    if (in == NULL || out == NULL) {
+        free(out);
+        free(in);
+        state->grow = 0;
+        return;
+    }
+    if (state->strm.avail_in)
+        memcpy(in, state->strm.next_in, state->strm.avail_in);
+    state->strm.next_in = in;
+    free(state->out);
+    free(state->in);
+    state->in = in;
+    state->out = out;
+    state->size = size;
+    state->want = size;
+}
+
 /* Fetch data and put it in the output buffer.  Assumes state->x.have is 0.
    Data is either copied from the input file or decompressed from the input
    file depending on state->how.  If state->how is LOOK, then a gzip header is
@@ -214,6 +328,7 @@ local int gz_decomp(gz_statep state) {
 local int gz_fetch(gz_statep state) {
     z_streamp strm = &(state->strm);
 
+    gz_grow(state);
     do {
         switch(state->how) {
         case LOOK:      /* -> LOOK, COPY (only if never GZIP), or GZIP */
@@ -234,11 +349,13 @@ local int gz_fetch(gz_statep state) {
             if (gz_decomp(state) == -1)
                 return -1;
         }
-    } while (state->x.have == 0 && (!state->eof || strm->avail_in));
+    } while (state->x.have == 0 && (!state->eof || strm->avail_in) &&
+             !state->again);
     return 0;
 }
 
-/* Skip len uncompressed bytes of output.  Return -1 on error, 0 on success. */
+/* Skip len uncompressed bytes of output.  Return -1 on error, 0 on success,
+   or 1 if the file would block, with the rest of the skip still pending. */
 local int gz_skip(gz_statep state, z_off64_t len) {
     unsigned n;
 
@@ -263,6 +380,13 @@ local int gz_skip(gz_statep state, z_off64_t len) {
             /* get more output, looking for header if required */
             if (gz_fetch(state) == -1)
                 return -1;
+
+            /* would block -- leave the rest of the skip for next time */
+            if (state->x.have == 0 && state->again) {
+                state->seek = 1;
+                state->skip = len;
+                return 1;
+            }
         }
     return 0;
 }
@@ -278,11 +402,12 @@ local z_size_t gz_read(gz_statep state, voidp buf, z_size_t len) {
     /* if len is zero, avoid unnecessary operations */
     if (len == 0)
         return 0;
+    state->again = 0;
 
     /* process a skip request */
     if (state->seek) {
         state->seek = 0;
-        if (gz_skip(state, state->skip) == -1)
+        if (gz_skip(state, state->skip))
             return 0;
     }
 
@@ -328,6 +453,7 @@ local z_size_t gz_read(gz_statep state, voidp buf, z_size_t len) {
 
         /* large len -- decompress directly into user buffer */
         else {  /* state->how == GZIP */
+            gz_grow(state);
             state->strm.avail_out = n;
             state->strm.next_out = (unsigned char *)buf;
             if (gz_decomp(state) == -1)
@@ -341,9 +467,10 @@ local z_size_t gz_read(gz_statep state, voidp buf, z_size_t len) {
         buf = (char *)buf + n;
         got += n;
         state->x.pos += n;
-    } while (len);
+    } while (len && !state->again);
 
-    /* return number of bytes read into user buffer */
+    /* return number of bytes read into user buffer, which can be short if a
+       non-blocking read would block */
     return got;
 }
 
@@ -527,7 +654,7 @@ int ZEXPORT gzungetc(int c, gzFile file) {
     /* process a skip request */
     if (state->seek) {
         state->seek = 0;
-        if (gz_skip(state, state->skip) == -1)
+        if (gz_skip(state, state->skip))
             return -1;
     }
 
@@ -596,9 +723,10 @@ char* ZEXPORT gzgets(gzFile file, char *buf, int len) {
         return NULL;
 
     /* process a skip request */
+    state->again = 0;
     if (state->seek) {
         state->seek = 0;
-        if (gz_skip(state, state->skip) == -1)
+        if (gz_skip(state, state->skip))
             return NULL;
     }
 
@@ -611,8 +739,9 @@ char* ZEXPORT gzgets(gzFile file, char *buf, int len) {
         /* assure that something is in the output buffer */
         if (state->x.have == 0 && gz_fetch(state) == -1)
             return NULL;                /* error */
-        if (state->x.have == 0) {       /* end of file */
-            state->past = 1;            /* read past end */
+        if (state->x.have == 0) {       /* end of file, or would block */
+            if (!state->again)
+                state->past = 1;        /* read past end */
             break;                      /* return what we have */
         }
 
@@ -638,6 +767,334 @@ char* ZEXPORT gzgets(gzFile file, char *buf, int len) {
     return str;
 }
 
+/* Append the len bytes at state->x.next to the n bytes of the line being
+   assembled in state->line, growing it as needed, and consume them.  Return
+   -1 if out of memory, otherwise 0. */
+local int gz_keep(gz_statep state, z_size_t n, unsigned len) {
+    z_size_t size;
+    char *line;
+
+    if (n + len > state->line_size) {
+        size = state->line_size ? state->line_size : 256;
+        while (size < n + len)
+            size <<= 1;
+        line = (char *)realloc(state->line, size);
+        if (line == NULL) {
+            gz_error(state, Z_MEM_ERROR, "out of memory");
+            return -1;
+        }
+        state->line = line;
+        state->line_size = size;
+    }
+    memcpy(state->line + n, state->x.next, len);
+    state->x.have -= len;
+    state->x.next += len;
+    state->x.pos += len;
+    return 0;
+}
+
+/*!
+  Read up to max lines from file into lines. A line that is whole in the
+  internal output buffer is returned where it is, without copying. Only a
+  line that continues past the end of the buffer is copied, to an internal
+  buffer, and it is then returned whole, however long it is.  The lines
+  returned are not null-terminated, and they stay valid only until the next
+  call on file of any function other than gzeof(), gzerror() or gzdirect().
+
+  Fewer than max lines can be returned when the end of the buffer is reached
+  with lines already in lines, since refilling the buffer would overwrite
+  them.  This function and gzgetline() can be mixed with the other reading
+  functions.
+
+  \return the number of lines in lines, which is zero only at the end of the
+  file or on error.  gzerror() can then be used to tell which.  With "n" in
+  the mode, it is also zero when the file would block, as gzblocked() tells.
+*/
+unsigned ZEXPORT gzgetlines(gzFile file, gz_line *lines, unsigned max) {
+    unsigned n, len;
+    unsigned char *eol;
+    gz_statep state;
+
+    /* check parameters and get internal structure */
+    if (file == NULL || lines == NULL)
+        return 0;
+    state = (gz_statep)file;
+
+    /* check that we're reading and that there's no (serious) error */
+    if (state->mode != GZ_READ ||
+        (state->err != Z_OK && state->err != Z_BUF_ERROR))
+        return 0;
+
+    /* process a skip request */
+    state->again = 0;
+    if (state->seek) {
+        state->seek = 0;
+        if (gz_skip(state, state->skip))
+            return 0;
+    }
+
+    n = 0;
+    while (n < max) {
+        /* return the next line in place if its end is in the buffer, unless
+           its start was kept by a call that would have blocked */
+        eol = NULL;
+        if (state->x.have) {
+            eol = (unsigned char *)memchr(state->x.next, '\n',
+                                          state->x.have);
+            if (eol != NULL && state->kept == 0) {
+                len = (unsigned)(eol - state->x.next) + 1;
+                lines[n].str = (const char *)state->x.next;
+                lines[n].len = len;
+                n++;
+                state->x.have -= len;
+                state->x.next += len;
+                state->x.pos += len;
+                continue;
+            }
+        }
+
+        /* the buffer has to be refilled, which would overwrite the lines
+           already returned (or the copied line) -- leave that for next time */
+        if (n)
+            break;
+        if (state->x.have == 0 && state->kept == 0) {
+            if (gz_fetch(state) == -1)
+                return 0;
+            if (state->x.have == 0) {
+                if (!state->again)
+                    state->past = 1;    /* read past end */
+                break;
+            }
+            continue;
+        }
+
+        /* the line continues past the buffer -- copy it up to its end */
+        for (;;) {
+            len = eol == NULL ? state->x.have :
+                                (unsigned)(eol - state->x.next) + 1;
+            if (len && gz_keep(state, state->kept, len) == -1)
+                return 0;
+            state->kept += len;
+            if (eol != NULL)
+                break;
+            if (gz_fetch(state) == -1)
+                return 0;
+            if (state->x.have == 0) {
+                if (state->again)       /* would block -- keep the start */
+                    return 0;
+                break;                  /* last line, with no newline */
+            }
+            eol = (unsigned char *)memchr(state->x.next, '\n',
+                                          state->x.have);
+        }
+        lines[n].str = state->line;
+        lines[n].len = state->kept;
+        state->kept = 0;
+        n++;
+    }
+    return n;
+}
+
+/*!
+  Read the next line from file, as gzgetlines() does for one line: the line
+  is not null-terminated, it includes the newline unless it is the last line
+  of the file and has none, and it stays valid only until the next call on
+  file.  If len is not Z_NULL, the length of the line is put in *len, or zero
+  if there is none.
+
+  \return a pointer to the line, or NULL at the end of the file, on error, or
+  if the file would block.
+*/
+const char * ZEXPORT gzgetline(gzFile file, z_size_t *len) {
+    gz_line line;
+
+    if (gzgetlines(file, &line, 1) == 0) {
+        if (len != NULL)
+            *len = 0;
+        return NULL;
+    }
+    if (len != NULL)
+        *len = line.len;
+    return line.str;
+}
+
+/* Write len bytes at buf to fd -- return -1 on error, otherwise 0. */
+local int gz_putfd(gz_statep state, int fd, const unsigned char *buf,
+                   unsigned len) {
+    int ret;
+    unsigned put, max = ((unsigned)-1 >> 2) + 1;
+
+    while (len) {
+        put = len > max ? max : len;
+        ret = (int)write(fd, buf, put);
+        if (ret < 0) {
+#ifdef EINTR
+            if (errno == EINTR)
+                continue;
+#endif
+            gz_error(state, Z_ERRNO, zstrerror());
+            return -1;
+        }
+        buf += ret;
+        len -= (unsigned)ret;
+    }
+    return 0;
+}
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+/* Move up to 1G from in to out in the kernel, with copy_file_range() if how
+   is 0, or with splice() if how is 1 -- return like read(). */
+local ssize_t gz_kmove(int in, int out, int how) {
+    size_t max = (size_t)1 << 30;
+
+#ifdef HAVE_COPY_FILE_RANGE
+    if (how == 0)
+        return copy_file_range(in, NULL, out, NULL, max, 0);
+#endif
+#ifdef HAVE_SPLICE
+    if (how == 1)
+        return splice(in, NULL, out, NULL, max, SPLICE_F_MOVE);
+#endif
+    (void)in, (void)out, (void)max;
+    errno = EINVAL;
+    return -1;
+}
+
+/* Copy the rest of the input file to fd without bringing it into user space:
+   with copy_file_range() when both are files that allow it, else with
+   splice() when either is a pipe.  Return the number of bytes copied, with
+   state->eof set if that is all of it, or -1 on error.  When the kernel
+   cannot do the copy, or stops being able to part way, the rest is left for
+   the caller to copy through the buffers. */
+local z_off64_t gz_kcopy(gz_statep state, int fd) {
+    z_off64_t total = 0;
+    ssize_t ret;
+    int how = 1;
+#ifdef HAVE_COPY_FILE_RANGE
+    struct stat st;
+
+    /* pseudo-files such as those in /proc report a zero size, and could
+       look empty to copy_file_range() */
+    if (fstat(state->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        how = 0;
+#endif
+
+#ifdef GZ_URING
+    if (state->uring != NULL && gz_uring_stop(state) == -1)
+        return -1;
+#endif
+    for (;;) {
+        ret = gz_kmove(state->fd, fd, how);
+        if (ret > 0) {
+            total += ret;
+            gz_advise(state, (unsigned)ret);
+            continue;
+        }
+        if (ret == 0) {
+            state->eof = 1;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+            errno == EOPNOTSUPP || (how == 0 && errno == EBADF)) {
+            if (how++ == 0)
+                continue;               /* try splice() instead */
+            break;                      /* have the caller do the rest */
+        }
+        gz_error(state, Z_ERRNO, zstrerror());
+        return -1;
+    }
+    return total;
+}
+#endif
+
+/*!
+  Write all of the remaining uncompressed data of file to the descriptor fd,
+  from the current position to the end, as gzread() would return it.
+
+  Decompressed data is written directly from the internal output buffer, so
+  it is not copied again.  If file is not gzip, then it is moved by the kernel
+  where possible, with copy_file_range() or splice(), and otherwise written
+  from the buffers.  If the buffer size was not set by gzbuffer(), the largest
+  size is used.  After gzcopyfd() returns, gzeof() is true unless there was an
+  error, or file was opened with "n" and gzblocked() is true.
+
+  \return the number of bytes written, or -1 on error, in which case
+  gzerror() can be used to tell if the error was in reading file, or in
+  writing fd (Z_ERRNO).  Some of the data may have been written even then.
+*/
+z_off64_t ZEXPORT gzcopyfd(gzFile file, int fd) {
+    z_off64_t total;
+    gz_statep state;
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+    z_off64_t got;
+    int kernel = 1;
+#endif
+
+    /* check parameters and get internal structure */
+    if (file == NULL || fd < 0)
+        return -1;
+    state = (gz_statep)file;
+
+    /* check that we're reading and that there's no (serious) error */
+    if (state->mode != GZ_READ ||
+        (state->err != Z_OK && state->err != Z_BUF_ERROR))
+        return -1;
+
+    /* process a skip request */
+    if (state->seek) {
+        state->seek = 0;
+        if (gz_skip(state, state->skip))
+            return -1;
+    }
+
+    /* the whole rest of the file goes through the buffers */
+    if (state->size == 0 && state->grow)
+        state->want = GZBUFMAX;
+
+    total = 0;
+    for (;;) {
+        /* write what is in the output buffer, decompressed or copied */
+        if (state->x.have) {
+            if (gz_putfd(state, fd, state->x.next, state->x.have) == -1)
+                return -1;
+            total += state->x.have;
+            state->x.pos += state->x.have;
+            state->x.next += state->x.have;
+            state->x.have = 0;
+        }
+
+#if defined(HAVE_COPY_FILE_RANGE) || defined(HAVE_SPLICE)
+        /* once past any data left in the buffers, have the kernel copy the
+           rest of a file that is not gzip */
+        if (kernel && state->how == COPY && state->strm.avail_in == 0 &&
+            !state->eof && state->fd != -1 && !state->nonblock) {
+            kernel = 0;
+            got = gz_kcopy(state, fd);
+            if (got == -1)
+                return -1;
+            total += got;
+            state->x.pos += got;
+            continue;
+        }
+#endif
+
+        /* get more output, or stop at the end of the input */
+        if (state->eof && state->strm.avail_in == 0)
+            break;
+        if (gz_fetch(state) == -1)
+            return -1;
+        if (state->x.have == 0) {
+            if (state->again)       /* would block -- not the end */
+                return total;
+            break;
+        }
+    }
+    state->past = 1;
+    return total;
+}
+
 /*!
   Return true (1) if file is being copied directly while reading, or false
   (0) if file is a gzip stream being decompressed.
@@ -698,15 +1155,19 @@ int ZEXPORT gzclose_r(gzFile file) {
         return Z_STREAM_ERROR;
 
     /* free memory and close file */
+#ifdef GZ_URING
+    gz_uring_end(state);
+#endif
     if (state->size) {
         inflateEnd(&(state->strm));
         free(state->out);
         free(state->in);
     }
+    free(state->line);
     err = state->err == Z_BUF_ERROR ? Z_BUF_ERROR : Z_OK;
     gz_error(state, Z_OK, NULL);
     free(state->path);
-    ret = close(state->fd);
+    ret = gz_sysclose(state);
     free(state);
     return ret ? Z_ERRNO : err;
 }
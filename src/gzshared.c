@@ -0,0 +1,270 @@
+/*!
+  \file gzshared.c Ring shared by threads writing to the same gzip file
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  A gzip file opened for writing with 'm' in the mode can be written by
+  several threads at once with gzwrite(), gzfwrite(), gzputs(), gzputc() and
+  gzprintf(). Each of those calls is a record: a writer reserves space for it
+  in a ring of GZ_SHARED_RING bytes by advancing the head with a
+  compare-and-swap, copies the record in, and then marks it ready by storing
+  its header. No lock is taken for that, so writers only contend on the head.
+
+  Compression is done by one thread at a time, whichever writer finds the
+  ring not busy after adding its record. It takes the ready records from the
+  tail in the order their space was reserved, up to the first one still being
+  copied, and passes them to gz_write(), so each record lands whole in the
+  file. A record too large for the ring is not copied: its header points at
+  the writer's buffer, and the writer waits for it to be compressed.
+
+  The consumed part of the ring is cleared before the tail moves past it, so
+  that a zero header always means a record not yet ready. state->err and
+  state->msg belong to the thread holding the ring, which copies the error
+  to an atomic for the others to see when it lets go. This needs C11
+  atomics, and is compiled out when they are not available or NO_GZSHARED is
+  defined, in which case 'm' is ignored.
+*/
+
+#include "gzguts.h"
+
+#ifdef GZ_SHARED
+
+#include <stdatomic.h>
+#include <stdint.h>
+#ifdef _WIN32
+#  include <windows.h>
+#  define gz_yield() SwitchToThread()
+#else
+#  include <sched.h>
+#  define gz_yield() sched_yield()
+#endif
+
+/* record header: the length shifted left two, and these flags */
+#define READY 1         /* record can be compressed */
+#define BIG 2           /* record holds a pointer to the writer's data */
+
+#define MASK (GZ_SHARED_RING - 1)
+
+struct gz_shared_s {
+    unsigned char *ring;        /* GZ_SHARED_RING bytes, 8-byte aligned */
+    atomic_uint_fast64_t head;  /* total bytes reserved */
+    atomic_uint_fast64_t tail;  /* total bytes consumed */
+    atomic_flag busy;           /* set while a thread is compressing */
+    atomic_int err;             /* state->err, as of the last unlock */
+};
+
+/* header of the record at position pos */
+#define HEADER(s, pos) \
+    ((_Atomic uint64_t *)((s)->ring + (size_t)((pos) & MASK)))
+
+/* ===========================================================================
+ * Allocate the ring for a file opened with 'm'. Return -1 if out of memory.
+ */
+int ZLIB_INTERNAL gz_shared_init(gz_statep state) {
+    gz_shared *s;
+
+    s = (gz_shared *)malloc(sizeof(gz_shared));
+    if (s == NULL)
+        return -1;
+    s->ring = (unsigned char *)calloc(GZ_SHARED_RING, 1);
+    if (s->ring == NULL) {
+        free(s);
+        return -1;
+    }
+    atomic_init(&s->head, 0);
+    atomic_init(&s->tail, 0);
+    atomic_flag_clear(&s->busy);
+    atomic_init(&s->err, Z_OK);
+    state->shared = s;
+    return 0;
+}
+
+/* ===========================================================================
+ * Copy len bytes from buf to the ring at pos, wrapping around its end.
+ */
+local void ring_copy(gz_shared *s, uint_fast64_t pos,
+                     const unsigned char *buf, size_t len) {
+    size_t at = (size_t)(pos & MASK), first = GZ_SHARED_RING - at;
+
+    if (first >= len)
+        memcpy(s->ring + at, buf, len);
+    else {
+        memcpy(s->ring + at, buf, first);
+        memcpy(s->ring, buf + first, len - first);
+    }
+}
+
+/* ===========================================================================
+ * Compress the ready records from the tail, with the ring held busy. If all
+ * is true, wait for the records still being copied until the ring is empty.
+ * After an error the records are dropped, to keep the writers going.
+ */
+local void ring_drain(gz_statep state, int all) {
+    gz_shared *s = state->shared;
+    uint_fast64_t t, need;
+    uint64_t hdr;
+    z_size_t len;
+    size_t at, first;
+    const unsigned char *ptr;
+
+    t = atomic_load(&s->tail);
+    for (;;) {
+        hdr = atomic_load_explicit(HEADER(s, t), memory_order_acquire);
+        if ((hdr & READY) == 0) {
+            if (!all || t == atomic_load(&s->head))
+                break;
+            gz_yield();             /* wait for a record being copied */
+            continue;
+        }
+        len = (z_size_t)(hdr >> 2);
+        need = 8 + ((hdr & BIG) ? 8 : (len + 7) & ~(uint_fast64_t)7);
+
+        /* compress the record, in two pieces if it wraps around */
+        at = (size_t)((t + 8) & MASK);
+        if (state->err == Z_OK) {
+            if (hdr & BIG) {
+                memcpy(&ptr, s->ring + at, sizeof(ptr));
+                gz_write(state, ptr, len);
+            }
+            else {
+                first = GZ_SHARED_RING - at;
+                if (first >= len)
+                    gz_write(state, s->ring + at, len);
+                else {
+                    gz_write(state, s->ring + at, first);
+                    gz_write(state, s->ring, len - first);
+                }
+            }
+        }
+
+        /* clear it for the next time around, then let the space be reused
+           -- the header is cleared atomically, since gz_shared_unlock() may
+           look at it */
+        atomic_store_explicit(HEADER(s, t), 0, memory_order_relaxed);
+        at = (size_t)((t + 8) & MASK);
+        first = GZ_SHARED_RING - at;
+        if (first >= need - 8)
+            memset(s->ring + at, 0, (size_t)need - 8);
+        else {
+            memset(s->ring + at, 0, first);
+            memset(s->ring, 0, (size_t)need - 8 - first);
+        }
+        t += need;
+        atomic_store(&s->tail, t);
+    }
+}
+
+/* ===========================================================================
+ * Let go of the ring, publishing the error. A writer that found it busy may
+ * have added a record after the last look at the tail, so look again, and
+ * compress it if no other thread has taken the ring by then.
+ */
+void ZLIB_INTERNAL gz_shared_unlock(gz_statep state) {
+    gz_shared *s = state->shared;
+
+    for (;;) {
+        atomic_store(&s->err, state->err);
+        atomic_flag_clear(&s->busy);
+        if ((atomic_load(HEADER(s, atomic_load(&s->tail))) & READY) == 0 ||
+            atomic_flag_test_and_set(&s->busy))
+            return;
+        ring_drain(state, 0);
+    }
+}
+
+/* ===========================================================================
+ * Take the ring, waiting for another thread compressing, and compress all of
+ * the records, so that the deflate stream can be used directly until
+ * gz_shared_unlock().
+ */
+void ZLIB_INTERNAL gz_shared_lock(gz_statep state) {
+    while (atomic_flag_test_and_set(&state->shared->busy))
+        gz_yield();
+    ring_drain(state, 1);
+}
+
+/* ===========================================================================
+ * Return the error as of the last time a thread let go of the ring.
+ */
+int ZLIB_INTERNAL gz_shared_err(gz_statep state) {
+    return atomic_load(&state->shared->err);
+}
+
+/* ===========================================================================
+ * Set the error from a writer, taking the ring to do so.
+ */
+void ZLIB_INTERNAL gz_shared_error(gz_statep state, int err,
+                                   const char *msg) {
+    gz_shared_lock(state);
+    gz_error(state, err, msg);
+    gz_shared_unlock(state);
+}
+
+/* ===========================================================================
+ * Compress what is ready if no other thread is doing so. Return true if this
+ * thread did it.
+ */
+local int ring_help(gz_statep state) {
+    if (atomic_flag_test_and_set(&state->shared->busy))
+        return 0;
+    ring_drain(state, 0);
+    gz_shared_unlock(state);
+    return 1;
+}
+
+/* ===========================================================================
+ * Write len bytes from buf as one record. Return -1 on error, otherwise 0.
+ */
+int ZLIB_INTERNAL gz_shared_put(gz_statep state, const void *buf,
+                                z_size_t len) {
+    gz_shared *s = state->shared;
+    uint_fast64_t h, need;
+    int big;
+
+    if (len == 0)
+        return 0;
+    big = len > (GZ_SHARED_RING >> 2);
+    need = 8 + (big ? 8 : (len + 7) & ~(uint_fast64_t)7);
+
+    /* reserve space, compressing to make room when the ring is full */
+    h = atomic_load(&s->head);
+    for (;;) {
+        if (h + need - atomic_load(&s->tail) > GZ_SHARED_RING) {
+            if (!ring_help(state))
+                gz_yield();
+            h = atomic_load(&s->head);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&s->head, &h, h + need))
+            break;
+    }
+
+    /* fill in the record, then mark it ready */
+    if (big)
+        ring_copy(s, h + 8, (const unsigned char *)&buf, sizeof(buf));
+    else
+        ring_copy(s, h + 8, (const unsigned char *)buf, (size_t)len);
+    atomic_store_explicit(HEADER(s, h), ((uint64_t)len << 2) | READY |
+                          (big ? BIG : 0), memory_order_release);
+
+    /* compress unless another thread is, and wait for a record that points
+       to buf to be done with it */
+    ring_help(state);
+    while (big && atomic_load(&s->tail) <= h)
+        if (!ring_help(state))
+            gz_yield();
+    return gz_shared_err(state) == Z_OK ? 0 : -1;
+}
+
+/* ===========================================================================
+ * Free the ring, which must be empty.
+ */
+void ZLIB_INTERNAL gz_shared_end(gz_statep state) {
+    if (state->shared == NULL)
+        return;
+    free(state->shared->ring);
+    free(state->shared);
+    state->shared = NULL;
+}
+
+#endif /* GZ_SHARED */
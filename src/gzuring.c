@@ -0,0 +1,505 @@
+/*!
+  \file gzuring.c io_uring backend for reading and writing gzip files
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  On Linux, once a gzip file has done a few blocking reads or writes,
+  gz_load() and gz_comp() hand their i/o to an io_uring instance instead of
+  calling read() and write(). A ring of GZ_URING_DEPTH buffers, registered
+  with the kernel when the memory lock limit allows it, keeps that many reads
+  of the next parts of the file in flight while inflate works on the current
+  one, or that many writes of compressed data in flight while deflate
+  produces more. Reads and writes are issued at explicit offsets, so the file
+  position of the descriptor is only brought up to date by gz_uring_stop(),
+  which is called before anything that relies on it.
+
+  The backend is only used on regular files not opened for appending, and is
+  dropped silently when the kernel does not support io_uring or refuses to
+  set it up, in which case the usual read() and write() loops go on. It is
+  compiled when HAVE_IO_URING is defined, which the CMake build does when
+  linux/io_uring.h is found, unless NO_IO_URING is defined.
+*/
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE           /* for syscall() and pwrite() */
+#endif
+#include "gzguts.h"
+
+#ifdef GZ_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#if defined(_LARGEFILE64_SOURCE) && _LFS64_LARGEFILE-0
+#  define LSEEK lseek64
+#  define FSTAT fstat64
+   typedef struct stat64 gz_stat_t;
+#else
+#  define LSEEK lseek
+#  define FSTAT fstat
+   typedef struct stat gz_stat_t;
+#endif
+
+/* number of buffers, and so of reads or writes in flight -- a power of two */
+#define GZ_URING_DEPTH 4
+
+/* io_uring instance and its ring of buffers */
+struct gz_uring_s {
+    int ring;                   /* io_uring file descriptor */
+    int fd;                     /* file read or written */
+    int fixed;                  /* true if the buffers are registered */
+    int active;                 /* true if reads were started or next is set */
+    int eof;                    /* true if a read returned end of file */
+    unsigned size;              /* size of each buffer */
+    unsigned head;              /* buffer to consume or to fill next */
+    unsigned pos;               /* bytes consumed from the head buffer */
+    z_off64_t next;             /* file offset of the next read or write */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;
+    size_t sq_len, cq_len;
+    struct iovec iov[GZ_URING_DEPTH];   /* buffer and length requested */
+    z_off64_t off[GZ_URING_DEPTH];      /* file offset of each buffer */
+    int busy[GZ_URING_DEPTH];           /* true while in flight */
+    int res[GZ_URING_DEPTH];            /* bytes done, or -errno */
+};
+
+/* ===========================================================================
+ * Submit a read or a write of u->iov[i] at u->off[i]. Return 0 on success,
+ * or -errno, in which case the entry is taken back from the submission queue
+ * and buffer i is free.
+ */
+local int uring_submit(gz_uring *u, int write, unsigned i) {
+    unsigned tail, idx;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    tail = *u->sq_tail;
+    idx = tail & *u->sq_mask;
+    sqe = u->sqes + idx;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->fd = u->fd;
+    if (u->fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (unsigned long)u->iov[i].iov_base;
+        sqe->len = (unsigned)u->iov[i].iov_len;
+        sqe->buf_index = (unsigned short)i;
+    }
+    else {
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (unsigned long)(u->iov + i);
+        sqe->len = 1;
+    }
+    sqe->off = (unsigned long long)u->off[i];
+    sqe->user_data = i;
+    u->sq_array[idx] = idx;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->busy[i] = 1;
+    u->res[i] = 0;
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, u->ring, 1, 0, 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == 1)
+        return 0;
+    ret = ret == -1 ? -errno : -EAGAIN;
+
+    /* the kernel did not take the entry -- withdraw it, or it would be
+       submitted with the next one while the caller reuses the buffer */
+    if (__atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) != tail)
+        return 0;                           /* it did after all */
+    __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+    u->busy[i] = 0;
+    return ret;
+}
+
+/* ===========================================================================
+ * Wait until buffer i is no longer in flight, reaping completions as they
+ * come. Return 0 on success, or -errno if waiting failed.
+ */
+local int uring_wait(gz_uring *u, unsigned i) {
+    unsigned head, tail;
+    struct io_uring_cqe *cqe;
+
+    while (u->busy[i]) {
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (syscall(__NR_io_uring_enter, u->ring, 0, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0) == -1 &&
+                errno != EINTR)
+                return -errno;
+            continue;
+        }
+        for (; head != tail; head++) {
+            cqe = u->cqes + (head & *u->cq_mask);
+            u->res[cqe->user_data] = cqe->res;
+            u->busy[cqe->user_data] = 0;
+        }
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/* ===========================================================================
+ * Wait for all of the buffers. Return 0, or the first error.
+ */
+local int uring_drain(gz_uring *u) {
+    unsigned i;
+    int ret = 0, err;
+
+    for (i = 0; i < GZ_URING_DEPTH; i++) {
+        err = uring_wait(u, i);
+        if (ret == 0)
+            ret = err;
+    }
+    return ret;
+}
+
+/* ===========================================================================
+ * Start reads on all of the buffers, from the head one at u->next on.
+ */
+local int uring_prime(gz_uring *u) {
+    unsigned i, k;
+    int ret;
+
+    u->pos = 0;
+    for (k = 0; k < GZ_URING_DEPTH; k++) {
+        i = (u->head + k) & (GZ_URING_DEPTH - 1);
+        u->iov[i].iov_len = u->size;
+        u->off[i] = u->next;
+        u->next += u->size;
+        ret = uring_submit(u, 0, i);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/* ===========================================================================
+ * Report an error from the ring. Return -1.
+ */
+local int uring_error(gz_statep state, int err) {
+    errno = -err;
+    gz_error(state, Z_ERRNO, zstrerror());
+    return -1;
+}
+
+/* ========================================================================= */
+/*!
+  Try to set up the io_uring backend for state, after GZ_URING_AFTER blocking
+  reads or writes. On any failure, state->uring is left NULL and the caller
+  goes on with read() or write().
+*/
+void ZLIB_INTERNAL gz_uring_start(gz_statep state) {
+    gz_uring *u;
+    struct io_uring_params p;
+    gz_stat_t st;
+    unsigned char *mem;
+    unsigned i;
+    int fd;
+
+    /* only for regular files, and not for appending, where the kernel
+       ignores the offsets and writes in flight could land out of order */
+    if (state->fd == -1 || FSTAT(state->fd, &st) == -1 ||
+        !S_ISREG(st.st_mode) ||
+        (state->mode == GZ_WRITE &&
+         (state->direct || (fcntl(state->fd, F_GETFL) & O_APPEND))))
+        return;
+
+    u = (gz_uring *)calloc(1, sizeof(gz_uring));
+    if (u == NULL)
+        return;
+    mem = (unsigned char *)malloc((size_t)state->size * GZ_URING_DEPTH);
+    if (mem == NULL) {
+        free(u);
+        return;
+    }
+    u->fd = state->fd;
+    u->size = state->size;
+    for (i = 0; i < GZ_URING_DEPTH; i++) {
+        u->iov[i].iov_base = mem + (size_t)i * u->size;
+        u->iov[i].iov_len = u->size;
+    }
+
+    /* create the instance and map its rings */
+    memset(&p, 0, sizeof(p));
+    fd = (int)syscall(__NR_io_uring_setup, GZ_URING_DEPTH, &p);
+    if (fd == -1) {
+        free(mem);
+        free(u);
+        return;
+    }
+    u->ring = fd;
+    u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sq_map = mmap(NULL, u->sq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    u->cq_map = mmap(NULL, u->cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    u->sqes = (struct io_uring_sqe *)mmap(NULL,
+                     p.sq_entries * sizeof(struct io_uring_sqe),
+                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                     IORING_OFF_SQES);
+    if (u->sq_map == MAP_FAILED || u->cq_map == MAP_FAILED ||
+        u->sqes == MAP_FAILED) {
+        if (u->sq_map != MAP_FAILED)
+            munmap(u->sq_map, u->sq_len);
+        if (u->cq_map != MAP_FAILED)
+            munmap(u->cq_map, u->cq_len);
+        if (u->sqes != MAP_FAILED)
+            munmap(u->sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+        close(fd);
+        free(mem);
+        free(u);
+        return;
+    }
+    u->sq_head = (unsigned *)((char *)u->sq_map + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_map + p.sq_off.tail);
+    u->sq_mask = (unsigned *)((char *)u->sq_map + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)((char *)u->sq_map + p.sq_off.array);
+    u->cq_head = (unsigned *)((char *)u->cq_map + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_map + p.cq_off.tail);
+    u->cq_mask = (unsigned *)((char *)u->cq_map + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + p.cq_off.cqes);
+
+    /* register the buffers if allowed -- the fixed buffer operations are
+       then used, else the vectored ones */
+    u->fixed = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS,
+                       u->iov, GZ_URING_DEPTH) == 0;
+    for (i = 0; i < GZ_URING_DEPTH; i++)
+        u->iov[i].iov_len = 0;              /* nothing to write yet */
+    state->uring = u;
+}
+
+/* ========================================================================= */
+/*!
+  Replacement for the read() loop of gz_load(): copy up to len bytes from the
+  buffers to buf, starting reads of the following parts of the file as
+  buffers are emptied. Return -1 on error, otherwise 0.
+*/
+int ZLIB_INTERNAL gz_uring_read(gz_statep state, unsigned char *buf,
+                                unsigned len, unsigned *have) {
+    gz_uring *u = state->uring;
+    unsigned h, got, n;
+    int ret;
+
+    *have = 0;
+    if (!u->active) {
+        u->next = LSEEK(state->fd, 0, SEEK_CUR);
+        if (u->next == -1)
+            return uring_error(state, -errno);
+        u->active = 1;
+        u->eof = 0;
+        ret = uring_prime(u);
+        if (ret)
+            return uring_error(state, ret);
+    }
+    while (*have < len) {
+        if (u->eof) {
+            state->eof = 1;
+            break;
+        }
+        h = u->head;
+        ret = uring_wait(u, h);
+        if (ret == 0 && u->res[h] < 0 && u->res[h] != -EINTR &&
+            u->res[h] != -EAGAIN)
+            ret = u->res[h];
+        if (ret)
+            return uring_error(state, ret);
+        if (u->res[h] < 0) {                /* interrupted -- try again */
+            ret = uring_submit(u, 0, h);
+            if (ret)
+                return uring_error(state, ret);
+            continue;
+        }
+
+        /* copy what is left in the head buffer */
+        got = (unsigned)u->res[h];
+        n = got - u->pos;
+        if (n > len - *have)
+            n = len - *have;
+        memcpy(buf + *have, (unsigned char *)u->iov[h].iov_base + u->pos, n);
+        *have += n;
+        u->pos += n;
+        if (u->pos < got)
+            break;
+
+        /* head buffer emptied -- a short read means end of file, or at
+           least that the reads after it started at the wrong offset */
+        if (got < u->iov[h].iov_len) {
+            ret = uring_drain(u);
+            if (ret)
+                return uring_error(state, ret);
+            if (got == 0) {
+                u->eof = 1;
+                u->next = u->off[h];
+                continue;
+            }
+            u->next = u->off[h] + got;
+            u->head = (h + 1) & (GZ_URING_DEPTH - 1);
+            ret = uring_prime(u);
+        }
+        else {
+            u->iov[h].iov_len = u->size;
+            u->off[h] = u->next;
+            u->next += u->size;
+            u->head = (h + 1) & (GZ_URING_DEPTH - 1);
+            u->pos = 0;
+            ret = uring_submit(u, 0, h);
+        }
+        if (ret)
+            return uring_error(state, ret);
+    }
+    return 0;
+}
+
+/* ===========================================================================
+ * Check the completed write of buffer i, finishing it with pwrite() if it was
+ * short. Return 0, or -errno.
+ */
+local int uring_written(gz_statep state, unsigned i) {
+    gz_uring *u = state->uring;
+    unsigned char *buf;
+    size_t left;
+    z_off64_t off;
+    ssize_t ret;
+
+    if (u->res[i] < 0 && u->res[i] != -EINTR && u->res[i] != -EAGAIN)
+        return u->res[i];
+    if (u->res[i] < 0)
+        u->res[i] = 0;
+    buf = (unsigned char *)u->iov[i].iov_base + u->res[i];
+    left = u->iov[i].iov_len - (size_t)u->res[i];
+    off = u->off[i] + u->res[i];
+    while (left) {
+        ret = pwrite(state->fd, buf, left, off);
+        if (ret == -1) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        buf += ret;
+        left -= (size_t)ret;
+        off += ret;
+    }
+    u->iov[i].iov_len = 0;
+    return 0;
+}
+
+/* ========================================================================= */
+/*!
+  Replacement for the write() loop of gz_comp(): copy len bytes from buf to
+  the buffers and start writing them, first waiting for the writes of the
+  buffers to be reused. Return -1 on error, otherwise 0.
+*/
+int ZLIB_INTERNAL gz_uring_write(gz_statep state, const unsigned char *buf,
+                                 unsigned len) {
+    gz_uring *u = state->uring;
+    unsigned h, n;
+    int ret;
+
+    if (!u->active) {
+        u->next = LSEEK(state->fd, 0, SEEK_CUR);
+        if (u->next == -1)
+            return uring_error(state, -errno);
+        u->active = 1;
+    }
+    while (len) {
+        h = u->head;
+        ret = uring_wait(u, h);
+        if (ret == 0 && u->iov[h].iov_len)
+            ret = uring_written(state, h);
+        if (ret)
+            return uring_error(state, ret);
+        n = len < u->size ? len : u->size;
+        memcpy(u->iov[h].iov_base, buf, n);
+        u->iov[h].iov_len = n;
+        u->off[h] = u->next;
+        ret = uring_submit(u, 1, h);
+        if (ret)                            /* no ring -- write it now */
+            ret = uring_written(state, h);
+        if (ret)
+            return uring_error(state, ret);
+        u->next += n;
+        u->head = (h + 1) & (GZ_URING_DEPTH - 1);
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* ========================================================================= */
+/*!
+  Return the offset in the file up to which data was consumed when reading,
+  or submitted when writing, as the file position would be without the
+  backend.
+*/
+z_off64_t ZLIB_INTERNAL gz_uring_tell(gz_statep state) {
+    gz_uring *u = state->uring;
+
+    if (!u->active)
+        return LSEEK(state->fd, 0, SEEK_CUR);
+    if (state->mode == GZ_READ)
+        return u->eof ? u->next : u->off[u->head] + u->pos;
+    return u->next;
+}
+
+/* ========================================================================= */
+/*!
+  Wait for the reads or writes in flight, and set the file position to
+  gz_uring_tell(). The next read starts reading ahead again from the file
+  position then, which may have been changed. Return -1 on error, otherwise
+  0.
+*/
+int ZLIB_INTERNAL gz_uring_stop(gz_statep state) {
+    gz_uring *u = state->uring;
+    z_off64_t pos;
+    unsigned i;
+    int ret;
+
+    if (!u->active)
+        return 0;
+    pos = gz_uring_tell(state);
+    ret = uring_drain(u);
+    for (i = 0; i < GZ_URING_DEPTH; i++)
+        if (state->mode == GZ_WRITE && u->iov[i].iov_len && ret == 0)
+            ret = uring_written(state, i);
+    u->active = 0;
+    u->head = 0;
+    u->pos = 0;
+    for (i = 0; i < GZ_URING_DEPTH; i++)
+        u->iov[i].iov_len = state->mode == GZ_READ ? u->size : 0;
+    if (ret)
+        return uring_error(state, ret);
+    if (LSEEK(state->fd, pos, SEEK_SET) == -1)
+        return uring_error(state, -errno);
+    return 0;
+}
+
+/* ========================================================================= */
+/*!
+  Stop the backend and release it.
+*/
+void ZLIB_INTERNAL gz_uring_end(gz_statep state) {
+    gz_uring *u = state->uring;
+
+    if (u == NULL)
+        return;
+    gz_uring_stop(state);
+    munmap(u->sqes, (*u->sq_mask + 1) * sizeof(struct io_uring_sqe));
+    munmap(u->sq_map, u->sq_len);
+    munmap(u->cq_map, u->cq_len);
+    close(u->ring);
+    free(u->iov[0].iov_base);
+    free(u);
+    state->uring = NULL;
+}
+
+#endif /* GZ_URING */
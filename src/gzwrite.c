@@ -7,6 +7,11 @@
 
 #include "gzguts.h"
 
+#if defined(Z_HAVE_UNISTD_H) && !defined(_WIN32)
+#  include <poll.h>
+#  define GZ_POLL
+#endif
+
 /* Initialize state for writing a gzip file.  Mark initialization by setting
    state->size to non-zero.  Return -1 on a memory allocation failure, or 0 on
    success. */
@@ -58,12 +63,58 @@ local int gz_init(gz_statep state) {
     return 0;
 }
 
+/* Write to the file, or with the callback of gzopen_funcs(), like write(). */
+local int gz_syswrite(gz_statep state, const unsigned char *buf,
+                      unsigned len) {
+    int ret;
+
+    ret = state->fd == -1 ? state->funcs.write(state->opaque, buf, len) :
+                            write(state->fd, buf, len);
+    if (ret > 0)
+        gz_advise(state, (unsigned)ret);
+    return ret;
+}
+
+/* Handle a failed write to the output file: return 1 if the file was opened
+   with 'n' and the write would have blocked, otherwise set the error and
+   return -1. */
+local int gz_wrerr(gz_statep state) {
+    if (state->nonblock && GZ_AGAIN()) {
+        state->again = 1;
+        return 1;
+    }
+    gz_error(state, Z_ERRNO, zstrerror());
+    return -1;
+}
+
+/* Write the compressed data from state->x.next up to strm->next_out.  Return
+   -1 on a write error, 1 if the file would block with some of it left, or 0
+   when it is all written. */
+local int gz_put(gz_statep state) {
+    int writ;
+    unsigned put, max = ((unsigned)-1 >> 2) + 1;
+    z_streamp strm = &(state->strm);
+
+    while (strm->next_out > state->x.next) {
+        put = strm->next_out - state->x.next > (int)max ? max :
+              (unsigned)(strm->next_out - state->x.next);
+        writ = gz_syswrite(state, state->x.next, put);
+        if (writ < 0)
+            return gz_wrerr(state);
+        state->x.next += writ;
+    }
+    return 0;
+}
+
 /* Compress whatever is at avail_in and next_in and write to the output file.
    Return -1 if there is an error writing to the output file or if gz_init()
    fails to allocate memory, otherwise 0.  flush is assumed to be a valid
    deflate() flush value.  If flush is Z_FINISH, then the deflate() state is
    reset to start a new gzip stream.  If gz->direct is true, then simply write
-   to the output file without compressing, and ignore flush. */
+   to the output file without compressing, and ignore flush.  With 'n' in the
+   mode, return 1 if the file would block, leaving what was not compressed yet
+   at next_in and what was not written yet at state->x.next for the next call
+   with the same flush. */
 local int gz_comp(gz_statep state, int flush) {
     int ret, writ;
     unsigned have, put, max = ((unsigned)-1 >> 2) + 1;
@@ -72,22 +123,26 @@ local int gz_comp(gz_statep state, int flush) {
     /* allocate memory if this is the first time through */
     if (state->size == 0 && gz_init(state) == -1)
         return -1;
+    state->again = 0;
 
     /* write directly if requested */
     if (state->direct) {
         while (strm->avail_in) {
             put = strm->avail_in > max ? max : strm->avail_in;
-            writ = write(state->fd, strm->next_in, put);
-            if (writ < 0) {
-                gz_error(state, Z_ERRNO, zstrerror());
-                return -1;
-            }
+            writ = gz_syswrite(state, strm->next_in, put);
+            if (writ < 0)
+                return gz_wrerr(state);
             strm->avail_in -= (unsigned)writ;
             strm->next_in += writ;
         }
         return 0;
     }
 
+    /* finish a flush that would have blocked -- deflate() may have nothing
+       more to give for it, so write what it gave before */
+    if (state->nonblock && flush != Z_NO_FLUSH && (writ = gz_put(state)) != 0)
+        return writ;
+
     /* check for a pending reset */
     if (state->reset) {
         /* don't start a new gzip member unless there is data to write */
@@ -104,16 +159,21 @@ local int gz_comp(gz_statep state, int flush) {
            doing Z_FINISH then don't write until we get to Z_STREAM_END */
         if (strm->avail_out == 0 || (flush != Z_NO_FLUSH &&
             (flush != Z_FINISH || ret == Z_STREAM_END))) {
-            while (strm->next_out > state->x.next) {
-                put = strm->next_out - state->x.next > (int)max ? max :
-                      (unsigned)(strm->next_out - state->x.next);
-                writ = write(state->fd, state->x.next, put);
-                if (writ < 0) {
-                    gz_error(state, Z_ERRNO, zstrerror());
+#ifdef GZ_URING
+            if (state->uring == NULL && strm->next_out > state->x.next &&
+                ++state->ios == GZ_URING_AFTER)
+                gz_uring_start(state);
+            if (state->uring != NULL) {
+                put = (unsigned)(strm->next_out - state->x.next);
+                if (gz_uring_write(state, state->x.next, put) == -1)
                     return -1;
-                }
-                state->x.next += writ;
+                gz_advise(state, put);
+                state->x.next = strm->next_out;
             }
+#endif
+            writ = gz_put(state);
+            if (writ)
+                return writ;
             if (strm->avail_out == 0) {
                 strm->avail_out = state->size;
                 strm->next_out = state->out;
@@ -132,6 +192,13 @@ local int gz_comp(gz_statep state, int flush) {
         have -= strm->avail_out;
     } while (have);
 
+    /* when flushing, wait for the writes in flight to complete */
+#ifdef GZ_URING
+    if (state->uring != NULL && flush != Z_NO_FLUSH &&
+        gz_uring_stop(state) == -1)
+        return -1;
+#endif
+
     /* if that completed a deflate stream, allow another to start */
     if (flush == Z_FINISH)
         state->reset = 1;
@@ -140,6 +207,22 @@ local int gz_comp(gz_statep state, int flush) {
     return 0;
 }
 
+/* Wait for the output file to be ready for more after a write that would have
+   blocked, or just return if that can't be waited for. */
+local void gz_wait(gz_statep state) {
+#ifdef GZ_POLL
+    struct pollfd pfd;
+
+    if (state->fd != -1) {
+        pfd.fd = state->fd;
+        pfd.events = POLLOUT;
+        (void)poll(&pfd, 1, -1);
+    }
+#else
+    (void)state;
+#endif
+}
+
 /* Compress len zeros to output.  Return -1 on a write error or memory
    allocation failure by gz_comp(), or 0 on success. */
 local int gz_zero(gz_statep state, z_off64_t len) {
@@ -171,13 +254,17 @@ local int gz_zero(gz_statep state, z_off64_t len) {
 }
 
 /* Write len bytes from buf to file.  Return the number of bytes written.  If
-   the returned value is less than len, then there was an error. */
-local z_size_t gz_write(gz_statep state, voidpc buf, z_size_t len) {
+   the returned value is less than len, then there was an error, or with 'n'
+   in the mode, the file would block.  With 'm' in the mode, this is only
+   called by the thread compressing the shared ring. */
+z_size_t ZLIB_INTERNAL gz_write(gz_statep state, voidpc buf, z_size_t len) {
+    int ret;
     z_size_t put = len;
 
     /* if len is zero, avoid unnecessary operations */
     if (len == 0)
         return 0;
+    state->again = 0;
 
     /* allocate memory if this is the first time through */
     if (state->size == 0 && gz_init(state) == -1)
@@ -190,8 +277,10 @@ local z_size_t gz_write(gz_statep state, voidpc buf, z_size_t len) {
             return 0;
     }
 
-    /* for small len, copy to input buffer, otherwise compress directly */
-    if (len < state->size) {
+    /* for small len, copy to input buffer, otherwise compress directly --
+       always copy if the file can block, since the user buffer can't be left
+       half compressed */
+    if (len < state->size || state->nonblock) {
         /* copy to input buffer, compress when full */
         do {
             unsigned have, copy;
@@ -200,7 +289,7 @@ local z_size_t gz_write(gz_statep state, voidpc buf, z_size_t len) {
                 state->strm.next_in = state->in;
             have = (unsigned)((state->strm.next_in + state->strm.avail_in) -
                               state->in);
-            copy = state->size - have;
+            copy = have < state->size ? state->size - have : 0;
             if (copy > len)
                 copy = (unsigned)len;
             memcpy(state->in + have, buf, copy);
@@ -208,8 +297,13 @@ local z_size_t gz_write(gz_statep state, voidpc buf, z_size_t len) {
             state->x.pos += copy;
             buf = (const char *)buf + copy;
             len -= copy;
-            if (len && gz_comp(state, Z_NO_FLUSH) == -1)
-                return 0;
+            if (len) {
+                ret = gz_comp(state, Z_NO_FLUSH);
+                if (ret == -1)
+                    return 0;
+                if (ret == 1)           /* would block -- took put - len */
+                    return put - len;
+            }
         } while (len);
     }
     else {
@@ -238,7 +332,9 @@ local z_size_t gz_write(gz_statep state, voidpc buf, z_size_t len) {
 /*!
    Compress and write the len uncompressed bytes at buf to file.
 
-   \return number of uncompressed bytes written or 0 in case of error.
+   \return number of uncompressed bytes written or 0 in case of error.  With
+   "n" in the mode, it can be less than len, or zero, if the file would block,
+   as gzblocked() then tells.
 */
 int ZEXPORT gzwrite(gzFile file, voidpc buf, unsigned len) {
     gz_statep state;
@@ -249,16 +345,21 @@ int ZEXPORT gzwrite(gzFile file, voidpc buf, unsigned len) {
     state = (gz_statep)file;
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return 0;
 
     /* since an int is returned, make sure len fits in one, otherwise return
        with an error (this avoids a flaw in the interface) */
     if ((int)len < 0) {
-        gz_error(state, Z_DATA_ERROR, "requested length does not fit in int");
+        GZ_ERROR(state, Z_DATA_ERROR, "requested length does not fit in int");
         return 0;
     }
 
+#ifdef GZ_SHARED
+    if (state->shared != NULL)
+        return gz_shared_put(state, buf, len) ? 0 : (int)len;
+#endif
+
     /* write len bytes from buf (the return value will fit in an int) */
     return (int)gz_write(state, buf, len);
 }
@@ -272,7 +373,9 @@ int ZEXPORT gzwrite(gzFile file, voidpc buf, unsigned len) {
   \return Number of full items written of size size, or zero
   if there was an error.  If the multiplication of size and nitems overflows,
   i.e. the product does not fit in a z_size_t, then nothing is written, zero
-  is returned, and the error state is set to Z_STREAM_ERROR.
+  is returned, and the error state is set to Z_STREAM_ERROR.  With "n" in the
+  mode, part of an item can be written when the file would block, so a size
+  of 1 is best used then.
 */
 z_size_t ZEXPORT gzfwrite(voidpc buf, z_size_t size, z_size_t nitems,
                           gzFile file) {
@@ -285,16 +388,21 @@ z_size_t ZEXPORT gzfwrite(voidpc buf, z_size_t size, z_size_t nitems,
     state = (gz_statep)file;
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return 0;
 
     /* compute bytes to read -- error on overflow */
     len = nitems * size;
     if (size && len / size != nitems) {
-        gz_error(state, Z_STREAM_ERROR, "request does not fit in a size_t");
+        GZ_ERROR(state, Z_STREAM_ERROR, "request does not fit in a size_t");
         return 0;
     }
 
+#ifdef GZ_SHARED
+    if (state->shared != NULL)
+        return gz_shared_put(state, buf, len) ? 0 : nitems;
+#endif
+
     /* write len bytes to buf, return the number of full items written */
     return len ? gz_write(state, buf, len) / size : 0;
 }
@@ -317,9 +425,16 @@ int ZEXPORT gzputc(gzFile file, int c) {
     strm = &(state->strm);
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return -1;
 
+#ifdef GZ_SHARED
+    if (state->shared != NULL) {
+        buf[0] = (unsigned char)c;
+        return gz_shared_put(state, buf, 1) ? -1 : c & 0xff;
+    }
+#endif
+
     /* check for seek request */
     if (state->seek) {
         state->seek = 0;
@@ -352,7 +467,8 @@ int ZEXPORT gzputc(gzFile file, int c) {
   Compress and write the given null-terminated string s to file, excluding
   the terminating null character.
 
-  \return number of characters written, or -1 in case of error.
+  \return number of characters written, or -1 in case of error.  With "n" in
+  the mode, fewer characters are written if the file would block.
 */
 int ZEXPORT gzputs(gzFile file, const char *s) {
     z_size_t len, put;
@@ -364,17 +480,21 @@ int ZEXPORT gzputs(gzFile file, const char *s) {
     state = (gz_statep)file;
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return -1;
 
     /* write string */
     len = strlen(s);
     if ((int)len < 0 || (unsigned)len != len) {
-        gz_error(state, Z_STREAM_ERROR, "string length does not fit in int");
+        GZ_ERROR(state, Z_STREAM_ERROR, "string length does not fit in int");
         return -1;
     }
+#ifdef GZ_SHARED
+    if (state->shared != NULL)
+        return gz_shared_put(state, s, len) ? -1 : (int)len;
+#endif
     put = gz_write(state, s, len);
-    return put < len ? -1 : (int)len;
+    return put < len && !state->again ? -1 : (int)put;
 }
 
 #if defined(STDC) || defined(Z_HAVE_STDARG_H)
@@ -382,7 +502,7 @@ int ZEXPORT gzputs(gzFile file, const char *s) {
 
 /* -- see zlib.h -- */
 int ZEXPORTVA gzvprintf(gzFile file, const char *format, va_list va) {
-    int len;
+    int len, ret;
     unsigned left;
     char *next;
     gz_statep state;
@@ -395,9 +515,36 @@ int ZEXPORTVA gzvprintf(gzFile file, const char *format, va_list va) {
     strm = &(state->strm);
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return Z_STREAM_ERROR;
 
+#ifdef GZ_SHARED
+    /* with other writers, format in a buffer of this thread's own */
+    if (state->shared != NULL) {
+        char own[512], *str = own;
+        va_list again;
+
+        va_copy(again, va);
+        len = vsnprintf(own, sizeof(own), format, va);
+        if (len > 0 && (size_t)len >= sizeof(own) &&
+            (unsigned)len < state->want) {
+            str = (char *)malloc((size_t)len + 1);
+            if (str == NULL)
+                len = 0;
+            else
+                (void)vsnprintf(str, (size_t)len + 1, format, again);
+        }
+        va_end(again);
+        if (len <= 0 || (unsigned)len >= state->want)
+            len = 0;
+        else if (gz_shared_put(state, str, (z_size_t)len))
+            len = GZ_ERR(state);
+        if (str != own)
+            free(str);
+        return len;
+    }
+#endif
+
     /* make sure we have some buffer space */
     if (state->size == 0 && gz_init(state) == -1)
         return state->err;
@@ -409,6 +556,15 @@ int ZEXPORTVA gzvprintf(gzFile file, const char *format, va_list va) {
             return state->err;
     }
 
+    /* a write that would have blocked can leave state->size bytes or more in
+       the input buffer -- compress them before adding more */
+    if (state->nonblock && strm->avail_in &&
+        (unsigned)(strm->next_in - state->in) + strm->avail_in >= state->size) {
+        ret = gz_comp(state, Z_NO_FLUSH);
+        if (ret)
+            return ret == 1 ? 0 : state->err;
+    }
+
     /* do the printf() into the input buffer, put length in len -- the input
        buffer is double-sized just for this function, so there is guaranteed to
        be state->size bytes available after the current contents */
@@ -443,8 +599,13 @@ int ZEXPORTVA gzvprintf(gzFile file, const char *format, va_list va) {
     if (strm->avail_in >= state->size) {
         left = strm->avail_in - state->size;
         strm->avail_in = state->size;
-        if (gz_comp(state, Z_NO_FLUSH) == -1)
+        ret = gz_comp(state, Z_NO_FLUSH);
+        if (ret == -1)
             return state->err;
+        if (ret == 1) {         /* would block -- leave the rest after it */
+            strm->avail_in += left;
+            return len;
+        }
         memmove(state->in, state->in + state->size, left);
         strm->next_in = state->in;
         strm->avail_in = left;
@@ -483,6 +644,7 @@ int ZEXPORTVA gzprintf(gzFile file, const char *format, int a1, int a2, int a3,
                        int a4, int a5, int a6, int a7, int a8, int a9, int a10,
                        int a11, int a12, int a13, int a14, int a15, int a16,
                        int a17, int a18, int a19, int a20) {
+    int ret;
     unsigned len, left;
     char *next;
     gz_statep state;
@@ -513,6 +675,15 @@ int ZEXPORTVA gzprintf(gzFile file, const char *format, int a1, int a2, int a3,
             return state->error;
     }
 
+    /* a write that would have blocked can leave state->size bytes or more in
+       the input buffer -- compress them before adding more */
+    if (state->nonblock && strm->avail_in &&
+        (unsigned)(strm->next_in - state->in) + strm->avail_in >= state->size) {
+        ret = gz_comp(state, Z_NO_FLUSH);
+        if (ret)
+            return ret == 1 ? 0 : state->err;
+    }
+
     /* do the printf() into the input buffer, put length in len -- the input
        buffer is double-sized just for this function, so there is guaranteed to
        be state->size bytes available after the current contents */
@@ -552,8 +723,13 @@ int ZEXPORTVA gzprintf(gzFile file, const char *format, int a1, int a2, int a3,
     if (strm->avail_in >= state->size) {
         left = strm->avail_in - state->size;
         strm->avail_in = state->size;
-        if (gz_comp(state, Z_NO_FLUSH) == -1)
+        ret = gz_comp(state, Z_NO_FLUSH);
+        if (ret == -1)
             return state->err;
+        if (ret == 1) {         /* would block -- leave the rest after it */
+            strm->avail_in += left;
+            return (int)len;
+        }
         memmove(state->in, state->in + state->size, left);
         strm->next_in = state->in;
         strm->avail_in = left;
@@ -563,6 +739,22 @@ int ZEXPORTVA gzprintf(gzFile file, const char *format, int a1, int a2, int a3,
 
 #endif
 
+/* Process a seek request and compress the remaining data with flush -- return
+   the error state. */
+local int gz_flush(gz_statep state, int flush) {
+    /* check for seek request */
+    if (state->seek) {
+        state->seek = 0;
+        if (gz_zero(state, state->skip) == -1)
+            return state->err;
+    }
+
+    /* compress remaining data with requested flush */
+    if (gz_comp(state, flush) == 1)
+        return Z_BUF_ERROR;             /* would block -- call again */
+    return state->err;
+}
+
 /*!
   Flush all pending output to file.
   
@@ -579,9 +771,16 @@ int ZEXPORTVA gzprintf(gzFile file, const char *format, int a1, int a2, int a3,
 
   gzflush should be called only when strictly necessary because it will
   degrade compression if called too often.
+
+  With "n" in the mode, Z_BUF_ERROR is returned if the file would block.
+  gzflush() must then be called again with the same flush once the file is
+  ready, until it returns Z_OK.
 */
 int ZEXPORT gzflush(gzFile file, int flush) {
     gz_statep state;
+#ifdef GZ_SHARED
+    int ret;
+#endif
 
     /* get internal structure */
     if (file == NULL)
@@ -589,13 +788,35 @@ int ZEXPORT gzflush(gzFile file, int flush) {
     state = (gz_statep)file;
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK)
         return Z_STREAM_ERROR;
 
     /* check flush parameter */
     if (flush < 0 || flush > Z_FINISH)
         return Z_STREAM_ERROR;
 
+#ifdef GZ_SHARED
+    /* compress what the other writers gave first, and hold them off */
+    if (state->shared != NULL) {
+        gz_shared_lock(state);
+        ret = gz_flush(state, flush);
+        gz_shared_unlock(state);
+        return ret;
+    }
+#endif
+    return gz_flush(state, flush);
+}
+
+/* Change the compression parameters of state to level and strategy, for
+   gzsetparams(). */
+local int gz_params(gz_statep state, int level, int strategy) {
+    int ret;
+    z_streamp strm = &(state->strm);
+
+    /* if no change is requested, then do nothing */
+    if (level == state->level && strategy == state->strategy)
+        return Z_OK;
+
     /* check for seek request */
     if (state->seek) {
         state->seek = 0;
@@ -603,9 +824,19 @@ int ZEXPORT gzflush(gzFile file, int flush) {
             return state->err;
     }
 
-    /* compress remaining data with requested flush */
-    (void)gz_comp(state, flush);
-    return state->err;
+    /* change compression parameters for subsequent input */
+    if (state->size) {
+        /* flush previous input with previous parameters before changing */
+        if (strm->avail_in) {
+            ret = gz_comp(state, Z_BLOCK);
+            if (ret)
+                return ret == 1 ? Z_BUF_ERROR : state->err;
+        }
+        deflateParams(strm, level, strategy);
+    }
+    state->level = level;
+    state->strategy = strategy;
+    return Z_OK;
 }
 
 /*!
@@ -617,42 +848,34 @@ int ZEXPORT gzflush(gzFile file, int flush) {
   \return Z_STREAM_ERROR if the file was not opened for writing
   \return Z_ERRNO if there is an error writing the flushed data
   \return Z_MEM_ERROR if there is a memory allocation error
+  \return Z_BUF_ERROR if the file was opened with "n" and would block, with
+  the parameters not changed yet
 */
 int ZEXPORT gzsetparams(gzFile file, int level, int strategy) {
     gz_statep state;
-    z_streamp strm;
+#ifdef GZ_SHARED
+    int ret;
+#endif
 
     /* get internal structure */
     if (file == NULL)
         return Z_STREAM_ERROR;
     state = (gz_statep)file;
-    strm = &(state->strm);
 
     /* check that we're writing and that there's no error */
-    if (state->mode != GZ_WRITE || state->err != Z_OK || state->direct)
+    if (state->mode != GZ_WRITE || GZ_ERR(state) != Z_OK || state->direct)
         return Z_STREAM_ERROR;
 
-    /* if no change is requested, then do nothing */
-    if (level == state->level && strategy == state->strategy)
-        return Z_OK;
-
-    /* check for seek request */
-    if (state->seek) {
-        state->seek = 0;
-        if (gz_zero(state, state->skip) == -1)
-            return state->err;
-    }
-
-    /* change compression parameters for subsequent input */
-    if (state->size) {
-        /* flush previous input with previous parameters before changing */
-        if (strm->avail_in && gz_comp(state, Z_BLOCK) == -1)
-            return state->err;
-        deflateParams(strm, level, strategy);
+#ifdef GZ_SHARED
+    /* change them between the records of the other writers */
+    if (state->shared != NULL) {
+        gz_shared_lock(state);
+        ret = gz_params(state, level, strategy);
+        gz_shared_unlock(state);
+        return ret;
     }
-    state->level = level;
-    state->strategy = strategy;
-    return Z_OK;
+#endif
+    return gz_params(state, level, strategy);
 }
 
 /*!
@@ -666,7 +889,7 @@ int ZEXPORT gzsetparams(gzFile file, int level, int strategy) {
   zlib library.
 */
 int ZEXPORT gzclose_w(gzFile file) {
-    int ret = Z_OK;
+    int ret = Z_OK, err;
     gz_statep state;
 
     /* get internal structure */
@@ -678,6 +901,14 @@ int ZEXPORT gzclose_w(gzFile file) {
     if (state->mode != GZ_WRITE)
         return Z_STREAM_ERROR;
 
+#ifdef GZ_SHARED
+    /* compress what is left in the ring */
+    if (state->shared != NULL) {
+        gz_shared_lock(state);
+        gz_shared_end(state);
+    }
+#endif
+
     /* check for seek request */
     if (state->seek) {
         state->seek = 0;
@@ -685,9 +916,15 @@ int ZEXPORT gzclose_w(gzFile file) {
             ret = state->err;
     }
 
-    /* flush, free memory, and close file */
-    if (gz_comp(state, Z_FINISH) == -1)
+    /* flush, free memory, and close file -- waiting as needed for a file that
+       would block */
+    while ((err = gz_comp(state, Z_FINISH)) == 1)
+        gz_wait(state);
+    if (err == -1)
         ret = state->err;
+#ifdef GZ_URING
+    gz_uring_end(state);
+#endif
     if (state->size) {
         if (!state->direct) {
             (void)deflateEnd(&(state->strm));
@@ -697,7 +934,7 @@ int ZEXPORT gzclose_w(gzFile file) {
     }
     gz_error(state, Z_OK, NULL);
     free(state->path);
-    if (close(state->fd) == -1)
+    if (gz_sysclose(state) == -1)
         ret = Z_ERRNO;
     free(state);
     return ret;
@@ -98,6 +98,10 @@ static int inflateStateCheck (z_streamp strm);
 static void fixedtables (struct inflate_state *state);
 static int updatewindow (z_streamp strm, const Bytef *end,
                            unsigned int copy);
+static unsigned tok_literals (struct inflate_state *state,
+                              const unsigned char *buf, unsigned len);
+static int tok_block (struct inflate_state *state, unsigned type);
+static void tok_match (struct inflate_state *state);
 #ifdef BUILDFIXED
    void makefixed (void);
 #endif
@@ -133,6 +137,8 @@ int ZEXPORT inflateResetKeep (z_streamp strm)
     state->flags = -1;
     state->dmax = 32768U;
     state->head = Z_NULL;
+    state->tok = Z_NULL;
+    state->run = Z_NULL;
     state->hold = 0;
     state->bits = 0;
     state->lencode = state->distcode = state->next = state->codes;
@@ -540,6 +546,97 @@ int updatewindow (z_streamp strm, const Bytef* end, unsigned int copy)
     return 0;
 }
 
+/*
+   Write the literals buf[0..len-1] to the tokens of inflateTokens(), adding
+   them to the open literal run as long as it is shorter than TOK_RUN.  Return
+   the number of literals written, which is less than len if there is no more
+   room at state->tok->next.
+ */
+unsigned tok_literals (struct inflate_state* state, const unsigned char* buf,
+                       unsigned len)
+{
+    z_tokensp tok = state->tok;
+    unsigned n, done = 0;
+
+    while (len) {
+        if (state->run != Z_NULL && *state->run < TOK_RUN - 1) {
+            n = TOK_RUN - 1 - *state->run;
+            if (n > len) n = len;
+            if (n > tok->avail) n = tok->avail;
+            if (n == 0) break;
+            *state->run += (unsigned char)n;
+        }
+        else {
+            if (tok->avail < 2) break;
+            state->run = tok->next++;
+            *state->run = 0;
+            tok->avail--;
+            tok->total++;
+            n = 1;
+        }
+        zmemcpy(tok->next, buf, n);
+        tok->next += n;
+        tok->avail -= n;
+        tok->total += n;
+        buf += n;
+        len -= n;
+        done += n;
+    }
+    return done;
+}
+
+/*
+   Write the token of a block of type 0 (stored), 1 (fixed) or 2 (dynamic),
+   once its header is decoded, or return 0 if there is not room for it.
+ */
+int tok_block (struct inflate_state* state, unsigned type)
+{
+    z_tokensp tok = state->tok;
+    unsigned char* put = tok->next;
+    unsigned n, size, i;
+
+    n = type == 2 ? state->nlen + state->ndist : 0;
+    size = type == 0 ? 4 : type == 1 ? 2 : 4 + ((n + 1) >> 1);
+    if (tok->avail < size) return 0;
+    put[0] = TOK_BLOCK;
+    put[1] = (unsigned char)(state->last | type << 1);
+    if (type == 0) {
+        put[2] = (unsigned char)(state->length);
+        put[3] = (unsigned char)(state->length >> 8);
+    }
+    else if (type == 2) {
+        put[2] = (unsigned char)(state->nlen - 257);
+        put[3] = (unsigned char)(state->ndist - 1);
+        for (i = 0; i < n; i++)
+            if (i & 1)
+                put[4 + (i >> 1)] |= (unsigned char)(state->lens[i] << 4);
+            else
+                put[4 + (i >> 1)] = (unsigned char)(state->lens[i]);
+    }
+    tok->next += size;
+    tok->avail -= size;
+    tok->total += size;
+    state->run = Z_NULL;
+    return 1;
+}
+
+/*
+   Write the token of the match of state->length bytes at state->offset back.
+   There must be room for three bytes.
+ */
+void tok_match (struct inflate_state* state)
+{
+    z_tokensp tok = state->tok;
+
+    tok->next[0] = (unsigned char)(0x80 | (state->offset - 1) >> 8);
+    tok->next[1] = (unsigned char)(state->offset - 1);
+    tok->next[2] = (unsigned char)(state->length - 3);
+    tok->next += 3;
+    tok->avail -= 3;
+    tok->total += 3;
+    state->run = Z_NULL;
+}
+
 /* Macros for inflate(): */
 
 /* check function to use adler32() for zlib or crc32() for gzip */
@@ -846,6 +943,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
     code last;                  /* parent table entry */
     unsigned len;               /* length to copy for repeats, bits to drop */
     int ret;                    /* return code */
+    uLong tokens;               /* save starting count of token bytes */
 #ifdef GUNZIP
     unsigned char hbuf[4];      /* buffer for gzip header crc calculation */
 #endif
@@ -861,6 +959,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
     LOAD();
     in = have;
     out = left;
+    tokens = state->tok != Z_NULL ? state->tok->total : 0;
     ret = Z_OK;
     for (;;)
         switch (state->mode) {
@@ -1120,6 +1219,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
             if (flush == Z_TREES) goto inf_leave;
                 /* fallthrough */
         case COPY_:
+            if (state->tok != Z_NULL && !tok_block(state, 0)) goto inf_leave;
             state->mode = COPY;
                 /* fallthrough */
         case COPY:
@@ -1128,6 +1228,10 @@ int ZEXPORT inflate (z_streamp strm, int flush)
                 if (copy > have) copy = have;
                 if (copy > left) copy = left;
                 if (copy == 0) goto inf_leave;
+                if (state->tok != Z_NULL) {
+                    copy = tok_literals(state, next, copy);
+                    if (copy == 0) goto inf_leave;
+                }
                 zmemcpy(put, next, copy);
                 have -= copy;
                 next += copy;
@@ -1265,12 +1369,19 @@ int ZEXPORT inflate (z_streamp strm, int flush)
             if (flush == Z_TREES) goto inf_leave;
                 /* fallthrough */
         case LEN_:
+            if (state->tok != Z_NULL &&
+                    !tok_block(state, state->lencode == state->codes ? 2 : 1))
+                goto inf_leave;
             state->mode = LEN;
                 /* fallthrough */
         case LEN:
-            if (have >= 6 && left >= 258) {
+            if (have >= 6 && left >= 258 &&
+                    (state->tok == Z_NULL || state->tok->avail >= 3)) {
                 RESTORE();
-                inflate_fast(strm, out);
+                if (state->tok == Z_NULL)
+                    inflate_fast(strm, out);
+                else
+                    inflate_fast_tokens(strm, out);
                 LOAD();
                 if (state->mode == TYPE)
                     state->back = -1;
@@ -1357,6 +1468,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
             state->mode = DISTEXT;
                 /* fallthrough */
         case DISTEXT:
+            if (state->tok != Z_NULL && state->tok->avail < 3) goto inf_leave;
             if (state->extra) {
                 NEEDBITS(state->extra);
                 state->offset += BITS(state->extra);
@@ -1371,6 +1483,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
             }
 #endif
             Tracevv((stderr, "inflate:         distance %u\n", state->offset));
+            if (state->tok != Z_NULL) tok_match(state);
             state->mode = MATCH;
                 /* fallthrough */
         case MATCH:
@@ -1420,7 +1533,10 @@ int ZEXPORT inflate (z_streamp strm, int flush)
             break;
         case LIT:
             if (left == 0) goto inf_leave;
-            *put++ = (unsigned char)(state->length);
+            *put = (unsigned char)(state->length);
+            if (state->tok != Z_NULL && tok_literals(state, put, 1) == 0)
+                goto inf_leave;
+            put++;
             left--;
             state->mode = LEN;
             break;
@@ -1485,6 +1601,7 @@ int ZEXPORT inflate (z_streamp strm, int flush)
      */
   inf_leave:
     RESTORE();
+    state->run = Z_NULL;
     if (state->wsize || (out != strm->avail_out && state->mode < BAD &&
             (state->mode < CHECK || flush != Z_FINISH)))
         if (updatewindow(strm, strm->next_out, out - strm->avail_out)) {
@@ -1502,7 +1619,9 @@ int ZEXPORT inflate (z_streamp strm, int flush)
     strm->data_type = (int)state->bits + (state->last ? 64 : 0) +
                       (state->mode == TYPE ? 128 : 0) +
                       (state->mode == LEN_ || state->mode == COPY_ ? 256 : 0);
-    if (((in == 0 && out == 0) || flush == Z_FINISH) && ret == Z_OK)
+    if (((in == 0 && out == 0 &&
+          (state->tok == Z_NULL || state->tok->total == tokens)) ||
+         flush == Z_FINISH) && ret == Z_OK)
         ret = Z_BUF_ERROR;
     return ret;
 }
@@ -1668,6 +1787,62 @@ int ZEXPORT inflateGetHeader (z_streamp strm, gz_headerp head)
     return Z_OK;
 }
 
+/*!
+  Requests that inflate() also write the LZ77 tokens of the deflate data it
+  decodes, the literals, matches and block headers, at tok->next.
+
+  inflateTokens() may be called after inflateInit2() or inflateReset(), or
+  between inflate() calls to start or stop the tokens at that point, with tok
+  set to Z_NULL to stop them.  The decompressed data is written at next_out as
+  usual; an application that only wants the tokens can give the same scratch
+  output buffer to each inflate() call.
+
+  inflateTokens() sets tok->total to zero.  As inflate() writes tokens, it
+  updates tok->next, tok->avail and tok->total as it does next_out, avail_out
+  and total_out.  When tok->avail is too small for the next token, inflate()
+  returns with Z_OK, or Z_BUF_ERROR if it made no progress at all, and can be
+  called again after making room.  A token is never split between calls, so
+  there must be room for the largest one, 162 bytes for a dynamic block
+  header, for inflate() to go on.
+
+  The tokens are bytes, in the order of the data they stand for:
+
+  - 0x00..0x7e: n, then n + 1 literal bytes.  A stored block is written as
+    literals too.
+  - 0x7f: a block header, then one byte with the last-block flag in bit 0 and
+    the block type in bits 1 and 2: 0 for stored, 1 for fixed and 2 for
+    dynamic codes.  A stored block has its length in two bytes, least
+    significant first.  A dynamic block has HLIT and HDIST as in RFC 1951, the
+    number of literal/length codes less 257 and the number of distance codes
+    less one, then the code lengths of those codes, two per byte, the first in
+    the low four bits.
+  - 0x80..0xff: a match, two bytes with 0x8000 plus the distance less one,
+    most significant first, then one byte with the length less three.
+
+  Within one inflate() call, consecutive literals are grouped in runs of up to
+  127.  The end of a block is not written: it is the next block header, or the
+  end of the stream after the block with the last-block flag.  inflateReset()
+  stops the tokens.
+
+  \return Z_OK if success
+  \return Z_STREAM_ERROR if the source stream state was inconsistent.
+*/
+int ZEXPORT inflateTokens (z_streamp strm, z_tokensp tok)
+{
+    struct inflate_state* state;
+
+    /* check state */
+    if (inflateStateCheck(strm)) return Z_STREAM_ERROR;
+    state = (struct inflate_state*)strm->state;
+
+    /* save token structure */
+    state->tok = tok;
+    state->run = Z_NULL;
+    if (tok != Z_NULL)
+        tok->total = 0;
+    return Z_OK;
+}
+
 /*!
    Search buf[0..len-1] for the pattern: 0, 0, 0xff, 0xff.  Return when found
    or when out of input.  When called, *have is the number of pattern bytes
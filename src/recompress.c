@@ -0,0 +1,686 @@
+/*!
+  \file recompress.c Encode a deflate stream again, keeping its matches
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  A fast compressor saves time on the search for matches, and also on the
+  blocks: it ends one whenever its symbol buffer is full, or uses the fixed
+  codes.  recompress() decodes such a stream into its literals and matches,
+  and codes them again with the trees of trees.c, after choosing the block
+  boundaries where the symbol statistics change.  There is no search for
+  matches, so it takes a fraction of the time of compressing the data again
+  at a higher level, for a part of the gain.
+
+  The decoder here keeps the symbols of a batch of the source, up to 64K of
+  them, and the data they stand for, after the 32K of history the matches can
+  reach.  A batch is split in two where that saves the most bits, as costed
+  by building the trees of each part, and the parts are split again as long
+  as that saves bits.  The splits tried are evenly spaced and at the block
+  ends of the source, and when the result is no smaller than the source, its
+  blocks are copied as they are instead.  Each part is then tallied and
+  flushed by trees.c as a block of deflate would be, so it can also go out
+  stored or with the fixed codes.
+*/
+
+#define ZLIB_INTERNAL
+#include "deflate.h"
+#include "inftrees.h"
+#include "inffixed.h"
+
+#define RC_HIST 32768U          /* history kept for the matches */
+#define RC_DATA 262144U         /* most data in a batch */
+#define RC_SYMS 65535U          /* most symbols in a batch */
+#define RC_MIN  1024            /* fewest symbols in a part worth splitting */
+#define RC_TRY  8               /* even splits tried for a part */
+#define RC_ENDS 64              /* most block ends of the source kept */
+
+/* frequencies of the literal/length and distance codes of some symbols */
+typedef struct {
+    unsigned l[L_CODES];
+    unsigned d[D_CODES];
+} rc_freq;
+
+/* where the decoder is in the source */
+typedef enum {
+    RC_HEAD,    /* at a block header */
+    RC_STORED,  /* in a stored block */
+    RC_CODES,   /* in a block of codes */
+    RC_DONE     /* after the last block */
+} rc_mode;
+
+typedef struct {
+    /* source */
+    const Bytef *next;          /* next input byte */
+    const Bytef *end;           /* end of the input */
+    ulg hold;                   /* bit buffer */
+    unsigned bits;              /* bits in hold, fewer than 8 between blocks */
+    rc_mode mode;               /* state of the decoder */
+    int last;                   /* true for the last block */
+    unsigned left;              /* bytes left in a stored block */
+    const code *lcode;          /* literal/length table */
+    const code *dcode;          /* distance table */
+    unsigned lbits, dbits;      /* their index bits */
+    code codes[ENOUGH];         /* dynamic tables */
+    ush lens[320];              /* code lengths */
+    ush work[288];              /* for inflate_table() */
+
+    /* batch */
+    Bytef *data;                /* history, then the data of the batch */
+    ulg have;                   /* bytes in data */
+    ulg out;                    /* data not yet in a block starts here */
+    ush *dist;                  /* distances of the symbols, 0 for literals */
+    uch *lc;                    /* literals, or lengths less MIN_MATCH */
+    unsigned n;                 /* symbols in the batch */
+    rc_freq freq;               /* their frequencies */
+    unsigned ends[RC_ENDS];     /* symbols where source blocks ended */
+    unsigned nends;             /* number of ends */
+
+    /* destination */
+    z_streamp strm;             /* deflate stream for the trees */
+    uLong room;                 /* dest left after strm->avail_out */
+} rc_state;
+
+/* bit buffer of the decoder, as in inflate.c, going to bad at the end of the
+   input */
+#define PULLBYTE() \
+    do { \
+        if (r->next == r->end) goto bad; \
+        r->hold += (ulg)(*r->next++) << r->bits; \
+        r->bits += 8; \
+    } while (0)
+#define NEEDBITS(n) \
+    do { \
+        while (r->bits < (unsigned)(n)) PULLBYTE(); \
+    } while (0)
+#define BITS(n) ((unsigned)r->hold & ((1U << (n)) - 1))
+#define DROPBITS(n) \
+    do { \
+        r->hold >>= (n); \
+        r->bits -= (unsigned)(n); \
+    } while (0)
+
+/* ===========================================================================
+ * Decode the code from table with root bits at the bit buffer into here.
+ */
+#define DECODE(table, root) \
+    do { \
+        for (;;) { \
+            here = table[BITS(root)]; \
+            if ((unsigned)here.bits <= r->bits) break; \
+            PULLBYTE(); \
+        } \
+        if (here.op && (here.op & 0xf0) == 0) { \
+            last = here; \
+            for (;;) { \
+                here = table[last.val + \
+                             (BITS(last.bits + last.op) >> last.bits)]; \
+                if ((unsigned)(last.bits + here.bits) <= r->bits) break; \
+                PULLBYTE(); \
+            } \
+            DROPBITS(last.bits); \
+        } \
+        DROPBITS(here.bits); \
+    } while (0)
+
+/* ===========================================================================
+ * Read the code lengths of a dynamic block and build its tables. Return 0,
+ * or -1 if they are not valid or the input ends.
+ */
+local int rc_tables(rc_state *r) {
+    static const ush order[19] =
+        {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    unsigned nlen, ndist, ncode, have, len, copy;
+    code here, *next;
+
+    NEEDBITS(14);
+    nlen = BITS(5) + 257;
+    DROPBITS(5);
+    ndist = BITS(5) + 1;
+    DROPBITS(5);
+    ncode = BITS(4) + 4;
+    DROPBITS(4);
+    if (nlen > 286 || ndist > 30)
+        return -1;
+    for (have = 0; have < ncode; have++) {
+        NEEDBITS(3);
+        r->lens[order[have]] = (ush)BITS(3);
+        DROPBITS(3);
+    }
+    for (; have < 19; have++)
+        r->lens[order[have]] = 0;
+    next = r->codes;
+    r->lcode = next;
+    r->lbits = 7;
+    if (inflate_table(CODES, r->lens, 19, &next, &r->lbits, r->work))
+        return -1;
+
+    have = 0;
+    while (have < nlen + ndist) {
+        for (;;) {
+            here = r->lcode[BITS(r->lbits)];
+            if ((unsigned)here.bits <= r->bits) break;
+            PULLBYTE();
+        }
+        if (here.val < 16) {
+            DROPBITS(here.bits);
+            r->lens[have++] = here.val;
+            continue;
+        }
+        if (here.val == 16) {
+            NEEDBITS(here.bits + 2);
+            DROPBITS(here.bits);
+            if (have == 0)
+                return -1;
+            len = r->lens[have - 1];
+            copy = 3 + BITS(2);
+            DROPBITS(2);
+        }
+        else if (here.val == 17) {
+            NEEDBITS(here.bits + 3);
+            DROPBITS(here.bits);
+            len = 0;
+            copy = 3 + BITS(3);
+            DROPBITS(3);
+        }
+        else {
+            NEEDBITS(here.bits + 7);
+            DROPBITS(here.bits);
+            len = 0;
+            copy = 11 + BITS(7);
+            DROPBITS(7);
+        }
+        if (have + copy > nlen + ndist)
+            return -1;
+        while (copy--)
+            r->lens[have++] = (ush)len;
+    }
+    if (r->lens[256] == 0)
+        return -1;
+
+    next = r->codes;
+    r->lcode = next;
+    r->lbits = 9;
+    if (inflate_table(LENS, r->lens, nlen, &next, &r->lbits, r->work))
+        return -1;
+    r->dcode = next;
+    r->dbits = 6;
+    if (inflate_table(DISTS, r->lens + nlen, ndist, &next, &r->dbits,
+                      r->work))
+        return -1;
+    return 0;
+  bad:
+    return -1;
+}
+
+/* note the end of a source block at the current symbol, as a split to try */
+#define END_BLOCK() \
+    do { \
+        if (r->nends < RC_ENDS && r->n && \
+            (r->nends == 0 || r->ends[r->nends - 1] != r->n)) \
+            r->ends[r->nends++] = r->n; \
+    } while (0)
+
+/* ===========================================================================
+ * Decode the source into the batch until it is full or the last block ends.
+ * Return Z_OK, or Z_DATA_ERROR if the source is not valid or incomplete, or
+ * has a distance farther back than wsize.
+ */
+local int rc_decode(rc_state *r, ulg wsize) {
+    code here, last;
+    unsigned len, dist, n;
+
+    while (r->mode != RC_DONE) {
+        if (r->n == RC_SYMS || r->have + MAX_MATCH > RC_HIST + RC_DATA)
+            return Z_OK;
+        switch (r->mode) {
+        case RC_HEAD:
+            NEEDBITS(3);
+            r->last = BITS(1);
+            DROPBITS(1);
+            switch (BITS(2)) {
+            case 0:
+                DROPBITS(2);
+                DROPBITS(r->bits & 7);
+                r->next -= r->bits >> 3;
+                r->hold = 0;
+                r->bits = 0;
+                if (r->end - r->next < 4)
+                    goto bad;
+                len = r->next[0] + ((unsigned)r->next[1] << 8);
+                if ((len ^ 0xffff) !=
+                    r->next[2] + ((unsigned)r->next[3] << 8))
+                    goto bad;
+                r->next += 4;
+                r->left = len;
+                r->mode = RC_STORED;
+                break;
+            case 1:
+                DROPBITS(2);
+                r->lcode = lenfix;
+                r->lbits = 9;
+                r->dcode = distfix;
+                r->dbits = 5;
+                r->mode = RC_CODES;
+                break;
+            case 2:
+                DROPBITS(2);
+                if (rc_tables(r))
+                    goto bad;
+                r->mode = RC_CODES;
+                break;
+            default:
+                goto bad;
+            }
+            break;
+
+        case RC_STORED:
+            n = r->left;
+            if (n > RC_SYMS - r->n)
+                n = RC_SYMS - r->n;
+            if (n > RC_HIST + RC_DATA - r->have)
+                n = (unsigned)(RC_HIST + RC_DATA - r->have);
+            if ((ulg)(r->end - r->next) < n)
+                goto bad;
+            zmemcpy(r->data + r->have, r->next, n);
+            zmemcpy(r->lc + r->n, r->next, n);
+            zmemzero(r->dist + r->n, n * sizeof(ush));
+            r->next += n;
+            r->have += n;
+            r->n += n;
+            r->left -= n;
+            if (r->left == 0) {
+                END_BLOCK();
+                r->mode = r->last ? RC_DONE : RC_HEAD;
+            }
+            break;
+
+        case RC_CODES:
+            do {
+                DECODE(r->lcode, r->lbits);
+                if (here.op == 0) {
+                    r->data[r->have++] = (Bytef)here.val;
+                    r->dist[r->n] = 0;
+                    r->lc[r->n++] = (uch)here.val;
+                    continue;
+                }
+                if (here.op & 32) {
+                    END_BLOCK();
+                    r->mode = r->last ? RC_DONE : RC_HEAD;
+                    break;
+                }
+                if (here.op & 64)
+                    goto bad;
+                len = here.val;
+                n = here.op & 15;
+                if (n) {
+                    NEEDBITS(n);
+                    len += BITS(n);
+                    DROPBITS(n);
+                }
+                DECODE(r->dcode, r->dbits);
+                if ((here.op & 16) == 0)
+                    goto bad;
+                dist = here.val;
+                n = here.op & 15;
+                if (n) {
+                    NEEDBITS(n);
+                    dist += BITS(n);
+                    DROPBITS(n);
+                }
+                if (dist > r->have || dist > wsize)
+                    goto bad;
+                for (n = 0; n < len; n++, r->have++)
+                    r->data[r->have] = r->data[r->have - dist];
+                r->dist[r->n] = (ush)dist;
+                r->lc[r->n++] = (uch)(len - MIN_MATCH);
+            } while (r->n < RC_SYMS &&
+                     r->have + MAX_MATCH <= RC_HIST + RC_DATA);
+            break;
+
+        default:
+            break;
+        }
+    }
+    return Z_OK;
+  bad:
+    return Z_DATA_ERROR;
+}
+
+/* ===========================================================================
+ * Add the symbols from lo to hi of the batch to the frequencies f.
+ */
+local void rc_count(const rc_state *r, unsigned lo, unsigned hi, rc_freq *f) {
+    unsigned i, dist;
+
+    for (i = lo; i < hi; i++) {
+        dist = r->dist[i];
+        if (dist == 0)
+            f->l[r->lc[i]]++;
+        else {
+            f->l[_length_code[r->lc[i]] + LITERALS + 1]++;
+            f->d[d_code(dist - 1)]++;
+        }
+    }
+}
+
+/* ===========================================================================
+ * Return the bits for a block with the frequencies f less those of less, if
+ * not NULL.
+ */
+local ulg rc_cost(rc_state *r, const rc_freq *f, const rc_freq *less) {
+    deflate_state *s = r->strm->state;
+    int i;
+
+    for (i = 0; i < L_CODES; i++)
+        s->dyn_ltree[i].Freq = (ush)(f->l[i] - (less ? less->l[i] : 0));
+    for (i = 0; i < D_CODES; i++)
+        s->dyn_dtree[i].Freq = (ush)(f->d[i] - (less ? less->d[i] : 0));
+    s->dyn_ltree[LITERALS].Freq = 1;   /* the end of block */
+    return _tr_block_bits(s);
+}
+
+/* ===========================================================================
+ * Tally the symbols from lo to hi and write them as a block, last if last is
+ * true. Return Z_OK, or Z_BUF_ERROR if dest is full.
+ */
+local int rc_block(rc_state *r, unsigned lo, unsigned hi, int last) {
+    z_streamp strm = r->strm;
+    deflate_state *s = strm->state;
+    const uInt max = (uInt)-1;
+    ulg len = 0;
+    unsigned i, n;
+    int full;
+
+    for (i = lo; i < hi; i++)
+        if (r->dist[i]) {
+            _tr_tally_dist(s, r->dist[i], r->lc[i], full);
+            len += r->lc[i] + MIN_MATCH;
+        }
+        else {
+            _tr_tally_lit(s, r->lc[i], full);
+            len++;
+        }
+    (void)full;
+    _tr_flush_block(s, len <= 0xffff ? (charf *)r->data + r->out : NULL,
+                    len, last);
+    r->out += len;
+
+    /* flush_pending(), taking more of dest as needed */
+    _tr_flush_bits(s);
+    while (s->pending) {
+        if (strm->avail_out == 0) {
+            if (r->room == 0)
+                return Z_BUF_ERROR;
+            strm->avail_out = r->room > (uLong)max ? max : (uInt)r->room;
+            r->room -= strm->avail_out;
+        }
+        n = s->pending < strm->avail_out ? s->pending : strm->avail_out;
+        zmemcpy(strm->next_out, s->pending_out, n);
+        strm->next_out += n;
+        s->pending_out += n;
+        strm->total_out += n;
+        strm->avail_out -= n;
+        s->pending -= n;
+    }
+    s->pending_out = s->pending_buf;
+    return Z_OK;
+}
+
+/* ===========================================================================
+ * Write the symbols from lo to hi as blocks, split where that saves bits,
+ * the last one last if last is true. f has their frequencies, and is used up,
+ * and whole is their cost as one block, or 0 if that is not known. Return as
+ * rc_block(). The splits tried are evenly spaced, and where the source ended
+ * its blocks, so that the blocks of a source that chose them well are found
+ * again.
+ */
+local int rc_split(rc_state *r, unsigned lo, unsigned hi, rc_freq *f,
+                   ulg whole, int last) {
+    rc_freq left;
+    unsigned k, e, even, at, prev, best = 0, max;
+    ulg cost, rest, first = 0, second = 0, min = (ulg)-1;
+    int err;
+
+    max = r->strm->state->lit_bufsize - 1;
+    if (hi - lo < 2 * RC_MIN && hi - lo <= max)
+        return rc_block(r, lo, hi, last);
+    if (whole == 0 && hi - lo <= max)
+        whole = rc_cost(r, f, Z_NULL);
+
+    /* the cost of the two parts at each split tried, in order */
+    zmemzero(&left, sizeof(rc_freq));
+    prev = lo;
+    k = 1;
+    for (e = 0; e < r->nends && r->ends[e] <= lo; e++)
+        ;
+    for (;;) {
+        even = k < RC_TRY ? lo + (unsigned)((ulg)(hi - lo) * k / RC_TRY) : hi;
+        if (e < r->nends && r->ends[e] < even)
+            at = r->ends[e++];
+        else {
+            at = even;
+            k++;
+        }
+        if (at >= hi)
+            break;
+        if (at == prev)
+            continue;
+        rc_count(r, prev, at, &left);
+        prev = at;
+        cost = rc_cost(r, &left, Z_NULL);
+        rest = rc_cost(r, f, &left);
+        if (cost + rest < min) {
+            first = cost;
+            second = rest;
+            min = cost + rest;
+            best = at;
+        }
+    }
+
+    /* a part too large for one block is split even if that costs bits */
+    if (hi - lo <= max && whole <= min)
+        return rc_block(r, lo, hi, last);
+    zmemzero(&left, sizeof(rc_freq));
+    rc_count(r, lo, best, &left);
+    for (k = 0; k < L_CODES; k++)
+        f->l[k] -= left.l[k];
+    for (k = 0; k < D_CODES; k++)
+        f->d[k] -= left.d[k];
+    err = rc_split(r, lo, best, &left, first, 0);
+    if (err == Z_OK)
+        err = rc_split(r, best, hi, f, second, last);
+    return err;
+}
+
+/*!
+   Compress the deflate stream at source again, with the same literals and
+   matches, but with new block boundaries and Huffman codes, into the format
+   of destBits.  This shrinks the output of fast compressors, which do not
+   spend the time to choose their blocks well, or use only the fixed codes,
+   at a small part of the cost of compressing the data again.  The formats
+   are given by the windowBits of deflateInit2() and inflateInit2(), as for
+   rewrap().  The window of destBits must reach all the distances of the
+   source, so it is safest to use 15 or 31.
+
+   The source is decoded once, checking its check value, and the check value
+   of the destination is computed on the way.  The destination header is the
+   one deflate() writes at the default level.  The matches of the source are
+   kept, so the result is not what a higher level would give, but costs no
+   search: much of the gain over a stream made with few or fixed blocks, and
+   less for the output of deflate(), which already has dynamic blocks.  The
+   splits tried include the block ends of the source, and if the new blocks
+   are still no smaller than those of the source, the source blocks are kept
+   as they are, as by rewrap().  So the deflate data never grows.
+
+   *sourceLen is the length of the source, and *destLen the size of dest.
+   On success, *destLen is the length of the new stream and *sourceLen the
+   number of source bytes used.  dest may not overlap source.
+
+   \return Z_OK if success, Z_MEM_ERROR if there was not enough memory,
+   Z_BUF_ERROR if there was not enough room in dest, Z_STREAM_ERROR if a
+   format is not valid, or Z_DATA_ERROR if the source is corrupted or
+   incomplete, needs a preset dictionary, or has a distance farther back
+   than the window of destBits.
+*/
+int ZEXPORT recompress(Bytef *dest, uLongf *destLen, int destBits,
+                       const Bytef *source, uLong *sourceLen,
+                       int sourceBits) {
+    z_stream strm, head;
+    rc_state *r;
+    deflate_state *s;
+    const uInt max = (uInt)-1;
+    uLong hlen, check = 0, crc, adler, total = 0, size = *destLen, body = 0;
+    int err, from, to;
+
+    /* the header of the source, and its format if it is to be detected */
+    from = sourceBits < 0 ? 0 : sourceBits < 16 ? 1 : sourceBits < 32 ? 2 :
+           -1;
+    to = destBits < 0 ? 0 : destBits < 16 ? 1 : 2;
+    hlen = 0;
+    if (from) {
+        head.zalloc = (alloc_func)0;
+        head.zfree = (free_func)0;
+        head.opaque = (voidpf)0;
+        head.next_in = source;
+        head.avail_in = 0;
+        err = inflateInit2(&head, sourceBits);
+        if (err != Z_OK)
+            return err;
+        hlen = *sourceLen;
+        do {
+            if (head.avail_in == 0) {
+                head.avail_in = hlen > (uLong)max ? max : (uInt)hlen;
+                hlen -= head.avail_in;
+            }
+            head.next_out = (Bytef *)&check;
+            head.avail_out = 0;
+            err = inflate(&head, Z_BLOCK);
+        } while (err == Z_OK && (head.data_type & 128) == 0);
+        hlen = head.total_in;
+        inflateEnd(&head);
+        if (err != Z_OK && err != Z_BUF_ERROR)
+            return err == Z_NEED_DICT ? Z_DATA_ERROR : err;
+        if ((head.data_type & 128) == 0)
+            return Z_DATA_ERROR;
+        if (from < 0)
+            from = source[0] == 31 && source[1] == 139 ? 2 : 1;
+    }
+
+    strm.zalloc = (alloc_func)0;
+    strm.zfree = (free_func)0;
+    strm.opaque = (voidpf)0;
+    err = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, destBits,
+                       MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK)
+        return err;
+    s = strm.state;
+    r = (rc_state *)ZALLOC(&strm, 1, sizeof(rc_state));
+    if (r == Z_NULL) {
+        deflateEnd(&strm);
+        return Z_MEM_ERROR;
+    }
+    zmemzero(r, sizeof(rc_state));
+    r->data = (Bytef *)ZALLOC(&strm, RC_HIST + RC_DATA, 1);
+    r->dist = (ush *)ZALLOC(&strm, RC_SYMS, sizeof(ush));
+    r->lc = (uch *)ZALLOC(&strm, RC_SYMS, 1);
+    if (r->data == Z_NULL || r->dist == Z_NULL || r->lc == Z_NULL) {
+        err = Z_MEM_ERROR;
+        goto done;
+    }
+    r->next = source + hlen;
+    r->end = source + *sourceLen;
+    r->mode = RC_HEAD;
+    r->strm = &strm;
+    r->room = *destLen;
+
+    /* the header of dest, from deflate() */
+    strm.next_in = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_out = dest;
+    strm.avail_out = r->room > (uLong)max ? max : (uInt)r->room;
+    r->room -= strm.avail_out;
+    err = strm.avail_out ? deflate(&strm, Z_NO_FLUSH) : Z_BUF_ERROR;
+    if (err == Z_OK && s->pending)
+        err = Z_BUF_ERROR;
+    body = strm.total_out;
+
+    /* decode a batch, encode it, and keep the last 32K for the next */
+    crc = crc32(0L, Z_NULL, 0);
+    adler = adler32(0L, Z_NULL, 0);
+    while (err == Z_OK && r->mode != RC_DONE) {
+        if (r->have > RC_HIST) {
+            memmove(r->data, r->data + r->have - RC_HIST, RC_HIST);
+            r->have = RC_HIST;
+        }
+        r->out = r->have;
+        r->n = 0;
+        r->nends = 0;
+        err = rc_decode(r, s->w_size);
+        if (err != Z_OK)
+            break;
+        if (from == 2 || to == 2)
+            crc = crc32(crc, r->data + r->out, r->have - r->out);
+        if (from == 1 || to == 1)
+            adler = adler32(adler, r->data + r->out, r->have - r->out);
+        total += r->have - r->out;
+        zmemzero(&r->freq, sizeof(rc_freq));
+        rc_count(r, 0, r->n, &r->freq);
+        err = rc_split(r, 0, r->n, &r->freq, 0, r->mode == RC_DONE);
+    }
+
+    /* the check value of the source, and the trailer of dest */
+    if (err == Z_OK) {
+        r->next -= r->bits >> 3;
+        body += (uLong)(r->next - source - hlen) + (to == 2 ? 8 : to ? 4 : 0);
+        if (from == 2) {
+            if (r->end - r->next < 8 ||
+                r->next[0] + ((uLong)r->next[1] << 8) +
+                ((uLong)r->next[2] << 16) + ((uLong)r->next[3] << 24) !=
+                crc ||
+                r->next[4] + ((uLong)r->next[5] << 8) +
+                ((uLong)r->next[6] << 16) + ((uLong)r->next[7] << 24) !=
+                (total & 0xffffffff))
+                err = Z_DATA_ERROR;
+            r->next += 8;
+        }
+        else if (from == 1) {
+            if (r->end - r->next < 4 ||
+                ((uLong)r->next[0] << 24) + ((uLong)r->next[1] << 16) +
+                ((uLong)r->next[2] << 8) + r->next[3] != adler)
+                err = Z_DATA_ERROR;
+            r->next += 4;
+        }
+    }
+    if (err == Z_OK) {
+        strm.adler = to == 2 ? crc : adler;
+        strm.total_in = total;
+        s->status = FINISH_STATE;
+        do {
+            if (strm.avail_out == 0) {
+                strm.avail_out = r->room > (uLong)max ? max : (uInt)r->room;
+                r->room -= strm.avail_out;
+            }
+            err = strm.avail_out ? deflate(&strm, Z_FINISH) : Z_BUF_ERROR;
+        } while (err == Z_OK);
+        if (err == Z_STREAM_END) {
+            err = Z_OK;
+            *destLen = strm.total_out;
+            *sourceLen = (uLong)(r->next - source);
+        }
+    }
+
+  done:
+    TRY_FREE(&strm, r->lc);
+    TRY_FREE(&strm, r->dist);
+    TRY_FREE(&strm, r->data);
+    ZFREE(&strm, r);
+    deflateEnd(&strm);
+
+    /* keep the blocks of the source if the new ones are no smaller, or did
+       not fit */
+    if ((err == Z_OK && *destLen >= body) || err == Z_BUF_ERROR) {
+        *destLen = size;
+        err = rewrap(dest, destLen, destBits, source, sourceLen, sourceBits);
+    }
+    return err;
+}
@@ -0,0 +1,181 @@
+/*!
+  \file rewrap.c Convert between the zlib, gzip and raw deflate formats
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  The three formats hold the same deflate data, with different headers and
+  trailers around it.  rewrap() moves the deflate data of one into the other
+  as it is.  It still decompresses the data once, to find where the stream
+  ends, to check it, and to compute the check value of the new format when it
+  is not the one of the old -- but that is a fraction of the time it would
+  take to compress the data again.
+*/
+
+#define ZLIB_INTERNAL
+#include "zutil.h"
+
+#define RW_RAW  0
+#define RW_ZLIB 1
+#define RW_GZIP 2
+
+#define RW_BUF 32768U   /* scratch output of the inflate pass */
+
+/* ===========================================================================
+ * Return the format for windowBits bits as given to deflateInit2(), or -1 if
+ * bits is not valid.
+ */
+local int rw_format(int bits) {
+    if (bits >= -MAX_WBITS && bits <= -8)
+        return RW_RAW;
+    if (bits >= 8 && bits <= MAX_WBITS)
+        return RW_ZLIB;
+    if (bits >= 16 + 8 && bits <= 16 + MAX_WBITS)
+        return RW_GZIP;
+    return -1;
+}
+
+/*!
+   Convert the deflate stream at source from one format to another, without
+   compressing it again.  The formats are given as the windowBits of
+   deflateInit2(): 8..15 for zlib, -8..-15 for raw deflate, and 24..31 for
+   gzip.  sourceBits is as for inflateInit2(), so it can also be 40..47 to
+   take zlib or gzip, whichever the source is.  The window size in destBits
+   is not used: a zlib header gets the window size of the source when it is
+   zlib, and 32K otherwise.
+
+   The source is decompressed once, into a small scratch buffer, to find the
+   end of the stream and verify its check value.  The check value of the
+   destination is computed in the same pass, or taken from the source when
+   both formats have the same -- gzip to gzip keeps the header and trailer of
+   the source as they are.  A new gzip header has no name and no time, and
+   its compression level is taken from the zlib header of the source.  A new
+   zlib header gets the compression level of the gzip header of the source.
+
+   *sourceLen is the length of the source, and *destLen the size of dest,
+   which is enough if it is *sourceLen + 18.  On success, *destLen is the
+   length of the converted stream, and *sourceLen the number of source bytes
+   used, so that source + *sourceLen is the first byte after the stream or,
+   for gzip, after its first member.  dest may be the same as source, to
+   convert the stream in place.
+
+   \return Z_OK if success, Z_MEM_ERROR if there was not enough memory,
+   Z_BUF_ERROR if there was not enough room in dest, Z_STREAM_ERROR if a
+   format is not valid, or Z_DATA_ERROR if the source is corrupted or
+   incomplete, or needs a preset dictionary.
+*/
+int ZEXPORT rewrap(Bytef *dest, uLongf *destLen, int destBits,
+                   const Bytef *source, uLong *sourceLen, int sourceBits) {
+    z_stream strm;
+    Bytef *buf, *put;
+    Byte trail[8];
+    int err, from, to, head;
+    const uInt max = (uInt)-1;
+    uLong left, body, need, check, total, isize;
+    uLong hlen, hdr;
+    unsigned tlen, xfl, lvl, i;
+
+    to = rw_format(destBits);
+    from = sourceBits < 0 ? RW_RAW : sourceBits < 16 ? RW_ZLIB :
+           sourceBits < 32 ? RW_GZIP : -1;
+    if (to < 0)
+        return Z_STREAM_ERROR;
+
+    strm.zalloc = (alloc_func)0;
+    strm.zfree = (free_func)0;
+    strm.opaque = (voidpf)0;
+    strm.next_in = source;
+    strm.avail_in = 0;
+    err = inflateInit2(&strm, sourceBits);
+    if (err != Z_OK)
+        return err;
+    buf = (Bytef *)ZALLOC(&strm, RW_BUF, 1);
+    if (buf == Z_NULL) {
+        inflateEnd(&strm);
+        return Z_MEM_ERROR;
+    }
+
+    /* inflate with Z_BLOCK until the header is read, so that its length is
+       total_in, then to the end, computing the check value for to if from
+       does not have the same */
+    left = *sourceLen;
+    head = from != RW_RAW;
+    hlen = 0;
+    check = to == RW_GZIP ? crc32(0L, Z_NULL, 0) : adler32(0L, Z_NULL, 0);
+    do {
+        if (strm.avail_in == 0) {
+            strm.avail_in = left > (uLong)max ? max : (uInt)left;
+            left -= strm.avail_in;
+        }
+        strm.next_out = buf;
+        strm.avail_out = RW_BUF;
+        err = inflate(&strm, head ? Z_BLOCK : Z_NO_FLUSH);
+        if (head) {
+            if ((strm.data_type & 128) == 0)
+                continue;
+            head = 0;
+            hlen = strm.total_in;
+            if (from < 0)
+                from = source[0] == 31 && source[1] == 139 ? RW_GZIP :
+                                                             RW_ZLIB;
+        }
+        if (to != from && to != RW_RAW) {
+            if (to == RW_GZIP)
+                check = crc32(check, buf, RW_BUF - strm.avail_out);
+            else
+                check = adler32(check, buf, RW_BUF - strm.avail_out);
+        }
+    } while (err == Z_OK);
+    total = strm.total_in;
+    isize = strm.total_out;
+    if (to == from)
+        check = strm.adler;
+    ZFREE(&strm, buf);
+    inflateEnd(&strm);
+    if (err != Z_STREAM_END)
+        return err == Z_NEED_DICT || err == Z_BUF_ERROR ? Z_DATA_ERROR : err;
+
+    /* the lengths of the pieces */
+    tlen = from == RW_GZIP ? 8 : from == RW_ZLIB ? 4 : 0;
+    body = total - hlen - tlen;
+    hdr = to == from ? hlen : to == RW_GZIP ? 10 : to == RW_ZLIB ? 2 : 0;
+    need = hdr + body + (to == RW_GZIP ? 8 : to == RW_ZLIB ? 4 : 0);
+    if (need > *destLen)
+        return Z_BUF_ERROR;
+
+    /* take what is needed from the source before dest can overwrite it */
+    xfl = from == RW_GZIP ? source[8] : 0;
+    lvl = from == RW_ZLIB ? source[1] >> 6 : 2;
+    for (i = 0; i < tlen; i++)
+        trail[i] = source[hlen + body + i];
+
+    /* the deflate data as it is, then the header and trailer around it */
+    put = dest + hdr;
+    memmove(put, source + hlen, body);
+    if (to == from) {
+        memmove(dest, source, hlen);
+        zmemcpy(put + body, trail, tlen);
+    }
+    else if (to == RW_GZIP) {
+        dest[0] = 31;
+        dest[1] = 139;
+        dest[2] = Z_DEFLATED;
+        dest[3] = dest[4] = dest[5] = dest[6] = dest[7] = 0;
+        dest[8] = lvl == 3 ? 2 : lvl == 0 ? 4 : 0;
+        dest[9] = OS_CODE;
+        for (i = 0; i < 4; i++) {
+            put[body + i] = (Byte)(check >> (8 * i));
+            put[body + 4 + i] = (Byte)(isize >> (8 * i));
+        }
+    }
+    else if (to == RW_ZLIB) {
+        lvl = xfl == 2 ? 3 : xfl == 4 ? 0 : 2;
+        dest[0] = 0x78;
+        dest[1] = (Byte)(lvl << 6);
+        dest[1] += 31 - (dest[0] * 256 + dest[1]) % 31;
+        for (i = 0; i < 4; i++)
+            put[body + i] = (Byte)(check >> (24 - 8 * i));
+    }
+    *destLen = need;
+    *sourceLen = total;
+    return Z_OK;
+}
@@ -29,6 +29,9 @@
        Sedgewick, R.
            Algorithms, p290.
            Addison-Wesley, 1983. ISBN 0-201-06672-6.
+       Moffat, A. and Katajainen, J.
+           "In-Place Calculation of Minimum-Redundancy Codes".
+           WADS 1995, LNCS 955, pp. 393-402.
 */
 
 
@@ -479,6 +482,8 @@ void ZLIB_INTERNAL _tr_init(deflate_state *s) {
     init_block(s);
 }
 
+#ifdef HEAP_TREES
+
 #define SMALLEST 1
 /* Index within the heap array of least frequent node in the Huffman tree */
 
@@ -707,6 +712,212 @@ local void build_tree(deflate_state *s, tree_desc *desc) {
     gen_codes ((ct_data *)tree, max_code, s->bl_count);
 }
 
+#else /* !HEAP_TREES */
+
+#define SORT_SMALL 32
+/* Most symbols sorted by insertion instead of by counting */
+
+/* ===========================================================================
+ * Sort the n keys in key[] in increasing order, using tmp[] for n keys. The
+ * frequencies in the keys are less than 2^16, and are sorted a byte at a
+ * time, skipping a byte that is the same in all of them, which is the high
+ * byte for small blocks.
+ */
+local void sort_keys(int *key, int *tmp, int n) {
+    unsigned count[256], sum, c;
+    int i, j, k, shift;
+
+    if (n <= SORT_SMALL) {
+        for (i = 1; i < n; i++) {
+            k = key[i];
+            for (j = i; j && key[j - 1] > k; j--)
+                key[j] = key[j - 1];
+            key[j] = k;
+        }
+        return;
+    }
+    for (shift = 9; shift < 25; shift += 8) {
+        zmemzero(count, sizeof(count));
+        for (i = 0; i < n; i++)
+            count[(key[i] >> shift) & 0xff]++;
+        if (count[(key[0] >> shift) & 0xff] == (unsigned)n)
+            continue;
+        for (sum = 0, c = 0; c < 256; c++) {
+            k = (int)count[c];
+            count[c] = sum;
+            sum += (unsigned)k;
+        }
+        for (i = 0; i < n; i++)
+            tmp[count[(key[i] >> shift) & 0xff]++] = key[i];
+        zmemcpy(key, tmp, (unsigned)n * sizeof(int));
+    }
+}
+
+/* ===========================================================================
+ * Replace the n weights in a[], in increasing order, with the bit lengths of
+ * an optimal prefix code for them, in place, in linear time. This is the
+ * algorithm of Moffat and Katajainen, "In-Place Calculation of
+ * Minimum-Redundancy Codes" (1995). The first pass merges the leaves and the
+ * internal nodes made so far as two queues, leaving parent pointers, taking
+ * the leaf on ties, which keeps the longest code as short as possible. The
+ * next passes turn those into depths of the internal nodes, and then into
+ * the lengths of the leaves, which are in decreasing order.
+ * IN assertion: n >= 2.
+ */
+local void code_lengths(int *a, int n) {
+    int root, leaf, next, avail, used, depth;
+
+    a[0] += a[1];
+    root = 0;
+    leaf = 2;
+    for (next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] = a[leaf++];
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = next;
+        }
+        else
+            a[next] += a[leaf++];
+    }
+
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--)
+        a[next] = a[a[next]] + 1;
+
+    avail = 1;
+    used = depth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (avail > 0) {
+        while (root >= 0 && a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (avail > used) {
+            a[next--] = depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+/* ===========================================================================
+ * Construct one Huffman tree and assigns the code bit strings and lengths.
+ * Update the total bit length for the current block.
+ * The symbols are sorted by frequency and the optimal lengths computed in
+ * place by code_lengths(), in place of the heap, which is costly for small
+ * blocks. Lengths over max_length are then fixed as gen_bitlen() does, by
+ * moving leaves in the counts of each length, and handing out the lengths
+ * again in order of frequency. The heap construction is used instead if
+ * HEAP_TREES is defined.
+ * IN assertion: the field freq is set for all tree elements.
+ * OUT assertions: the fields len and code are set to the optimal bit length
+ *     and corresponding code. The length opt_len is updated; static_len is
+ *     also updated if stree is not null. The field max_code is set.
+ */
+local void build_tree(deflate_state *s, tree_desc *desc) {
+    ct_data *tree         = desc->dyn_tree;
+    const ct_data *stree  = desc->stat_desc->static_tree;
+    const intf *extra     = desc->stat_desc->extra_bits;
+    int base              = desc->stat_desc->extra_base;
+    int elems             = desc->stat_desc->elems;
+    int max_length        = desc->stat_desc->max_length;
+    int *len = s->heap;           /* weights, then lengths, in key order */
+    int *key = s->heap + L_CODES; /* frequency << 9 | symbol, sorted */
+    int n = 0;         /* number of symbols in the tree */
+    int k;             /* iterate over the symbols, in key order */
+    int m;             /* symbol */
+    int c;             /* count of nodes or symbols */
+    int bits;          /* bit length */
+    int xbits;         /* extra bits */
+    int overflow = 0;  /* number of symbols with bit length too large */
+    int max_code = -1; /* largest code with non zero frequency */
+    ush f;             /* frequency */
+
+    for (m = 0; m < elems; m++) {
+        if (tree[m].Freq != 0) {
+            key[n++] = (int)tree[m].Freq << 9 | m;
+            max_code = m;
+        } else {
+            tree[m].Len = 0;
+        }
+    }
+
+    /* The pkzip format requires that at least one distance code exists,
+     * and that at least one bit should be sent even if there is only one
+     * possible code. So to avoid special checks later on we force at least
+     * two codes of non zero frequency.
+     */
+    while (n < 2) {
+        m = max_code < 2 ? ++max_code : 0;
+        tree[m].Freq = 1;
+        key[n++] = 1 << 9 | m;
+        s->opt_len--; if (stree) s->static_len -= stree[m].Len;
+        /* m is 0 or 1 so it does not have extra bits */
+    }
+    desc->max_code = max_code;
+
+    sort_keys(key, len, n);
+    for (k = 0; k < n; k++)
+        len[k] = key[k] >> 9;
+    code_lengths(len, n);
+
+    /* count the lengths, and fix those too large as gen_bitlen() does, which
+       counts the nodes of the tree below max_length, leaves and internal --
+       the nodes at a depth are its leaves plus half of those one deeper */
+    for (bits = 0; bits <= MAX_BITS; bits++) s->bl_count[bits] = 0;
+    k = 0;
+    for (bits = len[0], c = 0; bits > max_length; bits--) {
+        c >>= 1;
+        while (k < n && len[k] == bits) {
+            s->bl_count[max_length]++;
+            c++;
+            k++;
+        }
+        overflow += c;
+    }
+    for (; k < n; k++)
+        s->bl_count[len[k]]++;
+    if (overflow) {
+        Tracev((stderr,"\nbit length overflow\n"));
+        do {
+            bits = max_length - 1;
+            while (s->bl_count[bits] == 0) bits--;
+            s->bl_count[bits]--;        /* move one leaf down the tree */
+            s->bl_count[bits + 1] += 2; /* and an overflow item as brother */
+            s->bl_count[max_length]--;
+            overflow -= 2;
+        } while (overflow > 0);
+    }
+
+    /* hand out the lengths, longest to least frequent, and add up the bits */
+    k = 0;
+    for (bits = max_length; bits != 0; bits--) {
+        for (c = s->bl_count[bits]; c != 0; c--) {
+            m = key[k++] & 0x1ff;
+            tree[m].Len = (ush)bits;
+            xbits = 0;
+            if (m >= base) xbits = extra[m - base];
+            f = tree[m].Freq;
+            s->opt_len += (ulg)f * (unsigned)(bits + xbits);
+            if (stree)
+                s->static_len += (ulg)f * (unsigned)(stree[m].Len + xbits);
+        }
+    }
+
+    /* The field len is now set, we can generate the bit codes */
+    gen_codes ((ct_data *)tree, max_code, s->bl_count);
+}
+
+#endif /* HEAP_TREES */
+
 /* ===========================================================================
  * Scan a literal or distance tree to determine the frequencies of the codes
  * in the bit length tree.
@@ -1090,6 +1301,24 @@ void ZLIB_INTERNAL _tr_flush_block(deflate_state *s, charf *buf,
            s->compressed_len - 7*last));
 }
 
+/* ===========================================================================
+ * Return the bits that a block with the frequencies set in dyn_ltree and
+ * dyn_dtree would take with dynamic or static trees, whichever is fewer,
+ * with its header, and start a new block. This lets recompress() cost
+ * different block boundaries with the trees that would be sent.
+ */
+ulg ZLIB_INTERNAL _tr_block_bits(deflate_state *s) {
+    ulg dyn, stat;
+
+    build_tree(s, (tree_desc *)(&(s->l_desc)));
+    build_tree(s, (tree_desc *)(&(s->d_desc)));
+    build_bl_tree(s);
+    dyn = s->opt_len + 3;
+    stat = s->static_len + 3;
+    init_block(s);
+    return dyn < stat ? dyn : stat;
+}
+
 /* ===========================================================================
  * Save the match info and tally the frequency counts. Return true if
  * the current block must be flushed.
@@ -1110,7 +1339,7 @@ int ZLIB_INTERNAL _tr_tally(deflate_state *s, unsigned dist, unsigned lc) {
         s->matches++;
         /* Here, lc is the match length - MIN_MATCH */
         dist--;             /* dist = match distance - 1 */
-        Assert((ush)dist < (ush)MAX_DIST(s) &&
+        Assert((ush)dist < (ush)s->w_size &&
                (ush)lc <= (ush)(MAX_MATCH-MIN_MATCH) &&
                (ush)d_code(dist) < (ush)D_CODES,  "_tr_tally: bad match");
 
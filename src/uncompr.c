@@ -8,7 +8,7 @@
 /* @(#) $Id$ */
 
 #define ZLIB_INTERNAL
-#include <zlib/zlib.h>
+#include "zutil.h"
 
 /* =========================================================================== */
 /*!
@@ -108,3 +108,169 @@ int ZEXPORT uncompress(Bytef *dest, uLongf *destLen, const Bytef *source,
                        uLong sourceLen) {
     return uncompress2(dest, destLen, source, &sourceLen);
 }
+
+/* ===========================================================================
+ * Decompress the stream at source, in the format given by windowBits as for
+ * inflateInit2(), into a buffer from zalloc.  The buffer starts at hint bytes
+ * if that is plausible for *sourceLen bytes of input, and otherwise grows
+ * geometrically.  What is given back in *dest is exactly *destLen bytes,
+ * copied to a new buffer if the last one came out too large, or Z_NULL when
+ * there is no data.
+ */
+local int uncompress_alloc(Bytef **dest, uLongf *destLen,
+                           const Bytef *source, uLong *sourceLen, uLong hint,
+                           int windowBits, alloc_func zalloc, free_func zfree,
+                           voidpf opaque) {
+    z_stream stream;
+    int err;
+    const uInt max = (uInt)-1;
+    uLong len, left, size, got;
+    Bytef *out, *more;
+
+    *dest = Z_NULL;
+    *destLen = 0;
+#ifdef Z_SOLO
+    if (zalloc == (alloc_func)0 || zfree == (free_func)0)
+        return Z_STREAM_ERROR;
+#else
+    if (zalloc == (alloc_func)0)
+        zalloc = zcalloc;
+    if (zfree == (free_func)0)
+        zfree = zcfree;
+#endif
+
+    /* no more than deflate can expand to, which is a little over 1032:1 --
+       otherwise guess, and double as needed */
+    len = *sourceLen;
+    size = hint;
+    if (size == 0 || size / 1032 > len + 1 || size > (uLong)max)
+        size = len > (uLong)(max >> 2) - 64 ? (uLong)max : (len << 2) + 256;
+    out = (Bytef *)zalloc(opaque, (uInt)size, 1);
+    if (out == Z_NULL)
+        return Z_MEM_ERROR;
+
+    stream.next_in = (const Bytef *)source;
+    stream.avail_in = 0;
+    stream.zalloc = zalloc;
+    stream.zfree = zfree;
+    stream.opaque = opaque;
+    err = inflateInit2(&stream, windowBits);
+    if (err != Z_OK) {
+        zfree(opaque, out);
+        return err;
+    }
+
+    /* decompress, and when the buffer is full and inflate() needs more room
+       for output (not just to read the end of the stream), double it */
+    stream.next_out = out;
+    stream.avail_out = 0;
+    left = size;
+    for (;;) {
+        if (stream.avail_out == 0) {
+            stream.avail_out = left > (uLong)max ? max : (uInt)left;
+            left -= stream.avail_out;
+        }
+        if (stream.avail_in == 0) {
+            stream.avail_in = len > (uLong)max ? max : (uInt)len;
+            len -= stream.avail_in;
+        }
+        err = inflate(&stream, Z_NO_FLUSH);
+        if (err == Z_OK)
+            continue;
+        if (err != Z_BUF_ERROR || stream.avail_out || left)
+            break;
+        if (size == (uLong)max) {
+            err = Z_MEM_ERROR;
+            break;
+        }
+        got = stream.total_out;
+        size = size > (uLong)(max >> 1) ? (uLong)max : size << 1;
+        more = (Bytef *)zalloc(opaque, (uInt)size, 1);
+        if (more == Z_NULL) {
+            err = Z_MEM_ERROR;
+            break;
+        }
+        zmemcpy(more, out, (uInt)got);
+        zfree(opaque, out);
+        out = more;
+        stream.next_out = out + got;
+        left = size - got;
+    }
+    *sourceLen -= len + stream.avail_in;
+    got = stream.total_out;
+    inflateEnd(&stream);
+    if (err != Z_STREAM_END) {
+        zfree(opaque, out);
+        return err == Z_NEED_DICT || err == Z_BUF_ERROR ? Z_DATA_ERROR : err;
+    }
+
+    /* give back exactly what was decompressed */
+    if (got < size) {
+        more = Z_NULL;
+        if (got) {
+            more = (Bytef *)zalloc(opaque, (uInt)got, 1);
+            if (more == Z_NULL) {
+                zfree(opaque, out);
+                return Z_MEM_ERROR;
+            }
+            zmemcpy(more, out, (uInt)got);
+        }
+        zfree(opaque, out);
+        out = more;
+    }
+    *dest = out;
+    *destLen = got;
+    return Z_OK;
+}
+
+/*!
+   Decompress the zlib stream at source into a buffer allocated for it, of
+   exactly the decompressed size.
+
+   *sourceLen is the length of the source.  If sizeHint is not zero, it is
+   taken as the expected decompressed size, saved by the compressor, and the
+   output is allocated once if it is right.  Otherwise the buffer is grown
+   geometrically as needed, and then copied once to a buffer of the right
+   size.  The buffers are allocated and freed with zalloc and zfree, called
+   with opaque, as for a z_stream -- the standard malloc() and free() are used
+   if they are Z_NULL.
+
+   On success, *dest points to the decompressed data, to be freed by the
+   caller with zfree, *destLen is its length, and *sourceLen is the number of
+   source bytes consumed.  *dest is Z_NULL if the stream decompresses to
+   nothing.  The data is limited to 4 GB less one byte, the most that can be
+   asked of zalloc at once.
+
+   \return Z_OK if success, Z_MEM_ERROR if there was not enough memory, or
+   Z_DATA_ERROR if the input data was corrupted or incomplete.  Nothing is
+   left allocated on error.
+*/
+int ZEXPORT uncompressAlloc(Bytef **dest, uLongf *destLen,
+                            const Bytef *source, uLong *sourceLen,
+                            uLong sizeHint, alloc_func zalloc,
+                            free_func zfree, voidpf opaque) {
+    return uncompress_alloc(dest, destLen, source, sourceLen, sizeHint,
+                            MAX_WBITS, zalloc, zfree, opaque);
+}
+
+/*!
+   Same as uncompressAlloc(), but for a gzip stream, whose decompressed size
+   is taken from the ISIZE field of the gzip trailer, at the end of the
+   source.  So if source holds exactly one gzip member of less than 4 GB,
+   the output is allocated once.  Only the first member is decompressed, and
+   *sourceLen then tells where it ends.
+*/
+int ZEXPORT gunzipAlloc(Bytef **dest, uLongf *destLen, const Bytef *source,
+                        uLong *sourceLen, alloc_func zalloc, free_func zfree,
+                        voidpf opaque) {
+    const Bytef *isize;
+    uLong hint = 0;
+
+    if (*sourceLen >= 18) {
+        isize = source + *sourceLen - 4;
+        hint = (uLong)isize[0] + ((uLong)isize[1] << 8) +
+               ((uLong)isize[2] << 16) + ((uLong)isize[3] << 24);
+    }
+    return uncompress_alloc(dest, destLen, source, sourceLen, hint,
+                            MAX_WBITS + 16, zalloc, zfree, opaque);
+}
@@ -0,0 +1,373 @@
+/*!
+  \file zpool.c Default executor for the parallel work of zlib
+
+  For conditions of distribution and use, see copyright notice in zlib.h
+
+  The parallel functions of zlib run their tasks on a z_executor, which the
+  application can point at its own scheduler. zpoolCreate() makes the default
+  one: a pool of worker threads, each with a deque of tasks. A worker runs the
+  newest task of its own deque, and when that is empty, steals the oldest task
+  of another worker. Tasks submitted by a worker go on its own deque, and
+  those submitted from outside are dealt to the deques in turn.
+
+  A thread waiting for a group runs queued tasks, its own or stolen, until the
+  group is done, so that tasks can wait for the tasks they submit without
+  holding up a worker. Without pthreads, the pool has no threads, and tasks
+  are run as they are submitted.
+*/
+
+#include "zutil.h"
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  ifdef Z_HAVE_UNISTD_H
+#    include <unistd.h>
+#  endif
+#endif
+
+#ifdef HAVE_PTHREAD
+
+#define ZP_MAX 256              /* most threads in a pool */
+#define ZP_DEQUE 64             /* initial entries in a deque */
+
+typedef struct zp_pool_s zp_pool;
+
+typedef struct {
+    void (*run)(voidp);         /* task */
+    voidp arg;                  /* its argument */
+    unsigned *pending;          /* tasks left in its group */
+} zp_task;
+
+typedef struct {
+    zp_pool *pool;              /* pool of the deque's worker */
+    pthread_mutex_t lock;       /* for what follows */
+    zp_task *ring;              /* tasks, oldest at head */
+    unsigned size;              /* entries in ring, a power of two */
+    unsigned head, tail;        /* oldest task, one past the newest */
+} zp_deque;
+
+struct zp_pool_s {
+    z_executor exec;            /* handed out by zpoolCreate() */
+    unsigned n;                 /* number of workers */
+    unsigned started;           /* number of workers started */
+    pthread_t *tids;            /* worker threads */
+    zp_deque *deques;           /* one per worker */
+    pthread_key_t self;         /* worker number plus one in the workers */
+    pthread_mutex_t lock;       /* for what follows */
+    pthread_cond_t cond;        /* a task queued or group done, or stop */
+    unsigned queued;            /* tasks in the deques */
+    unsigned next;              /* deque for the next submit from outside */
+    int stop;                   /* true when the workers are to exit */
+};
+
+/* ===========================================================================
+ * Add a task at the new end of d, doubling it if full. Return -1 if out of
+ * memory, otherwise 0.
+ */
+local int deque_push(zp_deque *d, const zp_task *t) {
+    zp_task *ring;
+    unsigned i;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail - d->head == d->size) {
+        ring = (zp_task *)malloc(2 * d->size * sizeof(zp_task));
+        if (ring == NULL) {
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        for (i = 0; i < d->size; i++)
+            ring[i] = d->ring[(d->head + i) & (d->size - 1)];
+        free(d->ring);
+        d->ring = ring;
+        d->head = 0;
+        d->tail = d->size;
+        d->size <<= 1;
+    }
+    d->ring[d->tail++ & (d->size - 1)] = *t;
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+}
+
+/* ===========================================================================
+ * Take the newest task from d if newest is true, otherwise the oldest. Return
+ * true if there was one.
+ */
+local int deque_take(zp_deque *d, zp_task *t, int newest) {
+    int got;
+
+    pthread_mutex_lock(&d->lock);
+    got = d->tail != d->head;
+    if (got)
+        *t = newest ? d->ring[--d->tail & (d->size - 1)] :
+                      d->ring[d->head++ & (d->size - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return got;
+}
+
+/* ===========================================================================
+ * Take a task for worker i, from its own deque first, or for another thread
+ * if i is p->n. Return true if there was one.
+ */
+local int pool_take(zp_pool *p, unsigned i, zp_task *t) {
+    unsigned k;
+
+    if (i < p->n && deque_take(p->deques + i, t, 1))
+        goto got;
+    for (k = 1; k <= p->n; k++)
+        if (deque_take(p->deques + (i + k) % p->n, t, 0))
+            goto got;
+    return 0;
+  got:
+    pthread_mutex_lock(&p->lock);
+    p->queued--;
+    pthread_mutex_unlock(&p->lock);
+    return 1;
+}
+
+/* ===========================================================================
+ * Run a task, and wake the waiters if that completes its group.
+ */
+local void pool_run(zp_pool *p, zp_task *t) {
+    t->run(t->arg);
+    pthread_mutex_lock(&p->lock);
+    if (--*t->pending == 0)
+        pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* ===========================================================================
+ * Return the number of the worker running this, or p->n if not a worker.
+ */
+local unsigned pool_self(zp_pool *p) {
+    size_t self = (size_t)pthread_getspecific(p->self);
+
+    return self ? (unsigned)self - 1 : p->n;
+}
+
+/* the z_executor functions of the pool -- a group is its count of tasks not
+   yet run */
+local voidp pool_group(voidp opaque) {
+    unsigned *pending;
+
+    (void)opaque;
+    pending = (unsigned *)malloc(sizeof(unsigned));
+    if (pending != NULL)
+        *pending = 0;
+    return pending;
+}
+
+local int pool_submit(voidp opaque, voidp group, void (*task)(voidp),
+                      voidp arg) {
+    zp_pool *p = (zp_pool *)opaque;
+    unsigned i = pool_self(p);
+    zp_task t;
+
+    t.run = task;
+    t.arg = arg;
+    t.pending = (unsigned *)group;
+    pthread_mutex_lock(&p->lock);
+    if (i == p->n)
+        i = p->next++ % p->n;
+    if (deque_push(p->deques + i, &t)) {
+        pthread_mutex_unlock(&p->lock);
+        return -1;
+    }
+    ++*t.pending;
+    p->queued++;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+local void pool_wait(voidp opaque, voidp group) {
+    zp_pool *p = (zp_pool *)opaque;
+    unsigned *pending = (unsigned *)group, i = pool_self(p);
+    zp_task t;
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        if (*pending == 0) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+        if (pool_take(p, i, &t)) {
+            pool_run(p, &t);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        while (*pending && p->queued == 0)
+            pthread_cond_wait(&p->cond, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+    }
+    free(pending);
+}
+
+/* ===========================================================================
+ * Worker thread: run tasks until the pool is stopped and they are all done.
+ */
+local void *pool_worker(void *arg) {
+    zp_deque *d = (zp_deque *)arg;
+    zp_pool *p = d->pool;
+    unsigned i = (unsigned)(d - p->deques);
+    zp_task t;
+
+    pthread_setspecific(p->self, (void *)(size_t)(i + 1));
+    for (;;) {
+        if (pool_take(p, i, &t)) {
+            pool_run(p, &t);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        while (p->queued == 0 && !p->stop)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if (p->queued == 0) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    return NULL;
+}
+
+/* ===========================================================================
+ * Stop the workers once the tasks are done, and free the pool.
+ */
+local void pool_free(zp_pool *p) {
+    unsigned i;
+
+    pthread_mutex_lock(&p->lock);
+    p->stop = 1;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+    for (i = 0; i < p->started; i++)
+        pthread_join(p->tids[i], NULL);
+    for (i = 0; i < p->n; i++) {
+        pthread_mutex_destroy(&p->deques[i].lock);
+        free(p->deques[i].ring);
+    }
+    pthread_key_delete(p->self);
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p->deques);
+    free(p->tids);
+    free(p);
+}
+
+/*!
+  Create the default executor, a work-stealing pool of threads, to give to
+  the parallel functions of zlib when the application has no scheduler of
+  its own to use.  threads is the number of worker threads, or zero for the
+  number of processors online.  A thread waiting for tasks in the pool also
+  runs them, so one worker is enough for the tasks to use two processors.
+
+  \return the executor, to be freed with zpoolFree(), or Z_NULL if there was
+  not enough memory or the threads could not be started.  Where pthreads are
+  not available, the executor runs each task as it is submitted.
+*/
+z_executor * ZEXPORT zpoolCreate(unsigned threads) {
+    zp_pool *p;
+    unsigned i;
+
+    if (threads == 0) {
+#if defined(Z_HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+#else
+        threads = 1;
+#endif
+    }
+    if (threads > ZP_MAX)
+        threads = ZP_MAX;
+
+    p = (zp_pool *)calloc(1, sizeof(zp_pool));
+    if (p == NULL)
+        return Z_NULL;
+    p->n = threads;
+    p->tids = (pthread_t *)malloc(threads * sizeof(pthread_t));
+    p->deques = (zp_deque *)calloc(threads, sizeof(zp_deque));
+    if (p->tids == NULL || p->deques == NULL ||
+        pthread_key_create(&p->self, NULL)) {
+        free(p->deques);
+        free(p->tids);
+        free(p);
+        return Z_NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+        p->deques[i].pool = p;
+        p->deques[i].size = ZP_DEQUE;
+        p->deques[i].ring = (zp_task *)malloc(ZP_DEQUE * sizeof(zp_task));
+    }
+    for (i = 0; i < threads; i++)
+        if (p->deques[i].ring == NULL ||
+            pthread_create(p->tids + i, NULL, pool_worker, p->deques + i))
+            break;
+        else
+            p->started++;
+    if (p->started < threads) {
+        pool_free(p);
+        return Z_NULL;
+    }
+
+    p->exec.group = pool_group;
+    p->exec.submit = pool_submit;
+    p->exec.wait = pool_wait;
+    p->exec.threads = threads;
+    p->exec.opaque = p;
+    return &p->exec;
+}
+
+/*!
+  Free an executor made by zpoolCreate(), after running the tasks still
+  queued.  No task may be submitted to it after this is called.
+*/
+void ZEXPORT zpoolFree(z_executor *pool) {
+    if (pool != Z_NULL)
+        pool_free((zp_pool *)pool->opaque);
+}
+
+#else /* !HAVE_PTHREAD */
+
+/* without threads, run each task when it is submitted */
+local voidp pool_group(voidp opaque) {
+    return opaque;
+}
+
+local int pool_submit(voidp opaque, voidp group, void (*task)(voidp),
+                      voidp arg) {
+    (void)opaque;
+    (void)group;
+    task(arg);
+    return 0;
+}
+
+local void pool_wait(voidp opaque, voidp group) {
+    (void)opaque;
+    (void)group;
+}
+
+/* -- see the pthreads version above -- */
+z_executor * ZEXPORT zpoolCreate(unsigned threads) {
+    z_executor *exec;
+
+    (void)threads;
+    exec = (z_executor *)malloc(sizeof(z_executor));
+    if (exec == Z_NULL)
+        return Z_NULL;
+    exec->group = pool_group;
+    exec->submit = pool_submit;
+    exec->wait = pool_wait;
+    exec->threads = 1;
+    exec->opaque = exec;
+    return exec;
+}
+
+void ZEXPORT zpoolFree(z_executor *pool) {
+    free(pool);
+}
+
+#endif /* HAVE_PTHREAD */
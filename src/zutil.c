@@ -10,6 +10,14 @@
 #include "zutil.h"
 #ifndef Z_SOLO
 #  include "gzguts.h"
+#  ifdef _WIN32
+#    include <windows.h>
+#  else
+#    include <time.h>
+#    ifdef Z_HAVE_UNISTD_H
+#      include <unistd.h>
+#    endif
+#  endif
 #endif
 
 const char * const z_errmsg[10] = {
@@ -210,6 +218,34 @@ void ZLIB_INTERNAL zmemzero(Bytef* dest, uInt len) {
 
 #ifndef Z_SOLO
 
+/*!
+  Return the CPU time used by the calling thread in microseconds, so that
+  other threads of the process do not count against it. Where there is no
+  clock for the thread, clock() is used, which counts the whole process.
+*/
+ulg ZLIB_INTERNAL z_thread_usec(void) {
+#if defined(_WIN32)
+    FILETIME create, exit, kernel, user;
+    ULARGE_INTEGER k, u;
+
+    if (!GetThreadTimes(GetCurrentThread(), &create, &exit, &kernel, &user))
+        return 0;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (ulg)((k.QuadPart + u.QuadPart) / 10);
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+        return 0;
+    return (ulg)ts.tv_sec * 1000000UL + (ulg)(ts.tv_nsec / 1000);
+#else
+    return (ulg)((double)clock() * 1000000.0 / CLOCKS_PER_SEC);
+#endif
+}
+
 #ifdef SYS16BIT
 
 #ifdef __TURBOC__